@@ -0,0 +1,197 @@
+/*
+ * ChatGPT C Library - HTTP Transport Benchmark
+ * Compares the built-in HTTP/1.1 transport with the libcurl transport against a local
+ * keep-alive server (forked from this program), for plain and streamed replies.
+ * Reports wall time and client CPU time per request. POSIX only, no network or API key needed.
+ * Usage: ./bench_http [requests] [stream chunks] [gap between chunks in us]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "chatgpt.h"
+
+static int chunks = 200;  // Deltas per streamed reply
+static int gap_us = 0;    // Server pause between deltas
+
+static const char plain_reply[] =
+    "{\"id\":\"bench\",\"object\":\"chat.completion\",\"model\":\"gpt-4o-mini\","
+    "\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\",\"content\":\"pong\"},"
+    "\"finish_reason\":\"stop\"}],"
+    "\"usage\":{\"prompt_tokens\":8,\"completion_tokens\":1,\"total_tokens\":9}}";
+
+static void write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w <= 0) return;
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+// Answer one request: a JSON body, or an SSE stream in chunked encoding
+static void answer(int fd, int stream) {
+    char buf[512];
+
+    if (!stream) {
+        int n = snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                         "Content-Length: %zu\r\n\r\n", sizeof(plain_reply) - 1);
+        write_all(fd, buf, (size_t)n);
+        write_all(fd, plain_reply, sizeof(plain_reply) - 1);
+        return;
+    }
+
+    const char *head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\n\r\n";
+    write_all(fd, head, strlen(head));
+    for (int i = 0; i <= chunks; i++) {
+        char ev[160];
+        if (i < chunks) snprintf(ev, sizeof(ev), "data: {\"choices\":[{\"index\":0,\"delta\":{\"content\":\"t%d \"}}]}\n\n", i);
+        else snprintf(ev, sizeof(ev), "data: [DONE]\n\n");
+        int n = snprintf(buf, sizeof(buf), "%zx\r\n%s\r\n", strlen(ev), ev);
+        write_all(fd, buf, (size_t)n);
+        if (gap_us) {
+            struct timespec ts = { gap_us / 1000000, (long)(gap_us % 1000000) * 1000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    write_all(fd, "0\r\n\r\n", 5);
+}
+
+// Keep-alive server: a process per connection, since both transports keep theirs open
+static void serve(int lfd) {
+    static char buf[1 << 16];
+
+    signal(SIGCHLD, SIG_IGN);
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0) continue;
+        if (fork() != 0) {
+            close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        size_t have = 0;
+        for (;;) {
+            ssize_t n = read(fd, buf + have, sizeof(buf) - 1 - have);
+            if (n <= 0) break;
+            have += (size_t)n;
+            buf[have] = '\0';
+
+            char *end = strstr(buf, "\r\n\r\n");
+            if (!end) continue;
+            size_t len = 0;
+            for (char *p = buf; p < end; p = strstr(p, "\r\n") + 2) {
+                if (strncasecmp(p, "Content-Length:", 15) == 0) len = (size_t)atol(p + 15);
+            }
+            size_t total = (size_t)(end + 4 - buf) + len;
+            if (total > have) continue;
+
+            answer(fd, strstr(end + 4, "\"stream\":true") != NULL);
+            memmove(buf, buf + total, have - total);
+            have -= total;
+        }
+        _exit(0);
+    }
+}
+
+static double now_us(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void count_delta(const char *delta, void *user_data) {
+    (void)delta;
+    (*(int*)user_data)++;
+}
+
+// Time one transport for plain or streamed replies
+static void run(const char *name, ChatGPTTransport *t, const char *url, int stream, int requests) {
+    ChatGPTConversation *conv = chatgpt_conversation_new("bench-key", "gpt-4o-mini");
+    if (!conv) return;
+    chatgpt_set_base_url(conv, url);
+    chatgpt_set_transport(conv, t);
+    chatgpt_add_message(conv, "user", "ping");
+
+    int deltas = 0, failed = 0;
+    double wall = 0, cpu = 0;
+    for (int i = -1; i < requests; i++) {  // Request -1 opens the connection untimed
+        double w0 = now_us(CLOCK_MONOTONIC), c0 = now_us(CLOCK_PROCESS_CPUTIME_ID);
+        char *reply = NULL;
+
+        if (stream) {
+            if (chatgpt_chat_complete_stream(conv, count_delta, &deltas, &reply) != CHATGPT_OK) failed++;
+        } else if (!(reply = chatgpt_chat_complete(conv))) {
+            failed++;
+        }
+        free(reply);
+        if (i >= 0) {
+            wall += now_us(CLOCK_MONOTONIC) - w0;
+            cpu += now_us(CLOCK_PROCESS_CPUTIME_ID) - c0;
+        }
+        if (chatgpt_get_message_count(conv) > 1) chatgpt_pop_last_message(conv);  // Same request every time
+    }
+
+    printf("%-9s %-7s %8.1f us wall %8.1f us CPU per request", name, stream ? "stream" : "plain",
+           wall / requests, cpu / requests);
+    if (failed) printf("  (%d failed: %s)", failed, chatgpt_last_error(conv));
+    printf("\n");
+    chatgpt_conversation_free(conv);
+}
+
+int main(int argc, char **argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 500;
+    if (argc > 2) chunks = atoi(argv[2]);
+    if (argc > 3) gap_us = atoi(argv[3]);
+    if (requests <= 0 || chunks < 0 || gap_us < 0) {
+        fprintf(stderr, "Usage: %s [requests] [stream chunks] [gap between chunks in us]\n", argv[0]);
+        return 1;
+    }
+
+    // Loopback server on an ephemeral port
+    struct sockaddr_in sa;
+    socklen_t sl = sizeof(sa);
+    int one = 1;
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (lfd < 0 || bind(lfd, (struct sockaddr*)&sa, sizeof(sa)) != 0 || listen(lfd, 16) != 0 ||
+        getsockname(lfd, (struct sockaddr*)&sa, &sl) != 0) {
+        perror("listen");
+        return 1;
+    }
+    pid_t server = fork();
+    if (server == 0) serve(lfd);
+    close(lfd);
+
+    char url[64];
+    snprintf(url, sizeof(url), "http://127.0.0.1:%d", ntohs(sa.sin_port));
+    printf("%d requests, %d-chunk streams, %d us between chunks\n\n", requests, chunks, gap_us);
+
+    ChatGPTHttpOptions opts = {0};
+    ChatGPTTransport *builtin = chatgpt_transport_http_new(&opts);
+    for (int stream = 0; stream <= 1; stream++) {
+        run("libcurl", chatgpt_transport_curl(), url, stream, requests);
+        run("built-in", builtin, url, stream, requests);
+    }
+    chatgpt_transport_free(builtin);
+
+    kill(server, SIGKILL);  // Connection processes exit when the transports close theirs
+    waitpid(server, NULL, 0);
+    chatgpt_global_cleanup();
+    return 0;
+}
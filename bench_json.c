@@ -0,0 +1,102 @@
+/*
+ * ChatGPT C Library - Message JSON Allocation Benchmark
+ * Builds the messages JSON of a large conversation two ways and counts what goes through
+ * cJSON's allocator (tree nodes, string copies and print buffers):
+ *   - copying:    a cJSON tree with cJSON_AddStringToObject, which duplicates every content
+ *   - references: chatgpt_build_messages_json, whose tree points at the messages' own strings
+ * No network or API key needed.
+ * Usage: ./bench_json [conversation MB] [message KB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cJSON.h"
+#include "chatgpt.h"
+
+static size_t allocs;  // Allocations through the cJSON hooks
+static size_t bytes;   // Bytes requested through them
+
+static void *counting_malloc(size_t n) {
+    allocs++;
+    bytes += n;
+    return malloc(n);
+}
+
+static double now_ms(void) {
+    return (double)clock() * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// The straightforward tree: every role and content is copied into the tree
+static char *build_copying(const ChatGPTConversation *conv) {
+    cJSON *arr = cJSON_CreateArray();
+    if (!arr) return NULL;
+    for (size_t i = 0; i < conv->message_count; i++) {
+        cJSON *m = cJSON_CreateObject();
+        if (!m) break;
+        cJSON_AddStringToObject(m, "role", conv->messages[i].role);
+        cJSON_AddStringToObject(m, "content", conv->messages[i].content);
+        cJSON_AddItemToArray(arr, m);
+    }
+    char *out = cJSON_PrintUnformatted(arr);
+    cJSON_Delete(arr);
+    return out;
+}
+
+// The library's tree: string references under constant keys, so only nodes are allocated
+static char *build_references(const ChatGPTConversation *conv) {
+    return chatgpt_build_messages_json((ChatGPTConversation*)conv);
+}
+
+// Build rounds times and report the per-build averages
+static void run(const char *name, char *(*build)(const ChatGPTConversation*), const ChatGPTConversation *conv,
+                int rounds) {
+    size_t len = 0;
+    allocs = bytes = 0;
+    double start = now_ms();
+    for (int r = 0; r < rounds; r++) {
+        char *json = build(conv);
+        if (!json) {
+            printf("%-10s failed\n", name);
+            return;
+        }
+        len = strlen(json);
+        free(json);
+    }
+    printf("%-10s %9zu allocations %8.1f MB allocated %7.1f ms per build (%.1f MB of JSON)\n", name,
+           allocs / (size_t)rounds, bytes / (double)rounds / 1e6, (now_ms() - start) / rounds, len / 1e6);
+}
+
+int main(int argc, char **argv) {
+    double mb = argc > 1 ? atof(argv[1]) : 10;
+    int kb = argc > 2 ? atoi(argv[2]) : 4;
+    if (mb <= 0 || kb <= 0) {
+        fprintf(stderr, "Usage: %s [conversation MB] [message KB]\n", argv[0]);
+        return 1;
+    }
+
+    // Text with quotes and newlines, so escaping is part of the work
+    size_t size = (size_t)kb * 1024;
+    char *text = (char*)malloc(size + 1);
+    if (!text) return 1;
+    static const char words[] = "lorem ipsum \"dolor\" sit amet,\n";
+    for (size_t i = 0; i < size; i++) text[i] = words[i % (sizeof(words) - 1)];
+    text[size] = '\0';
+
+    ChatGPTConversation *conv = chatgpt_conversation_new("bench-key", "gpt-4o-mini");
+    if (!conv) return 1;
+    size_t count = (size_t)(mb * 1024 * 1024 / (double)size);
+    for (size_t i = 0; i < count; i++) chatgpt_add_message(conv, i % 2 ? "assistant" : "user", text);
+    free(text);
+    printf("%zu messages of %d KB\n\n", count, kb);
+
+    cJSON_Hooks hooks = { counting_malloc, free };
+    cJSON_InitHooks(&hooks);
+    run("copying", build_copying, conv, 10);
+    run("references", build_references, conv, 10);
+    cJSON_InitHooks(NULL);
+
+    chatgpt_conversation_free(conv);
+    return 0;
+}
@@ -85,11 +85,24 @@
 #endif
 #endif
 
+/* storage class for the error position: one per thread, so parallel parses don't race on it */
+#ifndef CJSON_THREAD_LOCAL
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+#define CJSON_THREAD_LOCAL _Thread_local
+#elif defined(_MSC_VER)
+#define CJSON_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define CJSON_THREAD_LOCAL __thread
+#else
+#define CJSON_THREAD_LOCAL
+#endif
+#endif
+
 typedef struct {
     const unsigned char *json;
     size_t position;
 } error;
-static error global_error = { NULL, 0 };
+static CJSON_THREAD_LOCAL error global_error = { NULL, 0 };
 
 CJSON_PUBLIC(const char *) cJSON_GetErrorPtr(void)
 {
@@ -206,35 +219,50 @@ static unsigned char* cJSON_strdup(const unsigned char* string, const internal_h
     return copy;
 }
 
-CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
+/* convert user hooks to internal ones, NULL meaning the global hooks */
+static internal_hooks make_hooks(const cJSON_Hooks * const hooks)
 {
+    internal_hooks result;
+
     if (hooks == NULL)
     {
-        /* Reset hooks */
-        global_hooks.allocate = malloc;
-        global_hooks.deallocate = free;
-        global_hooks.reallocate = realloc;
-        return;
+        return global_hooks;
     }
 
-    global_hooks.allocate = malloc;
+    result.allocate = malloc;
     if (hooks->malloc_fn != NULL)
     {
-        global_hooks.allocate = hooks->malloc_fn;
+        result.allocate = hooks->malloc_fn;
     }
 
-    global_hooks.deallocate = free;
+    result.deallocate = free;
     if (hooks->free_fn != NULL)
     {
-        global_hooks.deallocate = hooks->free_fn;
+        result.deallocate = hooks->free_fn;
     }
 
     /* use realloc only if both free and malloc are used */
-    global_hooks.reallocate = NULL;
-    if ((global_hooks.allocate == malloc) && (global_hooks.deallocate == free))
+    result.reallocate = NULL;
+    if ((result.allocate == malloc) && (result.deallocate == free))
+    {
+        result.reallocate = realloc;
+    }
+
+    return result;
+}
+
+CJSON_PUBLIC(void) cJSON_InitHooks(cJSON_Hooks* hooks)
+{
+    if (hooks == NULL)
     {
+        /* Reset hooks */
+        global_hooks.allocate = malloc;
+        global_hooks.deallocate = free;
         global_hooks.reallocate = realloc;
+        return;
     }
+
+    global_hooks = make_hooks(hooks);
 }
 
 /* Internal constructor. */
@@ -249,8 +277,8 @@ static cJSON *cJSON_New_Item(const internal_hooks * const hooks)
     return node;
 }
 
-/* Delete a cJSON structure. */
-CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
+/* Delete a cJSON structure with the hooks it was allocated with. */
+static void delete_item(cJSON *item, const internal_hooks * const hooks)
 {
     cJSON *next = NULL;
     while (item != NULL)
@@ -258,23 +286,35 @@ CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
         next = item->next;
         if (!(item->type & cJSON_IsReference) && (item->child != NULL))
         {
-            cJSON_Delete(item->child);
+            delete_item(item->child, hooks);
         }
         if (!(item->type & cJSON_IsReference) && (item->valuestring != NULL))
         {
-            global_hooks.deallocate(item->valuestring);
+            hooks->deallocate(item->valuestring);
             item->valuestring = NULL;
         }
         if (!(item->type & cJSON_StringIsConst) && (item->string != NULL))
         {
-            global_hooks.deallocate(item->string);
+            hooks->deallocate(item->string);
             item->string = NULL;
         }
-        global_hooks.deallocate(item);
+        hooks->deallocate(item);
         item = next;
     }
 }
 
+/* Delete a cJSON structure. */
+CJSON_PUBLIC(void) cJSON_Delete(cJSON *item)
+{
+    delete_item(item, &global_hooks);
+}
+
+CJSON_PUBLIC(void) cJSON_DeleteWithHooks(cJSON *item, const cJSON_Hooks *hooks)
+{
+    internal_hooks internal = make_hooks(hooks);
+    delete_item(item, &internal);
+}
+
 /* get the decimal point character of the current locale */
 static unsigned char get_decimal_point(void)
 {
@@ -1140,8 +1180,14 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithOpts(const char *value, const char **return
 
 /* Parse an object - create a new root, and populate. */
 CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated)
+{
+    return cJSON_ParseWithHooks(value, buffer_length, return_parse_end, require_null_terminated, NULL);
+}
+
+CJSON_PUBLIC(cJSON *) cJSON_ParseWithHooks(const char *value, size_t buffer_length, const char **return_parse_end, cJSON_bool require_null_terminated, const cJSON_Hooks *hooks)
 {
     parse_buffer buffer = { 0, 0, 0, 0, { 0, 0, 0 } };
+    internal_hooks item_hooks = make_hooks(hooks);
     cJSON *item = NULL;
 
     /* reset error position */
@@ -1156,9 +1202,9 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer
     buffer.content = (const unsigned char*)value;
     buffer.length = buffer_length;
     buffer.offset = 0;
-    buffer.hooks = global_hooks;
+    buffer.hooks = item_hooks;
 
-    item = cJSON_New_Item(&global_hooks);
+    item = cJSON_New_Item(&item_hooks);
     if (item == NULL) /* memory fail */
     {
         goto fail;
@@ -1189,7 +1235,7 @@ CJSON_PUBLIC(cJSON *) cJSON_ParseWithLengthOpts(const char *value, size_t buffer
 fail:
     if (item != NULL)
     {
-        cJSON_Delete(item);
+        delete_item(item, &item_hooks);
     }
 
     if (value != NULL)
@@ -1580,7 +1626,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        delete_item(head, &input_buffer->hooks);
     }
 
     return false;
@@ -1760,7 +1806,7 @@ success:
 fail:
     if (head != NULL)
     {
-        cJSON_Delete(head);
+        delete_item(head, &input_buffer->hooks);
     }
 
     return false;
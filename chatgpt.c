@@ -4,14 +4,61 @@
  * Supports conversation management, streaming responses, error handling, and configuration
  */
 
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L  // clock_gettime, nanosleep
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <ctype.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
 #include <curl/curl.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <strings.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <dlfcn.h>
+#endif
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CHATGPT_CRC32C_SSE42 1  // crc32 instruction, picked at run time
+#include <nmmintrin.h>
+#else
+#define CHATGPT_CRC32C_SSE42 0
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#endif
+#ifdef _WIN32
+#include <direct.h>
+#include <errno.h>
+#include <io.h>
+#endif
+
 #include "cJSON.h"
 #include "chatgpt.h"
 
 #define DEFAULT_MODEL "gpt-4o-mini"
+#define DEFAULT_BASE_URL "https://api.openai.com"
+#define ERROR_TEXT_MAX 512  // Capacity of a conversation's error text
 
 /*
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
@@ -27,6 +74,12 @@ static char *g_api_key = NULL;
 // Optional log file for debugging purposes
 static FILE *g_log = NULL;          
 
+// Scrubbing flags inherited by newly created conversations
+static unsigned g_scrub_flags = CHATGPT_SCRUB_NONE;
+
+// Record/replay cassette shared by all conversations (see CASSETTES section)
+static struct cassette *g_cassette = NULL;
+
 /*
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
 ┃                                               ┃
@@ -60,6 +113,38 @@ static char *dup_str(const char *s) {
     return p;
 }
 
+/*
+ * Monotonic clock in microseconds
+ * Used for latency measurement and cassette chunk timing
+ */
+static uint64_t now_us(void) {
+#ifdef _WIN32
+    LARGE_INTEGER f, t;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)(t.QuadPart / (f.QuadPart / 1000000.0));
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+#endif
+}
+
+/*
+ * Sleep for the given number of microseconds
+ */
+static void sleep_us(uint64_t us) {
+    if (!us) return;
+#ifdef _WIN32
+    Sleep((DWORD)((us + 999) / 1000));
+#else
+    struct timespec ts;
+    ts.tv_sec = (time_t)(us / 1000000u);
+    ts.tv_nsec = (long)(us % 1000000u) * 1000;
+    while (nanosleep(&ts, &ts) != 0) {}
+#endif
+}
+
 /*
  * Set a log file for debugging output
  * The library will write debug information to this file
@@ -109,9 +194,13 @@ static void set_error(ChatGPTConversation *c, ChatGPT_ErrorCode code, const char
     // Set error code
     c->last_code = code;
     
+    // The text buffer is only allocated once an error actually happens
+    if (msg && msg[0] && !c->last_error) c->last_error = (char*)malloc(ERROR_TEXT_MAX);
+    if (!c->last_error) return;
+    
     if (msg) {
-        strncpy(c->last_error, msg, sizeof(c->last_error) - 1);
-        c->last_error[sizeof(c->last_error) - 1] = '\0';
+        strncpy(c->last_error, msg, ERROR_TEXT_MAX - 1);
+        c->last_error[ERROR_TEXT_MAX - 1] = '\0';
     } else {
         c->last_error[0] = '\0';
     }
@@ -145,6 +234,8 @@ static int ensure_cap(ChatGPTConversation *c, size_t need) {
     for (size_t i = c->message_capacity; i < cap; i++) {
         m[i].role = NULL;
         m[i].content = NULL;
+        m[i].packed = NULL;
+        m[i].interned = NULL;
     }
     
     // Update client structure
@@ -153,6 +244,126 @@ static int ensure_cap(ChatGPTConversation *c, size_t need) {
     return CHATGPT_OK;
 }
 
+/*
+ * Change feed record types (see chatgpt_set_change_feed)
+ */
+enum {
+    DELTA_ADD = 1,              // role, content
+    DELTA_CLEAR,
+    DELTA_REMOVE,               // index
+    DELTA_REPLACE,              // index, content
+    DELTA_APPEND,               // index, text
+    DELTA_MODEL,                // model
+    DELTA_SNAPSHOT,             // template, parameters, MessagePack conversation
+    DELTA_TEMPLATE,             // rendered template messages (empty = none)
+    DELTA_PARAMS                // sampling parameters and scrub flags (see params_put)
+};
+
+// LEB128 varint; returns the position after it
+static unsigned char *put_varint(unsigned char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+/*
+ * Count a change and hand its delta record to the change feed, if any
+ * Record: op byte, varint seq, then for the op an optional varint index and up to two
+ * varint-length-prefixed strings
+ */
+static void delta_emit(ChatGPTConversation *c, int op, int64_t idx, const char *a, size_t an,
+                       const char *b, size_t bn) {
+    uint64_t seq = ++c->change_seq;
+    if (!c->change_fn) return;
+    
+    unsigned char local[512];
+    size_t need = 1 + 3 * 10 + an + bn + (b ? 10 : 0);
+    unsigned char *rec = need <= sizeof(local) ? local : (unsigned char*)malloc(need);
+    if (!rec) {
+        c->change_fn(seq, NULL, 0, c->change_ud);
+        return;
+    }
+    
+    unsigned char *p = rec;
+    *p++ = (unsigned char)op;
+    p = put_varint(p, seq);
+    if (idx >= 0) p = put_varint(p, (uint64_t)idx);
+    if (a) {
+        p = put_varint(p, an);
+        memcpy(p, a, an);
+        p += an;
+    }
+    if (b) {
+        p = put_varint(p, bn);
+        memcpy(p, b, bn);
+        p += bn;
+    }
+    c->change_fn(seq, rec, (size_t)(p - rec), c->change_ud);
+    if (rec != local) free(rec);
+}
+
+/*
+ * Request parameters as carried by the change feed (little-endian):
+ * temperature, top_p, presence_penalty, frequency_penalty as IEEE-754 doubles,
+ * then max_tokens and scrub_flags as u32
+ */
+#define PARAMS_LEN 40
+
+static void params_put(const ChatGPTConversation *c, unsigned char *p) {
+    const double d[4] = { c->temperature, c->top_p, c->presence_penalty, c->frequency_penalty };
+    uint32_t u[2] = { (uint32_t)c->max_tokens, c->scrub_flags };
+    
+    for (int i = 0; i < 4; i++) {
+        uint64_t bits;
+        memcpy(&bits, &d[i], sizeof(bits));
+        for (int k = 0; k < 8; k++) *p++ = (unsigned char)(bits >> (8 * k));
+    }
+    for (int i = 0; i < 2; i++) {
+        for (int k = 0; k < 4; k++) *p++ = (unsigned char)(u[i] >> (8 * k));
+    }
+}
+
+/*
+ * Load parameters written by params_put
+ * Returns: 0 on success, -1 if they are out of range (c is unchanged)
+ */
+static int params_get(ChatGPTConversation *c, const unsigned char *p) {
+    double d[4];
+    uint32_t u[2] = { 0, 0 };
+    
+    for (int i = 0; i < 4; i++) {
+        uint64_t bits = 0;
+        for (int k = 0; k < 8; k++) bits |= (uint64_t)*p++ << (8 * k);
+        memcpy(&d[i], &bits, sizeof(bits));
+    }
+    for (int i = 0; i < 2; i++) {
+        for (int k = 0; k < 4; k++) u[i] |= (uint32_t)*p++ << (8 * k);
+    }
+    
+    // Same ranges as the setters (comparisons also reject NaN)
+    if (!(d[0] >= 0 && d[0] <= 2) || !(d[1] > 0 && d[1] <= 1) || !(d[2] >= -2 && d[2] <= 2) ||
+        !(d[3] >= -2 && d[3] <= 2) || u[0] > INT_MAX || (u[1] & ~(uint32_t)CHATGPT_SCRUB_ALL)) {
+        return -1;
+    }
+    c->temperature = d[0];
+    c->top_p = d[1];
+    c->presence_penalty = d[2];
+    c->frequency_penalty = d[3];
+    c->max_tokens = (int)u[0];
+    c->scrub_flags = u[1];
+    return 0;
+}
+
+// Emit the current request parameters after one of them changed
+static void delta_emit_params(ChatGPTConversation *c) {
+    unsigned char p[PARAMS_LEN];
+    params_put(c, p);
+    delta_emit(c, DELTA_PARAMS, -1, (const char*)p, sizeof(p), NULL, 0);
+}
+
 /*
  * Remove trailing whitespace from a string
  * Modifies the string in-place by null-terminating at the first trailing whitespace
@@ -182,6 +393,70 @@ void chatgpt_rtrim(char *s) {
     }
 }
 
+/*
+ * Length of s[0..n) escaped for the inside of a JSON string literal
+ * Escapes exactly what cJSON escapes, so hand-built output matches its printer
+ */
+static size_t json_escaped_len(const char *s, size_t n) {
+    size_t out = n;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch == '"' || ch == '\\' || ch == '\b' || ch == '\f' || ch == '\n' || ch == '\r' || ch == '\t') out += 1;
+        else if (ch < 32) out += 5;
+    }
+    return out;
+}
+
+/*
+ * Write s[0..n) escaped (json_escaped_len bytes, no quotes, no terminator)
+ * Returns: Position after the last byte written
+ */
+static char *json_escape(char *d, const char *s, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    
+    for (size_t i = 0; i < n; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch >= 32 && ch != '"' && ch != '\\') {
+            *d++ = (char)ch;
+            continue;
+        }
+        *d++ = '\\';
+        switch (ch) {
+            case '"': *d++ = '"'; break;
+            case '\\': *d++ = '\\'; break;
+            case '\b': *d++ = 'b'; break;
+            case '\f': *d++ = 'f'; break;
+            case '\n': *d++ = 'n'; break;
+            case '\r': *d++ = 'r'; break;
+            case '\t': *d++ = 't'; break;
+            default:
+                memcpy(d, "u00", 3);
+                d[3] = hex[ch >> 4];
+                d[4] = hex[ch & 15];
+                d += 5;
+        }
+    }
+    return d;
+}
+
+/*
+ * Length of s[0..n) as a quoted JSON string literal
+ */
+static size_t json_quoted_len(const char *s, size_t n) {
+    return json_escaped_len(s, n) + 2;
+}
+
+/*
+ * Write s[0..n) as a quoted JSON string literal (json_quoted_len bytes, no terminator)
+ * Returns: Position after the closing quote
+ */
+static char *json_quote(char *d, const char *s, size_t n) {
+    *d++ = '"';
+    d = json_escape(d, s, n);
+    *d++ = '"';
+    return d;
+}
+
 /*
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
 ┃                                               ┃
@@ -223,914 +498,8421 @@ const char *chatgpt_get_api_key_global(void) {
 /*
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
 ┃                                               ┃
-┃             JSON MESSAGE BUILDING             ┃
+┃               MESSAGE INTERNING               ┃
 ┃                                               ┃
 ┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
  */
 
 /*
- * Build a JSON array representation of all messages in the conversation
- * This function creates a JSON array suitable for the OpenAI API
- * Usage: char *json = chatgpt_build_messages_json(conversation); ... free(json);
- * Returns: JSON string or NULL on error
+ * Identical message contents (system prompts, few-shot examples) can be stored once
+ * per process. An entry holds the text, its quoted JSON form for request bodies and a
+ * reference count; a message using it has content == entry->text and interned == entry.
+ * Shared text is never modified in place: writers take a private copy first (msg_own)
  */
-char *chatgpt_build_messages_json(ChatGPTConversation *c) {
-    
-    if (!c) return NULL;
-    
-    // Create JSON array for messages
-    cJSON *arr = cJSON_CreateArray();
-    if (!arr) return NULL;
-    
-    // Add each message to the array
-    for (size_t i = 0; i < c->message_count; i++) {
-        // Create message object
-        cJSON *o = cJSON_CreateObject();
-        if (!o) {
-            cJSON_Delete(arr);
-            return NULL;
-        }
-        
-        // Add role and content fields
-        cJSON_AddStringToObject(o, "role", c->messages[i].role ? c->messages[i].role : "user");
-        cJSON_AddStringToObject(o, "content", c->messages[i].content ? c->messages[i].content : "");
-        
-        // Add message to array
-        cJSON_AddItemToArray(arr, o);
-    }
-    
-    // Convert to string and cleanup
-    char *s = cJSON_PrintUnformatted(arr);
-    cJSON_Delete(arr);
-    return s;
+struct intern {
+    struct intern *next;    // Bucket chain
+    uint64_t hash;          // Hash of the text
+    size_t len;             // Text length
+    long refs;              // Messages using the entry (guarded by the table lock)
+    char *json;             // Quoted JSON string literal (stored after text)
+    size_t json_len;        // Length of json
+    char text[];            // Content, NUL-terminated
+};
+
+static struct intern **g_intern = NULL;   // Hash table, power-of-two buckets
+static size_t g_intern_buckets = 0;
+static size_t g_intern_count = 0;         // Live entries
+static size_t g_intern_bytes = 0;         // Heap held by live entries
+
+#ifdef _WIN32
+static SRWLOCK g_intern_lock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t g_intern_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void intern_lock(void) {
+#ifdef _WIN32
+    AcquireSRWLockExclusive(&g_intern_lock);
+#else
+    pthread_mutex_lock(&g_intern_lock);
+#endif
 }
 
+static void intern_unlock(void) {
+#ifdef _WIN32
+    ReleaseSRWLockExclusive(&g_intern_lock);
+#else
+    pthread_mutex_unlock(&g_intern_lock);
+#endif
+}
 
 /*
-┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
-┃                                               ┃
-┃        CONVERSATION LIFECYCLE MANAGEMENT      ┃
-┃                                               ┃
-┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ * Hash 8 bytes at a time (long prompts are the point of interning)
  */
+static uint64_t intern_hash(const char *s, size_t n) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ n;
+    uint64_t w;
+    
+    while (n >= 8) {
+        memcpy(&w, s, 8);
+        h = (h ^ (w * 0xFF51AFD7ED558CCDull));
+        h = ((h << 27) | (h >> 37)) * 0xC4CEB9FE1A85EC53ull;
+        s += 8;
+        n -= 8;
+    }
+    w = 0;
+    memcpy(&w, s, n);
+    h = (h ^ (w * 0xFF51AFD7ED558CCDull));
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 29);
+}
+
+static struct intern *intern_find(uint64_t h, const char *s, size_t n) {
+    if (!g_intern) return NULL;
+    struct intern *e = g_intern[h & (g_intern_buckets - 1)];
+    while (e && !(e->hash == h && e->len == n && memcmp(e->text, s, n) == 0)) e = e->next;
+    return e;
+}
 
 /*
- * Create a new ChatGPT conversation instance
- * This is the main constructor for the library - creates and initializes a conversation
- * Usage: ChatGPTConversation *conv = chatgpt_conversation_new("sk-your-key", "gpt-4");
- *        ChatGPTConversation *conv = chatgpt_conversation_new(NULL, NULL); // Uses global key and default model
- * Parameters:
- *   - api_key: OpenAI API key, or NULL to use global key
- *   - model: Model name (e.g., "gpt-4", "gpt-3.5-turbo"), or NULL for default
- * Returns: New conversation instance or NULL on error
+ * Get a reference on the shared copy of s[0..n), creating it if needed
+ * Returns: Entry or NULL on allocation failure
  */
-ChatGPTConversation *chatgpt_conversation_new(const char *api_key, const char *model) {
-    ChatGPTConversation *c;
-    
-    // Use global key if none provided
-    if (!api_key) api_key = g_api_key;
-    if (!api_key) return NULL;  // No key available
-    
-    // Allocate and initialize conversation structure
-    c = (ChatGPTConversation*)calloc(1, sizeof(ChatGPTConversation));
-    if (!c) return NULL;
-    
-    // Copy API key and model
-    c->api_key = dup_str(api_key);
-    c->model = dup_str(model ? model : DEFAULT_MODEL); 
-    
-    // Set default parameters
-    c->temperature = 0.7;       // Balanced creativity
-    c->top_p = 1.0;            // No nucleus sampling by default
-    c->max_tokens = 0;         // No token limit by default
-    c->presence_penalty = 0.0;  // No presence penalty by default
-    c->frequency_penalty = 0.0; // No frequency penalty by default
-    
-    // Set new default parameters
-    c->use_streaming = 1;      // Streaming enabled by default
-    c->context_messages = 5;   // Send last 5 messages by default
-    c->max_retries = 3;        // 3 retry attempts by default
-    c->retry_delay_ms = 1000;  // 1 second delay between retries
-    
-    // Set default base URL for OpenAI API
-    c->base_url = dup_str("https://api.openai.com");
+static struct intern *intern_get(const char *s, size_t n) {
+    uint64_t h = intern_hash(s, n);
+    
+    intern_lock();
+    struct intern *e = intern_find(h, s, n);
+    if (e) e->refs++;
+    intern_unlock();
+    if (e) return e;
+    
+    // Build the entry (escaping included) outside the lock
+    size_t jl = json_quoted_len(s, n);
+    struct intern *fresh = (struct intern*)malloc(sizeof(*fresh) + n + 1 + jl);
+    if (!fresh) return NULL;
+    fresh->hash = h;
+    fresh->len = n;
+    fresh->refs = 1;
+    memcpy(fresh->text, s, n);
+    fresh->text[n] = '\0';
+    fresh->json = fresh->text + n + 1;
+    fresh->json_len = jl;
+    json_quote(fresh->json, s, n);
+    
+    intern_lock();
+    e = intern_find(h, s, n);
+    if (e) {
+        // Another thread interned the same text meanwhile
+        e->refs++;
+        intern_unlock();
+        free(fresh);
+        return e;
+    }
     
-    // Initialize other fields
-    c->last_reply = NULL;
-    c->last_error[0] = '\0';
-    c->last_code = CHATGPT_OK;
-    c->last_http_code = 0;
+    // Keep the load factor at or below 1
+    if (g_intern_count >= g_intern_buckets) {
+        size_t nb = g_intern_buckets ? g_intern_buckets * 2 : 256;
+        struct intern **b = (struct intern**)calloc(nb, sizeof(*b));
+        if (b) {
+            for (size_t i = 0; i < g_intern_buckets; i++) {
+                struct intern *x = g_intern[i];
+                while (x) {
+                    struct intern *next = x->next;
+                    x->next = b[x->hash & (nb - 1)];
+                    b[x->hash & (nb - 1)] = x;
+                    x = next;
+                }
+            }
+            free(g_intern);
+            g_intern = b;
+            g_intern_buckets = nb;
+        } else if (!g_intern) {
+            intern_unlock();
+            free(fresh);
+            return NULL;
+        }
+    }
     
-    return c;
+    fresh->next = g_intern[h & (g_intern_buckets - 1)];
+    g_intern[h & (g_intern_buckets - 1)] = fresh;
+    g_intern_count++;
+    g_intern_bytes += sizeof(*fresh) + n + 1 + jl;
+    intern_unlock();
+    return fresh;
 }
 
 /*
- * Free all resources associated with a ChatGPT conversation
- * This cleans up all allocated memory and should be called for every conversation
- * Usage: chatgpt_conversation_free(conversation); conversation = NULL; // Good practice to null the pointer
+ * Drop a reference; the last one removes the entry from the table and frees it
  */
-void chatgpt_conversation_free(ChatGPTConversation *c) {
-    if (!c) return;
-    
-    // Free string fields
-    free(c->api_key);
-    free(c->model);
-    free(c->base_url);
-    free(c->last_reply);
-    
-    // Free all messages
-    for (size_t i = 0; i < c->message_count; i++) {
-        free(c->messages[i].role);
-        free(c->messages[i].content);
+static void intern_release(struct intern *e) {
+    intern_lock();
+    int last = --e->refs == 0;
+    if (last) {
+        struct intern **pp = &g_intern[e->hash & (g_intern_buckets - 1)];
+        while (*pp != e) pp = &(*pp)->next;
+        *pp = e->next;
+        g_intern_count--;
+        g_intern_bytes -= sizeof(*e) + e->len + 1 + e->json_len;
     }
-    free(c->messages);
-    
-    // Free the conversation structure itself
-    free(c);
+    intern_unlock();
+    if (last) free(e);
 }
 
 /*
- * Copy all settings from one conversation to another
- * Does not copy messages, only configuration settings
- * Usage: chatgpt_conversation_copy_settings(dest_conv, src_conv);
- * Returns: CHATGPT_OK on success, error code on failure
+ * Store text[0..n) as a message's content: shared when it is at least intern_min bytes
+ * (and intern_min is not 0), otherwise a private copy. The message must be empty
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_OOM on failure
  */
-int chatgpt_conversation_copy_settings(ChatGPTConversation *dest, const ChatGPTConversation *src) {
-    if (!dest || !src) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Copy model
-    if (src->model) {
-        char *new_model = dup_str(src->model);
-        if (!new_model) return CHATGPT_ERR_OOM;
-        free(dest->model);
-        dest->model = new_model;
-    }
-    
-    // Copy base URL
-    if (src->base_url) {
-        char *new_url = dup_str(src->base_url);
-        if (!new_url) return CHATGPT_ERR_OOM;
-        free(dest->base_url);
-        dest->base_url = new_url;
+static int msg_set_content_n(ChatGPTMessage *m, const char *text, size_t n, size_t intern_min) {
+    if (intern_min && n >= intern_min) {
+        struct intern *e = intern_get(text, n);
+        if (e) {
+            m->content = e->text;
+            m->interned = e;
+            return CHATGPT_OK;
+        }
     }
     
-    // Copy numerical settings
-    dest->temperature = src->temperature;
-    dest->top_p = src->top_p;
-    dest->max_tokens = src->max_tokens;
-    dest->presence_penalty = src->presence_penalty;
-    dest->frequency_penalty = src->frequency_penalty;
-    dest->use_streaming = src->use_streaming;
-    dest->context_messages = src->context_messages;
-    dest->max_retries = src->max_retries;
-    dest->retry_delay_ms = src->retry_delay_ms;
-    
+    m->content = (char*)malloc(n + 1);
+    if (!m->content) return CHATGPT_ERR_OOM;
+    memcpy(m->content, text, n);
+    m->content[n] = '\0';
+    m->interned = NULL;
     return CHATGPT_OK;
 }
 
 /*
-┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
-┃                                               ┃
-┃          CLIENT LIFECYCLE MANAGEMENT          ┃
-┃          (Legacy Compatibility)               ┃
-┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ * Free a message's content in whichever form it is held (private, shared or packed)
  */
+static void msg_drop_content(ChatGPTMessage *m) {
+    if (m->interned) intern_release((struct intern*)m->interned);
+    else free(m->content);
+    free(m->packed);
+    m->content = NULL;
+    m->packed = NULL;
+    m->interned = NULL;
+}
 
 /*
- * Create a new ChatGPT client instance
- * This is the main constructor for the library - creates and initializes a client
- * Usage: ChatGPTClient *client = chatgpt_client_new("sk-your-key", "gpt-4");
- *        ChatGPTClient *client = chatgpt_client_new(NULL, NULL); // Uses global key and default model
- * Parameters:
- *   - api_key: OpenAI API key, or NULL to use global key
- *   - model: Model name (e.g., "gpt-4", "gpt-3.5-turbo"), or NULL for default
- * Returns: New client instance or NULL on error
+ * Free everything a message owns
  */
+static void msg_free(ChatGPTMessage *m) {
+    free(m->role);
+    m->role = NULL;
+    msg_drop_content(m);
+}
+
 /*
- * Create a new ChatGPT client instance (legacy compatibility)
- * This is an alias for the new conversation function
- * Usage: ChatGPTClient *client = chatgpt_client_new("sk-your-key", "gpt-4");
- *        ChatGPTClient *client = chatgpt_client_new(NULL, NULL); // Uses global key and default model
- * Parameters:
- *   - api_key: OpenAI API key, or NULL to use global key
- *   - model: Model name (e.g., "gpt-4", "gpt-3.5-turbo"), or NULL for default
- * Returns: New client instance or NULL on error
+ * Give a message a private copy of shared content (before modifying it)
+ * Returns: CHATGPT_OK on success, error code on failure
  */
-ChatGPTClient *chatgpt_client_new(const char *api_key, const char *model) {
-    return chatgpt_conversation_new(api_key, model);
+static int msg_own(ChatGPTMessage *m) {
+    if (!m->interned) return CHATGPT_OK;
+    
+    char *d = dup_str(m->content);
+    if (!d) return CHATGPT_ERR_OOM;
+    intern_release((struct intern*)m->interned);
+    m->interned = NULL;
+    m->content = d;
+    return CHATGPT_OK;
 }
 
 /*
- * Free all resources associated with a ChatGPT client (legacy compatibility)
- * This cleans up all allocated memory and should be called for every client
- * Usage: chatgpt_client_free(client); client = NULL; // Good practice to null the pointer
+ * Store message contents of at least min_bytes once per process
+ * Conversations that share system prompts or few-shot examples then hold one copy between
+ * them, and requests copy its pre-escaped JSON instead of escaping it again
+ * Usage: chatgpt_set_interning(conversation, 256);
+ *        chatgpt_set_interning(conversation, 0); // Off (default); shared messages stay shared
+ * Returns: CHATGPT_OK on success, error code on failure
  */
-void chatgpt_client_free(ChatGPTClient *c) {
-    chatgpt_conversation_free(c);
+int chatgpt_set_interning(ChatGPTConversation *c, size_t min_bytes) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->intern_min_bytes = min_bytes;
+    return CHATGPT_OK;
 }
 
 /*
- * Clear the last error state
- * Resets error code to OK and clears error message
- * Usage: chatgpt_clear_error(conversation); // After handling an error
+ * Report the process-wide intern table's size
+ * Usage: size_t n, bytes; chatgpt_intern_stats(&n, &bytes);
+ * Returns: CHATGPT_OK (either pointer may be NULL)
  */
-void chatgpt_clear_error(ChatGPTConversation *c) {
-    if (c) {
-        c->last_error[0] = '\0';
-        c->last_code = CHATGPT_OK;
-        c->last_http_code = 0;
-    }
+int chatgpt_intern_stats(size_t *strings, size_t *bytes) {
+    intern_lock();
+    if (strings) *strings = g_intern_count;
+    if (bytes) *bytes = g_intern_bytes;
+    intern_unlock();
+    return CHATGPT_OK;
 }
 
 /*
- * Get the last error message as a string
- * Usage: if (result != CHATGPT_OK) printf("Error: %s\n", chatgpt_last_error(conversation));
- * Returns: Error message string (empty if no error, do not free this pointer)
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃              MESSAGE COMPRESSION              ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
  */
-const char *chatgpt_last_error(const ChatGPTConversation *c) {
-    return c ? c->last_error : "";
-}
 
 /*
- * Get the last error code
- * Usage: ChatGPT_ErrorCode code = chatgpt_last_code(conversation);
- * Returns: Error code enum value
+ * Cold message contents can be kept LZ-compressed in memory
+ * The codec writes the LZ4 block format (token, literals, 16-bit offset, match length)
+ * with a single-probe hash table: fast enough to run on every added message and
+ * about 2-3x on chat text. A compressed message has content == NULL and
+ * packed == [u32 raw_len][u32 lz_len][lz data]; readers inflate it into a temporary
+ * buffer, writers inflate it back in place
  */
-ChatGPT_ErrorCode chatgpt_last_code(const ChatGPTConversation *c) {
-    return c ? c->last_code : CHATGPT_ERR_INVALID_ARG;
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5      // The final bytes are always literals
+#define LZ_MATCH_LIMIT 12       // No match may start in the last 12 bytes
+#define LZ_MAX_OFFSET 65535
+#define PACK_HDR 8              // raw_len + lz_len
+
+static uint32_t lz_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *lz_put_len(unsigned char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
 }
 
 /*
-┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
-┃                                               ┃
-┃           CONVERSATION CONFIGURATION          ┃
-┃                                               ┃
-┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ * Emit one sequence: literals [anchor, anchor+lit) then a match (mlen = 0 for the last one)
+ * Returns: New output position or NULL if it does not fit
  */
+static unsigned char *lz_emit(unsigned char *op, unsigned char *oend, const unsigned char *anchor,
+                              size_t lit, size_t off, size_t mlen) {
+    size_t ml = mlen ? mlen - LZ_MIN_MATCH : 0;
+    if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1 + 2 + ml / 255 + 1) return NULL;
+    
+    unsigned char *token = op++;
+    *token = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) op = lz_put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    if (!mlen) return op;
+    
+    *op++ = (unsigned char)off;
+    *op++ = (unsigned char)(off >> 8);
+    *token |= (unsigned char)(ml >= 15 ? 15 : ml);
+    if (ml >= 15) op = lz_put_len(op, ml - 15);
+    return op;
+}
 
 /*
- * Set the AI model to use for completions
- * Common models: "gpt-4", "gpt-4-turbo", "gpt-3.5-turbo", "gpt-4o-mini"
- * Usage: chatgpt_set_model(conversation, "gpt-4");
- * Returns: CHATGPT_OK on success, error code on failure
+ * Compress src into dst
+ * Returns: Compressed size, or 0 if the result would not fit in cap
  */
-int chatgpt_set_model(ChatGPTConversation *c, const char *m) {
-    if (!c || !m) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Create copy of new model name
-    char *d = dup_str(m);
-    if (!d) return CHATGPT_ERR_OOM;
+static size_t lz_compress(const unsigned char *src, size_t n, unsigned char *dst, size_t cap) {
+    uint32_t table[1 << LZ_HASH_BITS];
+    const unsigned char *ip = src, *anchor = src, *end = src + n;
+    unsigned char *op = dst, *oend = dst + cap;
+    
+    if (n > LZ_MATCH_LIMIT) {
+        const unsigned char *mflimit = end - LZ_MATCH_LIMIT;
+        const unsigned char *mlimit = end - LZ_LAST_LITERALS;
+        
+        memset(table, 0, sizeof(table));
+        while (ip < mflimit) {
+            uint32_t seq = lz_read32(ip);
+            unsigned h = lz_hash(seq);
+            const unsigned char *ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+            
+            // Extend the match backwards into pending literals, then forwards
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const unsigned char *p = ip + LZ_MIN_MATCH, *q = ref + LZ_MIN_MATCH;
+            while (p < mlimit && *p == *q) {
+                p++;
+                q++;
+            }
+            
+            op = lz_emit(op, oend, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), (size_t)(p - ip));
+            if (!op) return 0;
+            ip = anchor = p;
+            if (ip < mflimit) table[lz_hash(lz_read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
     
-    // Replace old model with new one
-    free(c->model);
-    c->model = d;
-    return CHATGPT_OK;
+    op = lz_emit(op, oend, anchor, (size_t)(end - anchor), 0, 0);
+    return op ? (size_t)(op - dst) : 0;
 }
 
 /*
- * Set the temperature parameter (controls randomness/creativity)
- * Range: 0.0 to 2.0
- * - 0.0: Very deterministic, same input → same output
- * - 1.0: Balanced creativity
- * - 2.0: Very creative/random
- * Usage: chatgpt_set_temperature(conversation, 0.7);
- * Returns: CHATGPT_OK on success, error code on failure
+ * Decompress exactly out_len bytes (bounds-checked against both buffers)
+ * Returns: 0 on success, -1 on malformed input
  */
-int chatgpt_set_temperature(ChatGPTConversation *c, double v) {
-    if (!c) return CHATGPT_ERR_INVALID_ARG;
-    if (v < 0 || v > 2) return CHATGPT_ERR_INVALID_ARG;
-    
-    c->temperature = v;
-    return CHATGPT_OK;
+static int lz_decompress(const unsigned char *src, size_t n, unsigned char *dst, size_t out_len) {
+    const unsigned char *ip = src, *iend = src + n;
+    unsigned char *op = dst, *oend = dst + out_len;
+    
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t lit = token >> 4;
+        if (lit == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break;  // Last sequence has no match
+        
+        if (iend - ip < 2) return -1;
+        size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t)(op - dst)) return -1;
+        
+        size_t ml = token & 15;
+        if (ml == 15) {
+            unsigned b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                ml += b;
+            } while (b == 255);
+        }
+        ml += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < ml) return -1;
+        
+        // Overlapping matches (off < ml) repeat a pattern and must copy forwards
+        const unsigned char *m = op - off;
+        if (off >= ml) {
+            memcpy(op, m, ml);
+            op += ml;
+        } else {
+            while (ml--) *op++ = *m++;
+        }
+    }
+    return op == oend ? 0 : -1;
 }
 
 /*
- * Set the top_p parameter (nucleus sampling)
- * Range: 0.0 to 1.0 (exclusive of 0.0)
- * Controls diversity by considering only the top percentage of probable tokens
- * - 0.1: Very focused, only most likely tokens
- * - 1.0: Consider all tokens
- * Usage: chatgpt_set_top_p(conversation, 0.9);
- * Returns: CHATGPT_OK on success, error code on failure
+ * Compress a message's content in place if it is worth it (saves at least 1/8)
  */
-int chatgpt_set_top_p(ChatGPTConversation *c, double v) {
-    if (!c) return CHATGPT_ERR_INVALID_ARG;
-    if (v <= 0 || v > 1) return CHATGPT_ERR_INVALID_ARG;
+static void msg_pack(ChatGPTMessage *m) {
+    if (!m->content || m->packed || m->interned) return;  // Shared text is already stored once
+    
+    size_t n = strlen(m->content);
+    if (n > 0xFFFFFFFFu) return;
+    size_t cap = PACK_HDR + n - n / 8;
+    unsigned char *blob = (unsigned char*)malloc(cap);
+    if (!blob) return;
+    
+    size_t z = lz_compress((const unsigned char*)m->content, n, blob + PACK_HDR, cap - PACK_HDR);
+    if (!z) {
+        free(blob);
+        return;
+    }
+    uint32_t hdr[2] = { (uint32_t)n, (uint32_t)z };
+    memcpy(blob, hdr, PACK_HDR);
     
-    c->top_p = v;
-    return CHATGPT_OK;
+    unsigned char *shrunk = (unsigned char*)realloc(blob, PACK_HDR + z);
+    free(m->content);
+    m->content = NULL;
+    m->packed = (char*)(shrunk ? shrunk : blob);
 }
 
 /*
- * Set the presence penalty parameter
- * Range: -2.0 to 2.0 (default: 0.0)
- * Positive values penalize tokens that have already appeared in the text so far,
- * encouraging the model to introduce new topics and avoid repetition.
- * - 0.0: No penalty (default)
- * - Positive values: Discourage repetition of topics/words that already appeared
- * - Negative values: Encourage repetition of topics/words that already appeared
- * 
- * Key behavior: Penalizes ANY occurrence of a word/topic that already appeared.
- * If a word appeared once, the model will be "reluctant" to repeat it.
- * This causes the model to introduce new ideas to the text.
- * 
- * Usage: chatgpt_set_presence_penalty(conversation, 0.6); // Encourage diverse content
- * Returns: CHATGPT_OK on success, error code on failure
+ * Inflate a packed message into a fresh NUL-terminated buffer
  */
-int chatgpt_set_presence_penalty(ChatGPTConversation *c, double v) {
-    if (!c) return CHATGPT_ERR_INVALID_ARG;
-    if (v < -2.0 || v > 2.0) return CHATGPT_ERR_INVALID_ARG;
+static char *msg_inflate(const ChatGPTMessage *m) {
+    uint32_t hdr[2];
     
-    c->presence_penalty = v;
-    return CHATGPT_OK;
+    memcpy(hdr, m->packed, PACK_HDR);
+    char *s = (char*)malloc((size_t)hdr[0] + 1);
+    if (!s) return NULL;
+    if (lz_decompress((const unsigned char*)m->packed + PACK_HDR, hdr[1], (unsigned char*)s, hdr[0]) != 0) {
+        free(s);
+        return NULL;
+    }
+    s[hdr[0]] = '\0';
+    return s;
 }
 
 /*
- * Set the frequency penalty parameter  
- * Range: -2.0 to 2.0 (default: 0.0)
- * Positive values penalize tokens based on their frequency in the text so far,
- * with higher penalties for more frequently used words.
- * - 0.0: No penalty (default)
- * - Positive values: Reduce repetitive word usage proportionally to frequency
- * - Negative values: Encourage repetitive word usage proportionally to frequency
- * 
- * Key behavior: Penalizes repetition based on HOW MANY TIMES it occurred.
- * If a word repeats many times, the penalty grows.
- * This doesn't prevent repetition completely, but spreads word usage more evenly.
- * 
- * Usage: chatgpt_set_frequency_penalty(conversation, 0.3); // Reduce word repetition
- * Returns: CHATGPT_OK on success, error code on failure
+ * Message text for reading: the content itself, or an inflated copy stored in *tmp
+ * (caller frees *tmp). Returns NULL if a packed message cannot be inflated
  */
-int chatgpt_set_frequency_penalty(ChatGPTConversation *c, double v) {
-    if (!c) return CHATGPT_ERR_INVALID_ARG;
-    if (v < -2.0 || v > 2.0) return CHATGPT_ERR_INVALID_ARG;
-    
-    c->frequency_penalty = v;
-    return CHATGPT_OK;
+static const char *msg_text(const ChatGPTMessage *m, char **tmp) {
+    *tmp = NULL;
+    if (!m->packed) return m->content ? m->content : "";
+    *tmp = msg_inflate(m);
+    return *tmp;
 }
 
 /*
- * Set maximum tokens for the completion
- * Limits the length of the AI's response
- * - 0: No limit (uses model's default)
- * - Positive number: Maximum tokens to generate
- * Usage: chatgpt_set_max_tokens(conversation, 150); // Limit to 150 tokens
+ * Turn a packed message back into plain content (before modifying it)
  * Returns: CHATGPT_OK on success, error code on failure
  */
-int chatgpt_set_max_tokens(ChatGPTConversation *c, int n) {
-    if (!c || n < 0) return CHATGPT_ERR_INVALID_ARG;
-    
-    c->max_tokens = n;
+static int msg_unpack(ChatGPTMessage *m) {
+    if (!m->packed) return CHATGPT_OK;
+    
+    char *s = msg_inflate(m);
+    if (!s) return CHATGPT_ERR_OOM;
+    free(m->packed);
+    m->packed = NULL;
+    m->content = s;
     return CHATGPT_OK;
 }
 
 /*
- * Set the base URL for API requests
- * Allows using alternative OpenAI-compatible endpoints
- * Default: "https://api.openai.com"
- * Usage: chatgpt_set_base_url(conversation, "https://my-custom-api.com");
- * Returns: CHATGPT_OK on success, error code on failure
+ * Apply the compression policy after a message was appended
+ * The message that just dropped out of the keep_recent window is the only new candidate
  */
-int chatgpt_set_base_url(ChatGPTConversation *c, const char *u) {
-    if (!c || !u) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Create copy of new URL
-    char *d = dup_str(u);
-    if (!d) return CHATGPT_ERR_OOM;
+static void compress_aged(ChatGPTConversation *c) {
+    if (!c->compress_min_bytes || c->message_count <= (size_t)c->compress_keep_recent) return;
     
-    // Replace old URL with new one
-    free(c->base_url);
-    c->base_url = d;
-    return CHATGPT_OK;
+    ChatGPTMessage *m = &c->messages[c->message_count - 1 - (size_t)c->compress_keep_recent];
+    if (m->content && strlen(m->content) >= c->compress_min_bytes) msg_pack(m);
 }
 
 /*
- * Enable or disable streaming mode
- * 1 = streaming mode (default), 0 = complete response at once
- * Usage: chatgpt_set_streaming(conversation, 1); // Enable streaming
+ * Keep older message contents compressed in memory
+ * Messages that are at least min_bytes long and older than the keep_recent most recent ones
+ * are compressed as the conversation grows; they are inflated on demand for requests and saves
+ * Usage: chatgpt_set_compression(conversation, 256, 4);
+ *        chatgpt_set_compression(conversation, 0, 0); // Off (default); packed messages stay packed
  * Returns: CHATGPT_OK on success, error code on failure
  */
-int chatgpt_set_streaming(ChatGPTConversation *c, int use_streaming) {
-    if (!c) return CHATGPT_ERR_INVALID_ARG;
+int chatgpt_set_compression(ChatGPTConversation *c, size_t min_bytes, int keep_recent) {
+    if (!c || keep_recent < 0) return CHATGPT_ERR_INVALID_ARG;
     
-    c->use_streaming = use_streaming ? 1 : 0;
+    c->compress_min_bytes = min_bytes;
+    c->compress_keep_recent = keep_recent;
     return CHATGPT_OK;
 }
 
 /*
- * Set the number of recent messages to include in API requests
- * 0 = only last message, positive number = number of recent messages
- * Default: 5
- * Usage: chatgpt_set_context_messages(conversation, 10); // Send last 10 messages
- * Returns: CHATGPT_OK on success, error code on failure
+ * Compress every message of at least the policy's min_bytes, regardless of age
+ * Meant for conversations that go idle. Uses 64 bytes when no policy is set
+ * Usage: chatgpt_compact(conversation);
+ * Returns: Number of messages compressed, or negative error code
  */
-int chatgpt_set_context_messages(ChatGPTConversation *c, int context_messages) {
-    if (!c || context_messages < 0) return CHATGPT_ERR_INVALID_ARG;
+int chatgpt_compact(ChatGPTConversation *c) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
     
-    c->context_messages = context_messages;
-    return CHATGPT_OK;
+    size_t min = c->compress_min_bytes ? c->compress_min_bytes : 64;
+    int packed = 0;
+    for (size_t i = 0; i < c->message_count; i++) {
+        ChatGPTMessage *m = &c->messages[i];
+        if (!m->content || strlen(m->content) < min) continue;
+        msg_pack(m);
+        if (m->packed) packed++;
+    }
+    return packed;
 }
 
 /*
- * Set retry configuration for failed requests
- * max_retries: Maximum number of retry attempts (default: 3)
- * delay_ms: Delay between retries in milliseconds (default: 1000)
- * Usage: chatgpt_set_retry_config(conversation, 5, 2000); // 5 retries, 2 second delay
- * Returns: CHATGPT_OK on success, error code on failure
+ * Get the content of a message, inflating it first if it is compressed
+ * Usage: const char *text = chatgpt_message_content(conversation, 0);
+ * Returns: Content (owned by the conversation) or NULL on error
  */
-int chatgpt_set_retry_config(ChatGPTConversation *c, int max_retries, int delay_ms) {
-    if (!c || max_retries < 0 || delay_ms < 0) return CHATGPT_ERR_INVALID_ARG;
-    
-    c->max_retries = max_retries;
-    c->retry_delay_ms = delay_ms;
-    return CHATGPT_OK;
+const char *chatgpt_message_content(ChatGPTConversation *c, size_t index) {
+    if (!c || index >= c->message_count) return NULL;
+    if (msg_unpack(&c->messages[index]) != CHATGPT_OK) return NULL;
+    return c->messages[index].content;
 }
 
 /*
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
 ┃                                               ┃
-┃              MESSAGE MANAGEMENT               ┃
+┃             JSON MESSAGE BUILDING             ┃
 ┃                                               ┃
 ┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
  */
 
 /*
- * Add a message to the conversation with specified role and content
- * This is the core function for building conversations
- * Usage: chatgpt_add_message(client, "user", "Hello, how are you?");
- *        chatgpt_add_message(client, "assistant", "I'm doing well, thank you!");
- * Parameters:
- *   - role: "user", "assistant", or "system"
- *   - content: The message text
- * Returns: CHATGPT_OK on success, error code on failure
+ * Add a string member that references s instead of copying it
+ * key must be a string literal (it is not copied either); s must outlive the tree
+ * Returns: 1 on success, 0 on allocation failure
  */
-int chatgpt_add_message(ChatGPTConversation *c, const char *role, const char *content) {
-    int r;
-    char *r1, *c1;
+static int json_add_ref(cJSON *obj, const char *key, const char *s) {
+    cJSON *item = cJSON_CreateStringReference(s);
+    if (!item) return 0;
+    if (!cJSON_AddItemToObjectCS(obj, key, item)) {
+        cJSON_Delete(item);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * Build a JSON array representation of all messages in the conversation
+ * This function creates a JSON array suitable for the OpenAI API
+ * The tree references the messages' strings, so building it allocates only nodes
+ * (compressed messages are inflated and kept until the tree is printed)
+ * Usage: char *json = chatgpt_build_messages_json(conversation); ... free(json);
+ * Returns: JSON string or NULL on error
+ */
+char *chatgpt_build_messages_json(ChatGPTConversation *c) {
     
-    if (!c || !role || !content) return CHATGPT_ERR_INVALID_ARG;
+    if (!c) return NULL;
     
-    // Ensure we have capacity for one more message
-    r = ensure_cap(c, c->message_count + 1);
-    if (r) return r;
+    // Create JSON array for messages
+    cJSON *arr = cJSON_CreateArray();
+    if (!arr) return NULL;
     
-    // Create copies of role and content strings
-    r1 = dup_str(role);
-    c1 = dup_str(content);
-    if (!r1 || !c1) {
-        free(r1);
-        free(c1);
-        return CHATGPT_ERR_OOM;
-    }
+    // Inflated copies of compressed messages, freed after printing
+    char **tmps = NULL;
+    size_t n_tmps = 0;
+    size_t size = 16;
+    int ok = 1;
     
-    // Add message to array
-    c->messages[c->message_count].role = r1;
-    c->messages[c->message_count].content = c1;
-    c->message_count++;
+    // Add each message to the array
+    for (size_t i = 0; ok && i < c->message_count; i++) {
+        const ChatGPTMessage *m = &c->messages[i];
+        
+        // Create message object
+        cJSON *o = cJSON_CreateObject();
+        if (!o) {
+            ok = 0;
+            break;
+        }
+        cJSON_AddItemToArray(arr, o);
+        
+        // Add role and content fields
+        char *tmp;
+        const char *text = msg_text(m, &tmp);
+        if (tmp) {
+            if (!tmps) tmps = (char**)calloc(c->message_count, sizeof(*tmps));
+            if (!tmps) {
+                free(tmp);
+                ok = 0;
+                break;
+            }
+            tmps[n_tmps++] = tmp;
+        }
+        const char *role = m->role ? m->role : "user";
+        ok = text && json_add_ref(o, "role", role) && json_add_ref(o, "content", text);
+        if (ok) size += json_quoted_len(role, strlen(role)) + json_quoted_len(text, strlen(text)) + 24;
+    }
     
-    return CHATGPT_OK;
+    // Print into a buffer of the exact output size, then cleanup
+    char *s = NULL;
+    if (ok) s = size < INT_MAX ? cJSON_PrintBuffered(arr, (int)size, 0) : cJSON_PrintUnformatted(arr);
+    cJSON_Delete(arr);
+    for (size_t i = 0; i < n_tmps; i++) free(tmps[i]);
+    free(tmps);
+    return s;
 }
 
+
 /*
- * Add a user message to the conversation
- * Convenience function equivalent to chatgpt_add_message(conversation, "user", text)
- * Usage: chatgpt_add_user(conversation, "What's the weather like today?");
- * Returns: CHATGPT_OK on success, error code on failure
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃        CONVERSATION LIFECYCLE MANAGEMENT      ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
  */
-int chatgpt_add_user(ChatGPTConversation *c, const char *t) {
-    return chatgpt_add_message(c, "user", t);
-}
 
 /*
- * Add a system message to the conversation
- * System messages set the behavior and context for the AI
- * Usage: chatgpt_add_system(client, "You are a helpful coding assistant.");
- * Returns: CHATGPT_OK on success, error code on failure
+ * Per-thread pool of conversation objects
+ * Services that create and free a conversation per request recycle the same few
+ * structures (and their message arrays) instead of going through the allocator.
+ * Objects are returned to the pool of the thread that frees them
  */
-int chatgpt_add_system(ChatGPTClient *c, const char *t) {
-    return chatgpt_add_message(c, "system", t);
+#define CONV_POOL_MAX 32        // Pooled objects per thread
+#define CONV_POOL_KEEP_MSGS 64  // Largest message array kept with a pooled object
+
+#ifndef _WIN32
+struct conv_pool {
+    int count;
+    ChatGPTConversation *slots[CONV_POOL_MAX];
+};
+
+static pthread_key_t g_pool_key;
+static pthread_once_t g_pool_once = PTHREAD_ONCE_INIT;
+static int g_pool_key_ok = 0;
+
+static void conv_pool_free(void *p) {
+    struct conv_pool *pool = (struct conv_pool*)p;
+    
+    for (int i = 0; i < pool->count; i++) {
+        free(pool->slots[i]->messages);
+        free(pool->slots[i]);
+    }
+    free(pool);
 }
 
-/*
- * Add an assistant message to the conversation
- * Useful for providing examples or continuing a conversation
- * Usage: chatgpt_add_assistant(client, "I'd be happy to help with that!");
- * Returns: CHATGPT_OK on success, error code on failure
- */
-int chatgpt_add_assistant(ChatGPTClient *c, const char *t) {
-    return chatgpt_add_message(c, "assistant", t);
+static void conv_pool_key_init(void) {
+    g_pool_key_ok = pthread_key_create(&g_pool_key, conv_pool_free) == 0;
+}
+
+static struct conv_pool *conv_pool_get(int create) {
+    pthread_once(&g_pool_once, conv_pool_key_init);
+    if (!g_pool_key_ok) return NULL;
+    
+    struct conv_pool *pool = (struct conv_pool*)pthread_getspecific(g_pool_key);
+    if (!pool && create) {
+        pool = (struct conv_pool*)calloc(1, sizeof(*pool));
+        if (pool && pthread_setspecific(g_pool_key, pool) != 0) {
+            free(pool);
+            pool = NULL;
+        }
+    }
+    return pool;
 }
+#endif
 
 /*
- * Clear all messages from the conversation
- * Removes all messages but keeps configuration settings
+ * Get a zeroed conversation structure, from the pool when possible
+ * A pooled object keeps its (empty) message array and capacity
+ */
+static ChatGPTConversation *conv_alloc(void) {
+    ChatGPTMessage *msgs = NULL;
+    size_t cap = 0;
+    ChatGPTConversation *c = NULL;
+    
+#ifndef _WIN32
+    struct conv_pool *pool = conv_pool_get(0);
+    if (pool && pool->count > 0) {
+        c = pool->slots[--pool->count];
+        msgs = c->messages;
+        cap = c->message_capacity;
+    }
+#endif
+    if (!c) c = (ChatGPTConversation*)malloc(sizeof(ChatGPTConversation));
+    if (!c) return NULL;
+    
+    memset(c, 0, sizeof(*c));
+    c->messages = msgs;
+    c->message_capacity = cap;
+    return c;
+}
+
+/*
+ * Give a conversation structure back (its contents are already released)
+ */
+static void conv_recycle(ChatGPTConversation *c) {
+    if (c->message_capacity > CONV_POOL_KEEP_MSGS) {
+        free(c->messages);
+        c->messages = NULL;
+        c->message_capacity = 0;
+    }
+    
+#ifndef _WIN32
+    struct conv_pool *pool = conv_pool_get(1);
+    if (pool && pool->count < CONV_POOL_MAX) {
+        pool->slots[pool->count++] = c;
+        return;
+    }
+#endif
+    free(c->messages);
+    free(c);
+}
+
+/*
+ * Immutable settings shared by many conversations
+ * 'base' is a conversation holding only settings: new conversations start as a
+ * struct copy of it and borrow its strings instead of duplicating them
+ */
+struct ChatGPTClientConfig {
+    long refs;                   // Reference count (atomic)
+    ChatGPTConversation base;    // Settings template (owns api_key, model, base_url)
+    char *auth_header;           // Prebuilt "Authorization: Bearer ..." header
+    char *chat_url;              // Prebuilt chat completions URL
+};
+
+/*
+ * Is this setting string borrowed from the conversation's shared config?
+ */
+static int is_borrowed(const ChatGPTConversation *c, const char *s) {
+    const ChatGPTClientConfig *cfg = c->config;
+    return cfg && s && (s == cfg->base.api_key || s == cfg->base.model || s == cfg->base.base_url);
+}
+
+/*
+ * Free a setting string unless it belongs to the shared config
+ */
+static void free_setting(ChatGPTConversation *c, char *s) {
+    if (!is_borrowed(c, s)) free(s);
+}
+
+/*
+ * Setting value for dest taken from src: borrowed when both share the config it lives in
+ */
+static char *copy_setting(const ChatGPTConversation *dest, const ChatGPTConversation *src, char *s) {
+    if (dest->config && dest->config == src->config && is_borrowed(src, s)) return s;
+    return dup_str(s);
+}
+
+/*
+ * Create a new ChatGPT conversation instance
+ * This is the main constructor for the library - creates and initializes a conversation
+ * Usage: ChatGPTConversation *conv = chatgpt_conversation_new("sk-your-key", "gpt-4");
+ *        ChatGPTConversation *conv = chatgpt_conversation_new(NULL, NULL); // Uses global key and default model
+ * Parameters:
+ *   - api_key: OpenAI API key, or NULL to use global key
+ *   - model: Model name (e.g., "gpt-4", "gpt-3.5-turbo"), or NULL for default
+ * Returns: New conversation instance or NULL on error
+ */
+ChatGPTConversation *chatgpt_conversation_new(const char *api_key, const char *model) {
+    ChatGPTConversation *c;
+    
+    // Use global key if none provided
+    if (!api_key) api_key = g_api_key;
+    if (!api_key) return NULL;  // No key available
+    
+    // Allocate and initialize conversation structure
+    c = conv_alloc();
+    if (!c) return NULL;
+    
+    // Copy API key and model
+    c->api_key = dup_str(api_key);
+    c->model = dup_str(model ? model : DEFAULT_MODEL); 
+    
+    // Set default parameters
+    c->temperature = 0.7;       // Balanced creativity
+    c->top_p = 1.0;            // No nucleus sampling by default
+    c->max_tokens = 0;         // No token limit by default
+    c->presence_penalty = 0.0;  // No presence penalty by default
+    c->frequency_penalty = 0.0; // No frequency penalty by default
+    
+    // Set new default parameters
+    c->use_streaming = 1;      // Streaming enabled by default
+    c->context_messages = 5;   // Send last 5 messages by default
+    c->max_retries = 3;        // 3 retry attempts by default
+    c->retry_delay_ms = 1000;  // 1 second delay between retries
+    c->scrub_flags = g_scrub_flags; // Global scrubbing policy
+    
+    // Set default base URL for OpenAI API
+    c->base_url = dup_str(DEFAULT_BASE_URL);
+    
+    // Initialize other fields
+    c->last_reply = NULL;
+    c->last_error = NULL;
+    c->last_code = CHATGPT_OK;
+    c->last_http_code = 0;
+    
+    return c;
+}
+
+/*
+ * Free all resources associated with a ChatGPT conversation
+ * This cleans up all allocated memory and should be called for every conversation
+ * Usage: chatgpt_conversation_free(conversation); conversation = NULL; // Good practice to null the pointer
+ */
+void chatgpt_conversation_free(ChatGPTConversation *c) {
+    if (!c) return;
+    
+    // Free string fields (those borrowed from the shared config belong to it)
+    free_setting(c, c->api_key);
+    free_setting(c, c->model);
+    free_setting(c, c->base_url);
+    free(c->last_reply);
+    free(c->last_error);
+    free(c->template_json);
+    
+    // Free all messages (the array itself may be kept by the pool)
+    for (size_t i = 0; i < c->message_count; i++) {
+        msg_free(&c->messages[i]);
+    }
+    
+    // Drop the reference on the shared config
+    chatgpt_config_release(c->config);
+    
+    // Return the structure to this thread's pool, or free it
+    conv_recycle(c);
+}
+
+/*
+ * Copy all settings from one conversation to another
+ * Does not copy messages, only configuration settings
+ * Usage: chatgpt_conversation_copy_settings(dest_conv, src_conv);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_conversation_copy_settings(ChatGPTConversation *dest, const ChatGPTConversation *src) {
+    if (!dest || !src) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Copy model
+    if (src->model) {
+        char *new_model = copy_setting(dest, src, src->model);
+        if (!new_model) return CHATGPT_ERR_OOM;
+        free_setting(dest, dest->model);
+        dest->model = new_model;
+        delta_emit(dest, DELTA_MODEL, -1, new_model, strlen(new_model), NULL, 0);
+    }
+    
+    // Copy base URL
+    if (src->base_url) {
+        char *new_url = copy_setting(dest, src, src->base_url);
+        if (!new_url) return CHATGPT_ERR_OOM;
+        free_setting(dest, dest->base_url);
+        dest->base_url = new_url;
+    }
+    
+    // Copy numerical settings
+    dest->temperature = src->temperature;
+    dest->top_p = src->top_p;
+    dest->max_tokens = src->max_tokens;
+    dest->presence_penalty = src->presence_penalty;
+    dest->frequency_penalty = src->frequency_penalty;
+    dest->use_streaming = src->use_streaming;
+    dest->context_messages = src->context_messages;
+    dest->max_retries = src->max_retries;
+    dest->retry_delay_ms = src->retry_delay_ms;
+    dest->scrub_flags = src->scrub_flags;
+    dest->compress_min_bytes = src->compress_min_bytes;
+    dest->compress_keep_recent = src->compress_keep_recent;
+    dest->intern_min_bytes = src->intern_min_bytes;
+    dest->transport = src->transport;
+    dest->tenant = src->tenant;
+    dest->save_checksum = src->save_checksum;
+    dest->router = src->router;
+    dest->route_policy = src->route_policy;
+    delta_emit_params(dest);
+    
+    return CHATGPT_OK;
+}
+
+/*
+ * Freeze the settings of a template conversation into a shared, immutable config
+ * Configure the template with the usual setters first; its messages are not part of the config
+ * Usage: ChatGPTClientConfig *cfg = chatgpt_config_new(tmpl); chatgpt_conversation_free(tmpl);
+ * Returns: Config with one reference (release with chatgpt_config_release) or NULL on error
+ */
+ChatGPTClientConfig *chatgpt_config_new(const ChatGPTConversation *tmpl) {
+    if (!tmpl || !tmpl->api_key || !tmpl->model || !tmpl->base_url) return NULL;
+    
+    ChatGPTClientConfig *cfg = (ChatGPTClientConfig*)calloc(1, sizeof(*cfg));
+    if (!cfg) return NULL;
+    cfg->refs = 1;
+    
+    // Settings only: no messages, reply, error state or parent config
+    ChatGPTConversation *b = &cfg->base;
+    *b = *tmpl;
+    b->messages = NULL;
+    b->message_count = 0;
+    b->message_capacity = 0;
+    memset(&b->last_usage, 0, sizeof(b->last_usage));
+    b->last_reply = NULL;
+    b->template_json = NULL;
+    b->template_json_len = 0;
+    b->last_error = NULL;
+    b->last_code = CHATGPT_OK;
+    b->last_http_code = 0;
+    b->last_latency_ms = 0;
+    b->change_fn = NULL;
+    b->change_ud = NULL;
+    b->change_seq = 0;
+    b->routed_model = NULL;
+    b->config = NULL;
+    b->api_key = dup_str(tmpl->api_key);
+    b->model = dup_str(tmpl->model);
+    b->base_url = dup_str(tmpl->base_url);
+    
+    // Request pieces that only depend on these settings are built once here
+    size_t auth_len = strlen(tmpl->api_key) + 32;
+    size_t url_len = strlen(tmpl->base_url) + 32;
+    cfg->auth_header = (char*)malloc(auth_len);
+    cfg->chat_url = (char*)malloc(url_len);
+    if (!b->api_key || !b->model || !b->base_url || !cfg->auth_header || !cfg->chat_url) {
+        chatgpt_config_release(cfg);
+        return NULL;
+    }
+    snprintf(cfg->auth_header, auth_len, "Authorization: Bearer %s", b->api_key);
+    snprintf(cfg->chat_url, url_len, "%s/v1/chat/completions", b->base_url);
+    return cfg;
+}
+
+/*
+ * Take another reference on a shared config
+ * Usage: worker->cfg = chatgpt_config_retain(cfg);
+ * Returns: The same config
+ */
+ChatGPTClientConfig *chatgpt_config_retain(ChatGPTClientConfig *cfg) {
+    if (!cfg) return NULL;
+#ifdef _WIN32
+    InterlockedIncrement(&cfg->refs);
+#else
+    __atomic_add_fetch(&cfg->refs, 1, __ATOMIC_RELAXED);
+#endif
+    return cfg;
+}
+
+/*
+ * Drop a reference on a shared config, freeing it with the last one
+ * Conversations created from the config hold their own reference
+ * Usage: chatgpt_config_release(cfg);
+ */
+void chatgpt_config_release(ChatGPTClientConfig *cfg) {
+    if (!cfg) return;
+#ifdef _WIN32
+    if (InterlockedDecrement(&cfg->refs) != 0) return;
+#else
+    if (__atomic_sub_fetch(&cfg->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+#endif
+    
+    free(cfg->base.api_key);
+    free(cfg->base.model);
+    free(cfg->base.base_url);
+    free(cfg->auth_header);
+    free(cfg->chat_url);
+    free(cfg);
+}
+
+/*
+ * Create a conversation from a shared config
+ * At most one allocation (none when the thread's pool has an object): settings are copied
+ * by value and strings are borrowed from the config
+ * Setters still work on the conversation; a changed string becomes a private copy
+ * Usage: ChatGPTConversation *conv = chatgpt_conversation_new_from_config(cfg);
+ * Returns: New conversation instance or NULL on error
+ */
+ChatGPTConversation *chatgpt_conversation_new_from_config(ChatGPTClientConfig *cfg) {
+    if (!cfg) return NULL;
+    
+    ChatGPTConversation *c = conv_alloc();
+    if (!c) return NULL;
+    
+    // Keep the message array a pooled object brings along
+    ChatGPTMessage *msgs = c->messages;
+    size_t cap = c->message_capacity;
+    *c = cfg->base;
+    c->messages = msgs;
+    c->message_capacity = cap;
+    c->config = chatgpt_config_retain(cfg);
+    return c;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃          CLIENT LIFECYCLE MANAGEMENT          ┃
+┃          (Legacy Compatibility)               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Create a new ChatGPT client instance
+ * This is the main constructor for the library - creates and initializes a client
+ * Usage: ChatGPTClient *client = chatgpt_client_new("sk-your-key", "gpt-4");
+ *        ChatGPTClient *client = chatgpt_client_new(NULL, NULL); // Uses global key and default model
+ * Parameters:
+ *   - api_key: OpenAI API key, or NULL to use global key
+ *   - model: Model name (e.g., "gpt-4", "gpt-3.5-turbo"), or NULL for default
+ * Returns: New client instance or NULL on error
+ */
+/*
+ * Create a new ChatGPT client instance (legacy compatibility)
+ * This is an alias for the new conversation function
+ * Usage: ChatGPTClient *client = chatgpt_client_new("sk-your-key", "gpt-4");
+ *        ChatGPTClient *client = chatgpt_client_new(NULL, NULL); // Uses global key and default model
+ * Parameters:
+ *   - api_key: OpenAI API key, or NULL to use global key
+ *   - model: Model name (e.g., "gpt-4", "gpt-3.5-turbo"), or NULL for default
+ * Returns: New client instance or NULL on error
+ */
+ChatGPTClient *chatgpt_client_new(const char *api_key, const char *model) {
+    return chatgpt_conversation_new(api_key, model);
+}
+
+/*
+ * Free all resources associated with a ChatGPT client (legacy compatibility)
+ * This cleans up all allocated memory and should be called for every client
+ * Usage: chatgpt_client_free(client); client = NULL; // Good practice to null the pointer
+ */
+void chatgpt_client_free(ChatGPTClient *c) {
+    chatgpt_conversation_free(c);
+}
+
+/*
+ * Clear the last error state
+ * Resets error code to OK and clears error message
+ * Usage: chatgpt_clear_error(conversation); // After handling an error
+ */
+void chatgpt_clear_error(ChatGPTConversation *c) {
+    if (c) {
+        if (c->last_error) c->last_error[0] = '\0';
+        c->last_code = CHATGPT_OK;
+        c->last_http_code = 0;
+    }
+}
+
+/*
+ * Get the last error message as a string
+ * Usage: if (result != CHATGPT_OK) printf("Error: %s\n", chatgpt_last_error(conversation));
+ * Returns: Error message string (empty if no error, do not free this pointer)
+ */
+const char *chatgpt_last_error(const ChatGPTConversation *c) {
+    return c && c->last_error ? c->last_error : "";
+}
+
+/*
+ * Get the last error code
+ * Usage: ChatGPT_ErrorCode code = chatgpt_last_code(conversation);
+ * Returns: Error code enum value
+ */
+ChatGPT_ErrorCode chatgpt_last_code(const ChatGPTConversation *c) {
+    return c ? c->last_code : CHATGPT_ERR_INVALID_ARG;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃           CONVERSATION CONFIGURATION          ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Set the AI model to use for completions
+ * Common models: "gpt-4", "gpt-4-turbo", "gpt-3.5-turbo", "gpt-4o-mini"
+ * Usage: chatgpt_set_model(conversation, "gpt-4");
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_model(ChatGPTConversation *c, const char *m) {
+    if (!c || !m) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Create copy of new model name
+    char *d = dup_str(m);
+    if (!d) return CHATGPT_ERR_OOM;
+    
+    // Replace old model with new one
+    free_setting(c, c->model);
+    c->model = d;
+    delta_emit(c, DELTA_MODEL, -1, d, strlen(d), NULL, 0);
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the temperature parameter (controls randomness/creativity)
+ * Range: 0.0 to 2.0
+ * - 0.0: Very deterministic, same input → same output
+ * - 1.0: Balanced creativity
+ * - 2.0: Very creative/random
+ * Usage: chatgpt_set_temperature(conversation, 0.7);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_temperature(ChatGPTConversation *c, double v) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    if (v < 0 || v > 2) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->temperature = v;
+    delta_emit_params(c);
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the top_p parameter (nucleus sampling)
+ * Range: 0.0 to 1.0 (exclusive of 0.0)
+ * Controls diversity by considering only the top percentage of probable tokens
+ * - 0.1: Very focused, only most likely tokens
+ * - 1.0: Consider all tokens
+ * Usage: chatgpt_set_top_p(conversation, 0.9);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_top_p(ChatGPTConversation *c, double v) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    if (v <= 0 || v > 1) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->top_p = v;
+    delta_emit_params(c);
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the presence penalty parameter
+ * Range: -2.0 to 2.0 (default: 0.0)
+ * Positive values penalize tokens that have already appeared in the text so far,
+ * encouraging the model to introduce new topics and avoid repetition.
+ * - 0.0: No penalty (default)
+ * - Positive values: Discourage repetition of topics/words that already appeared
+ * - Negative values: Encourage repetition of topics/words that already appeared
+ * 
+ * Key behavior: Penalizes ANY occurrence of a word/topic that already appeared.
+ * If a word appeared once, the model will be "reluctant" to repeat it.
+ * This causes the model to introduce new ideas to the text.
+ * 
+ * Usage: chatgpt_set_presence_penalty(conversation, 0.6); // Encourage diverse content
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_presence_penalty(ChatGPTConversation *c, double v) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    if (v < -2.0 || v > 2.0) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->presence_penalty = v;
+    delta_emit_params(c);
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the frequency penalty parameter  
+ * Range: -2.0 to 2.0 (default: 0.0)
+ * Positive values penalize tokens based on their frequency in the text so far,
+ * with higher penalties for more frequently used words.
+ * - 0.0: No penalty (default)
+ * - Positive values: Reduce repetitive word usage proportionally to frequency
+ * - Negative values: Encourage repetitive word usage proportionally to frequency
+ * 
+ * Key behavior: Penalizes repetition based on HOW MANY TIMES it occurred.
+ * If a word repeats many times, the penalty grows.
+ * This doesn't prevent repetition completely, but spreads word usage more evenly.
+ * 
+ * Usage: chatgpt_set_frequency_penalty(conversation, 0.3); // Reduce word repetition
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_frequency_penalty(ChatGPTConversation *c, double v) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    if (v < -2.0 || v > 2.0) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->frequency_penalty = v;
+    delta_emit_params(c);
+    return CHATGPT_OK;
+}
+
+/*
+ * Set maximum tokens for the completion
+ * Limits the length of the AI's response
+ * - 0: No limit (uses model's default)
+ * - Positive number: Maximum tokens to generate
+ * Usage: chatgpt_set_max_tokens(conversation, 150); // Limit to 150 tokens
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_max_tokens(ChatGPTConversation *c, int n) {
+    if (!c || n < 0) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->max_tokens = n;
+    delta_emit_params(c);
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the base URL for API requests
+ * Allows using alternative OpenAI-compatible endpoints
+ * Default: "https://api.openai.com"
+ * Usage: chatgpt_set_base_url(conversation, "https://my-custom-api.com");
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_base_url(ChatGPTConversation *c, const char *u) {
+    if (!c || !u) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Create copy of new URL
+    char *d = dup_str(u);
+    if (!d) return CHATGPT_ERR_OOM;
+    
+    // Replace old URL with new one
+    free_setting(c, c->base_url);
+    c->base_url = d;
+    return CHATGPT_OK;
+}
+
+/*
+ * Enable or disable streaming mode
+ * 1 = streaming mode (default), 0 = complete response at once
+ * Usage: chatgpt_set_streaming(conversation, 1); // Enable streaming
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_streaming(ChatGPTConversation *c, int use_streaming) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->use_streaming = use_streaming ? 1 : 0;
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the number of recent messages to include in API requests
+ * 0 = only last message, positive number = number of recent messages
+ * Default: 5
+ * Usage: chatgpt_set_context_messages(conversation, 10); // Send last 10 messages
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_context_messages(ChatGPTConversation *c, int context_messages) {
+    if (!c || context_messages < 0) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->context_messages = context_messages;
+    return CHATGPT_OK;
+}
+
+/*
+ * Set retry configuration for failed requests
+ * max_retries: Maximum number of retry attempts (default: 3)
+ * delay_ms: Delay between retries in milliseconds (default: 1000)
+ * Usage: chatgpt_set_retry_config(conversation, 5, 2000); // 5 retries, 2 second delay
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_retry_config(ChatGPTConversation *c, int max_retries, int delay_ms) {
+    if (!c || max_retries < 0 || delay_ms < 0) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->max_retries = max_retries;
+    c->retry_delay_ms = delay_ms;
+    return CHATGPT_OK;
+}
+
+/*
+ * Enable outbound scrubbing of secrets and PII for this conversation
+ * The request body is masked after serialization, stored messages stay intact
+ * Usage: chatgpt_set_scrubbing(conversation, CHATGPT_SCRUB_ALL);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_scrubbing(ChatGPTConversation *c, unsigned flags) {
+    if (!c || (flags & ~(unsigned)CHATGPT_SCRUB_ALL)) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->scrub_flags = flags;
+    delta_emit_params(c);
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the scrubbing flags inherited by every conversation created afterwards
+ * Existing conversations keep their current setting
+ * Usage: chatgpt_set_scrubbing_global(CHATGPT_SCRUB_ALL);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_scrubbing_global(unsigned flags) {
+    if (flags & ~(unsigned)CHATGPT_SCRUB_ALL) return CHATGPT_ERR_INVALID_ARG;
+    
+    g_scrub_flags = flags;
+    return CHATGPT_OK;
+}
+
+/*
+ * Set the tenant this conversation's requests are scheduled as (see chatgpt_transport_fair_new)
+ * Usage: chatgpt_set_tenant(conversation, 42);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_tenant(ChatGPTConversation *c, unsigned tenant) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->tenant = tenant;
+    return CHATGPT_OK;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃              MESSAGE MANAGEMENT               ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Append a message given as role[0..rn) and content[0..cn) (neither may contain NUL bytes)
+ * Internal function behind chatgpt_add_message and the decoders
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+static int add_message_n(ChatGPTConversation *c, const char *role, size_t rn, const char *content, size_t cn) {
+    int r;
+    char *r1;
+    
+    // Ensure we have capacity for one more message
+    r = ensure_cap(c, c->message_count + 1);
+    if (r) return r;
+    
+    // Copy the role; the content is copied or shared per the interning policy
+    ChatGPTMessage *m = &c->messages[c->message_count];
+    r1 = (char*)malloc(rn + 1);
+    if (!r1 || msg_set_content_n(m, content, cn, c->intern_min_bytes) != CHATGPT_OK) {
+        free(r1);
+        return CHATGPT_ERR_OOM;
+    }
+    memcpy(r1, role, rn);
+    r1[rn] = '\0';
+    
+    // Add message to array
+    m->role = r1;
+    m->packed = NULL;
+    c->message_count++;
+    delta_emit(c, DELTA_ADD, -1, role, rn, content, cn);
+    
+    // Older messages may now fall under the compression policy
+    compress_aged(c);
+    
+    return CHATGPT_OK;
+}
+
+/*
+ * Add a message to the conversation with specified role and content
+ * This is the core function for building conversations
+ * Usage: chatgpt_add_message(client, "user", "Hello, how are you?");
+ *        chatgpt_add_message(client, "assistant", "I'm doing well, thank you!");
+ * Parameters:
+ *   - role: "user", "assistant", or "system"
+ *   - content: The message text
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_add_message(ChatGPTConversation *c, const char *role, const char *content) {
+    if (!c || !role || !content) return CHATGPT_ERR_INVALID_ARG;
+    return add_message_n(c, role, strlen(role), content, strlen(content));
+}
+
+/*
+ * Add a user message to the conversation
+ * Convenience function equivalent to chatgpt_add_message(conversation, "user", text)
+ * Usage: chatgpt_add_user(conversation, "What's the weather like today?");
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_add_user(ChatGPTConversation *c, const char *t) {
+    return chatgpt_add_message(c, "user", t);
+}
+
+/*
+ * Add a system message to the conversation
+ * System messages set the behavior and context for the AI
+ * Usage: chatgpt_add_system(client, "You are a helpful coding assistant.");
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_add_system(ChatGPTClient *c, const char *t) {
+    return chatgpt_add_message(c, "system", t);
+}
+
+/*
+ * Add an assistant message to the conversation
+ * Useful for providing examples or continuing a conversation
+ * Usage: chatgpt_add_assistant(client, "I'd be happy to help with that!");
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_add_assistant(ChatGPTClient *c, const char *t) {
+    return chatgpt_add_message(c, "assistant", t);
+}
+
+/*
+ * Clear all messages from the conversation
+ * Removes all messages but keeps configuration settings
  * Usage: chatgpt_clear_messages(client); // Start fresh conversation
  * Returns: CHATGPT_OK on success, error code on failure
  */
-int chatgpt_clear_messages(ChatGPTClient *c) {
-    if (!c) return CHATGPT_ERR_INVALID_ARG;
+int chatgpt_clear_messages(ChatGPTClient *c) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Free all message content
+    for (size_t i = 0; i < c->message_count; i++) {
+        msg_free(&c->messages[i]);
+    }
+    
+    // Reset message count
+    c->message_count = 0;
+    delta_emit(c, DELTA_CLEAR, -1, NULL, 0, NULL, 0);
+    return CHATGPT_OK;
+}
+
+/*
+ * Get the number of messages in the conversation
+ * Usage: int count = chatgpt_get_message_count(client);
+ * Returns: Number of messages, or 0 if client is NULL
+ */
+int chatgpt_get_message_count(const ChatGPTClient *c) {
+    return c ? (int)c->message_count : 0;
+}
+
+/*
+ * Remove the last message from the conversation
+ * Useful for undoing the last message addition
+ * Usage: chatgpt_pop_last_message(client); // Remove most recent message
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_pop_last_message(ChatGPTClient *c) {
+    if (!c || c->message_count == 0) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Get index of last message
+    size_t i = c->message_count - 1;
+    
+    // Free the message content
+    msg_free(&c->messages[i]);
+    
+    // Decrease count
+    c->message_count--;
+    delta_emit(c, DELTA_REMOVE, (int64_t)i, NULL, 0, NULL, 0);
+    return CHATGPT_OK;
+}
+
+/*
+ * Remove a message at a specific index
+ * All messages after the removed one will shift down by one position
+ * Usage: chatgpt_remove_message_at(client, 2); // Remove the third message (0-indexed)
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_remove_message_at(ChatGPTClient *c, size_t idx) {
+    if (!c || idx >= c->message_count) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Free the message at the specified index
+    msg_free(&c->messages[idx]);
+    
+    // Shift all subsequent messages down
+    for (size_t i = idx + 1; i < c->message_count; i++) {
+        c->messages[i - 1] = c->messages[i];
+    }
+    
+    // Decrease count
+    c->message_count--;
+    delta_emit(c, DELTA_REMOVE, (int64_t)idx, NULL, 0, NULL, 0);
+    return CHATGPT_OK;
+}
+
+/*
+ * Replace the content of message i with text[0..n)
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+static int msg_replace(ChatGPTConversation *c, size_t i, const char *text, size_t n) {
+    ChatGPTMessage *m = &c->messages[i];
+    ChatGPTMessage fresh = { NULL, NULL, NULL, NULL };
+    if (msg_set_content_n(&fresh, text, n, c->intern_min_bytes) != CHATGPT_OK) return CHATGPT_ERR_OOM;
+    
+    msg_drop_content(m);
+    m->content = fresh.content;
+    m->interned = fresh.interned;
+    delta_emit(c, DELTA_REPLACE, (int64_t)i, text, n, NULL, 0);
+    return CHATGPT_OK;
+}
+
+/*
+ * Append text[0..n) to the content of message i
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+static int msg_append(ChatGPTConversation *c, size_t i, const char *text, size_t n) {
+    ChatGPTMessage *m = &c->messages[i];
+    if (msg_unpack(m) != CHATGPT_OK || msg_own(m) != CHATGPT_OK) return CHATGPT_ERR_OOM;
+    size_t a = m->content ? strlen(m->content) : 0;
+    
+    // Reallocate content to fit additional text
+    char *p = (char*)realloc(m->content, a + n + 1);
+    if (!p) return CHATGPT_ERR_OOM;
+    
+    // Append new text
+    memcpy(p + a, text, n);
+    p[a + n] = '\0';
+    m->content = p;
+    delta_emit(c, DELTA_APPEND, (int64_t)i, text, n, NULL, 0);
+    return CHATGPT_OK;
+}
+
+/*
+ * Replace the content of the last user message
+ * Searches backwards to find the most recent user message and replaces its content
+ * Usage: chatgpt_replace_last_user(client, "Actually, let me ask something else...");
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE if no user message found
+ */
+int chatgpt_replace_last_user(ChatGPTClient *c, const char *txt) {
+    if (!c || !txt) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Search backwards for the last user message
+    for (size_t i = c->message_count; i > 0; i--) {
+        ChatGPTMessage *m = &c->messages[i - 1];
+        if (m->role && strcmp(m->role, "user") == 0) {
+            // Found user message, replace content
+            return msg_replace(c, i - 1, txt, strlen(txt));
+        }
+    }
+    
+    // No user message found
+    return CHATGPT_ERR_STATE;
+}
+
+/*
+ * Append text to the last assistant message
+ * Useful for building up responses incrementally
+ * Usage: chatgpt_append_to_last_assistant(client, " Additional information...");
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE if no assistant message found
+ */
+int chatgpt_append_to_last_assistant(ChatGPTClient *c, const char *extra) {
+    if (!c || !extra) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Search backwards for the last assistant message
+    for (size_t i = c->message_count; i > 0; i--) {
+        ChatGPTMessage *m = &c->messages[i - 1];
+        if (m->role && strcmp(m->role, "assistant") == 0) {
+            // Found assistant message, append to content
+            return msg_append(c, i - 1, extra, strlen(extra));
+        }
+    }
+    
+    // No assistant message found
+    return CHATGPT_ERR_STATE;
+}
+
+/*
+ * Reset the client to a clean state
+ * Clears messages, usage statistics, last reply, and errors
+ * Keeps configuration settings (model, temperature, etc.)
+ * Usage: chatgpt_reset(client); // Start completely fresh
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_reset(ChatGPTClient *c) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Clear all messages, template messages included
+    chatgpt_clear_messages(c);
+    chatgpt_set_template(c, NULL, NULL);
+    
+    // Reset usage statistics
+    c->last_usage.prompt_tokens = 0;
+    c->last_usage.completion_tokens = 0;
+    c->last_usage.total_tokens = 0;
+    c->last_latency_ms = 0;
+    c->routed_model = NULL;
+    
+    // Clear last reply
+    free(c->last_reply);
+    c->last_reply = NULL;
+    
+    // Clear error state
+    chatgpt_clear_error(c);
+    
+    return CHATGPT_OK;
+}
+
+/*
+ * Create a JSON dump of all messages (alias for chatgpt_build_messages_json)
+ * Usage: char *json = chatgpt_dump_messages(client); free(json); // Remember to free
+ * Returns: JSON string or NULL on error
+ */
+char *chatgpt_dump_messages(ChatGPTClient *c) {
+    return chatgpt_build_messages_json(c);
+}
+
+/*
+ * Print all messages to a file stream for debugging
+ * Useful for inspecting conversation state
+ * Usage: chatgpt_print_messages(client, stdout); // Print to console
+ *        chatgpt_print_messages(client, debug_file); // Print to file
+ */
+void chatgpt_print_messages(ChatGPTClient *c, FILE *out) {
+    if (!c) return;
+    if (!out) out = stdout;
+    
+    // Print each message with index, role, and content
+    for (size_t i = 0; i < c->message_count; i++) {
+        char *tmp;
+        const char *text = msg_text(&c->messages[i], &tmp);
+        fprintf(out, "%zu %s: %s\n", 
+                i, 
+                c->messages[i].role ? c->messages[i].role : "?",
+                text ? text : "");
+        free(tmp);
+    }
+}
+
+/*
+ * Get the last reply from the AI (cached)
+ * This is the complete response from the most recent API call
+ * Usage: const char *reply = chatgpt_last_reply(client); // Do not free this pointer
+ * Returns: Last reply string or NULL if no reply yet
+ */
+const char *chatgpt_last_reply(ChatGPTClient *c) {
+    return c ? c->last_reply : NULL;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃           CONVERSATION PERSISTENCE            ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Saved files are the messages JSON. With chatgpt_set_save_checksum() a checksum line,
+ * "#crc32c:xxxxxxxx\n", covering every byte before it follows (the file is then no longer
+ * plain JSON). Files are written to a temporary name, flushed to disk and renamed over
+ * the target, so a crash leaves either the old or the new file, never a torn one. Files
+ * with a checksum line are verified on load; files without one load as they are
+ */
+#define CRC_TRAILER "#crc32c:"
+#define CRC_TRAILER_LEN 17      // "#crc32c:" + 8 hex digits + '\n'
+
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78), one byte at a time
+static const uint32_t crc32c_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t n) {
+    while (n--) crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#if CHATGPT_CRC32C_SSE42
+/*
+ * CRC32C with the SSE4.2 crc32 instruction, eight bytes per step
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t n) {
+    uint64_t c = crc;
+    for (; n && ((uintptr_t)p & 7); n--) c = _mm_crc32_u8((uint32_t)c, *p++);
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; n; n--) c = _mm_crc32_u8((uint32_t)c, *p++);
+    return (uint32_t)c;
+}
+#endif
+
+/*
+ * CRC32C of a buffer, using the CPU's crc32 instruction when it has one
+ */
+static uint32_t crc32c(const void *data, size_t n) {
+    const unsigned char *p = (const unsigned char*)data;
+    uint32_t crc = 0xffffffffu;
+    
+#if CHATGPT_CRC32C_SSE42
+    if (__builtin_cpu_supports("sse4.2")) return ~crc32c_sse42(crc, p, n);
+#elif defined(__ARM_FEATURE_CRC32)
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    for (; n; n--) crc = __crc32cb(crc, *p++);
+    return ~crc;
+#endif
+    return ~crc32c_sw(crc, p, n);
+}
+
+/*
+ * Write a file atomically: temporary file in the same directory, flushed to disk, renamed over path
+ * The new file keeps the permissions of the one it replaces; new files are created 0600
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_IO (or CHATGPT_ERR_OOM) on failure
+ */
+static int write_file_atomic(const char *path, const char *data, size_t len) {
+    static unsigned long seq;
+    size_t tlen = strlen(path) + 48;
+    char *tmp = (char*)malloc(tlen);
+    if (!tmp) return CHATGPT_ERR_OOM;
+    int ok;
+    
+#ifdef _WIN32
+    snprintf(tmp, tlen, "%s.tmp.%lu.%ld", path, (unsigned long)GetCurrentProcessId(),
+             (long)InterlockedIncrement((LONG volatile*)&seq));
+    FILE *f = fopen(tmp, "wb");
+    ok = f != NULL;
+    if (f) {
+        ok = fwrite(data, 1, len, f) == len && fflush(f) == 0 && _commit(_fileno(f)) == 0;
+        if (fclose(f) != 0) ok = 0;
+    }
+    ok = ok && MoveFileExA(tmp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    struct stat st;
+    mode_t mode = stat(path, &st) == 0 ? (st.st_mode & 07777) : 0600;
+    
+    // Exclusive create: a leftover or planted file of the same name is never reused
+    int fd = -1;
+    for (int tries = 0; fd < 0 && tries < 8; tries++) {
+        snprintf(tmp, tlen, "%s.tmp.%ld.%lu", path, (long)getpid(), __atomic_add_fetch(&seq, 1, __ATOMIC_RELAXED));
+        fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0 && errno != EEXIST) break;
+    }
+    if (fd < 0) {
+        free(tmp);
+        return CHATGPT_ERR_IO;
+    }
+    ok = fchmod(fd, mode) == 0;
+    for (size_t off = 0; ok && off < len; ) {
+        ssize_t w = write(fd, data + off, len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) ok = 0;
+        else off += (size_t)w;
+    }
+    if (ok && fsync(fd) != 0) ok = 0;
+    if (close(fd) != 0) ok = 0;
+    ok = ok && rename(tmp, path) == 0;
+    
+    // Make the rename itself durable (best effort: not every filesystem allows it)
+    if (ok) {
+        const char *slash = strrchr(path, '/');
+        char dir[1024];
+        snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) + 1 : 1, slash ? path : ".");
+        int dfd = open(dir, O_RDONLY);
+        if (dfd >= 0) {
+            fsync(dfd);
+            close(dfd);
+        }
+    }
+#endif
+    if (!ok) remove(tmp);
+    free(tmp);
+    return ok ? CHATGPT_OK : CHATGPT_ERR_IO;
+}
+
+/*
+ * Read a whole file into a NUL-terminated buffer
+ * Returns: the buffer (caller frees) with its length in *len, or NULL (*rc says why)
+ */
+static char *read_file(const char *path, size_t *len, int *rc) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        *rc = CHATGPT_ERR_IO;
+        return NULL;
+    }
+    
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = sz >= 0 ? (char*)malloc((size_t)sz + 1) : NULL;
+    if (!buf) {
+        fclose(f);
+        *rc = sz < 0 ? CHATGPT_ERR_IO : CHATGPT_ERR_OOM;
+        return NULL;
+    }
+    
+    *len = fread(buf, 1, (size_t)sz, f);
+    buf[*len] = '\0';
+    int bad = ferror(f) || *len != (size_t)sz;
+    fclose(f);
+    if (bad) {
+        free(buf);
+        *rc = CHATGPT_ERR_IO;
+        return NULL;
+    }
+    return buf;
+}
+
+/*
+ * Check a buffer's checksum line
+ * Returns: 1 if it matches, 0 if it does not, -1 if there is none; *body gets the checksummed length
+ */
+static int crc_check(const char *buf, size_t len, size_t *body) {
+    *body = len;
+    if (len < CRC_TRAILER_LEN) return -1;
+    
+    const char *t = buf + len - CRC_TRAILER_LEN;
+    if (memcmp(t, CRC_TRAILER, 8) != 0 || t[CRC_TRAILER_LEN - 1] != '\n') return -1;
+    
+    char hex[9];
+    memcpy(hex, t + 8, 8);
+    hex[8] = '\0';
+    char *end;
+    unsigned long want = strtoul(hex, &end, 16);
+    if (end != hex + 8) return -1;
+    
+    *body = len - CRC_TRAILER_LEN;
+    return crc32c(buf, *body) == (uint32_t)want;
+}
+
+/*
+ * Replace a conversation's messages with those of a JSON messages array
+ * Entries without string role and content are skipped
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_JSON_PARSE if the text is not an array
+ */
+static int set_messages_json(ChatGPTConversation *c, const char *json, size_t len) {
+    // Parse JSON
+    cJSON *arr = cJSON_ParseWithLength(json, len);
+    if (!arr) return CHATGPT_ERR_JSON_PARSE;
+    
+    // Verify it's an array
+    if (!cJSON_IsArray(arr)) {
+        cJSON_Delete(arr);
+        return CHATGPT_ERR_JSON_PARSE;
+    }
+    
+    // Clear existing messages
+    chatgpt_clear_messages(c);
+    
+    // Add each message from JSON
+    cJSON *it = NULL;
+    cJSON_ArrayForEach(it, arr) {
+        cJSON *r = cJSON_GetObjectItem(it, "role");
+        cJSON *t = cJSON_GetObjectItem(it, "content");
+        
+        if (r && t && cJSON_IsString(r) && cJSON_IsString(t)) {
+            chatgpt_add_message(c, r->valuestring, t->valuestring);
+        }
+    }
+    
+    cJSON_Delete(arr);
+    return CHATGPT_OK;
+}
+
+/*
+ * Save the current conversation to a JSON file
+ * Saves only the messages array, not configuration settings, plus a checksum line when
+ * enabled with chatgpt_set_save_checksum()
+ * The file is replaced atomically: readers and crashes see the old or the new version
+ * Usage: chatgpt_save_conversation(client, "my_chat.json");
+ * Returns: CHATGPT_OK on success, error code on failure (CHATGPT_ERR_IO if the file cannot be written)
+ */
+int chatgpt_save_conversation(ChatGPTClient *c, const char *path) {
+    if (!c || !path) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Build JSON representation of messages
+    char *j = chatgpt_build_messages_json(c);
+    if (!j) return CHATGPT_ERR_OOM;
+    
+    // Append the newline and checksum line
+    size_t n = strlen(j);
+    if (c->save_checksum) {
+        char *d = (char*)realloc(j, n + 1 + CRC_TRAILER_LEN + 1);
+        if (!d) {
+            free(j);
+            return CHATGPT_ERR_OOM;
+        }
+        j = d;
+        j[n++] = '\n';
+        snprintf(j + n, CRC_TRAILER_LEN + 1, CRC_TRAILER "%08x\n", (unsigned)crc32c(j, n));
+        n += CRC_TRAILER_LEN;
+    }
+    
+    int rc = write_file_atomic(path, j, n);
+    free(j);
+    if (rc == CHATGPT_ERR_IO) set_error(c, rc, "Cannot write conversation file");
+    return rc;
+}
+
+/*
+ * Check a saved conversation file's checksum without parsing it
+ * Only files saved with chatgpt_set_save_checksum() enabled carry one
+ * Usage: if (chatgpt_verify_conversation_file("my_chat.json") != CHATGPT_OK) restore_backup();
+ * Returns: CHATGPT_OK if intact, CHATGPT_ERR_IO if unreadable, corrupt or without a checksum
+ */
+int chatgpt_verify_conversation_file(const char *path) {
+    if (!path) return CHATGPT_ERR_INVALID_ARG;
+    
+    size_t len, body;
+    int rc;
+    char *buf = read_file(path, &len, &rc);
+    if (!buf) return rc;
+    rc = crc_check(buf, len, &body) == 1 ? CHATGPT_OK : CHATGPT_ERR_IO;
+    free(buf);
+    return rc;
+}
+
+/*
+ * Load a conversation from a JSON file
+ * Replaces current messages with those from the file
+ * A file with a checksum line is verified first; one that fails is rejected untouched
+ * Usage: chatgpt_load_conversation(client, "my_chat.json");
+ * Returns: CHATGPT_OK on success, error code on failure (CHATGPT_ERR_IO if unreadable or corrupt)
+ */
+int chatgpt_load_conversation(ChatGPTClient *c, const char *path) {
+    if (!c || !path) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Read entire file into buffer
+    size_t len, body;
+    int rc;
+    char *buf = read_file(path, &len, &rc);
+    if (!buf) {
+        if (rc == CHATGPT_ERR_IO) set_error(c, rc, "Cannot read conversation file");
+        return rc;
+    }
+    
+    // Verify the checksum when there is one
+    if (crc_check(buf, len, &body) == 0) {
+        free(buf);
+        set_error(c, CHATGPT_ERR_IO, "Conversation file is corrupt (checksum mismatch)");
+        return CHATGPT_ERR_IO;
+    }
+    
+    rc = set_messages_json(c, buf, body);
+    free(buf);
+    return rc;
+}
+
+/*
+ * Choose whether saved files end with a CRC32C checksum line
+ * The line lets chatgpt_load_conversation() and chatgpt_verify_conversation_file() detect
+ * corruption, but other JSON tools will no longer parse the file
+ * Usage: chatgpt_set_save_checksum(conversation, 1);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_save_checksum(ChatGPTClient *c, int enabled) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->save_checksum = enabled != 0;
+    return CHATGPT_OK;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃              OUTBOUND SCRUBBING               ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Character classes used by the scrubber, one byte per input character
+ * The table is the whole "compiled" pattern set: every matcher below only
+ * tests class bits, so a body is scanned once with no per-pattern pass
+ */
+#define SC_DIGIT   0x01  // 0-9
+#define SC_ALPHA   0x02  // A-Z a-z
+#define SC_KEY     0x04  // Characters allowed in secret keys: alnum _ -
+#define SC_LOCAL   0x08  // Characters allowed in an e-mail local part: alnum . _ % + -
+#define SC_DOMAIN  0x10  // Characters allowed in an e-mail domain: alnum . -
+#define SC_TRIGGER 0x20  // Bytes that can anchor a match: digits, '-' (of "sk-") and '@'
+
+static const unsigned char scrub_class[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0x3c, 0x18, 0x00,
+    0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x20, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e,
+    0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x0c,
+    0x00, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e,
+    0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+#define SC_IS(ch, cls) (scrub_class[(unsigned char)(ch)] & (cls))
+#define SC_WORD (SC_DIGIT | SC_ALPHA)
+
+#define SCRUB_MIN_KEY_CHARS  20  // Characters after "sk-" before a token counts as a key
+#define SCRUB_MAX_LOCAL      64  // Longest e-mail local part considered
+#define SCRUB_MAX_DOMAIN    255  // Longest e-mail domain considered
+
+/*
+ * Word-at-a-time prefilter (SWAR)
+ * Tests 8 bytes at once for '@', '-' or an ASCII digit so that plain text
+ * is skipped without a per-byte table lookup
+ */
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_HAS_ZERO(x) (((x) - SWAR_ONES) & ~(x) & SWAR_HIGHS)
+#define SWAR_HAS_BYTE(x, b) SWAR_HAS_ZERO((x) ^ (SWAR_ONES * (uint64_t)(b)))
+#define SWAR_HAS_BETWEEN(x, m, n) \
+    (((SWAR_ONES * (127 + (uint64_t)(n)) - ((x) & (SWAR_ONES * 127))) & ~(x) & \
+      (((x) & (SWAR_ONES * 127)) + SWAR_ONES * (127 - (uint64_t)(m)))) & SWAR_HIGHS)
+
+static int scrub_word_has_trigger(uint64_t w) {
+    return (SWAR_HAS_BYTE(w, '@') | SWAR_HAS_BYTE(w, '-') | SWAR_HAS_BETWEEN(w, '0' - 1, '9' + 1)) != 0;
+}
+
+/*
+ * Check whether a JSON escape sequence ends exactly at position 'pos'
+ * Needed because the bytes right after a backslash ("\n", "é") look like word characters
+ */
+static int scrub_escape_ends_at(const char *buf, size_t pos) {
+    size_t k, run;
+    
+    // Two-byte escapes: \n \t \" ...
+    if (pos >= 2 && buf[pos - 2] == '\\') {
+        k = pos - 2;
+    } else if (pos >= 6 && buf[pos - 6] == '\\' && buf[pos - 5] == 'u') {
+        k = pos - 6;  // Six-byte escape: \uXXXX
+    } else {
+        return 0;
+    }
+    
+    // The backslash only starts an escape if it is not itself escaped
+    run = 0;
+    while (k > 0 && buf[k - 1] == '\\') { k--; run++; }
+    return (run % 2) == 0;
+}
+
+/*
+ * Check that a match may start at 'pos' (no word character glued in front)
+ */
+static int scrub_boundary_before(const char *buf, size_t pos) {
+    return pos == 0 || !SC_IS(buf[pos - 1], SC_WORD) || scrub_escape_ends_at(buf, pos);
+}
+
+/*
+ * Mask a span with '*'
+ */
+static void scrub_mask(char *buf, size_t from, size_t to) {
+    memset(buf + from, '*', to - from);
+}
+
+/*
+ * Match "sk-" followed by at least SCRUB_MIN_KEY_CHARS key characters
+ * 'dash' is the position of the '-' in "sk-"
+ * Returns: Position to continue scanning from
+ */
+static size_t scrub_api_key(char *buf, size_t len, size_t dash, size_t *hits) {
+    size_t e = dash + 1;
+    
+    if (dash < 2 || buf[dash - 2] != 's' || buf[dash - 1] != 'k') return dash + 1;
+    if (!scrub_boundary_before(buf, dash - 2)) return dash + 1;
+    
+    while (e < len && SC_IS(buf[e], SC_KEY)) e++;
+    if (e - (dash + 1) < SCRUB_MIN_KEY_CHARS) return e;
+    
+    // Keep the "sk-" prefix so redacted logs still show what kind of secret was there
+    scrub_mask(buf, dash + 1, e);
+    (*hits)++;
+    return e;
+}
+
+/*
+ * Match an e-mail address around the '@' at position 'at'
+ * Returns: Position to continue scanning from
+ */
+static size_t scrub_email(char *buf, size_t len, size_t at, size_t *hits) {
+    size_t s = at, e = at + 1, last_dot = 0, tld;
+    
+    // Local part: walk backwards
+    while (s > 0 && at - s < SCRUB_MAX_LOCAL && SC_IS(buf[s - 1], SC_LOCAL)) s--;
+    
+    // Never eat the tail of an escape sequence such as "\n" or "é"
+    if (s > 0 && buf[s - 1] == '\\' && scrub_escape_ends_at(buf, s + 1)) {
+        s += (buf[s] == 'u') ? 5 : 1;
+    }
+    if (s >= at) return at + 1;
+    
+    // Domain: walk forwards, remember the last dot
+    while (e < len && e - at <= SCRUB_MAX_DOMAIN && SC_IS(buf[e], SC_DOMAIN)) {
+        if (buf[e] == '.') last_dot = e;
+        e++;
+    }
+    
+    // Drop a trailing sentence dot ("mail me at a@b.com.")
+    while (e > at + 1 && buf[e - 1] == '.') {
+        e--;
+        if (last_dot == e) {
+            last_dot = 0;
+            for (size_t k = at + 1; k < e; k++) if (buf[k] == '.') last_dot = k;
+        }
+    }
+    
+    // Require "x.yy" at least: a dot that is not first and a 2+ letter TLD
+    if (!last_dot || last_dot == at + 1) return at + 1;
+    for (tld = last_dot + 1; tld < e && SC_IS(buf[tld], SC_ALPHA); tld++) {}
+    if (tld != e || e - last_dot - 1 < 2) return at + 1;
+    
+    scrub_mask(buf, s, at);
+    scrub_mask(buf, at + 1, e);
+    (*hits)++;
+    return e;
+}
+
+/*
+ * Match a card number starting at digit position 's'
+ * Digits may be grouped with single spaces or dashes and must pass the Luhn check
+ * Returns: Position to continue scanning from (always past the digit run)
+ */
+static size_t scrub_card(char *buf, size_t len, size_t s, size_t *hits) {
+    size_t e = s, digits = 0;
+    
+    if (!scrub_boundary_before(buf, s)) {
+        while (e < len && SC_IS(buf[e], SC_DIGIT)) e++;
+        return e;
+    }
+    
+    // Collect the digit run, allowing one separator between groups
+    while (e < len && digits <= 19) {
+        if (SC_IS(buf[e], SC_DIGIT)) {
+            digits++;
+            e++;
+        } else if ((buf[e] == ' ' || buf[e] == '-') && e + 1 < len && SC_IS(buf[e + 1], SC_DIGIT)) {
+            e++;
+        } else {
+            break;
+        }
+    }
+    
+    if (digits < 13 || digits > 19 || (e < len && SC_IS(buf[e], SC_WORD))) {
+        while (e < len && SC_IS(buf[e], SC_DIGIT)) e++;
+        return e;
+    }
+    
+    // Luhn checksum, walking right to left
+    unsigned sum = 0, dbl = 0;
+    for (size_t k = e; k > s; k--) {
+        char ch = buf[k - 1];
+        if (!SC_IS(ch, SC_DIGIT)) continue;
+        unsigned d = (unsigned)(ch - '0');
+        if (dbl) { d *= 2; if (d > 9) d -= 9; }
+        sum += d;
+        dbl = !dbl;
+    }
+    if (sum % 10 != 0) return e;
+    
+    // Mask digits only, separators keep the original grouping visible
+    for (size_t k = s; k < e; k++) {
+        if (SC_IS(buf[k], SC_DIGIT)) buf[k] = '*';
+    }
+    (*hits)++;
+    return e;
+}
+
+/*
+ * Mask secrets and PII in a buffer in place
+ * Single pass: the SWAR prefilter skips plain text, trigger bytes dispatch to
+ * the matcher for their pattern. Masking keeps the length unchanged, so a
+ * serialized JSON body can be scrubbed without re-serializing it.
+ * Usage: size_t n = chatgpt_scrub_buffer(body, strlen(body), CHATGPT_SCRUB_ALL);
+ * Returns: Number of masked spans
+ */
+size_t chatgpt_scrub_buffer(char *buf, size_t len, unsigned flags) {
+    size_t hits = 0, i = 0;
+    
+    if (!buf || !(flags & CHATGPT_SCRUB_ALL)) return 0;
+    
+    while (i < len) {
+        // Skip 8 bytes at a time while no trigger byte is present
+        while (i + 8 <= len) {
+            uint64_t w;
+            memcpy(&w, buf + i, 8);
+            if (scrub_word_has_trigger(w)) break;
+            i += 8;
+        }
+        if (i >= len) break;
+        
+        char ch = buf[i];
+        if (!SC_IS(ch, SC_TRIGGER)) {
+            i++;
+        } else if (ch == '@') {
+            i = (flags & CHATGPT_SCRUB_EMAILS) ? scrub_email(buf, len, i, &hits) : i + 1;
+        } else if (ch == '-') {
+            i = (flags & CHATGPT_SCRUB_API_KEYS) ? scrub_api_key(buf, len, i, &hits) : i + 1;
+        } else if (flags & CHATGPT_SCRUB_CARDS) {
+            // Stops on the first byte after the digits, so a following '@' is still seen
+            i = scrub_card(buf, len, i, &hits);
+        } else {
+            i++;
+        }
+    }
+    
+    return hits;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃             API REQUEST BUILDING              ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Growing output buffer for hand-built JSON
+ * Request bodies are written directly instead of going through a cJSON tree: shared
+ * message contents already carry their escaped form and are copied as they are
+ */
+struct jbuf {
+    char *d;        // Data (NUL-terminated when done)
+    size_t n;       // Bytes written
+    size_t cap;     // Allocated size
+    int failed;     // Allocation failed; further writes are ignored
+};
+
+static char *jb_reserve(struct jbuf *b, size_t more) {
+    if (b->failed) return NULL;
+    if (b->n + more + 1 > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 256;
+        while (cap < b->n + more + 1) cap *= 2;
+        char *p = (char*)realloc(b->d, cap);
+        if (!p) {
+            b->failed = 1;
+            return NULL;
+        }
+        b->d = p;
+        b->cap = cap;
+    }
+    return b->d + b->n;
+}
+
+static void jb_put(struct jbuf *b, const char *s, size_t n) {
+    char *p = jb_reserve(b, n);
+    if (!p) return;
+    memcpy(p, s, n);
+    b->n += n;
+}
+
+static void jb_lit(struct jbuf *b, const char *s) {
+    jb_put(b, s, strlen(s));
+}
+
+static void jb_str(struct jbuf *b, const char *s) {
+    size_t n = strlen(s);
+    size_t q = json_quoted_len(s, n);
+    char *p = jb_reserve(b, q);
+    if (!p) return;
+    json_quote(p, s, n);
+    b->n += q;
+}
+
+/*
+ * Write a number the way cJSON prints it (integers plainly, otherwise the shortest
+ * of 15 or 17 significant digits that reads back exactly)
+ */
+static void jb_num(struct jbuf *b, double d) {
+    char num[32];
+    int whole = d >= INT_MAX ? INT_MAX : d <= (double)INT_MIN ? INT_MIN : (int)d;
+    
+    if (isnan(d) || isinf(d)) {
+        snprintf(num, sizeof(num), "null");
+    } else if (d == (double)whole) {
+        snprintf(num, sizeof(num), "%d", whole);
+    } else {
+        double back = 0.0;
+        snprintf(num, sizeof(num), "%1.15g", d);
+        int parsed = sscanf(num, "%lg", &back) == 1;
+        double scale = fabs(back) > fabs(d) ? fabs(back) : fabs(d);
+        if (!parsed || fabs(back - d) > scale * DBL_EPSILON) {
+            snprintf(num, sizeof(num), "%1.17g", d);
+        }
+        for (char *p = num; *p; p++) {
+            if (*p == ',') *p = '.';  // Locale decimal point
+        }
+    }
+    jb_lit(b, num);
+}
+
+/*
+ * Build the JSON request body for OpenAI API
+ * Creates a complete request with model, messages, and parameters
+ * Internal function used by chat completion functions
+ * Parameters:
+ *   - stream: 1 for streaming mode, 0 for regular completion
+ * Returns: JSON string or NULL on error (caller must free)
+ */
+static char *build_request_body(ChatGPTClient *c, int stream) {
+    if (!c) return NULL;
+    
+    // Size the buffer up front so typical bodies need a single allocation
+    struct jbuf b = { NULL, 0, 0, 0 };
+    size_t guess = 256 + c->template_json_len;
+    for (size_t i = 0; i < c->message_count; i++) {
+        const ChatGPTMessage *m = &c->messages[i];
+        if (m->interned) guess += ((const struct intern*)m->interned)->json_len;
+        else if (m->content) guess += strlen(m->content) + 16;
+        guess += 48;
+    }
+    if (!jb_reserve(&b, guess)) return NULL;
+    
+    // Model name
+    jb_lit(&b, "{\"model\":");
+    jb_str(&b, c->model ? c->model : "gpt-4o-mini");
+    
+    // Messages array: rendered template messages first, then the conversation's own
+    jb_lit(&b, ",\"messages\":[");
+    if (c->template_json) jb_put(&b, c->template_json, c->template_json_len);
+    for (size_t i = 0; i < c->message_count; i++) {
+        const ChatGPTMessage *m = &c->messages[i];
+        
+        jb_lit(&b, (i || c->template_json) ? ",{\"role\":" : "{\"role\":");
+        jb_str(&b, m->role ? m->role : "user");
+        jb_lit(&b, ",\"content\":");
+        if (m->interned) {
+            // Shared content: escaped once when it was interned
+            const struct intern *e = (const struct intern*)m->interned;
+            jb_put(&b, e->json, e->json_len);
+        } else {
+            // Compressed messages are inflated just for this
+            char *tmp;
+            const char *text = msg_text(m, &tmp);
+            if (!text) {
+                free(b.d);
+                return NULL;
+            }
+            jb_str(&b, text);
+            free(tmp);
+        }
+        jb_lit(&b, "}");
+    }
+    jb_lit(&b, "]");
+    
+    // Generation parameters
+    jb_lit(&b, ",\"temperature\":");
+    jb_num(&b, c->temperature);
+    jb_lit(&b, ",\"top_p\":");
+    jb_num(&b, c->top_p);
+    
+    // Penalty parameters only when they are not default (0.0)
+    if (c->presence_penalty != 0.0) {
+        jb_lit(&b, ",\"presence_penalty\":");
+        jb_num(&b, c->presence_penalty);
+    }
+    if (c->frequency_penalty != 0.0) {
+        jb_lit(&b, ",\"frequency_penalty\":");
+        jb_num(&b, c->frequency_penalty);
+    }
+    
+    // max_tokens if specified (0 means don't include it)
+    if (c->max_tokens > 0) {
+        jb_lit(&b, ",\"max_tokens\":");
+        jb_num(&b, c->max_tokens);
+    }
+    
+    // Streaming flag if requested
+    if (stream) jb_lit(&b, ",\"stream\":true");
+    jb_lit(&b, "}");
+    
+    if (b.failed) {
+        free(b.d);
+        return NULL;
+    }
+    b.d[b.n] = '\0';
+    char *out = b.d;
+    
+    // Mask secrets and PII in the serialized body, messages themselves stay untouched
+    if (c->scrub_flags) {
+        size_t hits = chatgpt_scrub_buffer(out, b.n, c->scrub_flags);
+        if (hits) {
+            char note[96];
+            snprintf(note, sizeof(note), "Scrubbed %zu sensitive span(s) from request body", hits);
+            log_line(note);
+        }
+    }
+    return out;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃               PROMPT TEMPLATES                ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * A compiled template is the JSON of its message objects cut at each {{placeholder}}:
+ * static fragments are escaped once at compile time, so rendering only escapes the
+ * substituted values and concatenates. Templates are immutable once compiled and can
+ * be shared between threads
+ */
+#define TEMPLATE_NAME_MAX 64    // Longest placeholder name
+
+struct tmpl_part {
+    size_t off;             // Static fragment [off, off + len) of json
+    size_t len;
+    int var;                // Placeholder that follows the fragment (-1 = none)
+};
+
+struct ChatGPTTemplate {
+    char *json;                 // Static fragments, pre-escaped, back to back
+    size_t json_len;
+    struct tmpl_part *parts;    // Fragments in order
+    size_t n_parts;
+    char **names;               // Placeholder names, indexed by tmpl_part.var
+    size_t n_names;
+};
+
+/*
+ * Index of a placeholder name, adding it if new
+ * Returns: Index or -1 on allocation failure
+ */
+static int tmpl_var(ChatGPTTemplate *t, const char *name, size_t len) {
+    for (size_t i = 0; i < t->n_names; i++) {
+        if (strlen(t->names[i]) == len && memcmp(t->names[i], name, len) == 0) return (int)i;
+    }
+    
+    char **names = (char**)realloc(t->names, (t->n_names + 1) * sizeof(*names));
+    if (!names) return -1;
+    t->names = names;
+    char *copy = (char*)malloc(len + 1);
+    if (!copy) return -1;
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    t->names[t->n_names] = copy;
+    return (int)t->n_names++;
+}
+
+/*
+ * Close the current static fragment (ending at the buffer's end) and attach a placeholder
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int tmpl_cut(ChatGPTTemplate *t, const struct jbuf *b, size_t *start, int var) {
+    struct tmpl_part *parts = (struct tmpl_part*)realloc(t->parts, (t->n_parts + 1) * sizeof(*parts));
+    if (!parts) return -1;
+    t->parts = parts;
+    parts[t->n_parts].off = *start;
+    parts[t->n_parts].len = b->n - *start;
+    parts[t->n_parts].var = var;
+    t->n_parts++;
+    *start = b->n;
+    return 0;
+}
+
+/*
+ * Append content with its {{name}} placeholders cut out
+ * Text that only looks like a placeholder (no closing braces, empty or overlong name) stays literal
+ * Returns: 0 on success, -1 on allocation failure
+ */
+static int tmpl_add_content(ChatGPTTemplate *t, struct jbuf *b, size_t *start, const char *s) {
+    const char *lit = s;
+    
+    for (const char *p = strstr(s, "{{"); p; p = strstr(p, "{{")) {
+        const char *close = strstr(p + 2, "}}");
+        if (!close) break;
+        
+        // Trim the name
+        const char *n0 = p + 2, *n1 = close;
+        while (n0 < n1 && isspace((unsigned char)*n0)) n0++;
+        while (n1 > n0 && isspace((unsigned char)n1[-1])) n1--;
+        if (n1 == n0 || n1 - n0 > TEMPLATE_NAME_MAX || memchr(n0, '{', (size_t)(n1 - n0))) {
+            p += 2;
+            continue;
+        }
+        
+        // Escaped literal text up to the placeholder, then the cut
+        size_t ln = (size_t)(p - lit);
+        char *d = jb_reserve(b, json_escaped_len(lit, ln));
+        if (!d) return -1;
+        b->n = (size_t)(json_escape(d, lit, ln) - b->d);
+        int var = tmpl_var(t, n0, (size_t)(n1 - n0));
+        if (var < 0 || tmpl_cut(t, b, start, var) != 0) return -1;
+        lit = p = close + 2;
+    }
+    
+    size_t ln = strlen(lit);
+    char *d = jb_reserve(b, json_escaped_len(lit, ln));
+    if (!d) return -1;
+    b->n = (size_t)(json_escape(d, lit, ln) - b->d);
+    return 0;
+}
+
+/*
+ * Free a compiled template (conversations rendered from it are not affected)
+ * Usage: chatgpt_template_free(tmpl);
+ */
+void chatgpt_template_free(ChatGPTTemplate *t) {
+    if (!t) return;
+    
+    for (size_t i = 0; i < t->n_names; i++) free(t->names[i]);
+    free(t->names);
+    free(t->parts);
+    free(t->json);
+    free(t);
+}
+
+/*
+ * Compile a message list whose contents contain {{placeholders}}
+ * Usage: ChatGPTMessage msgs[] = { { "system", "You answer questions about {{product}}.", NULL, NULL },
+ *                                  { "user", "Reply in a {{tone}} tone.", NULL, NULL } };
+ *        ChatGPTTemplate *tmpl = chatgpt_template_compile(msgs, 2);
+ * Returns: Template or NULL on error
+ */
+ChatGPTTemplate *chatgpt_template_compile(const ChatGPTMessage *messages, size_t count) {
+    if (!messages && count) return NULL;
+    
+    ChatGPTTemplate *t = (ChatGPTTemplate*)calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    
+    struct jbuf b = { NULL, 0, 0, 0 };
+    size_t start = 0;
+    int ok = jb_reserve(&b, 256) != NULL;
+    for (size_t i = 0; ok && i < count; i++) {
+        if (!messages[i].content) {
+            ok = 0;
+            break;
+        }
+        jb_lit(&b, i ? ",{\"role\":" : "{\"role\":");
+        jb_str(&b, messages[i].role ? messages[i].role : "user");
+        jb_lit(&b, ",\"content\":\"");
+        ok = !b.failed && tmpl_add_content(t, &b, &start, messages[i].content) == 0;
+        jb_lit(&b, "\"}");
+    }
+    if (ok) ok = !b.failed && tmpl_cut(t, &b, &start, -1) == 0;
+    
+    t->json = b.d;
+    t->json_len = b.n;
+    if (!ok) {
+        chatgpt_template_free(t);
+        return NULL;
+    }
+    return t;
+}
+
+/*
+ * Install rendered template messages (json is taken over, NULL = none) and emit the change
+ */
+static void template_replace(ChatGPTConversation *c, char *json, size_t len) {
+    free(c->template_json);
+    c->template_json = json;
+    c->template_json_len = len;
+    delta_emit(c, DELTA_TEMPLATE, -1, json ? json : "", len, NULL, 0);
+}
+
+/*
+ * Set a conversation's template messages, rendered with the given values
+ * The rendered messages are sent before the conversation's own messages on every request.
+ * Only the values are escaped here; the static text was escaped when the template was compiled
+ * vars: NULL-terminated list of name/value pairs; every placeholder needs a value
+ * Usage: const char *vars[] = { "product", "Widget Pro", "tone", "formal", NULL };
+ *        chatgpt_set_template(conversation, tmpl, vars);
+ *        chatgpt_set_template(conversation, NULL, NULL); // Remove the template messages
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_INVALID_ARG if a value is missing, error code on failure
+ */
+int chatgpt_set_template(ChatGPTConversation *c, const ChatGPTTemplate *t, const char *const *vars) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    
+    if (!t) {
+        template_replace(c, NULL, 0);
+        return CHATGPT_OK;
+    }
+    
+    // Match values to placeholders and size the result exactly
+    const char **values = (const char**)calloc(t->n_names ? t->n_names : 1, sizeof(*values));
+    size_t *lens = (size_t*)calloc(t->n_names ? t->n_names : 1, sizeof(*lens));
+    if (!values || !lens) {
+        free(values);
+        free(lens);
+        return CHATGPT_ERR_OOM;
+    }
+    for (size_t i = 0; vars && vars[i] && vars[i + 1]; i += 2) {
+        for (size_t v = 0; v < t->n_names; v++) {
+            if (!values[v] && strcmp(vars[i], t->names[v]) == 0) values[v] = vars[i + 1];
+        }
+    }
+    size_t total = 0;
+    for (size_t v = 0; v < t->n_names; v++) {
+        if (!values[v]) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "No value for template placeholder '%s'", t->names[v]);
+            set_error(c, CHATGPT_ERR_INVALID_ARG, msg);
+            free(values);
+            free(lens);
+            return CHATGPT_ERR_INVALID_ARG;
+        }
+        lens[v] = strlen(values[v]);
+    }
+    for (size_t i = 0; i < t->n_parts; i++) {
+        int v = t->parts[i].var;
+        total += t->parts[i].len + (v >= 0 ? json_escaped_len(values[v], lens[v]) : 0);
+    }
+    
+    // Fragments and escaped values, back to back
+    char *out = (char*)malloc(total + 1);
+    if (!out) {
+        free(values);
+        free(lens);
+        return CHATGPT_ERR_OOM;
+    }
+    char *d = out;
+    for (size_t i = 0; i < t->n_parts; i++) {
+        int v = t->parts[i].var;
+        memcpy(d, t->json + t->parts[i].off, t->parts[i].len);
+        d += t->parts[i].len;
+        if (v >= 0) d = json_escape(d, values[v], lens[v]);
+    }
+    *d = '\0';
+    free(values);
+    free(lens);
+    
+    if (!total) {
+        free(out);
+        out = NULL;
+    }
+    template_replace(c, out, total);
+    return CHATGPT_OK;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃           BULK JSONL IMPORT / EXPORT          ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * One conversation per line: {"model":"...","messages":[{"role":"...","content":"..."},...]}
+ * Export hands out chunks of conversations to worker threads, each serializing into its own
+ * buffer; chunks are written strictly in order, each worker waiting for its turn. Import
+ * splits the file at newline boundaries and parses every slice on its own thread
+ * (POSIX only; on Windows both run on the calling thread)
+ */
+#define JSONL_CHUNK 256         // Conversations per export chunk
+#define JSONL_MAX_THREADS 64
+
+static int jsonl_threads(int threads) {
+#ifdef _WIN32
+    (void)threads;
+    return 1;
+#else
+    if (threads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (int)n : 1;
+    }
+    return threads > JSONL_MAX_THREADS ? JSONL_MAX_THREADS : threads;
+#endif
+}
+
+/*
+ * Append a conversation's messages as a JSON array of {"role","content"} objects
+ * Returns: 0 on success, -1 if a compressed message cannot be inflated
+ */
+static int jb_messages(struct jbuf *b, const ChatGPTConversation *c) {
+    jb_lit(b, "[");
+    for (size_t i = 0; i < c->message_count; i++) {
+        const ChatGPTMessage *m = &c->messages[i];
+        
+        jb_lit(b, i ? ",{\"role\":" : "{\"role\":");
+        jb_str(b, m->role ? m->role : "user");
+        jb_lit(b, ",\"content\":");
+        if (m->interned) {
+            const struct intern *e = (const struct intern*)m->interned;
+            jb_put(b, e->json, e->json_len);
+        } else {
+            char *tmp;
+            const char *text = msg_text(m, &tmp);
+            if (!text) return -1;
+            jb_str(b, text);
+            free(tmp);
+        }
+        jb_lit(b, "}");
+    }
+    jb_lit(b, "]");
+    return 0;
+}
+
+/*
+ * Append one conversation as a JSONL line
+ * Returns: 0 on success, -1 if a compressed message cannot be inflated
+ */
+static int jsonl_put(struct jbuf *b, const ChatGPTConversation *c) {
+    jb_lit(b, "{");
+    if (c->model) {
+        jb_lit(b, "\"model\":");
+        jb_str(b, c->model);
+        jb_lit(b, ",");
+    }
+    jb_lit(b, "\"messages\":");
+    if (jb_messages(b, c) != 0) return -1;
+    jb_lit(b, "}\n");
+    return 0;
+}
+
+struct jsonl_export {
+    ChatGPTConversation *const *convs;
+    size_t count;
+    FILE *f;
+    size_t next_chunk;          // Next chunk to serialize (guarded by lock)
+    size_t next_write;          // Chunk whose turn it is to be written (guarded by lock)
+    int rc;                     // First error (guarded by lock)
+#ifndef _WIN32
+    pthread_mutex_t lock;
+    pthread_cond_t turn;
+#endif
+};
+
+static void jsonl_export_lock(struct jsonl_export *e) {
+#ifndef _WIN32
+    pthread_mutex_lock(&e->lock);
+#else
+    (void)e;
+#endif
+}
+
+static void jsonl_export_unlock(struct jsonl_export *e) {
+#ifndef _WIN32
+    pthread_mutex_unlock(&e->lock);
+#else
+    (void)e;
+#endif
+}
+
+static void *jsonl_export_worker(void *arg) {
+    struct jsonl_export *e = (struct jsonl_export*)arg;
+    struct jbuf b = { NULL, 0, 0, 0 };
+    
+    for (;;) {
+        jsonl_export_lock(e);
+        size_t k = e->next_chunk++;
+        int stop = e->rc != CHATGPT_OK;
+        jsonl_export_unlock(e);
+        if (stop || k * JSONL_CHUNK >= e->count) break;
+        
+        // Serialize the chunk without holding anything
+        size_t end = (k + 1) * JSONL_CHUNK < e->count ? (k + 1) * JSONL_CHUNK : e->count;
+        int rc = CHATGPT_OK;
+        b.n = 0;
+        for (size_t i = k * JSONL_CHUNK; rc == CHATGPT_OK && i < end; i++) {
+            if (!e->convs[i] || jsonl_put(&b, e->convs[i]) != 0) rc = CHATGPT_ERR_INVALID_ARG;
+        }
+        if (b.failed) rc = CHATGPT_ERR_OOM;
+        
+        // Wait for this chunk's turn; while it is ours nobody else writes
+        jsonl_export_lock(e);
+#ifndef _WIN32
+        while (e->rc == CHATGPT_OK && e->next_write != k) pthread_cond_wait(&e->turn, &e->lock);
+#endif
+        if (e->rc != CHATGPT_OK) rc = e->rc;
+        jsonl_export_unlock(e);
+        
+        if (rc == CHATGPT_OK && b.n && fwrite(b.d, 1, b.n, e->f) != b.n) rc = CHATGPT_ERR_IO;
+        
+        jsonl_export_lock(e);
+        if (rc != CHATGPT_OK && e->rc == CHATGPT_OK) e->rc = rc;
+        e->next_write++;
+#ifndef _WIN32
+        pthread_cond_broadcast(&e->turn);
+#endif
+        jsonl_export_unlock(e);
+    }
+    
+    free(b.d);
+    return NULL;
+}
+
+/*
+ * Write many conversations to a JSONL file, one per line, serializing on several threads
+ * Lines are in array order. The conversations must not be modified while this runs
+ * threads: Worker threads (0 = one per CPU)
+ * Usage: chatgpt_export_jsonl(convs, n, "dump.jsonl", 0);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_export_jsonl(ChatGPTConversation *const *convs, size_t count, const char *path, int threads) {
+    if ((!convs && count) || !path) return CHATGPT_ERR_INVALID_ARG;
+    
+    struct jsonl_export e;
+    memset(&e, 0, sizeof(e));
+    e.convs = convs;
+    e.count = count;
+    e.rc = CHATGPT_OK;
+    e.f = fopen(path, "wb");
+    if (!e.f) return CHATGPT_ERR_IO;
+    
+    size_t chunks = (count + JSONL_CHUNK - 1) / JSONL_CHUNK;
+    int n = jsonl_threads(threads);
+    if ((size_t)n > chunks) n = chunks ? (int)chunks : 1;
+    
+#ifndef _WIN32
+    pthread_t tids[JSONL_MAX_THREADS];
+    int started = 0;
+    pthread_mutex_init(&e.lock, NULL);
+    pthread_cond_init(&e.turn, NULL);
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&tids[started], NULL, jsonl_export_worker, &e) == 0) started++;
+    }
+    jsonl_export_worker(&e);
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    pthread_cond_destroy(&e.turn);
+    pthread_mutex_destroy(&e.lock);
+#else
+    jsonl_export_worker(&e);
+#endif
+    
+    if (fclose(e.f) != 0 && e.rc == CHATGPT_OK) e.rc = CHATGPT_ERR_IO;
+    return e.rc;
+}
+
+struct jsonl_slice {
+    const char *p;              // Slice of the file: whole lines
+    const char *end;
+    ChatGPTClientConfig *cfg;   // Settings for new conversations (NULL = defaults)
+    ChatGPTConversation **convs; // Parsed conversations, in line order
+    size_t n, cap;
+    int rc;
+};
+
+/*
+ * Parse one line into a new conversation
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+static int jsonl_parse_line(struct jsonl_slice *s, const char *line, size_t len, ChatGPTConversation **out) {
+    cJSON *root = cJSON_ParseWithLength(line, len);
+    cJSON *msgs = root ? cJSON_GetObjectItemCaseSensitive(root, "messages") : NULL;
+    if (!cJSON_IsArray(msgs)) {
+        cJSON_Delete(root);
+        return CHATGPT_ERR_JSON_PARSE;
+    }
+    
+    cJSON *model = cJSON_GetObjectItemCaseSensitive(root, "model");
+    const char *name = cJSON_IsString(model) ? model->valuestring : NULL;
+    ChatGPTConversation *c = s->cfg ? chatgpt_conversation_new_from_config(s->cfg)
+                                    : chatgpt_conversation_new(NULL, name);
+    int rc = c ? CHATGPT_OK : (s->cfg || g_api_key ? CHATGPT_ERR_OOM : CHATGPT_ERR_STATE);
+    if (c && s->cfg && name && strcmp(name, c->model) != 0) rc = chatgpt_set_model(c, name);
+    
+    // Size the message array once, then add messages like chatgpt_load_conversation does
+    if (rc == CHATGPT_OK) rc = ensure_cap(c, (size_t)cJSON_GetArraySize(msgs));
+    cJSON *it = NULL;
+    cJSON_ArrayForEach(it, msgs) {
+        if (rc != CHATGPT_OK) break;
+        cJSON *r = cJSON_GetObjectItemCaseSensitive(it, "role");
+        cJSON *t = cJSON_GetObjectItemCaseSensitive(it, "content");
+        if (cJSON_IsString(r) && cJSON_IsString(t)) rc = chatgpt_add_message(c, r->valuestring, t->valuestring);
+    }
+    cJSON_Delete(root);
+    
+    if (rc != CHATGPT_OK) {
+        chatgpt_conversation_free(c);
+        return rc;
+    }
+    *out = c;
+    return CHATGPT_OK;
+}
+
+static void *jsonl_import_worker(void *arg) {
+    struct jsonl_slice *s = (struct jsonl_slice*)arg;
+    const char *p = s->p;
+    
+    while (p < s->end && s->rc == CHATGPT_OK) {
+        const char *nl = (const char*)memchr(p, '\n', (size_t)(s->end - p));
+        const char *eol = nl ? nl : s->end;
+        const char *q = p;
+        p = nl ? nl + 1 : s->end;
+        
+        // Blank lines (and a trailing '\r') are allowed
+        while (q < eol && isspace((unsigned char)*q)) q++;
+        if (q == eol) continue;
+        
+        if (s->n == s->cap) {
+            size_t cap = s->cap ? s->cap * 2 : 256;
+            ChatGPTConversation **v = (ChatGPTConversation**)realloc(s->convs, cap * sizeof(*v));
+            if (!v) {
+                s->rc = CHATGPT_ERR_OOM;
+                break;
+            }
+            s->convs = v;
+            s->cap = cap;
+        }
+        s->rc = jsonl_parse_line(s, q, (size_t)(eol - q), &s->convs[s->n]);
+        if (s->rc == CHATGPT_OK) s->n++;
+    }
+    return NULL;
+}
+
+/*
+ * Read a JSONL file of conversations (as written by chatgpt_export_jsonl), parsing on several threads
+ * cfg: Settings for the new conversations (a line's model overrides the config's), or NULL for
+ *      chatgpt_conversation_new() defaults with the global API key
+ * threads: Worker threads (0 = one per CPU)
+ * Usage: ChatGPTConversation **convs; size_t n;
+ *        chatgpt_import_jsonl("dump.jsonl", cfg, 0, &convs, &n);
+ *        ... free each with chatgpt_conversation_free(), then free(convs)
+ * Returns: CHATGPT_OK on success (conversations in file order), error code on failure (nothing returned)
+ */
+int chatgpt_import_jsonl(const char *path, ChatGPTClientConfig *cfg, int threads,
+                         ChatGPTConversation ***out, size_t *count) {
+    if (!path || !out || !count) return CHATGPT_ERR_INVALID_ARG;
+    *out = NULL;
+    *count = 0;
+    
+    // Whole file in memory: slices are parsed in place
+    size_t len;
+    int rc;
+    char *buf = read_file(path, &len, &rc);
+    if (!buf) return rc;
+    
+    // Cut into slices of about equal size, each ending just after a newline
+    int n = jsonl_threads(threads);
+    if ((size_t)n > len / 4096 + 1) n = (int)(len / 4096 + 1);
+    struct jsonl_slice slices[JSONL_MAX_THREADS];
+    const char *p = buf, *end = buf + len;
+    for (int i = 0; i < n; i++) {
+        const char *cut = i == n - 1 ? end : buf + len / (size_t)n * (size_t)(i + 1);
+        if (cut < p) cut = p;
+        if (cut < end) {
+            const char *nl = (const char*)memchr(cut, '\n', (size_t)(end - cut));
+            cut = nl ? nl + 1 : end;
+        }
+        memset(&slices[i], 0, sizeof(slices[i]));
+        slices[i].p = p;
+        slices[i].end = cut;
+        slices[i].cfg = cfg;
+        slices[i].rc = CHATGPT_OK;
+        p = cut;
+    }
+    
+#ifndef _WIN32
+    pthread_t tids[JSONL_MAX_THREADS];
+    int started[JSONL_MAX_THREADS];
+    for (int i = 1; i < n; i++) {
+        started[i] = pthread_create(&tids[i], NULL, jsonl_import_worker, &slices[i]) == 0;
+        if (!started[i]) jsonl_import_worker(&slices[i]);
+    }
+    jsonl_import_worker(&slices[0]);
+    for (int i = 1; i < n; i++) {
+        if (started[i]) pthread_join(tids[i], NULL);
+    }
+#else
+    for (int i = 0; i < n; i++) jsonl_import_worker(&slices[i]);
+#endif
+    free(buf);
+    
+    // Concatenate the slices in order
+    rc = CHATGPT_OK;
+    size_t total = 0;
+    for (int i = 0; i < n; i++) {
+        if (slices[i].rc != CHATGPT_OK && rc == CHATGPT_OK) rc = slices[i].rc;
+        total += slices[i].n;
+    }
+    ChatGPTConversation **all = NULL;
+    if (rc == CHATGPT_OK) {
+        all = (ChatGPTConversation**)malloc((total ? total : 1) * sizeof(*all));
+        if (!all) rc = CHATGPT_ERR_OOM;
+    }
+    size_t k = 0;
+    for (int i = 0; i < n; i++) {
+        for (size_t j = 0; j < slices[i].n; j++) {
+            if (all) all[k++] = slices[i].convs[j];
+            else chatgpt_conversation_free(slices[i].convs[j]);
+        }
+        free(slices[i].convs);
+    }
+    if (rc != CHATGPT_OK) return rc;
+    
+    *out = all;
+    *count = total;
+    return CHATGPT_OK;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃               ARROW IPC EXPORT                ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Conversations as an Arrow IPC stream (the format pyarrow.ipc.open_stream, DuckDB and
+ * Polars read): one row per message with the conversation's model, token usage and
+ * latency of its last request alongside. Roles and models are dictionary-encoded; new
+ * entries go out as delta dictionary batches just before the record batch that uses them.
+ *
+ * Stream layout: schema message, then per write dictionary batches (if any) and one record
+ * batch, then the end-of-stream marker on close. Every message is 0xFFFFFFFF, the metadata
+ * length, a FlatBuffers-encoded Message padded to 8 bytes, then the body buffers (each
+ * 8-byte aligned). The FlatBuffers tables are written front to back by the small builder
+ * below, which only knows what these few message types need. Little-endian hosts only
+ */
+#define ARROW_CONTINUATION 0xFFFFFFFFu
+#define ARROW_V5 4              // MetadataVersion.V5
+#define ARROW_MSG_SCHEMA 1      // MessageHeader union
+#define ARROW_MSG_DICTIONARY 2
+#define ARROW_MSG_RECORD_BATCH 3
+#define ARROW_TYPE_INT 2        // Type union
+#define ARROW_TYPE_FLOAT 3
+#define ARROW_TYPE_UTF8 5
+#define ARROW_MAX_BUFFERS 32
+
+static const struct {
+    const char *name;
+    int type;                   // ARROW_TYPE_*
+    int bits;                   // Int bit width; FLOAT is always double
+    int dict;                   // Dictionary id, -1 if plain
+} arrow_cols[] = {
+    { "conversation", ARROW_TYPE_INT, 64, -1 },         // Running number across the stream
+    { "message", ARROW_TYPE_INT, 32, -1 },              // Index within the conversation
+    { "role", ARROW_TYPE_UTF8, 0, 0 },
+    { "content", ARROW_TYPE_UTF8, 0, -1 },
+    { "model", ARROW_TYPE_UTF8, 0, 1 },
+    { "prompt_tokens", ARROW_TYPE_INT, 32, -1 },
+    { "completion_tokens", ARROW_TYPE_INT, 32, -1 },
+    { "total_tokens", ARROW_TYPE_INT, 32, -1 },
+    { "latency_ms", ARROW_TYPE_FLOAT, 64, -1 },
+};
+#define ARROW_COLS (sizeof(arrow_cols) / sizeof(arrow_cols[0]))
+
+// A dictionary: its values and how many of them the stream already has
+struct arrow_dict {
+    char **v;
+    size_t n, cap;
+    size_t sent;
+};
+
+struct ChatGPTArrowWriter {
+    FILE *f;
+    struct arrow_dict dicts[2]; // Roles (id 0) and models (id 1)
+    int64_t next_conv;          // Number of the next conversation written
+    int started;                // Initial dictionary batches written
+    struct jbuf meta, body, data; // Scratch space kept between batches
+};
+
+// Body layout of one batch being assembled
+struct arrow_batch {
+    int64_t nodes[2 * ARROW_COLS]; // (length, null_count) per column
+    size_t n_nodes;
+    int64_t bufs[2 * ARROW_MAX_BUFFERS]; // (offset, length) per buffer
+    size_t n_bufs;
+};
+
+static void fb_pad(struct jbuf *b, size_t align) {
+    static const char zero[8];
+    jb_put(b, zero, (align - b->n % align) % align);
+}
+
+static void fb_le(struct jbuf *b, uint64_t v, int size) {
+    char x[8];
+    for (int i = 0; i < size; i++) x[i] = (char)(v >> (8 * i));
+    jb_put(b, x, (size_t)size);
+}
+
+/*
+ * Point the offset slot at 'at' to the current position (FlatBuffers offsets only go forward)
+ */
+static void fb_link(struct jbuf *b, size_t at) {
+    if (b->failed) return;
+    uint32_t off = (uint32_t)(b->n - at);
+    for (int i = 0; i < 4; i++) b->d[at + i] = (char)(off >> (8 * i));
+}
+
+// A table field: 'size' bytes of 'val' (offset fields are 4 bytes, linked later)
+struct fb_field {
+    int id;
+    int size;
+    uint64_t val;
+};
+
+/*
+ * Write a vtable and its table, larger fields first so each lands aligned
+ * 'from' is the offset slot to point at the table; slots[i] receives the position of field i
+ */
+static void fb_table(struct jbuf *b, size_t from, const struct fb_field *f, int n, size_t *slots) {
+    int n_ids = 0;
+    size_t offs[8] = {0};
+    for (int i = 0; i < n; i++) {
+        if (f[i].id + 1 > n_ids) n_ids = f[i].id + 1;
+    }
+    
+    fb_pad(b, 2);
+    size_t vt = b->n, vt_size = 4 + 2 * (size_t)n_ids;
+    size_t t = (vt + vt_size + 3) & ~(size_t)3, pos = t + 4;
+    for (int size = 8; size >= 1; size /= 2) {
+        for (int i = 0; i < n; i++) {
+            if (f[i].size != size) continue;
+            pos = (pos + (size_t)size - 1) & ~((size_t)size - 1);
+            offs[i] = pos - t;
+            pos += (size_t)size;
+        }
+    }
+    
+    fb_le(b, vt_size, 2);
+    fb_le(b, pos - t, 2);
+    for (int id = 0; id < n_ids; id++) {
+        size_t off = 0;
+        for (int i = 0; i < n; i++) {
+            if (f[i].id == id) off = offs[i];
+        }
+        fb_le(b, off, 2);
+    }
+    fb_pad(b, 4);
+    fb_link(b, from);
+    fb_le(b, t - vt, 4);
+    for (size_t at = t + 4; at < pos; ) {
+        int i = 0;
+        while (i < n && t + offs[i] != at) i++;
+        if (i == n) {
+            fb_le(b, 0, 1);
+            at++;
+            continue;
+        }
+        if (slots) slots[i] = at;
+        fb_le(b, f[i].val, f[i].size);
+        at += (size_t)f[i].size;
+    }
+}
+
+/*
+ * Start a vector of 'count' elements aligned to 'align'; returns where the elements begin
+ */
+static size_t fb_vector(struct jbuf *b, size_t from, size_t count, size_t align) {
+    fb_pad(b, 4);
+    if ((b->n + 4) % align) fb_le(b, 0, 4);
+    fb_link(b, from);
+    fb_le(b, count, 4);
+    return b->n;
+}
+
+static void fb_string(struct jbuf *b, size_t from, const char *s) {
+    fb_pad(b, 4);
+    fb_link(b, from);
+    fb_le(b, strlen(s), 4);
+    jb_put(b, s, strlen(s) + 1);
+}
+
+/*
+ * Start a Message; returns the slot of its header offset
+ */
+static size_t arrow_message(struct jbuf *m, int type, size_t body_len) {
+    struct fb_field f[] = {
+        { 0, 2, ARROW_V5 },
+        { 1, 1, (uint64_t)type },
+        { 2, 4, 0 },
+        { 3, 8, body_len },
+    };
+    size_t slots[4] = {0};
+    
+    m->n = 0;
+    fb_le(m, 0, 4);             // Root offset
+    fb_table(m, 0, f, 4, slots);
+    return slots[2];
+}
+
+static void arrow_int_type(struct jbuf *m, size_t from, int bits) {
+    struct fb_field f[] = { { 0, 4, (uint64_t)bits }, { 1, 1, 1 } };
+    fb_table(m, from, f, 2, NULL);
+}
+
+static void arrow_schema_message(struct jbuf *m) {
+    size_t schema = arrow_message(m, ARROW_MSG_SCHEMA, 0);
+    struct fb_field sf[] = { { 1, 4, 0 } };
+    size_t fields;
+    fb_table(m, schema, sf, 1, &fields);
+    
+    size_t elems = fb_vector(m, fields, ARROW_COLS, 4);
+    for (size_t i = 0; i < ARROW_COLS; i++) fb_le(m, 0, 4);
+    
+    for (size_t i = 0; i < ARROW_COLS; i++) {
+        struct fb_field ff[] = {
+            { 0, 4, 0 },                                // name
+            { 2, 1, (uint64_t)arrow_cols[i].type },     // type_type
+            { 3, 4, 0 },                                // type
+            { 5, 4, 0 },                                // children
+            { 4, 4, 0 },                                // dictionary
+        };
+        size_t slots[5] = {0};
+        fb_table(m, elems + 4 * i, ff, arrow_cols[i].dict >= 0 ? 5 : 4, slots);
+        fb_string(m, slots[0], arrow_cols[i].name);
+        if (arrow_cols[i].type == ARROW_TYPE_INT) {
+            arrow_int_type(m, slots[2], arrow_cols[i].bits);
+        } else if (arrow_cols[i].type == ARROW_TYPE_FLOAT) {
+            struct fb_field pf[] = { { 0, 2, 2 } };     // Precision.DOUBLE
+            fb_table(m, slots[2], pf, 1, NULL);
+        } else {
+            fb_table(m, slots[2], NULL, 0, NULL);       // Utf8 has no fields
+        }
+        fb_vector(m, slots[3], 0, 4);
+        if (arrow_cols[i].dict >= 0) {
+            struct fb_field df[] = { { 0, 8, (uint64_t)arrow_cols[i].dict }, { 1, 4, 0 } };
+            size_t ds[2];
+            fb_table(m, slots[4], df, 2, ds);
+            arrow_int_type(m, ds[1], 32);
+        }
+    }
+}
+
+static void arrow_record_batch(struct jbuf *m, size_t from, int64_t rows, const struct arrow_batch *a) {
+    struct fb_field f[] = { { 0, 8, (uint64_t)rows }, { 1, 4, 0 }, { 2, 4, 0 } };
+    size_t slots[3] = {0};
+    fb_table(m, from, f, 3, slots);
+    
+    fb_vector(m, slots[1], a->n_nodes / 2, 8);
+    for (size_t i = 0; i < a->n_nodes; i++) fb_le(m, (uint64_t)a->nodes[i], 8);
+    fb_vector(m, slots[2], a->n_bufs / 2, 8);
+    for (size_t i = 0; i < a->n_bufs; i++) fb_le(m, (uint64_t)a->bufs[i], 8);
+}
+
+/*
+ * Write one encapsulated message: continuation marker, metadata length, metadata, body
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+static int arrow_emit(ChatGPTArrowWriter *w) {
+    fb_pad(&w->meta, 8);
+    fb_pad(&w->body, 8);
+    if (w->meta.failed || w->body.failed) return CHATGPT_ERR_OOM;
+    
+    char head[8];
+    uint32_t marker = ARROW_CONTINUATION, len = (uint32_t)w->meta.n;
+    memcpy(head, &marker, 4);
+    memcpy(head + 4, &len, 4);
+    if (fwrite(head, 1, 8, w->f) != 8 ||
+        fwrite(w->meta.d, 1, w->meta.n, w->f) != w->meta.n ||
+        (w->body.n && fwrite(w->body.d, 1, w->body.n, w->f) != w->body.n)) {
+        return CHATGPT_ERR_IO;
+    }
+    return CHATGPT_OK;
+}
+
+// Body buffers: each starts 8-byte aligned
+static size_t arrow_buf_begin(struct jbuf *body) {
+    fb_pad(body, 8);
+    return body->n;
+}
+
+static void arrow_buf_end(struct arrow_batch *a, struct jbuf *body, size_t start) {
+    a->bufs[a->n_bufs++] = (int64_t)start;
+    a->bufs[a->n_bufs++] = (int64_t)(body->n - start);
+}
+
+// Non-nullable columns have an empty validity bitmap
+static void arrow_column(struct arrow_batch *a, struct jbuf *body, int64_t rows) {
+    a->nodes[a->n_nodes++] = rows;
+    a->nodes[a->n_nodes++] = 0;
+    arrow_buf_end(a, body, arrow_buf_begin(body));
+}
+
+/*
+ * Index of a value in a dictionary, adding it if new
+ * Returns: the index, or -1 when out of memory
+ */
+static int32_t arrow_dict_index(struct arrow_dict *d, const char *s) {
+    for (size_t i = d->n; i-- > 0; ) {
+        if (strcmp(d->v[i], s) == 0) return (int32_t)i;
+    }
+    if (d->n == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : 8;
+        char **v = (char**)realloc(d->v, cap * sizeof(*v));
+        if (!v) return -1;
+        d->v = v;
+        d->cap = cap;
+    }
+    if (!(d->v[d->n] = dup_str(s))) return -1;
+    return (int32_t)d->n++;
+}
+
+/*
+ * Send the dictionary entries the stream does not have yet (a delta after the first batch)
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+static int arrow_send_dict(ChatGPTArrowWriter *w, int id) {
+    struct arrow_dict *d = &w->dicts[id];
+    struct arrow_batch a;
+    int64_t rows = (int64_t)(d->n - d->sent);
+    
+    if (rows == 0 && w->started) return CHATGPT_OK;
+    memset(&a, 0, sizeof(a));
+    w->body.n = 0;
+    a.nodes[a.n_nodes++] = rows;
+    a.nodes[a.n_nodes++] = 0;
+    arrow_buf_end(&a, &w->body, arrow_buf_begin(&w->body));
+    
+    size_t start = arrow_buf_begin(&w->body);
+    uint32_t off = 0;
+    fb_le(&w->body, 0, 4);
+    for (size_t i = d->sent; i < d->n; i++) {
+        off += (uint32_t)strlen(d->v[i]);
+        fb_le(&w->body, off, 4);
+    }
+    arrow_buf_end(&a, &w->body, start);
+    start = arrow_buf_begin(&w->body);
+    for (size_t i = d->sent; i < d->n; i++) jb_put(&w->body, d->v[i], strlen(d->v[i]));
+    arrow_buf_end(&a, &w->body, start);
+    fb_pad(&w->body, 8);
+    
+    size_t header = arrow_message(&w->meta, ARROW_MSG_DICTIONARY, w->body.n);
+    struct fb_field f[] = { { 0, 8, (uint64_t)id }, { 1, 4, 0 }, { 2, 1, d->sent > 0 } };
+    size_t slots[3] = {0};
+    fb_table(&w->meta, header, f, 3, slots);
+    arrow_record_batch(&w->meta, slots[1], rows, &a);
+    
+    int rc = arrow_emit(w);
+    if (rc == CHATGPT_OK) d->sent = d->n;
+    return rc;
+}
+
+/*
+ * Open an Arrow IPC stream file and write its schema
+ * Columns: conversation (int64), message (int32), role (dictionary<utf8>), content (utf8),
+ * model (dictionary<utf8>), prompt_tokens, completion_tokens, total_tokens (int32),
+ * latency_ms (double)
+ * Usage: ChatGPTArrowWriter *w = chatgpt_arrow_open("transcripts.arrow");
+ * Returns: New writer, or NULL on error
+ */
+ChatGPTArrowWriter *chatgpt_arrow_open(const char *path) {
+    if (!path) return NULL;
+    
+    ChatGPTArrowWriter *w = (ChatGPTArrowWriter*)calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->f = fopen(path, "wb");
+    if (!w->f) {
+        free(w);
+        return NULL;
+    }
+    
+    arrow_schema_message(&w->meta);
+    if (arrow_emit(w) != CHATGPT_OK) {
+        chatgpt_arrow_close(w);
+        return NULL;
+    }
+    return w;
+}
+
+/*
+ * Append conversations to the stream as one record batch, one row per message
+ * Token counts and latency are those of each conversation's last request
+ * Usage: chatgpt_arrow_write(w, convs, n);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_arrow_write(ChatGPTArrowWriter *w, ChatGPTConversation *const *convs, size_t count) {
+    if (!w || (!convs && count)) return CHATGPT_ERR_INVALID_ARG;
+    
+    struct arrow_batch a;
+    struct jbuf *body = &w->body;
+    int64_t rows = 0;
+    size_t start;
+    
+    for (size_t i = 0; i < count; i++) {
+        if (!convs[i]) return CHATGPT_ERR_INVALID_ARG;
+        rows += (int64_t)convs[i]->message_count;
+    }
+    memset(&a, 0, sizeof(a));
+    body->n = 0;
+    
+    // One pass per column, each appending its buffers to the body
+    for (size_t k = 0; k < ARROW_COLS; k++) {
+        arrow_column(&a, body, rows);
+        start = arrow_buf_begin(body);
+        
+        if (k == 3) {
+            // Content: offsets into the body, text into scratch until the offsets are done
+            w->data.n = 0;
+            fb_le(body, 0, 4);
+            for (size_t i = 0; i < count; i++) {
+                for (size_t j = 0; j < convs[i]->message_count; j++) {
+                    char *tmp;
+                    const char *text = msg_text(&convs[i]->messages[j], &tmp);
+                    if (!text) return CHATGPT_ERR_OOM;
+                    jb_put(&w->data, text, strlen(text));
+                    free(tmp);
+                    if (w->data.n > INT32_MAX) return CHATGPT_ERR_INVALID_ARG;  // Split the batch
+                    fb_le(body, w->data.n, 4);
+                }
+            }
+            arrow_buf_end(&a, body, start);
+            start = arrow_buf_begin(body);
+            if (w->data.n) jb_put(body, w->data.d, w->data.n);
+            arrow_buf_end(&a, body, start);
+            continue;
+        }
+        
+        for (size_t i = 0; i < count; i++) {
+            const ChatGPTConversation *c = convs[i];
+            int32_t model = arrow_cols[k].dict == 1 ? arrow_dict_index(&w->dicts[1], c->model ? c->model : "") : 0;
+            if (model < 0) return CHATGPT_ERR_OOM;
+            
+            for (size_t j = 0; j < c->message_count; j++) {
+                const ChatGPTMessage *m = &c->messages[j];
+                int32_t role;
+                switch (k) {
+                case 0: fb_le(body, (uint64_t)(w->next_conv + (int64_t)i), 8); break;
+                case 1: fb_le(body, (uint32_t)j, 4); break;
+                case 2:
+                    role = arrow_dict_index(&w->dicts[0], m->role ? m->role : "");
+                    if (role < 0) return CHATGPT_ERR_OOM;
+                    fb_le(body, (uint32_t)role, 4);
+                    break;
+                case 4: fb_le(body, (uint32_t)model, 4); break;
+                case 5: fb_le(body, (uint32_t)c->last_usage.prompt_tokens, 4); break;
+                case 6: fb_le(body, (uint32_t)c->last_usage.completion_tokens, 4); break;
+                case 7: fb_le(body, (uint32_t)c->last_usage.total_tokens, 4); break;
+                default: {
+                    uint64_t bits;
+                    memcpy(&bits, &c->last_latency_ms, 8);
+                    fb_le(body, bits, 8);
+                }
+                }
+            }
+        }
+        arrow_buf_end(&a, body, start);
+    }
+    fb_pad(body, 8);
+    if (body->failed) return CHATGPT_ERR_OOM;
+    
+    // New dictionary entries must reach the stream before the batch using them. The body
+    // is set aside meanwhile: the dictionary batches are built in the same scratch space
+    struct jbuf batch = *body;
+    memset(body, 0, sizeof(*body));
+    int rc = CHATGPT_OK;
+    for (int id = 0; id < 2 && rc == CHATGPT_OK; id++) rc = arrow_send_dict(w, id);
+    free(body->d);
+    *body = batch;
+    if (rc != CHATGPT_OK) return rc;
+    w->started = 1;
+    
+    size_t header = arrow_message(&w->meta, ARROW_MSG_RECORD_BATCH, body->n);
+    arrow_record_batch(&w->meta, header, rows, &a);
+    rc = arrow_emit(w);
+    if (rc == CHATGPT_OK) w->next_conv += (int64_t)count;
+    return rc;
+}
+
+/*
+ * Finish the stream (end-of-stream marker) and free the writer
+ * Usage: chatgpt_arrow_close(w);
+ * Returns: CHATGPT_OK on success, error code if the file could not be completed
+ */
+int chatgpt_arrow_close(ChatGPTArrowWriter *w) {
+    if (!w) return CHATGPT_ERR_INVALID_ARG;
+    
+    static const uint32_t eos[2] = { ARROW_CONTINUATION, 0 };
+    int rc = fwrite(eos, 1, sizeof(eos), w->f) == sizeof(eos) ? CHATGPT_OK : CHATGPT_ERR_IO;
+    if (fclose(w->f) != 0) rc = CHATGPT_ERR_IO;
+    
+    for (int id = 0; id < 2; id++) {
+        for (size_t i = 0; i < w->dicts[id].n; i++) free(w->dicts[id].v[i]);
+        free(w->dicts[id].v);
+    }
+    free(w->meta.d);
+    free(w->body.d);
+    free(w->data.d);
+    free(w);
+    return rc;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃           DEDUPLICATING CHUNK STORE           ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * An archive directory where conversations are saved as content-defined chunks
+ * A conversation's messages array (the same JSON chatgpt_save_conversation writes) is cut
+ * with FastCDC: a gear rolling hash picks cut points from the content itself, so two
+ * conversations with a common prefix produce the same chunks for it, wherever they diverge.
+ * Chunks are stored once under their SHA-256 (dir/chunks/ab/cdef...), and a conversation
+ * is a small manifest (dir/<name>.cdc) listing its chunks, with a CRC32C checksum line.
+ * Chunks and manifests are written atomically; a manifest only ever names chunks already
+ * on disk, and loading checks every chunk against its hash
+ */
+#define CDC_MIN 2048            // Chunk size bounds and target
+#define CDC_AVG 8192
+#define CDC_MAX 65536
+#define CDC_MASK_S 0x0003590703530000ull    // 15 bits: cut less often below CDC_AVG
+#define CDC_MASK_L 0x0000d90003530000ull    // 11 bits: cut more often above it
+#define CDC_MANIFEST_MAGIC "CGPTCDC1\n"
+#define ROTR32(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+struct ChatGPTChunkStore {
+    char *dir;
+    uint64_t gear[256];         // Gear hash table: fixed pseudo-random values per byte
+    ChatGPTChunkStats stats;
+};
+
+/*
+ * SHA-256 (FIPS 180-4) of a buffer
+ */
+static void sha256(const void *data, size_t len, unsigned char out[32]) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    uint32_t h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    const unsigned char *p = (const unsigned char*)data;
+    unsigned char tail[128];
+    size_t full = len & ~(size_t)63, rest = len - full;
+    
+    // The padded tail: leftover bytes, 0x80, zeros, bit length (one or two blocks)
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p + full, rest);
+    tail[rest] = 0x80;
+    size_t tail_len = rest < 56 ? 64 : 128;
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 0; i < 8; i++) tail[tail_len - 1 - i] = (unsigned char)(bits >> (8 * i));
+    
+    for (size_t off = 0; off < full + tail_len; off += 64) {
+        const unsigned char *blk = off < full ? p + off : tail + (off - full);
+        uint32_t w[64], a, b, c, d, e, f, g, hh;
+        
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)blk[4 * i] << 24 | (uint32_t)blk[4 * i + 1] << 16 |
+                   (uint32_t)blk[4 * i + 2] << 8 | blk[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = hh + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+            uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+    for (int i = 0; i < 8; i++) {
+        out[4 * i] = (unsigned char)(h[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(h[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(h[i] >> 8);
+        out[4 * i + 3] = (unsigned char)h[i];
+    }
+}
+
+/*
+ * Length of the next chunk of p[0..n): FastCDC with normalized chunking
+ */
+static size_t cdc_cut(const uint64_t *gear, const unsigned char *p, size_t n) {
+    if (n <= CDC_MIN) return n;
+    if (n > CDC_MAX) n = CDC_MAX;
+    size_t normal = n < CDC_AVG ? n : CDC_AVG;
+    uint64_t fp = 0;
+    size_t i = CDC_MIN;
+    
+    for (; i < normal; i++) {
+        fp = (fp << 1) + gear[p[i]];
+        if (!(fp & CDC_MASK_S)) return i + 1;
+    }
+    for (; i < n; i++) {
+        fp = (fp << 1) + gear[p[i]];
+        if (!(fp & CDC_MASK_L)) return i + 1;
+    }
+    return n;
+}
+
+static void cdc_hex(const unsigned char digest[32], char hex[65]) {
+    for (int i = 0; i < 32; i++) snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+}
+
+// Chunk path: dir/chunks/<first two hex digits>/<the other 62>
+static void cdc_chunk_path(const ChatGPTChunkStore *s, const char *hex, char *buf, size_t len) {
+    snprintf(buf, len, "%s/chunks/%.2s/%s", s->dir, hex, hex + 2);
+}
+
+static int cdc_mkdir(const char *path) {
+#ifdef _WIN32
+    return _mkdir(path) == 0 || errno == EEXIST ? 0 : -1;
+#else
+    return mkdir(path, 0777) == 0 || errno == EEXIST ? 0 : -1;
+#endif
+}
+
+/*
+ * Manifest path for a conversation name (plain file names only: no separators, no leading dot)
+ * Returns: 0 on success, -1 if the name is not acceptable
+ */
+static int cdc_manifest_path(const ChatGPTChunkStore *s, const char *name, char *buf, size_t len) {
+    if (!name[0] || name[0] == '.' || strpbrk(name, "/\\:")) return -1;
+    return (size_t)snprintf(buf, len, "%s/%s.cdc", s->dir, name) < len ? 0 : -1;
+}
+
+/*
+ * Open (creating if needed) a chunk store in a directory
+ * A store is used by one thread at a time
+ * Usage: ChatGPTChunkStore *s = chatgpt_chunk_store_open("/var/lib/app/archive");
+ * Returns: New store handle, or NULL on error
+ */
+ChatGPTChunkStore *chatgpt_chunk_store_open(const char *dir) {
+    char path[1024];
+    
+    if (!dir || snprintf(path, sizeof(path), "%s/chunks", dir) >= (int)sizeof(path) - 4) return NULL;
+    if (cdc_mkdir(dir) != 0 || cdc_mkdir(path) != 0) return NULL;
+    
+    ChatGPTChunkStore *s = (ChatGPTChunkStore*)calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->dir = dup_str(dir);
+    if (!s->dir) {
+        free(s);
+        return NULL;
+    }
+    
+    // Fixed seed: cut points, and so chunk names, must not change between runs
+    uint64_t x = 0x6368756e6b737464ull;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        s->gear[i] = z ^ (z >> 31);
+    }
+    return s;
+}
+
+/*
+ * Close a chunk store handle (the files stay)
+ * Usage: chatgpt_chunk_store_close(s);
+ */
+void chatgpt_chunk_store_close(ChatGPTChunkStore *s) {
+    if (!s) return;
+    free(s->dir);
+    free(s);
+}
+
+/*
+ * Save a conversation's messages under a name, writing only chunks the store lacks
+ * An existing save with the same name is replaced atomically
+ * Usage: chatgpt_chunk_store_save(s, conv, "ticket-4711");
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_chunk_store_save(ChatGPTChunkStore *s, ChatGPTConversation *c, const char *name) {
+    char mpath[1024], cpath[1100], hex[65];
+    unsigned char digest[32];
+    struct jbuf body = { NULL, 0, 0, 0 }, man = { NULL, 0, 0, 0 };
+    int rc = CHATGPT_OK;
+    
+    if (!s || !c || !name || cdc_manifest_path(s, name, mpath, sizeof(mpath)) != 0) return CHATGPT_ERR_INVALID_ARG;
+    if (jb_messages(&body, c) != 0) rc = CHATGPT_ERR_OOM;
+    if (body.failed) rc = CHATGPT_ERR_OOM;
+    jb_lit(&man, CDC_MANIFEST_MAGIC);
+    
+    const unsigned char *p = (const unsigned char*)body.d;
+    for (size_t off = 0; rc == CHATGPT_OK && off < body.n; ) {
+        size_t n = cdc_cut(s->gear, p + off, body.n - off);
+        sha256(p + off, n, digest);
+        cdc_hex(digest, hex);
+        cdc_chunk_path(s, hex, cpath, sizeof(cpath));
+        
+        // Present with the right size: already stored (the name is its content's hash)
+        FILE *f = fopen(cpath, "rb");
+        long have = -1;
+        if (f) {
+            if (fseek(f, 0, SEEK_END) == 0) have = ftell(f);
+            fclose(f);
+        }
+        if (have == (long)n) {
+            s->stats.chunks_reused++;
+            s->stats.bytes_reused += n;
+        } else {
+            char fan[1100];
+            snprintf(fan, sizeof(fan), "%s/chunks/%.2s", s->dir, hex);
+            cdc_mkdir(fan);
+            rc = write_file_atomic(cpath, (const char*)p + off, n);
+            s->stats.chunks_written++;
+            s->stats.bytes_written += n;
+        }
+        
+        char line[96];
+        snprintf(line, sizeof(line), "%s %lu\n", hex, (unsigned long)n);
+        jb_lit(&man, line);
+        off += n;
+    }
+    free(body.d);
+    
+    // The manifest goes last, once everything it names is on disk
+    if (rc == CHATGPT_OK) {
+        char trailer[CRC_TRAILER_LEN + 1];
+        snprintf(trailer, sizeof(trailer), CRC_TRAILER "%08x\n", man.failed ? 0u : (unsigned)crc32c(man.d, man.n));
+        jb_lit(&man, trailer);
+        rc = man.failed ? CHATGPT_ERR_OOM : write_file_atomic(mpath, man.d, man.n);
+    }
+    free(man.d);
+    if (rc == CHATGPT_ERR_IO) set_error(c, rc, "Cannot write to chunk store");
+    return rc;
+}
+
+/*
+ * Load a conversation saved with chatgpt_chunk_store_save, replacing its messages
+ * Every chunk is checked against its hash; on failure the conversation is left untouched
+ * Usage: chatgpt_chunk_store_load(s, conv, "ticket-4711");
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_IO if missing or corrupt, other error code on failure
+ */
+int chatgpt_chunk_store_load(ChatGPTChunkStore *s, ChatGPTConversation *c, const char *name) {
+    char mpath[1024], cpath[1100], hex[65];
+    unsigned char digest[32];
+    struct jbuf body = { NULL, 0, 0, 0 };
+    size_t len, listed;
+    int rc;
+    
+    if (!s || !c || !name || cdc_manifest_path(s, name, mpath, sizeof(mpath)) != 0) return CHATGPT_ERR_INVALID_ARG;
+    char *man = read_file(mpath, &len, &rc);
+    if (!man) return rc;
+    if (crc_check(man, len, &listed) != 1 || strncmp(man, CDC_MANIFEST_MAGIC, strlen(CDC_MANIFEST_MAGIC)) != 0) {
+        free(man);
+        set_error(c, CHATGPT_ERR_IO, "Chunk store manifest is corrupt");
+        return CHATGPT_ERR_IO;
+    }
+    man[listed] = '\0';
+    
+    // Reassemble the messages JSON chunk by chunk
+    rc = CHATGPT_OK;
+    for (char *line = man + strlen(CDC_MANIFEST_MAGIC); rc == CHATGPT_OK && *line; ) {
+        char *nl = strchr(line, '\n');
+        unsigned long n;
+        if (!nl || sscanf(line, "%64[0-9a-f] %lu", hex, &n) != 2 || strlen(hex) != 64) {
+            rc = CHATGPT_ERR_IO;
+            break;
+        }
+        line = nl + 1;
+        
+        cdc_chunk_path(s, hex, cpath, sizeof(cpath));
+        size_t got;
+        char *chunk = read_file(cpath, &got, &rc);
+        if (!chunk) break;
+        sha256(chunk, got, digest);
+        char want[65];
+        cdc_hex(digest, want);
+        if (got != n || strcmp(want, hex) != 0) rc = CHATGPT_ERR_IO;
+        else jb_put(&body, chunk, got);
+        free(chunk);
+    }
+    free(man);
+    if (rc == CHATGPT_OK && body.failed) rc = CHATGPT_ERR_OOM;
+    if (rc == CHATGPT_OK) rc = set_messages_json(c, body.d ? body.d : "[]", body.n ? body.n : 2);
+    free(body.d);
+    if (rc == CHATGPT_ERR_IO) set_error(c, rc, "Chunk store data is missing or corrupt");
+    return rc;
+}
+
+/*
+ * Get a chunk store's write counters since it was opened
+ * Usage: ChatGPTChunkStats st; chatgpt_chunk_store_stats(s, &st);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_chunk_store_stats(const ChatGPTChunkStore *s, ChatGPTChunkStats *out) {
+    if (!s || !out) return CHATGPT_ERR_INVALID_ARG;
+    *out = s->stats;
+    return CHATGPT_OK;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃             MESSAGEPACK ENCODING              ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Conversations as MessagePack, for passing between processes and storing without JSON text:
+ *   {"model": str | nil, "messages": [[role, content], ...]}
+ * "model" comes first and "messages" last. Every string is length-prefixed, so a reader
+ * hands out role and content as pointers into the buffer instead of copying them. JSON is
+ * produced only where a request actually needs it (chatgpt_msgpack_to_json)
+ */
+
+/*
+ * Write a string, array or map header; tag16 is the 16-bit form (0xda, 0xdc, 0xde), the
+ * 32-bit form follows it, and only strings have an 8-bit form (0xd9)
+ */
+static void mp_head(struct jbuf *b, unsigned char fix, unsigned char tag16, size_t n) {
+    unsigned char h[5];
+    size_t hl;
+    
+    if (n < (tag16 == 0xda ? 32u : 16u)) {
+        h[0] = (unsigned char)(fix | n);
+        hl = 1;
+    } else if (tag16 == 0xda && n < 256) {
+        h[0] = 0xd9;
+        h[1] = (unsigned char)n;
+        hl = 2;
+    } else if (n < 65536) {
+        h[0] = tag16;
+        h[1] = (unsigned char)(n >> 8);
+        h[2] = (unsigned char)n;
+        hl = 3;
+    } else {
+        h[0] = (unsigned char)(tag16 + 1);
+        h[1] = (unsigned char)(n >> 24);
+        h[2] = (unsigned char)(n >> 16);
+        h[3] = (unsigned char)(n >> 8);
+        h[4] = (unsigned char)n;
+        hl = 5;
+    }
+    jb_put(b, (const char*)h, hl);
+}
+
+static void mp_str(struct jbuf *b, const char *s, size_t n) {
+    mp_head(b, 0xa0, 0xda, n);
+    jb_put(b, s, n);
+}
+
+/*
+ * Read a string header and body
+ * Returns: 0 on success (*s, *n point into the buffer), -1 if malformed or not a string
+ */
+static int mp_read_str(const unsigned char **pp, const unsigned char *end, const char **s, size_t *n) {
+    const unsigned char *p = *pp;
+    size_t len;
+    
+    if (p >= end) return -1;
+    if ((*p & 0xe0) == 0xa0) {
+        len = *p++ & 0x1f;
+    } else if (*p == 0xd9 && end - p >= 2) {
+        len = p[1];
+        p += 2;
+    } else if (*p == 0xda && end - p >= 3) {
+        len = (size_t)p[1] << 8 | p[2];
+        p += 3;
+    } else if (*p == 0xdb && end - p >= 5) {
+        len = (size_t)p[1] << 24 | (size_t)p[2] << 16 | (size_t)p[3] << 8 | p[4];
+        p += 5;
+    } else {
+        return -1;
+    }
+    if ((size_t)(end - p) < len) return -1;
+    *s = (const char*)p;
+    *n = len;
+    *pp = p + len;
+    return 0;
+}
+
+/*
+ * Read an array or map header (fix, 16 and 32-bit forms; tag16 is 0xdc or 0xde)
+ * Returns: 0 on success with the element count in *n, -1 otherwise
+ */
+static int mp_read_head(const unsigned char **pp, const unsigned char *end, unsigned char fix,
+                        unsigned char tag16, size_t *n) {
+    const unsigned char *p = *pp;
+    
+    if (p >= end) return -1;
+    if ((*p & 0xf0) == fix) {
+        *n = *p & 0x0f;
+        *pp = p + 1;
+    } else if (*p == tag16 && end - p >= 3) {
+        *n = (size_t)p[1] << 8 | p[2];
+        *pp = p + 3;
+    } else if (*p == tag16 + 1 && end - p >= 5) {
+        *n = (size_t)p[1] << 24 | (size_t)p[2] << 16 | (size_t)p[3] << 8 | p[4];
+        *pp = p + 5;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Encode a conversation's model and messages as MessagePack
+ * Usage: char *buf; size_t len; chatgpt_msgpack_encode(conv, &buf, &len); ... free(buf);
+ * Returns: CHATGPT_OK on success (*out is malloc'd), error code on failure
+ */
+int chatgpt_msgpack_encode(const ChatGPTConversation *c, char **out, size_t *len) {
+    if (!c || !out || !len) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Strings are copied as they are, so the size is known up front (headers at most 5 bytes)
+    size_t need = 32 + (c->model ? strlen(c->model) : 0);
+    for (size_t i = 0; i < c->message_count; i++) {
+        const ChatGPTMessage *m = &c->messages[i];
+        need += 11 + (m->role ? strlen(m->role) : 4);
+        if (m->interned) need += ((const struct intern*)m->interned)->len;
+        else if (m->packed) {
+            uint32_t raw;
+            memcpy(&raw, m->packed, sizeof(raw));
+            need += raw;
+        }
+        else need += strlen(m->content ? m->content : "");
+    }
+    struct jbuf b = { NULL, 0, 0, 0 };
+    jb_reserve(&b, need);
+    
+    mp_head(&b, 0x80, 0xde, 2);
+    mp_str(&b, "model", 5);
+    if (c->model) mp_str(&b, c->model, strlen(c->model));
+    else jb_put(&b, "\xc0", 1);
+    mp_str(&b, "messages", 8);
+    mp_head(&b, 0x90, 0xdc, c->message_count);
+    for (size_t i = 0; i < c->message_count; i++) {
+        const ChatGPTMessage *m = &c->messages[i];
+        const char *role = m->role ? m->role : "user";
+        
+        jb_put(&b, "\x92", 1);
+        mp_str(&b, role, strlen(role));
+        if (m->interned) {
+            const struct intern *e = (const struct intern*)m->interned;
+            mp_str(&b, e->text, e->len);
+        } else {
+            char *tmp;
+            const char *text = msg_text(m, &tmp);
+            if (!text) {
+                free(b.d);
+                return CHATGPT_ERR_OOM;
+            }
+            mp_str(&b, text, strlen(text));
+            free(tmp);
+        }
+    }
+    if (b.failed) {
+        free(b.d);
+        return CHATGPT_ERR_OOM;
+    }
+    *out = b.d;
+    *len = b.n;
+    return CHATGPT_OK;
+}
+
+/*
+ * Start reading a MessagePack conversation without copying it
+ * The buffer must stay alive and unchanged while the reader and its views are used
+ * Usage: ChatGPTMsgpackReader r; ChatGPTMessageView v;
+ *        if (chatgpt_msgpack_open(&r, buf, len) == CHATGPT_OK)
+ *            while (chatgpt_msgpack_next(&r, &v) > 0) handle(v.role, v.role_len, v.content, v.content_len);
+ * Returns: CHATGPT_OK on success (model and count filled in), error code on failure
+ */
+int chatgpt_msgpack_open(ChatGPTMsgpackReader *r, const void *buf, size_t len) {
+    if (!r || (!buf && len)) return CHATGPT_ERR_INVALID_ARG;
+    
+    const unsigned char *p = (const unsigned char*)buf, *end = p + len;
+    size_t keys;
+    memset(r, 0, sizeof(*r));
+    if (mp_read_head(&p, end, 0x80, 0xde, &keys) != 0) return CHATGPT_ERR_JSON_PARSE;
+    
+    for (size_t k = 0; k < keys; k++) {
+        const char *key;
+        size_t key_len;
+        if (mp_read_str(&p, end, &key, &key_len) != 0) return CHATGPT_ERR_JSON_PARSE;
+        
+        if (key_len == 5 && memcmp(key, "model", 5) == 0) {
+            if (p < end && *p == 0xc0) p++;
+            else if (mp_read_str(&p, end, &r->model, &r->model_len) != 0) return CHATGPT_ERR_JSON_PARSE;
+        } else if (key_len == 8 && memcmp(key, "messages", 8) == 0 && k == keys - 1) {
+            if (mp_read_head(&p, end, 0x90, 0xdc, &r->count) != 0) return CHATGPT_ERR_JSON_PARSE;
+            r->p = p;
+            r->end = end;
+            return CHATGPT_OK;
+        } else {
+            return CHATGPT_ERR_JSON_PARSE;
+        }
+    }
+    return CHATGPT_ERR_JSON_PARSE;
+}
+
+/*
+ * Read the next message as pointers into the buffer (strings are not NUL-terminated)
+ * Returns: 1 if a message was read, 0 after the last one, negative error code if malformed
+ */
+int chatgpt_msgpack_next(ChatGPTMsgpackReader *r, ChatGPTMessageView *m) {
+    if (!r || !m) return -CHATGPT_ERR_INVALID_ARG;
+    if (r->index == r->count) return 0;
+    
+    const unsigned char *p = (const unsigned char*)r->p, *end = (const unsigned char*)r->end;
+    if (p >= end || *p != 0x92 ||
+        (p++, mp_read_str(&p, end, &m->role, &m->role_len)) != 0 ||
+        mp_read_str(&p, end, &m->content, &m->content_len) != 0) {
+        return -CHATGPT_ERR_JSON_PARSE;
+    }
+    r->p = p;
+    r->index++;
+    return 1;
+}
+
+/*
+ * Replace a conversation's messages (and model, if the data has one) with MessagePack data
+ * The data is checked completely first: on failure the conversation is left untouched
+ * Usage: chatgpt_msgpack_load(conv, buf, len);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_msgpack_load(ChatGPTConversation *c, const void *buf, size_t len) {
+    ChatGPTMsgpackReader r, first;
+    ChatGPTMessageView v;
+    int rc;
+    
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    rc = chatgpt_msgpack_open(&r, buf, len);
+    if (rc != CHATGPT_OK) return rc;
+    
+    // Validate everything (C strings cannot hold NUL bytes) before changing anything
+    first = r;
+    while ((rc = chatgpt_msgpack_next(&r, &v)) > 0) {
+        if (memchr(v.role, 0, v.role_len) || memchr(v.content, 0, v.content_len)) return CHATGPT_ERR_JSON_PARSE;
+    }
+    if (rc < 0 || (r.model && memchr(r.model, 0, r.model_len))) return CHATGPT_ERR_JSON_PARSE;
+    
+    if (r.model) {
+        char *model = (char*)malloc(r.model_len + 1);
+        if (!model) return CHATGPT_ERR_OOM;
+        memcpy(model, r.model, r.model_len);
+        model[r.model_len] = '\0';
+        rc = chatgpt_set_model(c, model);
+        free(model);
+        if (rc != CHATGPT_OK) return rc;
+    }
+    chatgpt_clear_messages(c);
+    rc = ensure_cap(c, r.count);
+    
+    r = first;
+    while (rc == CHATGPT_OK && chatgpt_msgpack_next(&r, &v) > 0) {
+        rc = add_message_n(c, v.role, v.role_len, v.content, v.content_len);
+    }
+    return rc;
+}
+
+/*
+ * Turn MessagePack conversation data straight into the messages JSON array sent to the API
+ * (the text chatgpt_build_messages_json would produce for the same conversation)
+ * Usage: char *json; chatgpt_msgpack_to_json(buf, len, &json); ... free(json);
+ * Returns: CHATGPT_OK on success (*json is malloc'd), error code on failure
+ */
+int chatgpt_msgpack_to_json(const void *buf, size_t len, char **json) {
+    ChatGPTMsgpackReader r;
+    ChatGPTMessageView v;
+    
+    if (!json) return CHATGPT_ERR_INVALID_ARG;
+    int rc = chatgpt_msgpack_open(&r, buf, len);
+    if (rc != CHATGPT_OK) return rc;
+    
+    struct jbuf b = { NULL, 0, 0, 0 };
+    jb_reserve(&b, len + len / 8 + 32 * r.count + 3);
+    jb_lit(&b, "[");
+    while ((rc = chatgpt_msgpack_next(&r, &v)) > 0) {
+        size_t need = json_quoted_len(v.role, v.role_len) + json_quoted_len(v.content, v.content_len) + 24;
+        char *p = jb_reserve(&b, need);
+        if (!p) break;
+        memcpy(p, r.index > 1 ? ",{\"role\":" : "{\"role\":", r.index > 1 ? 9 : 8);
+        p += r.index > 1 ? 9 : 8;
+        p = json_quote(p, v.role, v.role_len);
+        memcpy(p, ",\"content\":", 11);
+        p = json_quote(p + 11, v.content, v.content_len);
+        *p++ = '}';
+        b.n = (size_t)(p - b.d);
+    }
+    jb_lit(&b, "]");
+    if (rc < 0 || b.failed) {
+        free(b.d);
+        return rc < 0 ? -rc : CHATGPT_ERR_OOM;
+    }
+    b.d[b.n] = '\0';
+    *json = b.d;
+    return CHATGPT_OK;
+}
+
+/* 
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃                  CHANGE FEED                  ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Set (or with fn NULL, remove) the callback that receives a delta record for every change
+ * that shapes the conversation's requests: message add, remove/pop, clear, replace and
+ * append, and model, template and request parameter changes. Records are numbered
+ * by c->change_seq and are only valid during the call; a replica applies them in order with
+ * chatgpt_apply_change to stay identical to this conversation
+ * Usage: chatgpt_set_change_feed(conv, ship_to_peer, peer);
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_INVALID_ARG if c is NULL
+ */
+int chatgpt_set_change_feed(ChatGPTConversation *c, ChatGPTChangeFn fn, void *user_data) {
+    if (!c) return CHATGPT_ERR_INVALID_ARG;
+    c->change_fn = fn;
+    c->change_ud = user_data;
+    return CHATGPT_OK;
+}
+
+/*
+ * Build a snapshot record: everything that shapes the conversation's requests (template
+ * messages, request parameters, model and messages) as of change_seq, for seeding a new
+ * replica or resynchronizing one that missed records
+ * Record: op byte, varint seq, varint-length-prefixed template and parameters, MessagePack
+ * Usage: chatgpt_change_snapshot(conv, &rec, &len); send(rec, len); free(rec);
+ * Returns: CHATGPT_OK on success (*record is malloc'd), error code on failure
+ */
+int chatgpt_change_snapshot(const ChatGPTConversation *c, void **record, size_t *len) {
+    char *mp;
+    size_t n;
+    
+    if (!c || !record || !len) return CHATGPT_ERR_INVALID_ARG;
+    int rc = chatgpt_msgpack_encode(c, &mp, &n);
+    if (rc != CHATGPT_OK) return rc;
+    
+    unsigned char *rec = (unsigned char*)malloc(1 + 3 * 10 + c->template_json_len + PARAMS_LEN + n);
+    if (!rec) {
+        free(mp);
+        return CHATGPT_ERR_OOM;
+    }
+    rec[0] = DELTA_SNAPSHOT;
+    unsigned char *p = put_varint(rec + 1, c->change_seq);
+    p = put_varint(p, c->template_json_len);
+    if (c->template_json_len) memcpy(p, c->template_json, c->template_json_len);
+    p += c->template_json_len;
+    p = put_varint(p, PARAMS_LEN);
+    params_put(c, p);
+    p += PARAMS_LEN;
+    memcpy(p, mp, n);
+    free(mp);
+    
+    *record = rec;
+    *len = (size_t)(p - rec) + n;
+    return CHATGPT_OK;
+}
+
+// Read a LEB128 varint; returns the position after it, NULL if malformed or truncated
+static const unsigned char *get_varint(const unsigned char *p, const unsigned char *end, uint64_t *v) {
+    uint64_t x = 0;
+    for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char b = *p++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = x;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Read a varint-length-prefixed byte string; returns the position after it or NULL
+static const unsigned char *get_bytes(const unsigned char *p, const unsigned char *end,
+                                      const char **s, size_t *n) {
+    uint64_t len;
+    p = p ? get_varint(p, end, &len) : NULL;
+    if (!p || len > (uint64_t)(end - p)) return NULL;
+    *s = (const char*)p;
+    *n = (size_t)len;
+    return p + len;
+}
+
+// Read a varint-length-prefixed string without NUL bytes; returns the position after it or NULL
+static const unsigned char *get_text(const unsigned char *p, const unsigned char *end,
+                                     const char **s, size_t *n) {
+    p = get_bytes(p, end, s, n);
+    return p && !memchr(*s, 0, *n) ? p : NULL;
+}
+
+// Copy of a template JSON operand, NULL for an empty one; returns 0 or -1 when out of memory
+static int template_dup(const char *a, size_t an, char **out) {
+    *out = NULL;
+    if (!an) return 0;
+    if (!(*out = (char*)malloc(an + 1))) return -1;
+    memcpy(*out, a, an);
+    (*out)[an] = '\0';
+    return 0;
+}
+
+/*
+ * Apply a delta record from another conversation's change feed
+ * Records must arrive in sequence: ones at or below c->change_seq are duplicates and are
+ * ignored, a jump past change_seq + 1 means records were lost and needs a snapshot record.
+ * Snapshot records are always applied and set change_seq to theirs. Applied records are
+ * passed on to this conversation's own change feed, so replicas can be chained
+ * Usage: if (chatgpt_apply_change(replica, rec, len) == CHATGPT_ERR_STATE) request_snapshot();
+ * Returns: CHATGPT_OK on success (or duplicate), CHATGPT_ERR_STATE on a sequence gap,
+ *          CHATGPT_ERR_JSON_PARSE if the record is malformed or does not fit the conversation
+ */
+int chatgpt_apply_change(ChatGPTConversation *c, const void *record, size_t len) {
+    const unsigned char *p = (const unsigned char*)record, *end = p + len;
+    const char *a = NULL, *b = NULL;
+    size_t an = 0, bn = 0;
+    uint64_t seq, idx = 0;
+    
+    if (!c || !record) return CHATGPT_ERR_INVALID_ARG;
+    if (len < 2) return CHATGPT_ERR_JSON_PARSE;
+    int op = *p;
+    p = get_varint(p + 1, end, &seq);
+    if (!p) return CHATGPT_ERR_JSON_PARSE;
+    
+    if (op == DELTA_SNAPSHOT) {
+        const char *prm;
+        size_t prn;
+        char *tmpl;
+        
+        p = get_text(p, end, &a, &an);
+        p = get_bytes(p, end, &prm, &prn);
+        if (!p || prn != PARAMS_LEN) return CHATGPT_ERR_JSON_PARSE;
+        
+        // Rebuild silently (parameters roll back if the rest fails), then pass the snapshot itself on
+        unsigned char old[PARAMS_LEN];
+        params_put(c, old);
+        if (params_get(c, (const unsigned char*)prm)) return CHATGPT_ERR_JSON_PARSE;
+        if (template_dup(a, an, &tmpl)) {
+            params_get(c, old);
+            return CHATGPT_ERR_OOM;
+        }
+        ChatGPTChangeFn fn = c->change_fn;
+        c->change_fn = NULL;
+        int rc = chatgpt_msgpack_load(c, p, (size_t)(end - p));
+        if (rc == CHATGPT_OK) {
+            template_replace(c, tmpl, an);
+        } else {
+            free(tmpl);
+            params_get(c, old);
+        }
+        c->change_fn = fn;
+        if (rc != CHATGPT_OK) return rc;
+        c->change_seq = seq;
+        if (fn) fn(seq, record, len, c->change_ud);
+        return CHATGPT_OK;
+    }
+    
+    if (seq <= c->change_seq) return CHATGPT_OK;
+    if (seq != c->change_seq + 1) return CHATGPT_ERR_STATE;
+    
+    // Decode the operands and check them against the current messages
+    if (op == DELTA_REMOVE || op == DELTA_REPLACE || op == DELTA_APPEND) {
+        p = get_varint(p, end, &idx);
+        if (!p || idx >= c->message_count) return CHATGPT_ERR_JSON_PARSE;
+    }
+    if (op == DELTA_ADD || op == DELTA_REPLACE || op == DELTA_APPEND || op == DELTA_MODEL ||
+        op == DELTA_TEMPLATE) {
+        p = get_text(p, end, &a, &an);
+    }
+    if (op == DELTA_ADD) p = get_text(p, end, &b, &bn);
+    if (op == DELTA_PARAMS) {
+        p = get_bytes(p, end, &a, &an);
+        if (p && an != PARAMS_LEN) return CHATGPT_ERR_JSON_PARSE;
+    }
+    if (!p || p != end) return CHATGPT_ERR_JSON_PARSE;
+    
+    switch (op) {
+        case DELTA_ADD:
+            return add_message_n(c, a, an, b, bn);
+        case DELTA_CLEAR:
+            return chatgpt_clear_messages(c);
+        case DELTA_REMOVE:
+            return chatgpt_remove_message_at(c, (size_t)idx);
+        case DELTA_REPLACE:
+            return msg_replace(c, (size_t)idx, a, an);
+        case DELTA_APPEND:
+            return msg_append(c, (size_t)idx, a, an);
+        case DELTA_MODEL: {
+            char *m = (char*)malloc(an + 1);
+            if (!m) return CHATGPT_ERR_OOM;
+            memcpy(m, a, an);
+            m[an] = '\0';
+            int rc = chatgpt_set_model(c, m);
+            free(m);
+            return rc;
+        }
+        case DELTA_TEMPLATE: {
+            char *t;
+            if (template_dup(a, an, &t)) return CHATGPT_ERR_OOM;
+            template_replace(c, t, an);
+            return CHATGPT_OK;
+        }
+        case DELTA_PARAMS:
+            if (params_get(c, (const unsigned char*)a)) return CHATGPT_ERR_JSON_PARSE;
+            delta_emit_params(c);
+            return CHATGPT_OK;
+        default:
+            return CHATGPT_ERR_JSON_PARSE;
+    }
+}
+
+/* 
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃            HTTP RESPONSE HANDLING             ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Structure for accumulating HTTP response data
+ * Used by the transports to collect response data in chunks
+ */
+struct wb {
+    char *d;    // Data buffer
+    size_t n;   // Current size
+};
+
+/*
+ * Response sink that accumulates the body in a growing buffer
+ * Called by the transport for each chunk of response data received
+ * Internal function used by HTTP requests
+ */
+static size_t write_cb(const char *ptr, size_t need, void *ud) {
+    struct wb *w = (struct wb*)ud;
+    
+    // Reallocate buffer to fit new data
+    char *p = realloc(w->d, w->n + need + 1);
+    if (!p) return 0;  // Signal error to the transport
+    
+    // Copy new data and update buffer
+    w->d = p;
+    memcpy(w->d + w->n, ptr, need);
+    w->n += need;
+    w->d[w->n] = '\0';  // Ensure null termination
+    
+    return need;  // Return bytes processed
+}
+
+/*
+ * Adapter between curl's write callback layout and a chatgpt_sink_fn
+ * Lets the curl-based helpers reuse the same sinks as the transports
+ */
+struct curl_sink {
+    chatgpt_sink_fn fn;  // Sink to forward to
+    void *ud;            // Sink's user data
+};
+
+static size_t curl_sink_cb(char *ptr, size_t sz, size_t nm, void *ud) {
+    struct curl_sink *s = (struct curl_sink*)ud;
+    return s->fn(ptr, sz * nm, s->ud);
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃              SHARED CURL STATE                ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Process-wide curl share: DNS cache, TLS sessions and the connection cache
+ * Every easy handle the library creates is attached to it, so a request reuses
+ * the resolved address, resumes the TLS session and picks up the idle connection
+ * of whichever conversation or thread went before it
+ */
+static CURLSH *g_share = NULL;
+
+/*
+ * Library locks: one per curl lock-data type, then the library's own
+ */
+#define LOCK_CATALOG CURL_LOCK_DATA_LAST         // Model catalog cache
+#define LOCK_CASSETTE (CURL_LOCK_DATA_LAST + 1)  // g_cassette and cassette reference counts
+#define LOCK_TLS_FILE (CURL_LOCK_DATA_LAST + 2)  // g_tls_session_file and writes to it
+#define LOCK_COUNT (CURL_LOCK_DATA_LAST + 3)
+
+#ifdef _WIN32
+static CRITICAL_SECTION g_locks[LOCK_COUNT];
+static INIT_ONCE g_share_once = INIT_ONCE_STATIC_INIT;
+#else
+static pthread_mutex_t g_locks[LOCK_COUNT];
+static pthread_once_t g_share_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void lib_lock(int i) {
+#ifdef _WIN32
+    EnterCriticalSection(&g_locks[i]);
+#else
+    pthread_mutex_lock(&g_locks[i]);
+#endif
+}
+
+static void lib_unlock(int i) {
+#ifdef _WIN32
+    LeaveCriticalSection(&g_locks[i]);
+#else
+    pthread_mutex_unlock(&g_locks[i]);
+#endif
+}
+
+static void share_lock(CURL *h, curl_lock_data d, curl_lock_access a, void *ud) {
+    (void)h; (void)a; (void)ud;
+    lib_lock((int)d);
+}
+
+static void share_unlock(CURL *h, curl_lock_data d, void *ud) {
+    (void)h; (void)ud;
+    lib_unlock((int)d);
+}
+
+/*
+ * One-time libcurl setup: global init (not thread-safe, so it runs exactly once) and the share
+ */
+static void curl_shared_init(void) {
+    curl_global_init(CURL_GLOBAL_ALL);
+    
+    for (int i = 0; i < LOCK_COUNT; i++) {
+#ifdef _WIN32
+        InitializeCriticalSection(&g_locks[i]);
+#else
+        pthread_mutex_init(&g_locks[i], NULL);
+#endif
+    }
+    
+    g_share = curl_share_init();
+    if (!g_share) return;
+    curl_share_setopt(g_share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(g_share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(g_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK curl_shared_init_once(PINIT_ONCE o, PVOID p, PVOID *ctx) {
+    (void)o; (void)p; (void)ctx;
+    curl_shared_init();
+    return TRUE;
+}
+#endif
+
+static void curl_shared_once(void) {
+#ifdef _WIN32
+    InitOnceExecuteOnce(&g_share_once, curl_shared_init_once, NULL, NULL);
+#else
+    pthread_once(&g_share_once, curl_shared_init);
+#endif
+}
+
+/*
+ * Create a curl easy handle attached to the process-wide share
+ * TCP keepalive probes stop NATs and load balancers from dropping idle pooled connections
+ * Returns: Handle (free with curl_easy_cleanup) or NULL on error
+ */
+static CURL *curl_handle_new(void) {
+    curl_shared_once();
+    
+    CURL *h = curl_easy_init();
+    if (!h) return NULL;
+    if (g_share) curl_easy_setopt(h, CURLOPT_SHARE, g_share);
+    curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(h, CURLOPT_TCP_KEEPIDLE, 30L);
+    curl_easy_setopt(h, CURLOPT_TCP_KEEPINTVL, 15L);
+    curl_easy_setopt(h, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    return h;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃                    WARMUP                     ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Warmup opens connections ahead of the first request by sending GET /v1/models
+ * over several handles at once through the shared curl state: DNS, TCP, TLS and
+ * ALPN/HTTP/2 are all done when the first chat request arrives, and the response
+ * doubles as the model catalog. A background thread repeats the pass so idle
+ * connections are not closed by the server
+ */
+#define WARMUP_PING_SEC 45      // Interval between keep-alive passes
+#define WARMUP_MAX_CONNS 64     // Connections per endpoint upper bound
+
+static char *g_catalog = NULL;      // Cached GET /v1/models response body
+static char *g_catalog_key = NULL;  // API key the catalog was fetched with
+
+/*
+ * Cache a model catalog if it is well-formed (takes ownership of body)
+ */
+static void catalog_store(const char *key, char *body) {
+    cJSON *j = cJSON_Parse(body);
+    int ok = j && cJSON_IsArray(cJSON_GetObjectItemCaseSensitive(j, "data"));
+    cJSON_Delete(j);
+    
+    char *k = ok ? dup_str(key) : NULL;
+    if (!k) {
+        free(body);
+        return;
+    }
+    lib_lock(LOCK_CATALOG);
+    free(g_catalog);
+    free(g_catalog_key);
+    g_catalog = body;
+    g_catalog_key = k;
+    lib_unlock(LOCK_CATALOG);
+}
+
+/*
+ * Copy of the cached catalog fetched with this key, or NULL
+ */
+static char *catalog_get(const char *key) {
+    char *copy = NULL;
+    
+    curl_shared_once();
+    lib_lock(LOCK_CATALOG);
+    if (g_catalog && strcmp(g_catalog_key, key) == 0) copy = dup_str(g_catalog);
+    lib_unlock(LOCK_CATALOG);
+    return copy;
+}
+
+/*
+ * One warmup pass: n_conns concurrent GET /v1/models per endpoint
+ * key is warmup's own copy of the API key ("" for none), never g_api_key itself
+ * Returns: Number of handles that got an HTTP response (i.e. a live connection)
+ */
+static int warm_pass(char **urls, int n_conns, const char *key) {
+    struct curl_slist *hdr = NULL;
+    int n_urls = 0, warmed = 0, stored = 0;
+    
+    while (urls[n_urls]) n_urls++;
+    int total = n_urls * n_conns;
+    CURL **hs = (CURL**)calloc((size_t)total, sizeof(CURL*));
+    struct wb *bodies = (struct wb*)calloc((size_t)total, sizeof(struct wb));
+    struct curl_sink *sinks = (struct curl_sink*)calloc((size_t)total, sizeof(struct curl_sink));
+    CURLM *m = curl_multi_init();
+    
+    if (!hs || !bodies || !sinks || !m) {
+        free(hs); free(bodies); free(sinks);
+        if (m) curl_multi_cleanup(m);
+        return 0;
+    }
+    
+    // The catalog needs the key; without one the 401 still leaves a warm connection
+    if (key[0]) {
+        char auth[512];
+        snprintf(auth, sizeof(auth), "Authorization: Bearer %s", key);
+        hdr = curl_slist_append(hdr, auth);
+    }
+    
+    for (int i = 0; i < total; i++) {
+        char url[512];
+        
+        hs[i] = curl_handle_new();
+        if (!hs[i]) continue;
+        sinks[i].fn = write_cb;
+        sinks[i].ud = &bodies[i];
+        snprintf(url, sizeof(url), "%s/v1/models", urls[i / n_conns]);
+        curl_easy_setopt(hs[i], CURLOPT_URL, url);
+        curl_easy_setopt(hs[i], CURLOPT_HTTPHEADER, hdr);
+        curl_easy_setopt(hs[i], CURLOPT_WRITEFUNCTION, curl_sink_cb);
+        curl_easy_setopt(hs[i], CURLOPT_WRITEDATA, (void*)&sinks[i]);
+        curl_easy_setopt(hs[i], CURLOPT_CONNECTTIMEOUT_MS, 5000L);
+        curl_easy_setopt(hs[i], CURLOPT_TIMEOUT_MS, 15000L);
+        curl_multi_add_handle(m, hs[i]);
+    }
+    
+    // Drive all handles to completion
+    int running = 1;
+    while (running) {
+        if (curl_multi_perform(m, &running) != CURLM_OK) break;
+        if (running) curl_multi_wait(m, NULL, 0, 1000, NULL);
+    }
+    
+    for (int i = 0; i < total; i++) {
+        long code = 0;
+        
+        if (!hs[i]) continue;
+        curl_easy_getinfo(hs[i], CURLINFO_RESPONSE_CODE, &code);
+        if (code) warmed++;
+        
+        // The first good catalog from the default endpoint is what chatgpt_get_available_models() serves
+        if (code == 200 && key[0] && !stored && bodies[i].d && strcmp(urls[i / n_conns], DEFAULT_BASE_URL) == 0) {
+            catalog_store(key, bodies[i].d);
+            stored = 1;
+            bodies[i].d = NULL;
+        }
+        free(bodies[i].d);
+        curl_multi_remove_handle(m, hs[i]);
+        curl_easy_cleanup(hs[i]);
+    }
+    
+    curl_multi_cleanup(m);
+    curl_slist_free_all(hdr);
+    free(hs);
+    free(bodies);
+    free(sinks);
+    return warmed;
+}
+
+static void free_str_list(char **list) {
+    if (!list) return;
+    for (char **p = list; *p; p++) free(*p);
+    free(list);
+}
+
+#ifndef _WIN32
+/*
+ * Keep-alive thread state
+ * The endpoint list only changes while the thread is stopped
+ */
+static pthread_mutex_t g_warm_mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_warm_cv = PTHREAD_COND_INITIALIZER;
+static pthread_t g_warm_thread;
+static int g_warm_state = 0;        // 0 = idle, 1 = running, 2 = stopping
+static char **g_warm_urls = NULL;   // NULL-terminated endpoint list
+static char *g_warm_key = NULL;     // Copy of the global API key taken by chatgpt_client_warmup
+static int g_warm_conns = 0;        // Connections per endpoint
+
+static void *warm_pinger(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_warm_mu);
+    while (g_warm_state == 1) {
+        struct timespec ts;
+        int rc = 0;
+        
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += WARMUP_PING_SEC;
+        while (g_warm_state == 1 && rc != ETIMEDOUT) rc = pthread_cond_timedwait(&g_warm_cv, &g_warm_mu, &ts);
+        if (g_warm_state != 1) break;
+        
+        pthread_mutex_unlock(&g_warm_mu);
+        warm_pass(g_warm_urls, g_warm_conns, g_warm_key);
+        pthread_mutex_lock(&g_warm_mu);
+    }
+    pthread_mutex_unlock(&g_warm_mu);
+    return NULL;
+}
+#endif
+
+/*
+ * Stop the keep-alive thread, if any
+ */
+static void warm_stop(void) {
+#ifndef _WIN32
+    pthread_mutex_lock(&g_warm_mu);
+    if (g_warm_state != 1) {
+        pthread_mutex_unlock(&g_warm_mu);
+        return;
+    }
+    g_warm_state = 2;
+    pthread_cond_signal(&g_warm_cv);
+    pthread_mutex_unlock(&g_warm_mu);
+    
+    pthread_join(g_warm_thread, NULL);
+    free_str_list(g_warm_urls);
+    free(g_warm_key);
+    g_warm_urls = NULL;
+    g_warm_key = NULL;
+    g_warm_state = 0;
+#endif
+}
+
+/*
+ * Prewarm connections and the model catalog before the first request
+ * endpoints: NULL-terminated list of base URLs (as for chatgpt_set_base_url), NULL for the default
+ * n_connections: Connections to open per endpoint (at least 1)
+ * Uses the global API key for the catalog, copied at the call: the keep-alive thread never
+ * reads the global, so a later chatgpt_set_api_key_global() takes effect at the next warmup.
+ * Calling it again replaces the previous endpoint set
+ * Usage: chatgpt_client_warmup(NULL, 4);
+ * Returns: CHATGPT_OK if at least one connection came up, error code otherwise
+ */
+int chatgpt_client_warmup(const char *const *endpoints, int n_connections) {
+    static const char *const defaults[] = { DEFAULT_BASE_URL, NULL };
+    size_t n = 0;
+    
+    if (n_connections < 0) return CHATGPT_ERR_INVALID_ARG;
+    if (n_connections == 0) n_connections = 1;
+    if (n_connections > WARMUP_MAX_CONNS) n_connections = WARMUP_MAX_CONNS;
+    if (!endpoints) endpoints = defaults;
+    while (endpoints[n]) n++;
+    if (n == 0) return CHATGPT_ERR_INVALID_ARG;
+    
+    // Private copies of the endpoint list and key for the keep-alive thread
+    char **urls = (char**)calloc(n + 1, sizeof(char*));
+    char *key = dup_str(g_api_key ? g_api_key : "");
+    if (!urls || !key) {
+        free(urls);
+        free(key);
+        return CHATGPT_ERR_OOM;
+    }
+    for (size_t i = 0; i < n; i++) {
+        urls[i] = dup_str(endpoints[i]);
+        if (!urls[i]) {
+            free_str_list(urls);
+            free(key);
+            return CHATGPT_ERR_OOM;
+        }
+    }
+    
+    warm_stop();
+    curl_shared_once();
+    int warmed = warm_pass(urls, n_connections, key);
+    if (g_log) {
+        char note[64];
+        snprintf(note, sizeof(note), "Warmup: %d connection(s) ready", warmed);
+        log_line(note);
+    }
+    
+#ifndef _WIN32
+    pthread_mutex_lock(&g_warm_mu);
+    g_warm_urls = urls;
+    g_warm_key = key;
+    g_warm_conns = n_connections;
+    g_warm_state = 1;
+    if (pthread_create(&g_warm_thread, NULL, warm_pinger, NULL) != 0) {
+        g_warm_state = 0;
+        g_warm_urls = NULL;
+        g_warm_key = NULL;
+        free_str_list(urls);
+        free(key);
+    }
+    pthread_mutex_unlock(&g_warm_mu);
+#else
+    free_str_list(urls);
+    free(key);
+#endif
+    
+    return warmed > 0 ? CHATGPT_OK : CHATGPT_ERR_HTTP;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃                  TRANSPORTS                   ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Free a transport created by one of the chatgpt_transport_*_new() functions
+ * The shared curl transport is never freed
+ * Usage: chatgpt_transport_free(t);
+ */
+void chatgpt_transport_free(ChatGPTTransport *t) {
+    if (t && t->destroy) t->destroy(t);
+}
+
+#define RETRY_AFTER_MAX_MS 60000  // Longest server-requested retry delay honoured
+
+/*
+ * Convert a Retry-After delay-seconds value to milliseconds, capped at RETRY_AFTER_MAX_MS
+ * Returns: Delay in milliseconds, or -1 if the value is not a number
+ */
+static long retry_after_ms_of(const char *v) {
+    char *end;
+    double secs = strtod(v, &end);
+    if (end == v || !(secs >= 0)) return -1;
+    return secs * 1000 < RETRY_AFTER_MAX_MS ? (long)(secs * 1000) : RETRY_AFTER_MAX_MS;
+}
+
+/*
+ * Whether a raw header line starts with the given name and a colon, ignoring case
+ * (HTTP/2 delivers header names in lowercase)
+ */
+static int header_line_is(const char *line, size_t len, const char *name) {
+    size_t nl = strlen(name);
+    if (len <= nl || line[nl] != ':') return 0;
+    for (size_t i = 0; i < nl; i++) {
+        char a = line[i], b = name[i];
+        if (a >= 'A' && a <= 'Z') a += 'a' - 'A';
+        if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+        if (a != b) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Per-request state of the curl transport
+ * Tracks the status so it is known before the first body byte reaches the sink
+ */
+struct curl_call {
+    CURL *curl;                   // Handle being performed
+    const ChatGPTRequest *req;    // Request being served
+    ChatGPTResponse *resp;        // Response metadata being filled in
+};
+
+static size_t curl_call_write(char *ptr, size_t sz, size_t nm, void *ud) {
+    struct curl_call *k = (struct curl_call*)ud;
+    
+    // Status is known once headers are in, publish it before the body
+    if (!k->resp->http_code) curl_easy_getinfo(k->curl, CURLINFO_RESPONSE_CODE, &k->resp->http_code);
+    return k->req->sink(ptr, sz * nm, k->req->sink_data);
+}
+
+static size_t curl_call_header(char *ptr, size_t sz, size_t nm, void *ud) {
+    struct curl_call *k = (struct curl_call*)ud;
+    size_t n = sz * nm;
+    
+    // Only delay-seconds is supported, HTTP-date values are ignored
+    if (header_line_is(ptr, n, "Retry-After")) {
+        char tmp[32];
+        size_t m = n - 12 < sizeof(tmp) - 1 ? n - 12 : sizeof(tmp) - 1;
+        memcpy(tmp, ptr + 12, m);
+        tmp[m] = '\0';
+        long ms = retry_after_ms_of(tmp);
+        if (ms >= 0) k->resp->retry_after_ms = ms;
+    }
+    return n;
+}
+
+/*
+ * POST through libcurl (default transport)
+ */
+static int curl_transport_post(ChatGPTTransport *self, const ChatGPTRequest *req, ChatGPTResponse *resp) {
+    struct curl_slist *hdr = NULL; // HTTP headers
+    struct curl_call k;            // Callback state
+    CURLcode rc;                   // Curl result code
+    
+    (void)self;
+    
+    // Initialize curl
+    k.curl = curl_handle_new();
+    if (!k.curl) {
+        snprintf(resp->error, sizeof(resp->error), "Failed to initialize curl");
+        return -1;
+    }
+    k.req = req;
+    k.resp = resp;
+    
+    // Set up HTTP headers
+    for (size_t i = 0; i < req->header_count; i++) {
+        hdr = curl_slist_append(hdr, req->headers[i]);
+    }
+    
+    // Configure curl options
+    curl_easy_setopt(k.curl, CURLOPT_URL, req->url);
+    curl_easy_setopt(k.curl, CURLOPT_HTTPHEADER, hdr);
+    curl_easy_setopt(k.curl, CURLOPT_POSTFIELDS, req->body);
+    curl_easy_setopt(k.curl, CURLOPT_POSTFIELDSIZE, (long)req->body_len);
+    curl_easy_setopt(k.curl, CURLOPT_WRITEFUNCTION, curl_call_write);
+    curl_easy_setopt(k.curl, CURLOPT_WRITEDATA, (void*)&k);
+    curl_easy_setopt(k.curl, CURLOPT_HEADERFUNCTION, curl_call_header);
+    curl_easy_setopt(k.curl, CURLOPT_HEADERDATA, (void*)&k);
+    
+    // Perform the HTTP request
+    rc = curl_easy_perform(k.curl);
+    curl_easy_getinfo(k.curl, CURLINFO_RESPONSE_CODE, &resp->http_code);
+    if (rc != CURLE_OK) snprintf(resp->error, sizeof(resp->error), "%s", curl_easy_strerror(rc));
+    
+    // Cleanup curl resources
+    curl_slist_free_all(hdr);
+    curl_easy_cleanup(k.curl);
+    
+    return rc == CURLE_OK ? 0 : -1;
+}
+
+static ChatGPTTransport g_curl_transport = { curl_transport_post, NULL, NULL };
+
+/*
+ * Get the built-in libcurl transport
+ * This is what conversations use unless chatgpt_set_transport() says otherwise
+ * Usage: ChatGPTTransport *t = chatgpt_transport_curl();
+ * Returns: Shared transport instance (never free it)
+ */
+ChatGPTTransport *chatgpt_transport_curl(void) {
+    return &g_curl_transport;
+}
+
+/*
+ * State of a fault-injecting transport
+ */
+struct fault_transport {
+    ChatGPTTransport base;       // Public interface (must stay first)
+    ChatGPTTransport *inner;     // Transport doing the real work
+    ChatGPTFaultConfig cfg;      // Fault profile
+    ChatGPTFaultStats stats;     // Injection counters
+    uint32_t rng;                // xorshift32 state
+    int burst_left;              // Remaining requests in the current error burst
+#ifdef _WIN32
+    CRITICAL_SECTION lock;       // Guards stats, rng and burst_left
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+/*
+ * Per-request state of the fault-injecting sink wrapper
+ */
+struct fault_call {
+    struct fault_transport *ft;  // Owning transport
+    const ChatGPTRequest *req;   // Original request (real sink)
+    size_t cut;                  // Truncate after this many bytes (0 = never)
+    size_t sent;                 // Bytes delivered so far
+    int truncated;               // Set once the cut point was hit
+};
+
+static void fault_lock(struct fault_transport *ft) {
+#ifdef _WIN32
+    EnterCriticalSection(&ft->lock);
+#else
+    pthread_mutex_lock(&ft->lock);
+#endif
+}
+
+static void fault_unlock(struct fault_transport *ft) {
+#ifdef _WIN32
+    LeaveCriticalSection(&ft->lock);
+#else
+    pthread_mutex_unlock(&ft->lock);
+#endif
+}
+
+/* fault_rand() and fault_unit() need the transport's lock */
+static uint32_t fault_rand(struct fault_transport *ft) {
+    uint32_t x = ft->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return ft->rng = x;
+}
+
+static double fault_unit(struct fault_transport *ft) {
+    return (fault_rand(ft) >> 8) / 16777216.0;  // Uniform in [0, 1)
+}
+
+/*
+ * Sink wrapper: truncates and slow-drips the inner transport's bytes
+ */
+static size_t fault_sink(const char *data, size_t len, void *ud) {
+    struct fault_call *k = (struct fault_call*)ud;
+    const ChatGPTFaultConfig *cfg = &k->ft->cfg;
+    size_t done = 0;
+    
+    while (done < len) {
+        size_t n = len - done;
+        
+        if (cfg->drip_bytes && n > cfg->drip_bytes) n = cfg->drip_bytes;
+        if (k->cut && k->sent + n >= k->cut) {
+            n = k->cut - k->sent;
+            k->truncated = 1;
+        }
+        if (n && k->req->sink(data + done, n, k->req->sink_data) != n) return done;
+        
+        done += n;
+        k->sent += n;
+        if (k->truncated) return done;  // Short count makes the inner transport abort
+        if (cfg->drip_bytes && cfg->drip_delay_ms > 0 && done < len) {
+            sleep_us((uint64_t)cfg->drip_delay_ms * 1000);
+            fault_lock(k->ft);
+            k->ft->stats.delayed_ms += cfg->drip_delay_ms;
+            fault_unlock(k->ft);
+        }
+    }
+    return done;
+}
+
+static int fault_transport_post(ChatGPTTransport *self, const ChatGPTRequest *req, ChatGPTResponse *resp) {
+    struct fault_transport *ft = (struct fault_transport*)self;
+    const ChatGPTFaultConfig *cfg = &ft->cfg;
+    struct fault_call k;
+    ChatGPTRequest wrapped;
+    int inject_error = 0, inject_reset = 0;
+    
+    k.ft = ft;
+    k.req = req;
+    k.sent = 0;
+    k.truncated = 0;
+    k.cut = 0;
+    
+    // Draw every decision for this request at once, so concurrent callers neither
+    // interleave the RNG nor split an error burst; the sleeps happen unlocked
+    fault_lock(ft);
+    ft->stats.requests++;
+    
+    // Added latency: uniform body plus an occasional long tail
+    int delay = cfg->latency_min_ms;
+    if (cfg->latency_max_ms > cfg->latency_min_ms) {
+        delay += (int)(fault_rand(ft) % (uint32_t)(cfg->latency_max_ms - cfg->latency_min_ms + 1));
+    }
+    if (cfg->latency_tail_prob > 0 && fault_unit(ft) < cfg->latency_tail_prob) delay += cfg->latency_tail_ms;
+    if (delay > 0) ft->stats.delayed_ms += delay;
+    
+    if (ft->burst_left > 0 || (cfg->error_prob > 0 && fault_unit(ft) < cfg->error_prob)) {
+        if (ft->burst_left <= 0) ft->burst_left = cfg->error_burst > 0 ? cfg->error_burst : 1;
+        ft->burst_left--;
+        ft->stats.errors++;
+        inject_error = 1;
+    } else if (cfg->reset_prob > 0 && fault_unit(ft) < cfg->reset_prob) {
+        ft->stats.resets++;
+        inject_reset = 1;
+    } else if (cfg->truncate_prob > 0 && fault_unit(ft) < cfg->truncate_prob) {
+        size_t max = cfg->truncate_max_bytes ? cfg->truncate_max_bytes : 512;
+        k.cut = 1 + fault_rand(ft) % max;
+    }
+    fault_unlock(ft);
+    
+    if (delay > 0) sleep_us((uint64_t)delay * 1000);
+    
+    // HTTP error bursts (429/5xx) with an optional Retry-After
+    if (inject_error) {
+        char body[128];
+        int n;
+        
+        resp->http_code = cfg->error_status ? cfg->error_status : 503;
+        resp->retry_after_ms = cfg->retry_after_ms;
+        n = snprintf(body, sizeof(body),
+                     "{\"error\":{\"message\":\"Injected fault: HTTP %ld\",\"type\":\"injected\"}}",
+                     resp->http_code);
+        req->sink(body, (size_t)n, req->sink_data);
+        return 0;
+    }
+    
+    // Connection reset before any response byte
+    if (inject_reset) {
+        snprintf(resp->error, sizeof(resp->error), "Connection reset by peer (injected)");
+        return -1;
+    }
+    
+    // Forward through the wrapper sink, possibly cutting the stream short
+    wrapped = *req;
+    wrapped.sink = fault_sink;
+    wrapped.sink_data = &k;
+    
+    int rc = ft->inner->post(ft->inner, &wrapped, resp);
+    if (k.truncated) {
+        fault_lock(ft);
+        ft->stats.truncations++;
+        fault_unlock(ft);
+        snprintf(resp->error, sizeof(resp->error), "Stream truncated after %zu bytes (injected)", k.sent);
+        return -1;
+    }
+    return rc;
+}
+
+static void fault_transport_destroy(ChatGPTTransport *self) {
+    struct fault_transport *ft = (struct fault_transport*)self;
+#ifdef _WIN32
+    DeleteCriticalSection(&ft->lock);
+#else
+    pthread_mutex_destroy(&ft->lock);
+#endif
+    free(ft);
+}
+
+/*
+ * Create a transport that injects faults in front of another transport
+ * The inner transport is not owned and must outlive the wrapper
+ * Usage:
+ *   ChatGPTFaultConfig fc = {0};
+ *   fc.error_prob = 0.05; fc.error_burst = 3; fc.error_status = 429; fc.retry_after_ms = 200;
+ *   ChatGPTTransport *t = chatgpt_transport_fault_new(chatgpt_transport_curl(), &fc);
+ * Returns: New transport (free with chatgpt_transport_free) or NULL on error
+ */
+ChatGPTTransport *chatgpt_transport_fault_new(ChatGPTTransport *inner, const ChatGPTFaultConfig *cfg) {
+    if (!inner || !cfg) return NULL;
+    if (cfg->latency_min_ms < 0 || cfg->latency_max_ms < 0 || cfg->latency_tail_ms < 0) return NULL;
+    
+    struct fault_transport *ft = (struct fault_transport*)calloc(1, sizeof(*ft));
+    if (!ft) return NULL;
+#ifdef _WIN32
+    InitializeCriticalSection(&ft->lock);
+#else
+    if (pthread_mutex_init(&ft->lock, NULL) != 0) {
+        free(ft);
+        return NULL;
+    }
+#endif
+    
+    ft->base.post = fault_transport_post;
+    ft->base.destroy = fault_transport_destroy;
+    ft->base.impl = ft;
+    ft->inner = inner;
+    ft->cfg = *cfg;
+    ft->rng = cfg->seed ? cfg->seed : (uint32_t)now_us() | 1u;
+    return &ft->base;
+}
+
+/*
+ * Read the counters of a fault-injecting transport
+ * Usage: ChatGPTFaultStats st; chatgpt_transport_fault_stats(t, &st);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_transport_fault_stats(const ChatGPTTransport *t, ChatGPTFaultStats *out) {
+    if (!t || !out || t->post != fault_transport_post) return CHATGPT_ERR_INVALID_ARG;
+    
+    struct fault_transport *ft = (struct fault_transport*)t->impl;
+    fault_lock(ft);
+    *out = ft->stats;
+    fault_unlock(ft);
+    return CHATGPT_OK;
+}
+
+/*
+ * Fair-queuing transport: requests wait per tenant (ChatGPTRequest.tenant) and are let
+ * through to the inner transport by deficit round robin. Each visit of a tenant with
+ * work credits it quantum * weight tokens; it sends while its oldest request costs no
+ * more than its credit. Tenants at their concurrency cap or out of rate tokens are
+ * skipped without credit, so an idle or throttled tenant cannot bank a burst.
+ *
+ * A request's cost is its estimated tokens: body bytes / 4 for the prompt plus the
+ * body's max_tokens (or completion_estimate). The estimate is charged to the tenant's
+ * token bucket when the request is let through and corrected to usage.total_tokens
+ * when the response reports it. Waiting callers block on their own condition variable;
+ * whoever changes the state (a new request, a finished one, a refill deadline) runs
+ * the scheduler.
+ */
+#ifndef _WIN32
+
+#define FAIR_BUCKETS 64             // Tenant hash buckets
+
+// A caller waiting for its turn (lives on the caller's stack)
+struct fair_wait {
+    struct fair_wait *next;
+    long cost;                       // Estimated tokens
+    int granted;
+    uint64_t queued_us;
+    pthread_cond_t cv;
+};
+
+struct fair_tenant {
+    unsigned id;
+    struct fair_tenant *next_hash;
+    struct fair_tenant *next_active; // Ring of tenants with waiting requests
+    ChatGPTTenantLimits lim;
+    struct fair_wait *head, *tail;   // FIFO of waiting requests
+    long deficit;                    // DRR credit in tokens
+    int credited;                    // Credit added on the current visit
+    int in_flight;
+    double tokens;                   // Token bucket level (may go negative)
+    uint64_t refill_us;              // Last bucket update
+    ChatGPTTenantStats stats;
+};
+
+struct fair_transport {
+    ChatGPTTransport base;           // Public interface (must stay first)
+    ChatGPTTransport *inner;         // Transport doing the real work
+    ChatGPTFairConfig cfg;
+    pthread_mutex_t lock;            // Guards everything below
+    struct fair_tenant *buckets[FAIR_BUCKETS];
+    struct fair_tenant *active;      // Tenant the round robin is at (NULL = none waiting)
+    int in_flight;
+    uint64_t wake_us;                // Earliest refill a throttled tenant waits for (0 = none)
+};
+
+// Per-request state of the usage-scanning sink wrapper
+struct fair_call {
+    const ChatGPTRequest *req;
+    int state;                       // Characters of "total_tokens": matched, then 15 = in number
+    long total;                      // Reported usage (-1 = not seen)
+};
+
+static const char FAIR_USAGE_KEY[] = "\"total_tokens\":";
+
+static size_t fair_sink(const char *data, size_t len, void *ud) {
+    struct fair_call *k = (struct fair_call*)ud;
+    const int key_len = (int)sizeof(FAIR_USAGE_KEY) - 1;
+    
+    for (size_t i = 0; i < len; i++) {
+        char ch = data[i];
+        if (k->state == key_len) {
+            if (ch >= '0' && ch <= '9') {
+                k->total = (k->total < 0 ? 0 : k->total * 10) + (ch - '0');
+                continue;
+            }
+            if (ch == ' ' && k->total < 0) continue;
+            k->state = 0;
+        }
+        if (ch == FAIR_USAGE_KEY[k->state]) k->state++;
+        else k->state = ch == '"';
+        if (k->state == key_len) k->total = -1;
+    }
+    return k->req->sink(data, len, k->req->sink_data);
+}
+
+/*
+ * Estimated tokens of a request: prompt bytes / 4 plus the requested completion size
+ * "max_tokens": cannot occur inside a JSON string (its quotes would be escaped)
+ */
+static long fair_cost(const struct fair_transport *ft, const ChatGPTRequest *req) {
+    const char key[] = "\"max_tokens\":";
+    const size_t kn = sizeof(key) - 1;
+    long completion = ft->cfg.completion_estimate > 0 ? ft->cfg.completion_estimate : 256;
+    
+    for (const char *p = req->body, *end = req->body + req->body_len; end - p > (ptrdiff_t)kn; p++) {
+        p = (const char*)memchr(p, '"', (size_t)(end - p) - kn);
+        if (!p) break;
+        if (memcmp(p, key, kn) == 0) {
+            long v = 0;
+            for (p += kn; p < end && *p >= '0' && *p <= '9' && v < 100000000; p++) v = v * 10 + (*p - '0');
+            if (v > 0) completion = v;
+            break;
+        }
+    }
+    return (long)(req->body_len / 4) + completion;
+}
+
+static struct fair_tenant *fair_tenant_find(struct fair_transport *ft, unsigned id) {
+    for (struct fair_tenant *t = ft->buckets[(id * 2654435761u) % FAIR_BUCKETS]; t; t = t->next_hash) {
+        if (t->id == id) return t;
+    }
+    return NULL;
+}
+
+// Find a tenant, adding it with default limits on first use
+static struct fair_tenant *fair_tenant_get(struct fair_transport *ft, unsigned id) {
+    struct fair_tenant *t = fair_tenant_find(ft, id);
+    if (t) return t;
+    
+    struct fair_tenant **pp = &ft->buckets[(id * 2654435761u) % FAIR_BUCKETS];
+    t = (struct fair_tenant*)calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    t->id = id;
+    t->lim.weight = 1;
+    t->refill_us = now_us();
+    t->next_hash = *pp;
+    *pp = t;
+    return t;
+}
+
+// Bring a tenant's bucket up to date
+static void fair_refill(struct fair_tenant *t, uint64_t now) {
+    if (t->lim.tokens_per_sec > 0) {
+        double burst = t->lim.burst_tokens > 0 ? t->lim.burst_tokens : t->lim.tokens_per_sec;
+        t->tokens += t->lim.tokens_per_sec * (double)(now - t->refill_us) / 1e6;
+        if (t->tokens > burst) t->tokens = burst;
+    }
+    t->refill_us = now;
+}
+
+// Whether a tenant may send now (its bucket is up to date)
+static int fair_eligible(const struct fair_tenant *t) {
+    return !(t->lim.max_in_flight > 0 && t->in_flight >= t->lim.max_in_flight) &&
+           !(t->lim.tokens_per_sec > 0 && t->tokens <= 0);
+}
+
+/*
+ * Let waiting requests through while there is room (lock held)
+ * Also sets wake_us to the earliest time a throttled tenant gets tokens again
+ */
+static void fair_schedule(struct fair_transport *ft) {
+    uint64_t now = now_us();
+    int max = ft->cfg.max_in_flight;
+    long quantum = ft->cfg.quantum > 0 ? ft->cfg.quantum : 256;
+    
+    ft->wake_us = 0;
+    while (ft->active && (max <= 0 || ft->in_flight < max)) {
+        struct fair_tenant *start = ft->active, *t = start;
+        int eligible = 0;
+        long rounds = 0;  // Fewest further visits any eligible tenant needs to afford its head
+        
+        // Walk the ring from the current tenant until someone can send
+        for (;;) {
+            fair_refill(t, now);
+            int capped = t->lim.max_in_flight > 0 && t->in_flight >= t->lim.max_in_flight;
+            int dry = t->lim.tokens_per_sec > 0 && t->tokens <= 0;
+            if (dry && !capped) {
+                // Its oldest caller may be sleeping without a deadline: have it set one
+                uint64_t at = now + (uint64_t)(-t->tokens / t->lim.tokens_per_sec * 1e6) + 1;
+                if (!ft->wake_us || at < ft->wake_us) ft->wake_us = at;
+                pthread_cond_signal(&t->head->cv);
+            }
+            if (!capped && !dry) {
+                long per = quantum * (long)t->lim.weight;
+                eligible = 1;
+                if (!t->credited) {
+                    t->deficit += per;
+                    t->credited = 1;
+                }
+                if (t->head->cost <= t->deficit) break;
+                long r = (t->head->cost - t->deficit + per - 1) / per;
+                if (!rounds || r < rounds) rounds = r;
+            }
+            // Visit over: move on
+            t->credited = 0;
+            t = t->next_active;
+            ft->active = t;
+            if (t == start && !eligible) return;
+            if (t == start) {
+                // Nobody could afford their request this round. Rather than circling once per
+                // quantum, credit every eligible tenant all but the last of the rounds the
+                // nearest one needs; the next walk then grants exactly as circling would
+                if (rounds > 1) {
+                    struct fair_tenant *x = start;
+                    do {
+                        if (fair_eligible(x)) x->deficit += (rounds - 1) * quantum * (long)x->lim.weight;
+                        x = x->next_active;
+                    } while (x != start);
+                }
+                eligible = 0;
+                rounds = 0;
+            }
+        }
+        
+        // Grant the tenant's oldest request
+        struct fair_wait *w = t->head;
+        t->head = w->next;
+        if (!t->head) t->tail = NULL;
+        t->deficit -= w->cost;
+        t->in_flight++;
+        ft->in_flight++;
+        if (t->lim.tokens_per_sec > 0) t->tokens -= (double)w->cost;
+        t->stats.requests++;
+        t->stats.tokens += (unsigned long)w->cost;
+        t->stats.wait_ms += (double)(now - w->queued_us) / 1000.0;
+        w->granted = 1;
+        pthread_cond_signal(&w->cv);
+        
+        if (!t->head) {
+            // Out of work: leave the ring and forget the credit
+            t->deficit = 0;
+            t->credited = 0;
+            struct fair_tenant *prev = t;
+            while (prev->next_active != t) prev = prev->next_active;
+            prev->next_active = t->next_active;
+            ft->active = t->next_active == t ? NULL : t->next_active;
+            t->next_active = NULL;
+        }
+    }
+}
+
+static int fair_transport_post(ChatGPTTransport *self, const ChatGPTRequest *req, ChatGPTResponse *resp) {
+    struct fair_transport *ft = (struct fair_transport*)self;
+    struct fair_wait w;
+    
+    w.next = NULL;
+    w.cost = fair_cost(ft, req);
+    w.granted = 0;
+    w.queued_us = now_us();
+    pthread_cond_init(&w.cv, NULL);
+    
+    pthread_mutex_lock(&ft->lock);
+    struct fair_tenant *t = fair_tenant_get(ft, req->tenant);
+    if (!t) {
+        pthread_mutex_unlock(&ft->lock);
+        pthread_cond_destroy(&w.cv);
+        snprintf(resp->error, sizeof(resp->error), "Out of memory");
+        return -1;
+    }
+    
+    // Queue behind the tenant's earlier requests; a tenant with nothing queued joins the
+    // ring right after the current one, so light tenants wait one visit, not a whole round
+    if (t->tail) {
+        t->tail->next = &w;
+    } else {
+        t->head = &w;
+        if (!ft->active) {
+            t->next_active = t;
+            ft->active = t;
+        } else {
+            t->next_active = ft->active->next_active;
+            ft->active->next_active = t;
+        }
+    }
+    t->tail = &w;
+    
+    fair_schedule(ft);
+    if (!w.granted) t->stats.waited++;
+    while (!w.granted) {
+        if (ft->wake_us) {
+            // Throttled tenants get tokens back with time, not with events
+            struct timespec ts;
+            uint64_t us = ft->wake_us > now_us() ? ft->wake_us - now_us() : 0;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += (time_t)(us / 1000000u);
+            ts.tv_nsec += (long)(us % 1000000u) * 1000;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            if (pthread_cond_timedwait(&w.cv, &ft->lock, &ts) == ETIMEDOUT) fair_schedule(ft);
+        } else {
+            pthread_cond_wait(&w.cv, &ft->lock);
+        }
+    }
+    pthread_mutex_unlock(&ft->lock);
+    pthread_cond_destroy(&w.cv);
+    
+    // Forward, watching for the usage the server reports
+    struct fair_call k = { req, 0, -1 };
+    ChatGPTRequest wrapped = *req;
+    wrapped.sink = fair_sink;
+    wrapped.sink_data = &k;
+    int rc = ft->inner->post(ft->inner, &wrapped, resp);
+    
+    pthread_mutex_lock(&ft->lock);
+    t->in_flight--;
+    ft->in_flight--;
+    if (k.total >= 0) {
+        if (t->lim.tokens_per_sec > 0) t->tokens += (double)(w.cost - k.total);
+        t->stats.tokens += (unsigned long)k.total;
+        t->stats.tokens -= (unsigned long)w.cost;
+    }
+    fair_schedule(ft);
+    pthread_mutex_unlock(&ft->lock);
+    return rc;
+}
+
+static void fair_transport_destroy(ChatGPTTransport *self) {
+    struct fair_transport *ft = (struct fair_transport*)self;
+    for (int i = 0; i < FAIR_BUCKETS; i++) {
+        while (ft->buckets[i]) {
+            struct fair_tenant *t = ft->buckets[i];
+            ft->buckets[i] = t->next_hash;
+            free(t);
+        }
+    }
+    pthread_mutex_destroy(&ft->lock);
+    free(ft);
+}
+
+#endif /* !_WIN32 */
+
+/*
+ * Create a transport that shares another transport fairly between tenants
+ * Conversations name their tenant with chatgpt_set_tenant(); tenants without limits set
+ * by chatgpt_transport_fair_set_tenant() get weight 1 and no caps.
+ * The inner transport is not owned and must outlive the wrapper
+ * Usage:
+ *   ChatGPTFairConfig fc = {0};
+ *   fc.max_in_flight = 32;
+ *   ChatGPTTransport *t = chatgpt_transport_fair_new(chatgpt_transport_curl(), &fc);
+ * Returns: New transport (free with chatgpt_transport_free, with no request in progress)
+ *          or NULL on error (and on Windows, where it is not available)
+ */
+ChatGPTTransport *chatgpt_transport_fair_new(ChatGPTTransport *inner, const ChatGPTFairConfig *cfg) {
+#ifndef _WIN32
+    if (!inner || !cfg || cfg->max_in_flight < 0 || cfg->quantum < 0 || cfg->completion_estimate < 0) return NULL;
+    
+    struct fair_transport *ft = (struct fair_transport*)calloc(1, sizeof(*ft));
+    if (!ft) return NULL;
+    if (pthread_mutex_init(&ft->lock, NULL) != 0) {
+        free(ft);
+        return NULL;
+    }
+    ft->base.post = fair_transport_post;
+    ft->base.destroy = fair_transport_destroy;
+    ft->base.impl = ft;
+    ft->inner = inner;
+    ft->cfg = *cfg;
+    return &ft->base;
+#else
+    (void)inner; (void)cfg;
+    return NULL;
+#endif
+}
+
+/*
+ * Set a tenant's share and limits on a fair-queuing transport (takes effect immediately)
+ * Usage:
+ *   ChatGPTTenantLimits lim = {0};
+ *   lim.weight = 1; lim.max_in_flight = 4; lim.tokens_per_sec = 2000;
+ *   chatgpt_transport_fair_set_tenant(t, BATCH_TENANT, &lim);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_transport_fair_set_tenant(ChatGPTTransport *t, unsigned tenant, const ChatGPTTenantLimits *lim) {
+#ifndef _WIN32
+    if (!t || !lim || t->post != fair_transport_post || lim->max_in_flight < 0 ||
+        lim->tokens_per_sec < 0 || lim->burst_tokens < 0) {
+        return CHATGPT_ERR_INVALID_ARG;
+    }
+    
+    struct fair_transport *ft = (struct fair_transport*)t;
+    pthread_mutex_lock(&ft->lock);
+    struct fair_tenant *x = fair_tenant_get(ft, tenant);
+    if (x) {
+        fair_refill(x, now_us());
+        x->lim = *lim;
+        if (!x->lim.weight) x->lim.weight = 1;
+        
+        // A new bucket starts full
+        double burst = lim->burst_tokens > 0 ? lim->burst_tokens : lim->tokens_per_sec;
+        if (x->tokens > burst || x->stats.requests == 0) x->tokens = burst;
+        fair_schedule(ft);
+    }
+    pthread_mutex_unlock(&ft->lock);
+    return x ? CHATGPT_OK : CHATGPT_ERR_OOM;
+#else
+    (void)t; (void)tenant; (void)lim;
+    return CHATGPT_ERR_INVALID_ARG;
+#endif
+}
+
+/*
+ * Read a tenant's counters on a fair-queuing transport (does not add the tenant)
+ * Usage: ChatGPTTenantStats st; chatgpt_transport_fair_tenant_stats(t, 7, &st);
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_INVALID_ARG for a tenant that has neither
+ *          sent a request nor been configured
+ */
+int chatgpt_transport_fair_tenant_stats(ChatGPTTransport *t, unsigned tenant, ChatGPTTenantStats *out) {
+#ifndef _WIN32
+    if (!t || !out || t->post != fair_transport_post) return CHATGPT_ERR_INVALID_ARG;
+    
+    struct fair_transport *ft = (struct fair_transport*)t;
+    pthread_mutex_lock(&ft->lock);
+    struct fair_tenant *x = fair_tenant_find(ft, tenant);
+    if (x) {
+        *out = x->stats;
+        out->in_flight = x->in_flight;
+        out->queued = 0;
+        for (struct fair_wait *w = x->head; w; w = w->next) out->queued++;
+    }
+    pthread_mutex_unlock(&ft->lock);
+    return x ? CHATGPT_OK : CHATGPT_ERR_INVALID_ARG;
+#else
+    (void)t; (void)tenant; (void)out;
+    return CHATGPT_ERR_INVALID_ARG;
+#endif
+}
+
+/*
+ * Set the transport used by a conversation
+ * Pass NULL to go back to the built-in curl transport
+ * The conversation does not take ownership of the transport
+ * Usage: chatgpt_set_transport(conversation, my_transport);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_transport(ChatGPTConversation *c, ChatGPTTransport *t) {
+    if (!c || (t && !t->post)) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->transport = t;
+    return CHATGPT_OK;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃         BUILT-IN HTTP/1.1 TRANSPORT           ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Minimal plaintext HTTP/1.1 client for local OpenAI-compatible endpoints
+ * - "http://host[:port]/path" over TCP, "http+unix://%2Fpath%2Fto.sock/path" over a Unix socket
+ * - Keep-alive: idle connections are parked per transport and reused
+ * - Content-Length, chunked and read-until-close bodies
+ * - Body bytes are handed to the sink straight from the receive buffer, no copies
+ */
+#ifndef _WIN32
+
+#define HTTP_RECV_BUF   16384  // Receive buffer, also the header size limit
+#define HTTP_KEY_MAX      256  // Longest endpoint key (host:port or socket path)
+
+/*
+ * Parsed request target
+ */
+struct http_target {
+    int is_unix;                 // 1 = Unix domain socket
+    char host[HTTP_KEY_MAX];     // Host name, or socket path for Unix sockets
+    char port[8];                // TCP port
+    const char *path;            // Request path (points into the URL)
+};
+
+/*
+ * A parked keep-alive connection
+ */
+struct http_conn {
+    int fd;                      // Socket
+    char key[HTTP_KEY_MAX + 8];  // Endpoint it is connected to
+};
+
+/*
+ * State of a built-in HTTP transport
+ */
+struct http_transport {
+    ChatGPTTransport base;       // Public interface (must stay first)
+    ChatGPTHttpOptions opt;      // Effective options
+    pthread_mutex_t lock;        // Guards the idle pool
+    struct http_conn *idle;      // Idle keep-alive connections
+    int n_idle;                  // Number of idle connections
+};
+
+/*
+ * Decode %XX escapes (used for the socket path of http+unix URLs)
+ */
+static int http_unescape(const char *s, size_t n, char *out, size_t cap) {
+    size_t o = 0;
+    for (size_t i = 0; i < n; i++) {
+        char ch = s[i];
+        if (ch == '%' && i + 2 < n) {
+            char hex[3] = { s[i + 1], s[i + 2], '\0' };
+            ch = (char)strtol(hex, NULL, 16);
+            i += 2;
+        }
+        if (o + 1 >= cap) return -1;
+        out[o++] = ch;
+    }
+    out[o] = '\0';
+    return 0;
+}
+
+/*
+ * Split a URL into endpoint and path
+ * Returns: 0 on success, -1 if the URL is not supported
+ */
+static int http_parse_url(const char *url, struct http_target *t) {
+    const char *p, *end;
+    
+    memset(t, 0, sizeof(*t));
+    
+    if (strncmp(url, "http+unix://", 12) == 0) {
+        p = url + 12;
+        end = strchr(p, '/');
+        if (!end) end = p + strlen(p);
+        t->is_unix = 1;
+        if (end == p || http_unescape(p, (size_t)(end - p), t->host, sizeof(t->host))) return -1;
+    } else if (strncmp(url, "http://", 7) == 0) {
+        const char *colon;
+        p = url + 7;
+        end = p + strcspn(p, "/");
+        if (*p == '[') {
+            // IPv6 literal: [addr]:port
+            const char *rb = memchr(p, ']', (size_t)(end - p));
+            if (!rb) return -1;
+            if ((size_t)(rb - p - 1) >= sizeof(t->host)) return -1;
+            memcpy(t->host, p + 1, (size_t)(rb - p - 1));
+            colon = (rb + 1 < end && rb[1] == ':') ? rb + 1 : NULL;
+        } else {
+            colon = memchr(p, ':', (size_t)(end - p));
+            size_t hl = (size_t)((colon ? colon : end) - p);
+            if (hl == 0 || hl >= sizeof(t->host)) return -1;
+            memcpy(t->host, p, hl);
+        }
+        if (colon) {
+            size_t pl = (size_t)(end - colon - 1);
+            if (pl == 0 || pl >= sizeof(t->port)) return -1;
+            memcpy(t->port, colon + 1, pl);
+        } else {
+            strcpy(t->port, "80");
+        }
+    } else {
+        return -1;
+    }
+    
+    t->path = *end ? end : "/";
+    return 0;
+}
+
+/*
+ * Find the blank line that ends a header block
+ * Returns: Pointer to the "\r\n\r\n" or NULL
+ */
+static const char *http_find_head_end(const char *p, size_t n) {
+    for (size_t i = 0; i + 4 <= n; i++) {
+        if (p[i] == '\r' && p[i + 1] == '\n' && p[i + 2] == '\r' && p[i + 3] == '\n') return p + i;
+    }
+    return NULL;
+}
+
+/*
+ * Wait for a socket to become readable or writable
+ * Returns: 1 when ready, 0 on timeout, -1 on error
+ */
+static int http_wait(int fd, short events, int timeout_ms) {
+    struct pollfd pfd;
+    int r;
+    
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    do {
+        r = poll(&pfd, 1, timeout_ms);
+    } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+#define HTTP_ERR_HOST_MAX 96  // Host characters quoted in connection errors
+
+/*
+ * Open a new connection to the target
+ * Returns: Connected socket or -1 (err is filled in)
+ */
+static int http_connect(const struct http_transport *ht, const struct http_target *t,
+                        char *err, size_t err_len) {
+    int fd = -1;
+    
+    if (t->is_unix) {
+        struct sockaddr_un sa;
+        
+        if (strlen(t->host) >= sizeof(sa.sun_path)) {
+            snprintf(err, err_len, "Unix socket path too long");
+            return -1;
+        }
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        strcpy(sa.sun_path, t->host);
+        
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) {
+            snprintf(err, err_len, "Cannot connect to %.*s: %s", HTTP_ERR_HOST_MAX, t->host, strerror(errno));
+            if (fd >= 0) close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    
+    struct addrinfo hints, *res = NULL, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    
+    int gai = getaddrinfo(t->host, t->port, &hints, &res);
+    if (gai != 0) {
+        // Host names are bounded so the reason always fits the caller's error buffer
+        snprintf(err, err_len, "Cannot resolve %.*s: %s", HTTP_ERR_HOST_MAX, t->host, gai_strerror(gai));
+        return -1;
+    }
+    
+    int why = 0;  // errno of the last failed address
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            why = errno;
+            continue;
+        }
+        
+        // Non-blocking connect so the connect timeout applies
+        int fl = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, fl | O_NONBLOCK);
+        int r = connect(fd, ai->ai_addr, ai->ai_addrlen);
+        why = errno;
+        if (r != 0 && why == EINPROGRESS) {
+            int ready = http_wait(fd, POLLOUT, ht->opt.connect_timeout_ms);
+            if (ready == 1) {
+                int so = 0;
+                socklen_t sl = sizeof(so);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &so, &sl);
+                r = so == 0 ? 0 : -1;
+                why = so;
+            } else {
+                why = ready == 0 ? ETIMEDOUT : errno;
+            }
+        }
+        if (r == 0) {
+            int one = 1;
+            fcntl(fd, F_SETFL, fl);
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    
+    if (fd < 0) {
+        int v6 = strchr(t->host, ':') != NULL;
+        snprintf(err, err_len, "Cannot connect to %s%.*s%s:%s: %s", v6 ? "[" : "", HTTP_ERR_HOST_MAX, t->host,
+                 v6 ? "]" : "", t->port, why == ETIMEDOUT ? "connect timed out" : strerror(why));
+    }
+    return fd;
+}
+
+/*
+ * Take an idle connection for the endpoint, dropping ones the peer has closed
+ * Returns: Socket or -1 if none is available
+ */
+static int http_pool_take(struct http_transport *ht, const char *key) {
+    int fd = -1;
+    
+    pthread_mutex_lock(&ht->lock);
+    for (int i = ht->n_idle - 1; i >= 0; i--) {
+        if (strcmp(ht->idle[i].key, key) != 0) continue;
+        fd = ht->idle[i].fd;
+        ht->idle[i] = ht->idle[--ht->n_idle];
+        
+        // A readable idle socket means EOF or garbage: not reusable
+        if (http_wait(fd, POLLIN, 0) != 0) {
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        break;
+    }
+    pthread_mutex_unlock(&ht->lock);
+    return fd;
+}
+
+/*
+ * Park a connection for reuse, closing it when the pool is full
+ */
+static void http_pool_put(struct http_transport *ht, const char *key, int fd) {
+    pthread_mutex_lock(&ht->lock);
+    if (ht->n_idle < ht->opt.max_idle) {
+        ht->idle[ht->n_idle].fd = fd;
+        snprintf(ht->idle[ht->n_idle].key, sizeof(ht->idle[0].key), "%s", key);
+        ht->n_idle++;
+        fd = -1;
+    }
+    pthread_mutex_unlock(&ht->lock);
+    if (fd >= 0) close(fd);
+}
+
+/*
+ * Send header and body without joining them first
+ * Returns: 0 on success, -1 on error
+ */
+static int http_send_all(int fd, const char *head, size_t head_len, const char *body, size_t body_len,
+                         int timeout_ms) {
+    struct iovec iov[2];
+    struct msghdr mh;
+    int n_iov = 2;
+    
+    iov[0].iov_base = (void*)head;
+    iov[0].iov_len = head_len;
+    iov[1].iov_base = (void*)body;
+    iov[1].iov_len = body_len;
+    
+    while (n_iov > 0) {
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov + (2 - n_iov);
+        mh.msg_iovlen = (size_t)n_iov;
+        
+        ssize_t w = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && http_wait(fd, POLLOUT, timeout_ms) == 1) continue;
+            return -1;
+        }
+        
+        // Advance past what was written
+        while (n_iov > 0 && (size_t)w >= iov[2 - n_iov].iov_len) {
+            w -= (ssize_t)iov[2 - n_iov].iov_len;
+            n_iov--;
+        }
+        if (n_iov > 0) {
+            iov[2 - n_iov].iov_base = (char*)iov[2 - n_iov].iov_base + w;
+            iov[2 - n_iov].iov_len -= (size_t)w;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Receive with the I/O timeout
+ * On TCP, quick-ACK is re-armed first: servers that write headers and body
+ * separately would otherwise stall on Nagle plus our delayed ACK (~40 ms)
+ * Returns: Bytes read, 0 on EOF, -1 on error or timeout
+ */
+static ssize_t http_recv(int fd, char *buf, size_t cap, int timeout_ms, int is_tcp) {
+#ifdef TCP_QUICKACK
+    if (is_tcp) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
+#else
+    (void)is_tcp;
+#endif
+    for (;;) {
+        int r = http_wait(fd, POLLIN, timeout_ms);
+        if (r == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (r < 0) return -1;
+        
+        ssize_t n = recv(fd, buf, cap, 0);
+        if (n < 0 && errno == EINTR) continue;
+        return n;
+    }
+}
+
+/*
+ * Incremental chunked transfer-encoding decoder
+ */
+enum { CH_SIZE, CH_EXT, CH_DATA, CH_DATA_END, CH_TRAILER, CH_DONE };
+
+struct http_chunked {
+    int state;          // One of CH_*
+    size_t left;        // Bytes left in the current chunk (or size being parsed)
+    int digits;         // Hex digits seen for the current size
+    int line_chars;     // Characters on the current trailer line
+};
+
+/*
+ * Feed received bytes through the decoder, passing payload slices to the sink
+ * Returns: 0 to continue, 1 when the body is complete, -1 on error
+ */
+static int http_chunked_feed(struct http_chunked *d, const char *p, size_t n,
+                             const ChatGPTRequest *req) {
+    size_t i = 0;
+    
+    while (i < n && d->state != CH_DONE) {
+        char ch = p[i];
+        switch (d->state) {
+        case CH_SIZE:
+            if (isxdigit((unsigned char)ch)) {
+                int v = ch <= '9' ? ch - '0' : (ch | 0x20) - 'a' + 10;
+                if (d->left > (SIZE_MAX >> 4)) return -1;
+                d->left = (d->left << 4) | (size_t)v;
+                d->digits++;
+            } else if (ch == ';' || ch == ' ' || ch == '\t') {
+                d->state = CH_EXT;
+            } else if (ch == '\n') {
+                if (!d->digits) return -1;
+                d->state = d->left ? CH_DATA : CH_TRAILER;
+                d->line_chars = 0;
+            } else if (ch != '\r') {
+                return -1;
+            }
+            i++;
+            break;
+        case CH_EXT:
+            // Chunk extensions are ignored
+            if (ch == '\n') {
+                if (!d->digits) return -1;
+                d->state = d->left ? CH_DATA : CH_TRAILER;
+                d->line_chars = 0;
+            }
+            i++;
+            break;
+        case CH_DATA: {
+            size_t take = n - i < d->left ? n - i : d->left;
+            if (req->sink(p + i, take, req->sink_data) != take) return -1;
+            d->left -= take;
+            i += take;
+            if (!d->left) d->state = CH_DATA_END;
+            break;
+        }
+        case CH_DATA_END:
+            if (ch == '\n') {
+                d->state = CH_SIZE;
+                d->digits = 0;
+            } else if (ch != '\r') {
+                return -1;
+            }
+            i++;
+            break;
+        case CH_TRAILER:
+            // Trailer fields end with an empty line
+            if (ch == '\n') {
+                if (!d->line_chars) d->state = CH_DONE;
+                d->line_chars = 0;
+            } else if (ch != '\r') {
+                d->line_chars++;
+            }
+            i++;
+            break;
+        }
+    }
+    return d->state == CH_DONE ? 1 : 0;
+}
+
+/*
+ * Case-insensitive header name match at the start of a header line
+ * Returns: Pointer to the (space-trimmed) value or NULL
+ */
+static const char *http_header_value(const char *line, const char *line_end, const char *name) {
+    size_t nl = strlen(name);
+    if ((size_t)(line_end - line) <= nl || strncasecmp(line, name, nl) != 0 || line[nl] != ':') return NULL;
+    line += nl + 1;
+    while (line < line_end && (*line == ' ' || *line == '\t')) line++;
+    return line;
+}
+
+/*
+ * Perform one request on an open connection
+ * Returns: 1 if the connection can be kept, 0 if it must be closed, -1 on failure
+ *          (-2 when the connection died before any response byte, so a retry is safe)
+ */
+static int http_exchange(struct http_transport *ht, int fd, const struct http_target *t,
+                         const ChatGPTRequest *req, ChatGPTResponse *resp) {
+    char buf[HTTP_RECV_BUF];
+    size_t have = 0, hdr_end = 0;
+    int timeout = ht->opt.io_timeout_ms;
+    
+    // Request head; the body goes out separately with sendmsg()
+    size_t cap = 256 + strlen(t->path) + strlen(t->host);
+    for (size_t i = 0; i < req->header_count; i++) cap += strlen(req->headers[i]) + 2;
+    char *head = (char*)malloc(cap);
+    if (!head) {
+        snprintf(resp->error, sizeof(resp->error), "Out of memory");
+        return -1;
+    }
+    
+    // IPv6 literals go back in brackets (RFC 7230 section 5.4)
+    int hl;
+    if (t->is_unix) {
+        hl = snprintf(head, cap, "POST %s HTTP/1.1\r\nHost: localhost\r\n", t->path);
+    } else {
+        int v6 = strchr(t->host, ':') != NULL;
+        hl = snprintf(head, cap, "POST %s HTTP/1.1\r\nHost: %s%s%s:%s\r\n", t->path,
+                      v6 ? "[" : "", t->host, v6 ? "]" : "", t->port);
+    }
+    for (size_t i = 0; i < req->header_count; i++) {
+        hl += snprintf(head + hl, cap - (size_t)hl, "%s\r\n", req->headers[i]);
+    }
+    hl += snprintf(head + hl, cap - (size_t)hl, "Content-Length: %zu\r\nConnection: keep-alive\r\n\r\n",
+                   req->body_len);
+    
+    int sent = http_send_all(fd, head, (size_t)hl, req->body, req->body_len, timeout);
+    free(head);
+    if (sent != 0) {
+        snprintf(resp->error, sizeof(resp->error), "Send failed: %s", strerror(errno));
+        return -2;
+    }
+    
+    // Read until the header block is complete, skipping 1xx interim responses
+    for (;;) {
+        const char *e;
+        while (!(e = http_find_head_end(buf, have))) {
+            if (have == sizeof(buf) - 1) {
+                snprintf(resp->error, sizeof(resp->error), "Response headers too large");
+                return -1;
+            }
+            ssize_t n = http_recv(fd, buf + have, sizeof(buf) - 1 - have, timeout, !t->is_unix);
+            if (n <= 0) {
+                snprintf(resp->error, sizeof(resp->error), "%s",
+                         n == 0 ? "Connection closed by peer" : strerror(errno));
+                return have == 0 ? -2 : -1;
+            }
+            have += (size_t)n;
+            buf[have] = '\0';
+        }
+        hdr_end = (size_t)(e - buf) + 4;
+        
+        int major = 0, minor = 0, status = 0;
+        if (sscanf(buf, "HTTP/%d.%d %d", &major, &minor, &status) != 3) {
+            snprintf(resp->error, sizeof(resp->error), "Malformed status line");
+            return -1;
+        }
+        if (status >= 200 || status < 100) {
+            resp->http_code = status;
+            break;
+        }
+        memmove(buf, buf + hdr_end, have - hdr_end);
+        have -= hdr_end;
+        buf[have] = '\0';
+    }
+    
+    // Interpret the headers we care about
+    long long content_length = -1;
+    int chunked = 0, keep = 1;
+    const char *line = strstr(buf, "\r\n") + 2;
+    while (line < buf + hdr_end - 2) {
+        const char *le = strstr(line, "\r\n");
+        const char *v;
+        if ((v = http_header_value(line, le, "Content-Length"))) {
+            content_length = strtoll(v, NULL, 10);
+        } else if ((v = http_header_value(line, le, "Transfer-Encoding"))) {
+            chunked = strncasecmp(v, "chunked", 7) == 0;
+        } else if ((v = http_header_value(line, le, "Connection"))) {
+            if (strncasecmp(v, "close", 5) == 0) keep = 0;
+        } else if ((v = http_header_value(line, le, "Retry-After"))) {
+            long ms = retry_after_ms_of(v);
+            if (ms >= 0) resp->retry_after_ms = ms;
+        }
+        line = le + 2;
+    }
+    if (strncmp(buf, "HTTP/1.0", 8) == 0) keep = 0;
+    
+    // Body bytes that arrived with the headers
+    const char *p = buf + hdr_end;
+    size_t n = have - hdr_end;
+    
+    if (resp->http_code == 204 || resp->http_code == 304) {
+        return keep && n == 0;
+    }
+    
+    if (chunked) {
+        struct http_chunked d;
+        memset(&d, 0, sizeof(d));
+        for (;;) {
+            int r = n ? http_chunked_feed(&d, p, n, req) : 0;
+            if (r < 0) {
+                snprintf(resp->error, sizeof(resp->error), "Malformed chunked body or write aborted");
+                return -1;
+            }
+            if (r == 1) return keep;
+            ssize_t got = http_recv(fd, buf, sizeof(buf), timeout, !t->is_unix);
+            if (got <= 0) {
+                snprintf(resp->error, sizeof(resp->error), "Connection lost mid-response");
+                return -1;
+            }
+            p = buf;
+            n = (size_t)got;
+        }
+    }
+    
+    if (content_length >= 0) {
+        unsigned long long left = (unsigned long long)content_length;
+        for (;;) {
+            size_t take = n < left ? n : (size_t)left;
+            if (take && req->sink(p, take, req->sink_data) != take) {
+                snprintf(resp->error, sizeof(resp->error), "Write callback aborted transfer");
+                return -1;
+            }
+            left -= take;
+            if (!left) return keep && take == n;
+            ssize_t got = http_recv(fd, buf, sizeof(buf), timeout, !t->is_unix);
+            if (got <= 0) {
+                snprintf(resp->error, sizeof(resp->error), "Connection lost mid-response");
+                return -1;
+            }
+            p = buf;
+            n = (size_t)got;
+        }
+    }
+    
+    // No framing: the body runs until the server closes the connection
+    for (;;) {
+        if (n && req->sink(p, n, req->sink_data) != n) {
+            snprintf(resp->error, sizeof(resp->error), "Write callback aborted transfer");
+            return -1;
+        }
+        ssize_t got = http_recv(fd, buf, sizeof(buf), timeout, !t->is_unix);
+        if (got == 0) return 0;
+        if (got < 0) {
+            snprintf(resp->error, sizeof(resp->error), "%s", strerror(errno));
+            return -1;
+        }
+        p = buf;
+        n = (size_t)got;
+    }
+}
+
+static int http_transport_post(ChatGPTTransport *self, const ChatGPTRequest *req, ChatGPTResponse *resp) {
+    struct http_transport *ht = (struct http_transport*)self;
+    struct http_target t;
+    char key[HTTP_KEY_MAX + 8];
+    
+    if (http_parse_url(req->url, &t) != 0) {
+        snprintf(resp->error, sizeof(resp->error), "URL not supported by the built-in HTTP transport: %s", req->url);
+        return -1;
+    }
+    snprintf(key, sizeof(key), "%s%s%s", t.host, t.is_unix ? "" : ":", t.is_unix ? "" : t.port);
+    
+    // A parked connection may have been closed by the server meanwhile: retry once on a fresh one
+    for (int fresh = 0; fresh < 2; fresh++) {
+        int fd = fresh ? -1 : http_pool_take(ht, key);
+        if (fd < 0) {
+            fresh = 1;
+            fd = http_connect(ht, &t, resp->error, sizeof(resp->error));
+            if (fd < 0) return -1;
+        }
+        
+        resp->error[0] = '\0';
+        int r = http_exchange(ht, fd, &t, req, resp);
+        if (r == 1) {
+            http_pool_put(ht, key, fd);
+            return 0;
+        }
+        close(fd);
+        if (r == 0) return 0;
+        if (r == -1 || fresh) return -1;
+    }
+    return -1;
+}
+
+static void http_transport_destroy(ChatGPTTransport *self) {
+    struct http_transport *ht = (struct http_transport*)self;
+    
+    for (int i = 0; i < ht->n_idle; i++) close(ht->idle[i].fd);
+    pthread_mutex_destroy(&ht->lock);
+    free(ht->idle);
+    free(ht);
+}
+
+#endif /* !_WIN32 */
+
+/*
+ * Create the built-in HTTP/1.1 transport for plaintext local endpoints
+ * Point the conversation at "http://127.0.0.1:8000" or "http+unix://%2Frun%2Fllm.sock"
+ * Usage:
+ *   ChatGPTTransport *t = chatgpt_transport_http_new(NULL);  // Default options
+ *   chatgpt_set_transport(conversation, t);
+ * Returns: New transport (free with chatgpt_transport_free) or NULL on error or on Windows
+ */
+ChatGPTTransport *chatgpt_transport_http_new(const ChatGPTHttpOptions *opts) {
+#ifdef _WIN32
+    (void)opts;
+    return NULL;
+#else
+    struct http_transport *ht = (struct http_transport*)calloc(1, sizeof(*ht));
+    if (!ht) return NULL;
+    
+    // Defaults: 8 idle connections, 5 s connect, 5 min between bytes (long streams)
+    ht->opt.max_idle = 8;
+    ht->opt.connect_timeout_ms = 5000;
+    ht->opt.io_timeout_ms = 300000;
+    if (opts) {
+        if (opts->max_idle > 0) ht->opt.max_idle = opts->max_idle;
+        if (opts->connect_timeout_ms > 0) ht->opt.connect_timeout_ms = opts->connect_timeout_ms;
+        if (opts->io_timeout_ms > 0) ht->opt.io_timeout_ms = opts->io_timeout_ms;
+    }
+    
+    ht->idle = (struct http_conn*)calloc((size_t)(ht->opt.max_idle ? ht->opt.max_idle : 1), sizeof(struct http_conn));
+    if (!ht->idle || pthread_mutex_init(&ht->lock, NULL) != 0) {
+        free(ht->idle);
+        free(ht);
+        return NULL;
+    }
+    
+    ht->base.post = http_transport_post;
+    ht->base.destroy = http_transport_destroy;
+    ht->base.impl = ht;
+    return &ht->base;
+#endif
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃            RECORD / REPLAY CASSETTES          ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Cassette file layout (all integers little-endian):
+ *   "CGPTCAS1"                                         file magic
+ *   'Q' u32 len, request body                          one per attempt
+ *   'C' u32 delay_us, u32 len, bytes                   one per received chunk
+ *   'E' i32 failed, i32 http_code, i32 retry_after_ms,
+ *       u32 len, error text                            end of attempt
+ * delay_us is measured from the previous chunk (or from the request for the first one)
+ */
+#define CASSETTE_MAGIC "CGPTCAS1"
+
+static int cas_put_u32(FILE *f, uint32_t v) {
+    unsigned char b[4];
+    b[0] = (unsigned char)v; b[1] = (unsigned char)(v >> 8);
+    b[2] = (unsigned char)(v >> 16); b[3] = (unsigned char)(v >> 24);
+    return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+static int cas_get_u32(FILE *f, uint32_t *v) {
+    unsigned char b[4];
+    if (fread(b, 1, 4, f) != 4) return -1;
+    *v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return 0;
+}
+
+static int cas_put_blob(FILE *f, const char *p, size_t n) {
+    if (cas_put_u32(f, (uint32_t)n)) return -1;
+    return (n == 0 || fwrite(p, 1, n, f) == n) ? 0 : -1;
+}
+
+/*
+ * Read a length-prefixed blob into a fresh NUL-terminated buffer
+ */
+static char *cas_get_blob(FILE *f, uint32_t *n_out) {
+    uint32_t n;
+    if (cas_get_u32(f, &n)) return NULL;
+    char *p = (char*)malloc((size_t)n + 1);
+    if (!p) return NULL;
+    if (n && fread(p, 1, n, f) != n) {
+        free(p);
+        return NULL;
+    }
+    p[n] = '\0';
+    if (n_out) *n_out = n;
+    return p;
+}
+
+static void cas_buf_u32(struct jbuf *b, uint32_t v) {
+    char p[4];
+    p[0] = (char)v; p[1] = (char)(v >> 8); p[2] = (char)(v >> 16); p[3] = (char)(v >> 24);
+    jb_put(b, p, 4);
+}
+
+static void cas_buf_blob(struct jbuf *b, const char *p, size_t n) {
+    cas_buf_u32(b, (uint32_t)n);
+    jb_put(b, p, n);
+}
+
+/*
+ * An open cassette: the process-wide one behind chatgpt_cassette_open() (inner is NULL,
+ * requests go to each conversation's transport) or a cassette transport wrapping inner.
+ * Recorders build each exchange in memory and append it whole under the lock, so
+ * concurrent requests never interleave their records; replayers read one whole
+ * exchange under the lock and play it back without it.
+ */
+struct cassette {
+    ChatGPTTransport base;       // Public interface (must stay first)
+    ChatGPTTransport *inner;     // Wrapped transport (NULL for the process-wide cassette)
+    FILE *f;                     // Cassette file
+    ChatGPT_CassetteMode mode;   // RECORD or REPLAY
+    double speed;                // Replay time scale
+    int broken;                  // A write failed; later recordings fail too
+    int refs;                    // Holders (under LOCK_CASSETTE)
+#ifdef _WIN32
+    CRITICAL_SECTION lock;       // Guards f and broken
+#else
+    pthread_mutex_t lock;
+#endif
+};
+
+static void cas_lock(struct cassette *cas) {
+#ifdef _WIN32
+    EnterCriticalSection(&cas->lock);
+#else
+    pthread_mutex_lock(&cas->lock);
+#endif
+}
+
+static void cas_unlock(struct cassette *cas) {
+#ifdef _WIN32
+    LeaveCriticalSection(&cas->lock);
+#else
+    pthread_mutex_unlock(&cas->lock);
+#endif
+}
+
+static int cassette_transport_post(ChatGPTTransport *self, const ChatGPTRequest *req, ChatGPTResponse *resp);
+static void cassette_transport_destroy(ChatGPTTransport *self);
+
+/*
+ * Open a cassette file with one reference
+ * Returns: The cassette, or NULL (*rc says why)
+ */
+static struct cassette *cassette_open(const char *path, ChatGPT_CassetteMode mode, double speed, int *rc) {
+    char magic[8];
+    FILE *f;
+    
+    *rc = CHATGPT_ERR_INVALID_ARG;
+    if (!path || speed < 0) return NULL;
+    if (mode != CHATGPT_CASSETTE_RECORD && mode != CHATGPT_CASSETTE_REPLAY) return NULL;
+    
+    curl_shared_once();
+    f = fopen(path, mode == CHATGPT_CASSETTE_RECORD ? "wb" : "rb");
+    *rc = CHATGPT_ERR_STATE;
+    if (!f) return NULL;
+    
+    if (mode == CHATGPT_CASSETTE_RECORD) {
+        if (fwrite(CASSETTE_MAGIC, 1, 8, f) != 8 || fflush(f) != 0) {
+            fclose(f);
+            return NULL;
+        }
+    } else if (fread(magic, 1, 8, f) != 8 || memcmp(magic, CASSETTE_MAGIC, 8) != 0) {
+        fclose(f);
+        *rc = CHATGPT_ERR_JSON_PARSE;
+        return NULL;
+    }
+    
+    struct cassette *cas = (struct cassette*)calloc(1, sizeof(*cas));
+    *rc = CHATGPT_ERR_OOM;
+    if (!cas) {
+        fclose(f);
+        return NULL;
+    }
+#ifdef _WIN32
+    InitializeCriticalSection(&cas->lock);
+#else
+    if (pthread_mutex_init(&cas->lock, NULL) != 0) {
+        fclose(f);
+        free(cas);
+        return NULL;
+    }
+#endif
+    cas->base.post = cassette_transport_post;
+    cas->base.destroy = cassette_transport_destroy;
+    cas->base.impl = cas;
+    cas->f = f;
+    cas->mode = mode;
+    cas->speed = speed;
+    cas->refs = 1;
+    *rc = CHATGPT_OK;
+    return cas;
+}
+
+/*
+ * Drop a reference; the last one closes the file
+ */
+static void cassette_release(struct cassette *cas) {
+    if (!cas) return;
+    
+    lib_lock(LOCK_CASSETTE);
+    int last = --cas->refs == 0;
+    lib_unlock(LOCK_CASSETTE);
+    if (!last) return;
+    
+    fclose(cas->f);
+#ifdef _WIN32
+    DeleteCriticalSection(&cas->lock);
+#else
+    pthread_mutex_destroy(&cas->lock);
+#endif
+    free(cas);
+}
+
+/*
+ * Take a reference to the process-wide cassette, so closing or replacing it
+ * cannot pull it from under a request in progress
+ * Returns: The cassette (release it with cassette_release) or NULL when none is open
+ */
+static struct cassette *cassette_acquire(void) {
+    struct cassette *cas;
+    
+    curl_shared_once();
+    lib_lock(LOCK_CASSETTE);
+    cas = g_cassette;
+    if (cas) cas->refs++;
+    lib_unlock(LOCK_CASSETTE);
+    return cas;
+}
+
+/*
+ * Open a cassette for recording or replay
+ * RECORD truncates the file, REPLAY reads exchanges back in the order they were recorded
+ * speed: Replay time scale (1.0 = original timing, 4.0 = four times faster, 0 = no delays)
+ * Requests already in progress finish on the cassette they started with
+ * Usage: chatgpt_cassette_open("traffic.cas", CHATGPT_CASSETTE_REPLAY, 0);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_cassette_open(const char *path, ChatGPT_CassetteMode mode, double speed) {
+    int rc;
+    struct cassette *cas = cassette_open(path, mode, speed, &rc);
+    if (!cas) return rc;
+    
+    lib_lock(LOCK_CASSETTE);
+    struct cassette *old = g_cassette;
+    g_cassette = cas;
+    lib_unlock(LOCK_CASSETTE);
+    cassette_release(old);
+    return CHATGPT_OK;
+}
+
+/*
+ * Close the active cassette and go back to live network traffic
+ * Requests already in progress finish on the cassette, which closes after the last one
+ * Usage: chatgpt_cassette_close();
+ * Returns: CHATGPT_OK (always succeeds)
+ */
+int chatgpt_cassette_close(void) {
+    curl_shared_once();
+    lib_lock(LOCK_CASSETTE);
+    struct cassette *old = g_cassette;
+    g_cassette = NULL;
+    lib_unlock(LOCK_CASSETTE);
+    cassette_release(old);
+    return CHATGPT_OK;
+}
+
+/*
+ * Sink wrapper used while recording
+ * Adds each chunk with its arrival delay to the exchange, then hands it to the real sink
+ */
+struct cas_rec {
+    const ChatGPTRequest *req;  // Request holding the real sink
+    struct jbuf out;            // Exchange being recorded
+    uint64_t last;              // Timestamp of the previous chunk
+};
+
+static size_t cas_record_sink(const char *data, size_t len, void *ud) {
+    struct cas_rec *r = (struct cas_rec*)ud;
+    uint64_t t = now_us();
+    uint64_t d = t - r->last;
+    
+    r->last = t;
+    jb_put(&r->out, "C", 1);
+    cas_buf_u32(&r->out, d > UINT32_MAX ? UINT32_MAX : (uint32_t)d);
+    cas_buf_blob(&r->out, data, len);
+    return r->req->sink(data, len, r->req->sink_data);
+}
+
+/*
+ * Send one attempt through a transport and append it to the cassette
+ * Returns: The transport's result, or -1 when the exchange could not be recorded
+ */
+static int cassette_record(struct cassette *cas, ChatGPTTransport *t, const ChatGPTRequest *req,
+                           ChatGPTResponse *resp) {
+    struct cas_rec rec;
+    ChatGPTRequest wrapped = *req;
+    int ok;
+    
+    cas_lock(cas);
+    ok = !cas->broken;
+    cas_unlock(cas);
+    if (!ok) {
+        snprintf(resp->error, sizeof(resp->error), "Cassette write failed");
+        return -1;
+    }
+    
+    memset(&rec, 0, sizeof(rec));
+    rec.req = req;
+    jb_put(&rec.out, "Q", 1);
+    cas_buf_blob(&rec.out, req->body, req->body_len);
+    
+    rec.last = now_us();
+    wrapped.sink = cas_record_sink;
+    wrapped.sink_data = &rec;
+    
+    int rc = t->post(t, &wrapped, resp);
+    
+    jb_put(&rec.out, "E", 1);
+    cas_buf_u32(&rec.out, rc != 0);
+    cas_buf_u32(&rec.out, (uint32_t)resp->http_code);
+    cas_buf_u32(&rec.out, (uint32_t)resp->retry_after_ms);
+    cas_buf_blob(&rec.out, resp->error, strlen(resp->error));
+    
+    cas_lock(cas);
+    ok = !rec.out.failed && !cas->broken &&
+         fwrite(rec.out.d, 1, rec.out.n, cas->f) == rec.out.n && fflush(cas->f) == 0;
+    if (!ok) cas->broken = 1;
+    cas_unlock(cas);
+    free(rec.out.d);
+    
+    if (!ok) {
+        snprintf(resp->error, sizeof(resp->error), "Cassette write failed");
+        return -1;
+    }
+    return rc;
+}
+
+/*
+ * Read the next recorded exchange (lock held)
+ * Chunks land in *chunks as host-order u32 delay, u32 length and the bytes
+ * Returns: 0 on success, -1 with resp->error filled in
+ */
+static int cassette_read_exchange(struct cassette *cas, const ChatGPTRequest *req, struct jbuf *chunks,
+                                  ChatGPTResponse *resp, int *failed) {
+    FILE *f = cas->f;
+    int tag = fgetc(f);
+    uint32_t n = 0;
+    char *rec;
+    
+    if (tag != 'Q') {
+        snprintf(resp->error, sizeof(resp->error), "Cassette exhausted");
+        return -1;
+    }
+    
+    // Requests are matched by position, a different body only gets logged
+    rec = cas_get_blob(f, &n);
+    if (!rec) {
+        snprintf(resp->error, sizeof(resp->error), "Truncated cassette");
+        return -1;
+    }
+    if (n != req->body_len || memcmp(rec, req->body, n) != 0) {
+        log_line("Cassette replay: request body differs from recording");
+    }
+    free(rec);
+    
+    while ((tag = fgetc(f)) == 'C') {
+        uint32_t delay;
+        if (cas_get_u32(f, &delay) || !(rec = cas_get_blob(f, &n))) {
+            snprintf(resp->error, sizeof(resp->error), "Truncated cassette");
+            return -1;
+        }
+        jb_put(chunks, (const char*)&delay, sizeof(delay));
+        jb_put(chunks, (const char*)&n, sizeof(n));
+        jb_put(chunks, rec, n);
+        free(rec);
+    }
+    
+    if (tag == 'E') {
+        uint32_t fl, code, retry_after;
+        if (!cas_get_u32(f, &fl) && !cas_get_u32(f, &code) &&
+            !cas_get_u32(f, &retry_after) && (rec = cas_get_blob(f, NULL))) {
+            resp->http_code = (long)(int32_t)code;
+            resp->retry_after_ms = (long)(int32_t)retry_after;
+            snprintf(resp->error, sizeof(resp->error), "%s", rec);
+            free(rec);
+            *failed = fl != 0;
+            return 0;
+        }
+    }
+    
+    snprintf(resp->error, sizeof(resp->error), "Truncated cassette");
+    return -1;
+}
+
+/*
+ * Replay the next recorded attempt into the request's sink
+ * Chunks are delivered with their recorded spacing divided by the replay speed
+ * Returns: 0 if the recorded attempt succeeded, -1 otherwise (resp->error is filled in)
+ */
+static int cassette_replay(struct cassette *cas, const ChatGPTRequest *req, ChatGPTResponse *resp) {
+    struct jbuf chunks = {0};
+    int failed = 1;
+    
+    cas_lock(cas);
+    int rc = cassette_read_exchange(cas, req, &chunks, resp, &failed);
+    cas_unlock(cas);
+    if (rc == 0 && chunks.failed) {
+        snprintf(resp->error, sizeof(resp->error), "Out of memory");
+        rc = -1;
+    }
+    
+    for (size_t off = 0; rc == 0 && off < chunks.n; ) {
+        uint32_t delay, n;
+        memcpy(&delay, chunks.d + off, sizeof(delay));
+        memcpy(&n, chunks.d + off + 4, sizeof(n));
+        off += 8;
+        if (cas->speed > 0) sleep_us((uint64_t)(delay / cas->speed));
+        if (req->sink(chunks.d + off, n, req->sink_data) != n) {
+            snprintf(resp->error, sizeof(resp->error), "Write callback aborted replay");
+            rc = -1;
+        }
+        off += n;
+    }
+    free(chunks.d);
+    return rc == 0 && !failed ? 0 : -1;
+}
+
+/*
+ * Send one attempt through a cassette: replay it, or send it through t and record it
+ */
+static int cassette_post(struct cassette *cas, ChatGPTTransport *t, const ChatGPTRequest *req,
+                         ChatGPTResponse *resp) {
+    if (cas->mode == CHATGPT_CASSETTE_REPLAY) return cassette_replay(cas, req, resp);
+    return cassette_record(cas, t, req, resp);
+}
+
+static int cassette_transport_post(ChatGPTTransport *self, const ChatGPTRequest *req, ChatGPTResponse *resp) {
+    struct cassette *cas = (struct cassette*)self;
+    return cassette_post(cas, cas->inner, req, resp);
+}
+
+static void cassette_transport_destroy(ChatGPTTransport *self) {
+    cassette_release((struct cassette*)self);
+}
+
+/*
+ * Create a transport that records the exchanges of another transport, or replays them
+ * Unlike chatgpt_cassette_open() this only covers the conversations using the transport
+ * The inner transport is not owned and must outlive the wrapper (it is unused on replay)
+ * Usage: ChatGPTTransport *t = chatgpt_transport_cassette_new(chatgpt_transport_curl(), "a.cas", CHATGPT_CASSETTE_RECORD, 0);
+ * Returns: New transport (free with chatgpt_transport_free) or NULL on error
+ */
+ChatGPTTransport *chatgpt_transport_cassette_new(ChatGPTTransport *inner, const char *path,
+                                                 ChatGPT_CassetteMode mode, double speed) {
+    int rc;
+    if (!inner) return NULL;
+    
+    struct cassette *cas = cassette_open(path, mode, speed, &rc);
+    if (!cas) return NULL;
+    cas->inner = inner;
+    return &cas->base;
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃           TLS SESSION PERSISTENCE             ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * TLS session file layout (little-endian, same blob encoding as cassettes):
+ *   "CGPTTLS1"
+ *   per session: u32 len, peer key | u32 len, salt+hmac | u32 len, session data |
+ *                u32 lo, u32 hi (valid-until, Unix seconds)
+ * Needs curl_easy_ssls_export/import from libcurl 8.12+. Built against older headers,
+ * they are looked up in the running libcurl instead, which may well be newer; without
+ * them the calls report CHATGPT_ERR_STATE. Define CHATGPT_REQUIRE_TLS_SESSION_FILE to
+ * make building against older headers a compile error instead.
+ */
+#define TLS_SESSION_MAGIC "CGPTTLS1"
+
+#if LIBCURL_VERSION_NUM < 0x080c00 && defined(CHATGPT_REQUIRE_TLS_SESSION_FILE)
+#error "TLS session persistence needs libcurl 8.12 or newer"
+#endif
+
+static char *g_tls_session_file = NULL;  // Under LOCK_TLS_FILE
+
+typedef CURLcode (*tls_export_cb_fn)(CURL *h, void *ud, const char *key, const unsigned char *shmac,
+                                     size_t shmac_len, const unsigned char *sdata, size_t sdata_len,
+                                     curl_off_t valid_until, int ietf_tls_id, const char *alpn,
+                                     size_t earlydata_max);
+typedef CURLcode (*tls_export_fn)(CURL *h, tls_export_cb_fn cb, void *ud);
+typedef CURLcode (*tls_import_fn)(CURL *h, const char *key, const unsigned char *shmac, size_t shmac_len,
+                                  const unsigned char *sdata, size_t sdata_len);
+
+/*
+ * Find libcurl's TLS session export and import functions
+ * Returns: 1 with both set, 0 if this libcurl has none
+ */
+static int tls_session_api(tls_export_fn *ex, tls_import_fn *im) {
+#if LIBCURL_VERSION_NUM >= 0x080c00
+    *ex = curl_easy_ssls_export;
+    *im = curl_easy_ssls_import;
+    return 1;
+#elif !defined(_WIN32)
+    static tls_export_fn found_ex;
+    static tls_import_fn found_im;
+    static int looked;
+    
+    // Racing first callers store the same values
+    if (!__atomic_load_n(&looked, __ATOMIC_ACQUIRE)) {
+        void *self = dlopen(NULL, RTLD_LAZY);
+        if (self) {
+            found_ex = (tls_export_fn)dlsym(self, "curl_easy_ssls_export");
+            found_im = (tls_import_fn)dlsym(self, "curl_easy_ssls_import");
+            dlclose(self);
+        }
+        __atomic_store_n(&looked, 1, __ATOMIC_RELEASE);
+    }
+    *ex = found_ex;
+    *im = found_im;
+    return found_ex && found_im;
+#else
+    (void)ex; (void)im;
+    return 0;
+#endif
+}
+
+static CURLcode tls_export_cb(CURL *h, void *ud, const char *key, const unsigned char *shmac, size_t shmac_len,
+                              const unsigned char *sdata, size_t sdata_len, curl_off_t valid_until,
+                              int ietf_tls_id, const char *alpn, size_t earlydata_max) {
+    struct jbuf *b = (struct jbuf*)ud;
+    uint64_t until = valid_until > 0 ? (uint64_t)valid_until : 0;
+    
+    (void)h; (void)ietf_tls_id; (void)alpn; (void)earlydata_max;
+    cas_buf_blob(b, key ? key : "", key ? strlen(key) : 0);
+    cas_buf_blob(b, (const char*)shmac, shmac_len);
+    cas_buf_blob(b, (const char*)sdata, sdata_len);
+    cas_buf_u32(b, (uint32_t)until);
+    cas_buf_u32(b, (uint32_t)(until >> 32));
+    return b->failed ? CURLE_OUT_OF_MEMORY : CURLE_OK;
+}
+
+/*
+ * Write the TLS sessions held by the shared cache to the session file
+ * Replaced atomically (see write_file_atomic), so a crash never leaves a torn file
+ * Usage: chatgpt_save_tls_sessions();  // e.g. periodically and before exit
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_save_tls_sessions(void) {
+    tls_export_fn ex;
+    tls_import_fn im;
+    struct jbuf b = {0};
+    int rc;
+    
+    if (!tls_session_api(&ex, &im)) {
+        log_line("TLS session persistence needs libcurl 8.12 or newer");
+        return CHATGPT_ERR_STATE;
+    }
+    CURL *h = curl_handle_new();
+    if (!h) return CHATGPT_ERR_OOM;
+    
+    // Held throughout, so saves neither race each other nor lose the path
+    lib_lock(LOCK_TLS_FILE);
+    if (!g_tls_session_file) {
+        rc = CHATGPT_ERR_STATE;
+    } else {
+        jb_put(&b, TLS_SESSION_MAGIC, 8);
+        CURLcode cc = ex(h, tls_export_cb, &b);
+        if (b.failed) rc = CHATGPT_ERR_OOM;
+        else if (cc != CURLE_OK) rc = CHATGPT_ERR_STATE;
+        else rc = write_file_atomic(g_tls_session_file, b.d, b.n);
+    }
+    lib_unlock(LOCK_TLS_FILE);
+    curl_easy_cleanup(h);
+    free(b.d);
+    return rc;
+}
+
+/*
+ * Persist TLS sessions in a file so a restarted process resumes instead of full handshakes
+ * Sessions in the file are imported into the shared cache right away (expired ones are skipped);
+ * a missing file is not an error. Pass NULL to stop using a file
+ * Usage: chatgpt_set_tls_session_file("/var/cache/app/tls.sessions");
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_tls_session_file(const char *path) {
+    tls_export_fn ex;
+    tls_import_fn im;
+    char *copy = NULL;
+    
+    curl_shared_once();
+    if (path) {
+        if (!tls_session_api(&ex, &im)) {
+            log_line("TLS session persistence needs libcurl 8.12 or newer");
+            return CHATGPT_ERR_STATE;
+        }
+        copy = dup_str(path);
+        if (!copy) return CHATGPT_ERR_OOM;
+    }
+    lib_lock(LOCK_TLS_FILE);
+    free(g_tls_session_file);
+    g_tls_session_file = copy;
+    lib_unlock(LOCK_TLS_FILE);
+    if (!path) return CHATGPT_OK;
+    
+    char magic[8];
+    int imported = 0;
+    
+    FILE *f = fopen(path, "rb");
+    if (!f) return CHATGPT_OK;
+    CURL *h = curl_handle_new();
+    if (!h || fread(magic, 1, 8, f) != 8 || memcmp(magic, TLS_SESSION_MAGIC, 8) != 0) {
+        if (h) curl_easy_cleanup(h);
+        fclose(f);
+        return h ? CHATGPT_ERR_STATE : CHATGPT_ERR_OOM;
+    }
+    
+    for (;;) {
+        uint32_t key_len, shmac_len, sdata_len, lo, hi;
+        char *key = cas_get_blob(f, &key_len);
+        char *shmac = key ? cas_get_blob(f, &shmac_len) : NULL;
+        char *sdata = shmac ? cas_get_blob(f, &sdata_len) : NULL;
+        int ok = sdata && !cas_get_u32(f, &lo) && !cas_get_u32(f, &hi);
+        
+        if (ok && (((uint64_t)hi << 32) | lo) > (uint64_t)time(NULL)) {
+            if (im(h, key_len ? key : NULL, (const unsigned char*)shmac, shmac_len,
+                   (const unsigned char*)sdata, sdata_len) == CURLE_OK) {
+                imported++;
+            }
+        }
+        free(key);
+        free(shmac);
+        free(sdata);
+        if (!ok) break;
+    }
+    curl_easy_cleanup(h);
+    fclose(f);
+    
+    char note[64];
+    snprintf(note, sizeof(note), "Imported %d TLS session(s)", imported);
+    log_line(note);
+    return CHATGPT_OK;
+}
+
+/*
+ * Release the process-wide curl state
+ * Saves TLS sessions first when a session file is set. Call once at exit, after the last request
+ * Usage: chatgpt_global_cleanup();
+ */
+void chatgpt_global_cleanup(void) {
+    warm_stop();
+    free(g_catalog);
+    free(g_catalog_key);
+    g_catalog = g_catalog_key = NULL;
+    
+    curl_shared_once();
+    lib_lock(LOCK_TLS_FILE);
+    int persist = g_tls_session_file != NULL;
+    lib_unlock(LOCK_TLS_FILE);
+    if (persist) {
+        chatgpt_save_tls_sessions();
+        chatgpt_set_tls_session_file(NULL);
+    }
+    
+    if (g_share) {
+        curl_share_cleanup(g_share);
+        g_share = NULL;
+    }
+    curl_global_cleanup();
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃                 SESSION STORE                 ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Conversations keyed by session id under a memory budget
+ * Resident sessions that are not acquired sit on an LRU list; when the estimated
+ * heap footprint exceeds the budget the least recently used ones are written to a
+ * spill file and freed ("hibernated"). Acquiring a hibernated session reads it back;
+ * chatgpt_session_prefetch() does that on a background thread ahead of time.
+ * Disk I/O always happens with the store lock released.
+ *
+ * Spill blobs are process-local (they contain the raw struct, whose shared config
+ * and transport pointers stay valid because the stub keeps the config referenced):
+ *   "CGPTSES1" | u32 owned-string flags | struct bytes | owned strings |
+ *   u32 count | per message: role, u32 kind (0 = text, 1 = packed, 2 = shared text), data
+ * An owned API key is never written: the session stub keeps it in memory. Files are
+ * created exclusively with mode 0600 and symlinks are not followed
+ * Messages are compressed on the way out and stay compressed once back in memory
+ */
+#ifndef _WIN32
+
+#define SESSION_MAGIC "CGPTSES1"
+#define SESSION_PREFETCH_QUEUE 256
+#define SESSION_PACK_MIN 64         // Messages shorter than this are spilled as plain text
+
+// Owned-string flags in a spill blob
+#define SES_OWN_MODEL 1u
+#define SES_OWN_KEY 2u
+#define SES_OWN_URL 4u
+#define SES_OWN_REPLY 8u
+#define SES_OWN_TEMPLATE 16u
+
+enum { SES_RESIDENT, SES_HIBERNATED, SES_LOADING, SES_SPILLING };
+
+struct session {
+    char *id;                        // Session id (owned)
+    struct session *next_hash;       // Bucket chain
+    struct session *lru_prev;        // Towards most recently used
+    struct session *lru_next;        // Towards least recently used
+    ChatGPTConversation *conv;       // Conversation while resident
+    ChatGPTClientConfig *config;     // Config reference held while hibernated
+    unsigned long file_no;           // Spill file number while hibernated
+    char *api_key;                   // Conversation's own API key while hibernated (never spilled)
+    size_t bytes;                    // Footprint counted in resident_bytes
+    int pins;                        // Outstanding acquires
+    int state;                       // SES_*
+    int in_lru;                      // On the LRU list (resident and unpinned)
+};
+
+struct ChatGPTSessionStore {
+    pthread_mutex_t lock;            // Guards everything below
+    pthread_cond_t changed;          // A load or spill finished
+    pthread_cond_t work;             // Prefetch queue has work or store is stopping
+    char *dir;                       // Spill directory
+    size_t budget;                   // Resident bytes allowed
+    size_t resident_bytes;           // Estimated heap of resident sessions
+    struct session **buckets;        // Hash table
+    size_t n_buckets;
+    size_t n_sessions;
+    struct session *lru_head;        // Most recently used
+    struct session *lru_tail;        // Next to hibernate
+    unsigned long next_file;         // Spill file counter
+    char *queue[SESSION_PREFETCH_QUEUE]; // Ids waiting for prefetch
+    size_t q_head, q_len;
+    pthread_t worker;                // Prefetch thread
+    int worker_started;
+    int stopping;
+    ChatGPTSessionStats stats;
+};
+
+static size_t ses_hash(const char *id) {
+    size_t h = 2166136261u;
+    for (; *id; id++) h = (h ^ (unsigned char)*id) * 16777619u;
+    return h;
+}
+
+static struct session *ses_find(ChatGPTSessionStore *st, const char *id) {
+    struct session *s = st->buckets[ses_hash(id) & (st->n_buckets - 1)];
+    while (s && strcmp(s->id, id) != 0) s = s->next_hash;
+    return s;
+}
+
+static int ses_insert(ChatGPTSessionStore *st, struct session *s) {
+    // Keep the load factor at or below 1
+    if (st->n_sessions >= st->n_buckets) {
+        size_t nb = st->n_buckets * 2;
+        struct session **b = (struct session**)calloc(nb, sizeof(*b));
+        if (!b) return CHATGPT_ERR_OOM;
+        for (size_t i = 0; i < st->n_buckets; i++) {
+            struct session *e = st->buckets[i];
+            while (e) {
+                struct session *next = e->next_hash;
+                size_t h = ses_hash(e->id) & (nb - 1);
+                e->next_hash = b[h];
+                b[h] = e;
+                e = next;
+            }
+        }
+        free(st->buckets);
+        st->buckets = b;
+        st->n_buckets = nb;
+    }
+    
+    size_t h = ses_hash(s->id) & (st->n_buckets - 1);
+    s->next_hash = st->buckets[h];
+    st->buckets[h] = s;
+    st->n_sessions++;
+    return CHATGPT_OK;
+}
+
+static void ses_unlink_hash(ChatGPTSessionStore *st, struct session *s) {
+    struct session **pp = &st->buckets[ses_hash(s->id) & (st->n_buckets - 1)];
+    while (*pp != s) pp = &(*pp)->next_hash;
+    *pp = s->next_hash;
+    st->n_sessions--;
+}
+
+static void lru_push_front(ChatGPTSessionStore *st, struct session *s) {
+    s->lru_prev = NULL;
+    s->lru_next = st->lru_head;
+    if (st->lru_head) st->lru_head->lru_prev = s;
+    st->lru_head = s;
+    if (!st->lru_tail) st->lru_tail = s;
+    s->in_lru = 1;
+}
+
+static void lru_unlink(ChatGPTSessionStore *st, struct session *s) {
+    if (!s->in_lru) return;
+    if (s->lru_prev) s->lru_prev->lru_next = s->lru_next;
+    else st->lru_head = s->lru_next;
+    if (s->lru_next) s->lru_next->lru_prev = s->lru_prev;
+    else st->lru_tail = s->lru_prev;
+    s->lru_prev = s->lru_next = NULL;
+    s->in_lru = 0;
+}
+
+/*
+ * Estimated heap footprint of a conversation (allocations plus ~16 bytes of malloc overhead each)
+ */
+static size_t conv_footprint(const ChatGPTConversation *c) {
+    size_t n = sizeof(*c) + c->message_capacity * sizeof(ChatGPTMessage) + 32;
     
-    // Free all message content
     for (size_t i = 0; i < c->message_count; i++) {
-        free(c->messages[i].role);
-        free(c->messages[i].content);
+        const ChatGPTMessage *m = &c->messages[i];
+        if (m->role) n += strlen(m->role) + 17;
+        if (m->interned) {
+            // Shared with other conversations: hibernating this one would not free it
+        } else if (m->content) {
+            n += strlen(m->content) + 17;
+        } else if (m->packed) {
+            uint32_t hdr[2];
+            memcpy(hdr, m->packed, PACK_HDR);
+            n += PACK_HDR + hdr[1] + 16;
+        }
+    }
+    if (c->model && !is_borrowed(c, c->model)) n += strlen(c->model) + 17;
+    if (c->api_key && !is_borrowed(c, c->api_key)) n += strlen(c->api_key) + 17;
+    if (c->base_url && !is_borrowed(c, c->base_url)) n += strlen(c->base_url) + 17;
+    if (c->last_reply) n += strlen(c->last_reply) + 17;
+    if (c->template_json) n += c->template_json_len + 17;
+    if (c->last_error) n += ERROR_TEXT_MAX + 16;
+    return n;
+}
+
+/*
+ * Spill file name for a file number
+ * Returns: 0 on success, -1 if the path does not fit (never use a truncated one)
+ */
+static int spill_path(const ChatGPTSessionStore *st, unsigned long no, char *buf, size_t len) {
+    int n = snprintf(buf, len, "%s/chatgpt-%ld-%lu.ses", st->dir, (long)getpid(), no);
+    return n < 0 || (size_t)n >= len ? -1 : 0;
+}
+
+/*
+ * Write a conversation to a new spill file (packs its long messages as a side effect)
+ * The file must not exist yet; it is created 0600 without following symlinks
+ * Returns: 0 on success, -1 on error
+ */
+static int conv_spill(ChatGPTConversation *c, const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) return -1;
+    FILE *f = fdopen(fd, "wb");
+    if (!f) {
+        close(fd);
+        remove(path);
+        return -1;
     }
     
-    // Reset message count
+    uint32_t own = 0;
+    if (c->model && !is_borrowed(c, c->model)) own |= SES_OWN_MODEL;
+    if (c->api_key && !is_borrowed(c, c->api_key)) own |= SES_OWN_KEY;
+    if (c->base_url && !is_borrowed(c, c->base_url)) own |= SES_OWN_URL;
+    if (c->last_reply) own |= SES_OWN_REPLY;
+    if (c->template_json) own |= SES_OWN_TEMPLATE;
+    
+    int ok = fwrite(SESSION_MAGIC, 1, 8, f) == 8 && !cas_put_u32(f, own) &&
+             fwrite(c, sizeof(*c), 1, f) == 1;
+    if (ok && (own & SES_OWN_MODEL)) ok = !cas_put_blob(f, c->model, strlen(c->model));
+    if (ok && (own & SES_OWN_URL)) ok = !cas_put_blob(f, c->base_url, strlen(c->base_url));
+    if (ok && (own & SES_OWN_REPLY)) ok = !cas_put_blob(f, c->last_reply, strlen(c->last_reply));
+    if (ok && (own & SES_OWN_TEMPLATE)) ok = !cas_put_blob(f, c->template_json, c->template_json_len);
+    if (ok) ok = !cas_put_u32(f, (uint32_t)c->message_count);
+    
+    for (size_t i = 0; ok && i < c->message_count; i++) {
+        ChatGPTMessage *m = &c->messages[i];
+        const char *role = m->role ? m->role : "user";
+        
+        if (m->content && strlen(m->content) >= SESSION_PACK_MIN) msg_pack(m);
+        ok = !cas_put_blob(f, role, strlen(role));
+        if (ok && m->packed) {
+            uint32_t hdr[2];
+            memcpy(hdr, m->packed, PACK_HDR);
+            ok = !cas_put_u32(f, 1) && !cas_put_blob(f, m->packed, PACK_HDR + hdr[1]);
+        } else if (ok) {
+            const char *text = m->content ? m->content : "";
+            ok = !cas_put_u32(f, m->interned ? 2 : 0) && !cas_put_blob(f, text, strlen(text));
+        }
+    }
+    
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) remove(path);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Read a conversation back from a spill file
+ * cfg: The config the spilled conversation referenced (the result takes its own reference)
+ * key: The conversation's own API key kept by the stub (taken over on success only)
+ * Returns: Conversation or NULL on error
+ */
+static ChatGPTConversation *conv_restore(const char *path, ChatGPTClientConfig *cfg, char *key) {
+    ChatGPTConversation tmp;
+    char magic[8];
+    uint32_t own, count;
+    
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    FILE *f = fd >= 0 ? fdopen(fd, "rb") : NULL;
+    if (!f) {
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+    if (fread(magic, 1, 8, f) != 8 || memcmp(magic, SESSION_MAGIC, 8) != 0 || cas_get_u32(f, &own) ||
+        fread(&tmp, sizeof(tmp), 1, f) != 1) {
+        fclose(f);
+        return NULL;
+    }
+    
+    ChatGPTConversation *c = conv_alloc();
+    if (!c) {
+        fclose(f);
+        return NULL;
+    }
+    
+    // Settings come back verbatim; heap pointers are rebuilt below
+    ChatGPTMessage *msgs = c->messages;
+    size_t cap = c->message_capacity;
+    *c = tmp;
+    c->messages = msgs;
+    c->message_capacity = cap;
     c->message_count = 0;
+    c->last_error = NULL;
+    c->last_reply = NULL;
+    c->template_json = NULL;
+    c->config = chatgpt_config_retain(cfg);
+    if (own & SES_OWN_MODEL) c->model = NULL;
+    if (own & SES_OWN_KEY) c->api_key = NULL;
+    if (own & SES_OWN_URL) c->base_url = NULL;
+    
+    int ok = !(own & SES_OWN_KEY) || key;
+    if (ok && (own & SES_OWN_MODEL)) ok = (c->model = cas_get_blob(f, NULL)) != NULL;
+    if (ok && (own & SES_OWN_URL)) ok = (c->base_url = cas_get_blob(f, NULL)) != NULL;
+    if (ok && (own & SES_OWN_REPLY)) ok = (c->last_reply = cas_get_blob(f, NULL)) != NULL;
+    if (ok && (own & SES_OWN_TEMPLATE)) {
+        uint32_t len;
+        ok = (c->template_json = cas_get_blob(f, &len)) != NULL;
+        c->template_json_len = len;
+    }
+    if (ok) ok = !cas_get_u32(f, &count) && ensure_cap(c, count) == CHATGPT_OK;
+    
+    for (uint32_t i = 0; ok && i < count; i++) {
+        ChatGPTMessage *m = &c->messages[i];
+        uint32_t kind;
+        
+        m->role = cas_get_blob(f, NULL);
+        m->content = m->packed = NULL;
+        m->interned = NULL;
+        c->message_count++;
+        ok = m->role && !cas_get_u32(f, &kind);
+        if (!ok) break;
+        
+        uint32_t len;
+        char *data = cas_get_blob(f, &len);
+        struct intern *e = (data && kind == 2) ? intern_get(data, len) : NULL;
+        if (!data) {
+            ok = 0;
+        } else if (kind == 1) {
+            m->packed = data;
+        } else if (e) {
+            // Rejoin the shared copy (other sessions may still hold it)
+            free(data);
+            m->content = e->text;
+            m->interned = e;
+        } else {
+            m->content = data;
+        }
+    }
+    fclose(f);
+    
+    if (!ok) {
+        chatgpt_conversation_free(c);
+        return NULL;
+    }
+    if (own & SES_OWN_KEY) c->api_key = key;
+    return c;
+}
+
+/*
+ * Look up a session, waiting out any load or spill in progress (lock held)
+ */
+static struct session *ses_find_stable(ChatGPTSessionStore *st, const char *id) {
+    for (;;) {
+        struct session *s = ses_find(st, id);
+        if (!s || s->state == SES_RESIDENT || s->state == SES_HIBERNATED) return s;
+        pthread_cond_wait(&st->changed, &st->lock);
+    }
+}
+
+/*
+ * Bring a hibernated session back into memory (lock held, dropped during the read)
+ * The session ends up resident and off the LRU list
+ * Returns: 0 on success, -1 on error (session stays hibernated)
+ */
+static int ses_load(ChatGPTSessionStore *st, struct session *s) {
+    char path[1024];
+    
+    if (spill_path(st, s->file_no, path, sizeof(path)) != 0) return -1;
+    s->state = SES_LOADING;
+    pthread_mutex_unlock(&st->lock);
+    ChatGPTConversation *c = conv_restore(path, s->config, s->api_key);
+    size_t bytes = c ? conv_footprint(c) : 0;
+    if (c) remove(path);
+    pthread_mutex_lock(&st->lock);
+    
+    if (c) {
+        chatgpt_config_release(s->config);
+        s->config = NULL;
+        s->api_key = NULL;
+        s->conv = c;
+        s->bytes = bytes;
+        st->resident_bytes += bytes;
+        s->state = SES_RESIDENT;
+        st->stats.loads++;
+    } else {
+        s->state = SES_HIBERNATED;
+    }
+    pthread_cond_broadcast(&st->changed);
+    return c ? 0 : -1;
+}
+
+/*
+ * Hibernate a resident, unpinned session (lock held, dropped during the write)
+ * Returns: 0 on success, -1 on error (session stays resident)
+ */
+static int ses_spill(ChatGPTSessionStore *st, struct session *s) {
+    char path[1024];
+    ChatGPTConversation *c = s->conv;
+    unsigned long no = ++st->next_file;
+    
+    if (spill_path(st, no, path, sizeof(path)) != 0) return -1;
+    lru_unlink(st, s);
+    s->state = SES_SPILLING;
+    st->resident_bytes -= s->bytes;
+    pthread_mutex_unlock(&st->lock);
+    int rc = conv_spill(c, path);
+    if (rc == 0) {
+        // The stub keeps the config alive so borrowed strings in the blob stay valid,
+        // and keeps an owned API key in memory rather than on disk
+        ChatGPTClientConfig *cfg = chatgpt_config_retain(c->config);
+        char *key = NULL;
+        if (c->api_key && !is_borrowed(c, c->api_key)) {
+            key = c->api_key;
+            c->api_key = NULL;
+        }
+        chatgpt_conversation_free(c);
+        c = NULL;
+        pthread_mutex_lock(&st->lock);
+        s->config = cfg;
+        s->api_key = key;
+    } else {
+        pthread_mutex_lock(&st->lock);
+    }
+    
+    if (rc == 0) {
+        s->conv = NULL;
+        s->file_no = no;
+        s->bytes = 0;
+        s->state = SES_HIBERNATED;
+        st->stats.spills++;
+    } else {
+        st->resident_bytes += s->bytes;
+        s->state = SES_RESIDENT;
+        lru_push_front(st, s);
+    }
+    pthread_cond_broadcast(&st->changed);
+    return rc;
+}
+
+/*
+ * Hibernate least recently used sessions until the store is within budget (lock held)
+ */
+static void ses_enforce_budget(ChatGPTSessionStore *st) {
+    while (st->resident_bytes > st->budget && st->lru_tail) {
+        if (ses_spill(st, st->lru_tail) != 0) break;  // Disk trouble: stay over budget
+    }
+}
+
+static void ses_free(ChatGPTSessionStore *st, struct session *s) {
+    if (s->conv) {
+        chatgpt_conversation_free(s->conv);
+    } else if (s->state == SES_HIBERNATED) {
+        char path[1024];
+        if (spill_path(st, s->file_no, path, sizeof(path)) == 0) remove(path);
+        chatgpt_config_release(s->config);
+        free(s->api_key);
+    }
+    free(s->id);
+    free(s);
+}
+
+static void *ses_prefetch_worker(void *arg) {
+    ChatGPTSessionStore *st = (ChatGPTSessionStore*)arg;
+    
+    pthread_mutex_lock(&st->lock);
+    for (;;) {
+        while (!st->stopping && st->q_len == 0) pthread_cond_wait(&st->work, &st->lock);
+        if (st->stopping) break;
+        
+        char *id = st->queue[st->q_head];
+        st->q_head = (st->q_head + 1) % SESSION_PREFETCH_QUEUE;
+        st->q_len--;
+        
+        struct session *s = ses_find_stable(st, id);
+        if (s && s->state == SES_HIBERNATED && ses_load(st, s) == 0) {
+            // Most recently used: it is about to be acquired
+            lru_push_front(st, s);
+            st->stats.prefetches++;
+            ses_enforce_budget(st);
+        }
+        free(id);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return NULL;
+}
+
+#endif /* !_WIN32 */
+
+/*
+ * Create a session store
+ * spill_dir: Existing directory for hibernated sessions (files are removed when loaded or freed,
+ *            created 0600 and never through a symlink)
+ * memory_budget: Estimated bytes of resident conversations before idle ones are hibernated
+ * Usage: ChatGPTSessionStore *st = chatgpt_session_store_new("/var/tmp", 512u << 20);
+ * Returns: Store or NULL on error (and on Windows, where it is not available)
+ */
+ChatGPTSessionStore *chatgpt_session_store_new(const char *spill_dir, size_t memory_budget) {
+#ifdef _WIN32
+    (void)spill_dir; (void)memory_budget;
+    return NULL;
+#else
+    if (!spill_dir) return NULL;
+    
+    ChatGPTSessionStore *st = (ChatGPTSessionStore*)calloc(1, sizeof(*st));
+    if (!st) return NULL;
+    st->dir = dup_str(spill_dir);
+    st->budget = memory_budget;
+    st->n_buckets = 64;
+    st->buckets = (struct session**)calloc(st->n_buckets, sizeof(*st->buckets));
+    if (!st->dir || !st->buckets || pthread_mutex_init(&st->lock, NULL) != 0) {
+        free(st->dir);
+        free(st->buckets);
+        free(st);
+        return NULL;
+    }
+    pthread_cond_init(&st->changed, NULL);
+    pthread_cond_init(&st->work, NULL);
+    return st;
+#endif
+}
+
+/*
+ * Free a session store with all its conversations and spill files
+ * No session may be acquired at this point
+ * Usage: chatgpt_session_store_free(st);
+ */
+void chatgpt_session_store_free(ChatGPTSessionStore *st) {
+#ifndef _WIN32
+    if (!st) return;
+    
+    pthread_mutex_lock(&st->lock);
+    st->stopping = 1;
+    pthread_cond_broadcast(&st->work);
+    pthread_mutex_unlock(&st->lock);
+    if (st->worker_started) pthread_join(st->worker, NULL);
+    
+    for (size_t i = 0; i < st->n_buckets; i++) {
+        struct session *s = st->buckets[i];
+        while (s) {
+            struct session *next = s->next_hash;
+            ses_free(st, s);
+            s = next;
+        }
+    }
+    for (size_t i = 0; i < st->q_len; i++) free(st->queue[(st->q_head + i) % SESSION_PREFETCH_QUEUE]);
+    
+    pthread_cond_destroy(&st->changed);
+    pthread_cond_destroy(&st->work);
+    pthread_mutex_destroy(&st->lock);
+    free(st->buckets);
+    free(st->dir);
+    free(st);
+#else
+    (void)st;
+#endif
+}
+
+/*
+ * Add a conversation to the store under an id (the store takes ownership)
+ * Usage: chatgpt_session_put(st, "user-42", conv);
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE if the id exists, error code on failure
+ */
+int chatgpt_session_put(ChatGPTSessionStore *st, const char *id, ChatGPTConversation *c) {
+#ifndef _WIN32
+    if (!st || !id || !c) return CHATGPT_ERR_INVALID_ARG;
+    
+    struct session *s = (struct session*)calloc(1, sizeof(*s));
+    if (!s || !(s->id = dup_str(id))) {
+        free(s);
+        return CHATGPT_ERR_OOM;
+    }
+    s->conv = c;
+    s->state = SES_RESIDENT;
+    s->bytes = conv_footprint(c);
+    
+    pthread_mutex_lock(&st->lock);
+    if (ses_find(st, id) || ses_insert(st, s) != CHATGPT_OK) {
+        int exists = ses_find(st, id) != NULL;
+        pthread_mutex_unlock(&st->lock);
+        free(s->id);
+        free(s);
+        return exists ? CHATGPT_ERR_STATE : CHATGPT_ERR_OOM;
+    }
+    st->resident_bytes += s->bytes;
+    lru_push_front(st, s);
+    ses_enforce_budget(st);
+    pthread_mutex_unlock(&st->lock);
     return CHATGPT_OK;
+#else
+    (void)st; (void)id; (void)c;
+    return CHATGPT_ERR_STATE;
+#endif
 }
 
 /*
- * Get the number of messages in the conversation
- * Usage: int count = chatgpt_get_message_count(client);
- * Returns: Number of messages, or 0 if client is NULL
+ * Get a session's conversation for use, loading it from disk if it was hibernated
+ * The conversation stays in memory until chatgpt_session_release(); do not free it.
+ * Like any conversation it must be used by one thread at a time
+ * Usage: ChatGPTConversation *c = chatgpt_session_acquire(st, "user-42");
+ * Returns: Conversation or NULL if the id is unknown or the session cannot be loaded
  */
-int chatgpt_get_message_count(const ChatGPTClient *c) {
-    return c ? (int)c->message_count : 0;
+ChatGPTConversation *chatgpt_session_acquire(ChatGPTSessionStore *st, const char *id) {
+#ifndef _WIN32
+    if (!st || !id) return NULL;
+    
+    pthread_mutex_lock(&st->lock);
+    struct session *s = ses_find_stable(st, id);
+    if (s && s->state == SES_HIBERNATED && ses_load(st, s) != 0) s = NULL;
+    if (!s) {
+        pthread_mutex_unlock(&st->lock);
+        return NULL;
+    }
+    
+    lru_unlink(st, s);
+    s->pins++;
+    ChatGPTConversation *c = s->conv;
+    ses_enforce_budget(st);
+    pthread_mutex_unlock(&st->lock);
+    return c;
+#else
+    (void)st; (void)id;
+    return NULL;
+#endif
 }
 
 /*
- * Remove the last message from the conversation
- * Useful for undoing the last message addition
- * Usage: chatgpt_pop_last_message(client); // Remove most recent message
+ * Hand a session back after use; its footprint is re-measured and it becomes most recently used
+ * Usage: chatgpt_session_release(st, "user-42");
  * Returns: CHATGPT_OK on success, error code on failure
  */
-int chatgpt_pop_last_message(ChatGPTClient *c) {
-    if (!c || c->message_count == 0) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Get index of last message
-    size_t i = c->message_count - 1;
+int chatgpt_session_release(ChatGPTSessionStore *st, const char *id) {
+#ifndef _WIN32
+    if (!st || !id) return CHATGPT_ERR_INVALID_ARG;
+    
+    pthread_mutex_lock(&st->lock);
+    struct session *s = ses_find(st, id);
+    if (!s || s->pins == 0) {
+        pthread_mutex_unlock(&st->lock);
+        return CHATGPT_ERR_STATE;
+    }
     
-    // Free the message content
-    free(c->messages[i].role);
-    free(c->messages[i].content);
+    st->resident_bytes -= s->bytes;
+    s->bytes = conv_footprint(s->conv);
+    st->resident_bytes += s->bytes;
+    if (--s->pins == 0) lru_push_front(st, s);
+    ses_enforce_budget(st);
+    pthread_mutex_unlock(&st->lock);
+    return CHATGPT_OK;
+#else
+    (void)st; (void)id;
+    return CHATGPT_ERR_STATE;
+#endif
+}
+
+/*
+ * Remove a session and free its conversation (or spill file)
+ * Usage: chatgpt_session_remove(st, "user-42");
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE while acquired, error code on failure
+ */
+int chatgpt_session_remove(ChatGPTSessionStore *st, const char *id) {
+#ifndef _WIN32
+    if (!st || !id) return CHATGPT_ERR_INVALID_ARG;
+    
+    pthread_mutex_lock(&st->lock);
+    struct session *s = ses_find_stable(st, id);
+    if (!s || s->pins > 0) {
+        pthread_mutex_unlock(&st->lock);
+        return s ? CHATGPT_ERR_STATE : CHATGPT_ERR_INVALID_ARG;
+    }
+    lru_unlink(st, s);
+    ses_unlink_hash(st, s);
+    if (s->state == SES_RESIDENT) st->resident_bytes -= s->bytes;
+    pthread_mutex_unlock(&st->lock);
     
-    // Decrease count
-    c->message_count--;
+    ses_free(st, s);
+    return CHATGPT_OK;
+#else
+    (void)st; (void)id;
+    return CHATGPT_ERR_STATE;
+#endif
+}
+
+/*
+ * Start loading a hibernated session in the background (a hint: it is about to be acquired)
+ * Usage: chatgpt_session_prefetch(st, "user-42");
+ * Returns: CHATGPT_OK when queued or already resident, error code on failure
+ */
+int chatgpt_session_prefetch(ChatGPTSessionStore *st, const char *id) {
+#ifndef _WIN32
+    if (!st || !id) return CHATGPT_ERR_INVALID_ARG;
+    
+    pthread_mutex_lock(&st->lock);
+    struct session *s = ses_find(st, id);
+    int rc = CHATGPT_OK;
+    if (!s) {
+        rc = CHATGPT_ERR_INVALID_ARG;
+    } else if (s->state == SES_HIBERNATED) {
+        if (!st->worker_started) {
+            if (pthread_create(&st->worker, NULL, ses_prefetch_worker, st) == 0) st->worker_started = 1;
+        }
+        char *copy = dup_str(id);
+        if (!st->worker_started || !copy || st->q_len == SESSION_PREFETCH_QUEUE) {
+            free(copy);
+            rc = CHATGPT_ERR_STATE;
+        } else {
+            st->queue[(st->q_head + st->q_len) % SESSION_PREFETCH_QUEUE] = copy;
+            st->q_len++;
+            pthread_cond_signal(&st->work);
+        }
+    }
+    pthread_mutex_unlock(&st->lock);
+    return rc;
+#else
+    (void)st; (void)id;
+    return CHATGPT_ERR_STATE;
+#endif
+}
+
+/*
+ * Read the store's counters
+ * Usage: ChatGPTSessionStats s; chatgpt_session_store_stats(st, &s);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_session_store_stats(ChatGPTSessionStore *st, ChatGPTSessionStats *out) {
+#ifndef _WIN32
+    if (!st || !out) return CHATGPT_ERR_INVALID_ARG;
+    
+    pthread_mutex_lock(&st->lock);
+    *out = st->stats;
+    out->sessions = st->n_sessions;
+    out->resident_bytes = st->resident_bytes;
+    out->resident = out->hibernated = 0;
+    for (size_t i = 0; i < st->n_buckets; i++) {
+        for (struct session *s = st->buckets[i]; s; s = s->next_hash) {
+            if (s->conv) out->resident++;
+            else out->hibernated++;
+        }
+    }
+    pthread_mutex_unlock(&st->lock);
     return CHATGPT_OK;
+#else
+    (void)st; (void)out;
+    return CHATGPT_ERR_STATE;
+#endif
+}
+
+/*
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃                 SESSION TABLE                 ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Concurrent map from session id to conversation for servers, all in memory
+ * Lookups take no lock: bucket chains are published with release stores and walked
+ * with acquire loads. Inserts and removals lock one of STAB_STRIPES mutexes (picked by
+ * the id's hash, so a bucket always maps to the same stripe); growing the table takes
+ * all of them and swaps in a rebuilt bucket array. Unlinked chain cells, entries and old
+ * arrays are freed by epoch: a reader announces the epoch it entered in a slot, and
+ * retired memory is freed once every announced epoch is newer than its retirement.
+ *
+ * Each session has a FIFO ticket lock: acquire takes a ticket and waits (on a condition
+ * variable, not spinning, since a turn lasts a whole API call) until it is served, so
+ * concurrent turns on one session queue in arrival order while other sessions proceed.
+ */
+#ifndef _WIN32
+
+#define STAB_STRIPES 64             // Writer locks (power of two, at most the bucket count)
+#define STAB_SLOTS 128              // Concurrent readers announced at once
+#define STAB_LOAD 2                 // Entries per bucket before the table doubles
+#define STAB_DEAD 0x80000000u       // Entry refs: removed, cannot be acquired any more
+
+enum { STAB_LINK, STAB_ENTRY, STAB_ARRAY };
+
+// Header of anything freed by epoch
+struct stab_retired {
+    struct stab_retired *next;
+    uint64_t epoch;                  // Global epoch when it was unlinked
+    int kind;                        // STAB_*
+};
+
+struct stab_entry {
+    struct stab_retired r;
+    char *id;                        // Session id (owned, immutable)
+    size_t hash;
+    ChatGPTConversation *conv;       // Owned
+    unsigned refs;                   // 1 for the table + holders and waiters, | STAB_DEAD
+    unsigned next_ticket;            // Next turn to hand out
+    unsigned serving;                // Turn that holds the session
+    pthread_mutex_t lock;            // Only for waiting on turn
+    pthread_cond_t turn;
+};
+
+struct stab_link {
+    struct stab_retired r;
+    struct stab_link *next;
+    struct stab_entry *e;
+};
+
+struct stab_array {
+    struct stab_retired r;
+    size_t n;                        // Buckets (power of two)
+    struct stab_link *b[];
+};
+
+struct ChatGPTSessionTable {
+    struct stab_array *arr;          // Current buckets (swapped under all stripe locks)
+    size_t count;                    // Entries (atomic)
+    uint64_t epoch;                  // Global epoch (atomic)
+    struct { uint64_t epoch; char pad[56]; } slot[STAB_SLOTS]; // 0 = free, else reader's epoch
+    pthread_mutex_t stripe[STAB_STRIPES];
+    pthread_mutex_t retire_lock;     // Guards the retired list
+    struct stab_retired *retired;
+};
+
+static void stab_reclaim_one(struct stab_retired *r) {
+    if (r->kind == STAB_ENTRY) {
+        struct stab_entry *e = (struct stab_entry*)r;
+        pthread_mutex_destroy(&e->lock);
+        pthread_cond_destroy(&e->turn);
+        free(e->id);
+    } else if (r->kind == STAB_ARRAY) {
+        // A replaced array takes its chain cells along (the entries moved on)
+        struct stab_array *a = (struct stab_array*)r;
+        for (size_t i = 0; i < a->n; i++) {
+            for (struct stab_link *l = a->b[i], *next; l; l = next) {
+                next = l->next;
+                free(l);
+            }
+        }
+    }
+    free(r);
+}
+
+/*
+ * Announce a reader; returns its slot for stab_leave
+ * The slot search starts at a per-thread spot (threads run on distinct stacks)
+ */
+static size_t stab_enter(ChatGPTSessionTable *t) {
+    char here;
+    size_t i = (size_t)(((uintptr_t)&here >> 12) * 2654435761u) % STAB_SLOTS;
+    for (;;) {
+        for (size_t k = 0; k < STAB_SLOTS; k++, i = (i + 1) % STAB_SLOTS) {
+            uint64_t e = __atomic_load_n(&t->epoch, __ATOMIC_SEQ_CST), zero = 0;
+            if (__atomic_load_n(&t->slot[i].epoch, __ATOMIC_RELAXED) == 0 &&
+                __atomic_compare_exchange_n(&t->slot[i].epoch, &zero, e, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                return i;
+            }
+        }
+        sched_yield();               // More than STAB_SLOTS readers at once
+    }
+}
+
+static void stab_leave(ChatGPTSessionTable *t, size_t i) {
+    __atomic_store_n(&t->slot[i].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Hand unlinked memory to the epoch collector and free whatever no reader can still see
+ */
+static void stab_retire(ChatGPTSessionTable *t, struct stab_retired *r) {
+    pthread_mutex_lock(&t->retire_lock);
+    if (r) {
+        r->epoch = __atomic_fetch_add(&t->epoch, 1, __ATOMIC_SEQ_CST);
+        r->next = t->retired;
+        t->retired = r;
+    }
+    
+    // Oldest epoch a reader may still be in
+    uint64_t min = UINT64_MAX;
+    for (size_t i = 0; i < STAB_SLOTS; i++) {
+        uint64_t e = __atomic_load_n(&t->slot[i].epoch, __ATOMIC_SEQ_CST);
+        if (e && e < min) min = e;
+    }
+    struct stab_retired **pp = &t->retired;
+    while (*pp) {
+        struct stab_retired *x = *pp;
+        if (x->epoch < min) {
+            *pp = x->next;
+            stab_reclaim_one(x);
+        } else {
+            pp = &x->next;
+        }
+    }
+    pthread_mutex_unlock(&t->retire_lock);
+}
+
+/*
+ * Find an entry and take a reference to it, without locking
+ * Returns: Entry or NULL if the id is unknown (or being removed)
+ */
+static struct stab_entry *stab_ref(ChatGPTSessionTable *t, const char *id) {
+    size_t h = ses_hash(id);
+    size_t slot = stab_enter(t);
+    struct stab_array *a = __atomic_load_n(&t->arr, __ATOMIC_ACQUIRE);
+    struct stab_link *l = __atomic_load_n(&a->b[h & (a->n - 1)], __ATOMIC_ACQUIRE);
+    struct stab_entry *found = NULL;
+    
+    for (; l; l = __atomic_load_n(&l->next, __ATOMIC_ACQUIRE)) {
+        struct stab_entry *e = l->e;
+        if (e->hash != h || strcmp(e->id, id) != 0) continue;
+        
+        unsigned r = __atomic_load_n(&e->refs, __ATOMIC_RELAXED);
+        while (!(r & STAB_DEAD)) {
+            if (__atomic_compare_exchange_n(&e->refs, &r, r + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                found = e;
+                break;
+            }
+        }
+        break;
+    }
+    stab_leave(t, slot);
+    return found;
 }
 
 /*
- * Remove a message at a specific index
- * All messages after the removed one will shift down by one position
- * Usage: chatgpt_remove_message_at(client, 2); // Remove the third message (0-indexed)
- * Returns: CHATGPT_OK on success, error code on failure
+ * Double the buckets once the table is over its load (no stripe lock held by the caller)
+ * Readers keep walking the old array, which is left intact and retired
  */
-int chatgpt_remove_message_at(ChatGPTClient *c, size_t idx) {
-    if (!c || idx >= c->message_count) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Free the message at the specified index
-    free(c->messages[idx].role);
-    free(c->messages[idx].content);
-    
-    // Shift all subsequent messages down
-    for (size_t i = idx + 1; i < c->message_count; i++) {
-        c->messages[i - 1] = c->messages[i];
+static void stab_grow(ChatGPTSessionTable *t) {
+    for (int i = 0; i < STAB_STRIPES; i++) pthread_mutex_lock(&t->stripe[i]);
+    
+    struct stab_array *old = t->arr;
+    size_t n = old->n * 2;
+    struct stab_array *a = NULL;
+    if (__atomic_load_n(&t->count, __ATOMIC_RELAXED) > old->n * STAB_LOAD) {
+        a = (struct stab_array*)calloc(1, sizeof(*a) + n * sizeof(a->b[0]));
+    }
+    if (a) {
+        a->r.kind = STAB_ARRAY;
+        a->n = n;
+        int ok = 1;
+        for (size_t i = 0; ok && i < old->n; i++) {
+            for (struct stab_link *l = old->b[i]; l; l = l->next) {
+                struct stab_link *c = (struct stab_link*)malloc(sizeof(*c));
+                if (!c) {
+                    ok = 0;
+                    break;
+                }
+                c->r.kind = STAB_LINK;
+                c->e = l->e;
+                c->next = a->b[l->e->hash & (n - 1)];
+                a->b[l->e->hash & (n - 1)] = c;
+            }
+        }
+        if (ok) {
+            __atomic_store_n(&t->arr, a, __ATOMIC_RELEASE);
+        } else {
+            // Out of memory: keep the longer chains
+            stab_reclaim_one(&a->r);
+            a = NULL;
+        }
     }
     
-    // Decrease count
-    c->message_count--;
-    return CHATGPT_OK;
+    for (int i = STAB_STRIPES; i-- > 0;) pthread_mutex_unlock(&t->stripe[i]);
+    if (a) stab_retire(t, &old->r);
 }
 
+#endif /* !_WIN32 */
+
 /*
- * Replace the content of the last user message
- * Searches backwards to find the most recent user message and replaces its content
- * Usage: chatgpt_replace_last_user(client, "Actually, let me ask something else...");
- * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE if no user message found
+ * Create a session table
+ * expected: Sessions to size the buckets for (the table grows past it as needed)
+ * Usage: ChatGPTSessionTable *t = chatgpt_session_table_new(10000);
+ * Returns: Table or NULL on error (and on Windows, where it is not available)
  */
-int chatgpt_replace_last_user(ChatGPTClient *c, const char *txt) {
-    if (!c || !txt) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Search backwards for the last user message
-    for (size_t i = c->message_count; i > 0; i--) {
-        ChatGPTMessage *m = &c->messages[i - 1];
-        if (m->role && strcmp(m->role, "user") == 0) {
-            // Found user message, replace content
-            char *d = dup_str(txt);
-            if (!d) return CHATGPT_ERR_OOM;
-            
-            free(m->content);
-            m->content = d;
-            return CHATGPT_OK;
-        }
+ChatGPTSessionTable *chatgpt_session_table_new(size_t expected) {
+#ifdef _WIN32
+    (void)expected;
+    return NULL;
+#else
+    size_t n = STAB_STRIPES;
+    while (n * STAB_LOAD < expected && n < ((size_t)1 << 30)) n *= 2;
+    
+    ChatGPTSessionTable *t = (ChatGPTSessionTable*)calloc(1, sizeof(*t));
+    struct stab_array *a = (struct stab_array*)calloc(1, sizeof(*a) + n * sizeof(a->b[0]));
+    if (!t || !a) {
+        free(t);
+        free(a);
+        return NULL;
     }
-    
-    // No user message found
-    return CHATGPT_ERR_STATE;
+    a->r.kind = STAB_ARRAY;
+    a->n = n;
+    t->arr = a;
+    t->epoch = 1;
+    for (int i = 0; i < STAB_STRIPES; i++) pthread_mutex_init(&t->stripe[i], NULL);
+    pthread_mutex_init(&t->retire_lock, NULL);
+    return t;
+#endif
 }
 
 /*
- * Append text to the last assistant message
- * Useful for building up responses incrementally
- * Usage: chatgpt_append_to_last_assistant(client, " Additional information...");
- * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE if no assistant message found
+ * Free a session table with all its conversations
+ * No other thread may be using it, and no session may be acquired
+ * Usage: chatgpt_session_table_free(t);
  */
-int chatgpt_append_to_last_assistant(ChatGPTClient *c, const char *extra) {
-    if (!c || !extra) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Search backwards for the last assistant message
-    for (size_t i = c->message_count; i > 0; i--) {
-        ChatGPTMessage *m = &c->messages[i - 1];
-        if (m->role && strcmp(m->role, "assistant") == 0) {
-            // Found assistant message, append to content
-            size_t a = m->content ? strlen(m->content) : 0;
-            size_t b = strlen(extra);
-            
-            // Reallocate content to fit additional text
-            char *p = (char*)realloc(m->content, a + b + 1);
-            if (!p) return CHATGPT_ERR_OOM;
-            
-            // Append new text
-            memcpy(p + a, extra, b + 1);
-            m->content = p;
-            return CHATGPT_OK;
+void chatgpt_session_table_free(ChatGPTSessionTable *t) {
+#ifndef _WIN32
+    if (!t) return;
+    
+    struct stab_array *a = t->arr;
+    for (size_t i = 0; i < a->n; i++) {
+        for (struct stab_link *l = a->b[i]; l; l = l->next) {
+            chatgpt_conversation_free(l->e->conv);
+            stab_reclaim_one(&l->e->r);
         }
     }
-    
-    // No assistant message found
-    return CHATGPT_ERR_STATE;
+    stab_reclaim_one(&a->r);
+    while (t->retired) {
+        struct stab_retired *r = t->retired;
+        t->retired = r->next;
+        stab_reclaim_one(r);
+    }
+    for (int i = 0; i < STAB_STRIPES; i++) pthread_mutex_destroy(&t->stripe[i]);
+    pthread_mutex_destroy(&t->retire_lock);
+    free(t);
+#else
+    (void)t;
+#endif
 }
 
 /*
- * Reset the client to a clean state
- * Clears messages, usage statistics, last reply, and errors
- * Keeps configuration settings (model, temperature, etc.)
- * Usage: chatgpt_reset(client); // Start completely fresh
- * Returns: CHATGPT_OK on success, error code on failure
+ * Add a conversation to the table under an id (the table takes ownership)
+ * Usage: chatgpt_session_table_put(t, "user-42", conv);
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE if the id exists, error code on failure
  */
-int chatgpt_reset(ChatGPTClient *c) {
-    if (!c) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Clear all messages
-    chatgpt_clear_messages(c);
-    
-    // Reset usage statistics
-    c->last_usage.prompt_tokens = 0;
-    c->last_usage.completion_tokens = 0;
-    c->last_usage.total_tokens = 0;
-    
-    // Clear last reply
-    free(c->last_reply);
-    c->last_reply = NULL;
+int chatgpt_session_table_put(ChatGPTSessionTable *t, const char *id, ChatGPTConversation *c) {
+#ifndef _WIN32
+    if (!t || !id || !c) return CHATGPT_ERR_INVALID_ARG;
+    
+    struct stab_entry *e = (struct stab_entry*)calloc(1, sizeof(*e));
+    struct stab_link *l = (struct stab_link*)malloc(sizeof(*l));
+    if (!e || !l || !(e->id = dup_str(id))) {
+        free(e);
+        free(l);
+        return CHATGPT_ERR_OOM;
+    }
+    e->r.kind = STAB_ENTRY;
+    e->hash = ses_hash(id);
+    e->conv = c;
+    e->refs = 1;
+    pthread_mutex_init(&e->lock, NULL);
+    pthread_cond_init(&e->turn, NULL);
+    l->r.kind = STAB_LINK;
+    l->e = e;
+    
+    pthread_mutex_t *m = &t->stripe[e->hash & (STAB_STRIPES - 1)];
+    pthread_mutex_lock(m);
+    struct stab_array *a = t->arr;
+    struct stab_link **head = &a->b[e->hash & (a->n - 1)];
+    for (struct stab_link *x = *head; x; x = x->next) {
+        if (x->e->hash == e->hash && strcmp(x->e->id, id) == 0) {
+            pthread_mutex_unlock(m);
+            e->conv = NULL;
+            stab_reclaim_one(&e->r);
+            free(l);
+            return CHATGPT_ERR_STATE;
+        }
+    }
     
-    // Clear error state
-    chatgpt_clear_error(c);
+    // Fully built before it becomes visible to readers
+    l->next = *head;
+    __atomic_store_n(head, l, __ATOMIC_RELEASE);
+    size_t count = __atomic_add_fetch(&t->count, 1, __ATOMIC_RELAXED);
+    size_t n = a->n;
+    pthread_mutex_unlock(m);
     
+    if (count > n * STAB_LOAD) stab_grow(t);
     return CHATGPT_OK;
+#else
+    (void)t; (void)id; (void)c;
+    return CHATGPT_ERR_STATE;
+#endif
 }
 
 /*
- * Create a JSON dump of all messages (alias for chatgpt_build_messages_json)
- * Usage: char *json = chatgpt_dump_messages(client); free(json); // Remember to free
- * Returns: JSON string or NULL on error
+ * Take a session for one turn, waiting (first come, first served) while other threads hold it
+ * The lookup takes no lock; only callers for the same session wait on each other.
+ * The conversation is theirs until chatgpt_session_table_release(); do not free it
+ * Usage: ChatGPTConversation *c = chatgpt_session_table_acquire(t, "user-42");
+ *        chatgpt_add_user(c, text); chatgpt_complete(c, ...); chatgpt_session_table_release(t, "user-42");
+ * Returns: Conversation or NULL if the id is unknown
  */
-char *chatgpt_dump_messages(ChatGPTClient *c) {
-    return chatgpt_build_messages_json(c);
+ChatGPTConversation *chatgpt_session_table_acquire(ChatGPTSessionTable *t, const char *id) {
+#ifndef _WIN32
+    if (!t || !id) return NULL;
+    
+    struct stab_entry *e = stab_ref(t, id);
+    if (!e) return NULL;
+    
+    // Ticket lock: the common uncontended case never touches the mutex
+    unsigned ticket = __atomic_fetch_add(&e->next_ticket, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&e->serving, __ATOMIC_SEQ_CST) != ticket) {
+        pthread_mutex_lock(&e->lock);
+        while (__atomic_load_n(&e->serving, __ATOMIC_SEQ_CST) != ticket) pthread_cond_wait(&e->turn, &e->lock);
+        pthread_mutex_unlock(&e->lock);
+    }
+    return e->conv;
+#else
+    (void)t; (void)id;
+    return NULL;
+#endif
 }
 
 /*
- * Print all messages to a file stream for debugging
- * Useful for inspecting conversation state
- * Usage: chatgpt_print_messages(client, stdout); // Print to console
- *        chatgpt_print_messages(client, debug_file); // Print to file
+ * End a turn taken with chatgpt_session_table_acquire, letting the next waiter in
+ * Usage: chatgpt_session_table_release(t, "user-42");
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE if the session is not acquired
  */
-void chatgpt_print_messages(ChatGPTClient *c, FILE *out) {
-    if (!c) return;
-    if (!out) out = stdout;
+int chatgpt_session_table_release(ChatGPTSessionTable *t, const char *id) {
+#ifndef _WIN32
+    if (!t || !id) return CHATGPT_ERR_INVALID_ARG;
+    
+    struct stab_entry *e = stab_ref(t, id);
+    if (!e) return CHATGPT_ERR_STATE;
+    unsigned s = __atomic_load_n(&e->serving, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&e->next_ticket, __ATOMIC_SEQ_CST) == s) {
+        __atomic_sub_fetch(&e->refs, 1, __ATOMIC_RELEASE);
+        return CHATGPT_ERR_STATE;
+    }
     
-    // Print each message with index, role, and content
-    for (size_t i = 0; i < c->message_count; i++) {
-        fprintf(out, "%zu %s: %s\n", 
-                i, 
-                c->messages[i].role ? c->messages[i].role : "?",
-                c->messages[i].content ? c->messages[i].content : "");
+    // Serve the next ticket; wake the waiters if there are any
+    __atomic_store_n(&e->serving, s + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&e->next_ticket, __ATOMIC_SEQ_CST) != s + 1) {
+        pthread_mutex_lock(&e->lock);
+        pthread_cond_broadcast(&e->turn);
+        pthread_mutex_unlock(&e->lock);
     }
+    
+    // Drop this lookup's reference and the one taken by acquire
+    __atomic_sub_fetch(&e->refs, 2, __ATOMIC_RELEASE);
+    return CHATGPT_OK;
+#else
+    (void)t; (void)id;
+    return CHATGPT_ERR_STATE;
+#endif
 }
 
 /*
- * Get the last reply from the AI (cached)
- * This is the complete response from the most recent API call
- * Usage: const char *reply = chatgpt_last_reply(client); // Do not free this pointer
- * Returns: Last reply string or NULL if no reply yet
+ * Remove a session and free its conversation
+ * Usage: chatgpt_session_table_remove(t, "user-42");
+ * Returns: CHATGPT_OK on success, CHATGPT_ERR_STATE while acquired or waited for,
+ *          CHATGPT_ERR_INVALID_ARG if the id is unknown
  */
-const char *chatgpt_last_reply(ChatGPTClient *c) {
-    return c ? c->last_reply : NULL;
+int chatgpt_session_table_remove(ChatGPTSessionTable *t, const char *id) {
+#ifndef _WIN32
+    if (!t || !id) return CHATGPT_ERR_INVALID_ARG;
+    
+    size_t h = ses_hash(id);
+    pthread_mutex_t *m = &t->stripe[h & (STAB_STRIPES - 1)];
+    pthread_mutex_lock(m);
+    struct stab_array *a = t->arr;
+    struct stab_link **pp = &a->b[h & (a->n - 1)];
+    while (*pp && ((*pp)->e->hash != h || strcmp((*pp)->e->id, id) != 0)) pp = &(*pp)->next;
+    
+    struct stab_link *l = *pp;
+    unsigned idle = 1;
+    if (!l || !__atomic_compare_exchange_n(&l->e->refs, &idle, STAB_DEAD, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        pthread_mutex_unlock(m);
+        return l ? CHATGPT_ERR_STATE : CHATGPT_ERR_INVALID_ARG;
+    }
+    __atomic_store_n(pp, l->next, __ATOMIC_RELEASE);
+    __atomic_sub_fetch(&t->count, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(m);
+    
+    // Readers may still be looking at the cell and entry, but no one holds the conversation
+    struct stab_entry *e = l->e;
+    chatgpt_conversation_free(e->conv);
+    e->conv = NULL;
+    stab_retire(t, &l->r);
+    stab_retire(t, &e->r);
+    return CHATGPT_OK;
+#else
+    (void)t; (void)id;
+    return CHATGPT_ERR_STATE;
+#endif
+}
+
+/*
+ * Number of sessions in the table
+ * Usage: size_t n = chatgpt_session_table_size(t);
+ * Returns: Session count (0 if t is NULL)
+ */
+size_t chatgpt_session_table_size(ChatGPTSessionTable *t) {
+#ifndef _WIN32
+    return t ? __atomic_load_n(&t->count, __ATOMIC_RELAXED) : 0;
+#else
+    (void)t;
+    return 0;
+#endif
 }
 
 /*
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
 ┃                                               ┃
-┃           CONVERSATION PERSISTENCE            ┃
+┃              HTTP REQUEST DISPATCH            ┃
 ┃                                               ┃
 ┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
  */
 
 /*
- * Save the current conversation to a JSON file
- * Saves only the messages array, not configuration settings
- * Usage: chatgpt_save_conversation(client, "my_chat.json");
- * Returns: CHATGPT_OK on success, error code on failure
+ * HTTP statuses worth retrying: rate limiting and server-side failures
  */
-int chatgpt_save_conversation(ChatGPTClient *c, const char *path) {
-    if (!c || !path) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Build JSON representation of messages
-    char *j = chatgpt_build_messages_json(c);
-    if (!j) return CHATGPT_ERR_OOM;
-    
-    // Open file for writing
-    FILE *f = fopen(path, "w");
-    if (!f) {
-        free(j);
-        return CHATGPT_ERR_HTTP;  // Reusing HTTP error for file I/O
-    }
-    
-    // Write JSON to file
-    fputs(j, f);
-    fclose(f);
-    free(j);
-    
-    return CHATGPT_OK;
+static int is_retryable_status(long code) {
+    return code == 429 || code >= 500;
 }
 
 /*
- * Load a conversation from a JSON file
- * Replaces current messages with those from the file
- * Usage: chatgpt_load_conversation(client, "my_chat.json");
- * Returns: CHATGPT_OK on success, error code on failure
+ * Sink wrapper that holds back retryable error bodies
+ * While retries remain, a 429/5xx body is dropped instead of reaching the caller,
+ * so the next attempt starts from a clean sink
  */
-int chatgpt_load_conversation(ChatGPTClient *c, const char *path) {
-    if (!c || !path) return CHATGPT_ERR_INVALID_ARG;
-    
-    // Open file for reading
-    FILE *f = fopen(path, "r");
-    if (!f) return CHATGPT_ERR_HTTP;
-    
-    // Get file size
-    fseek(f, 0, SEEK_END);
-    long sz = ftell(f);
-    if (sz < 0) {
-        fclose(f);
-        return CHATGPT_ERR_STATE;
+#define HELD_BODY_MAX 65536  // Largest error body held back for inspection; longer ones pass on
+
+struct retry_gate {
+    chatgpt_sink_fn sink;   // Caller's sink
+    void *ud;               // Caller's sink data
+    ChatGPTResponse *resp;  // Current attempt's response metadata
+    int hold;               // Nonzero while more attempts are allowed
+    size_t delivered;       // Bytes passed to the caller in this attempt
+    struct jbuf *held;      // Collects error bodies instead of the caller (NULL = pass them on);
+                            // failed is set once a body outgrew it and went to the caller after all
+};
+
+static size_t retry_gate_sink(const char *data, size_t len, void *ud) {
+    struct retry_gate *g = (struct retry_gate*)ud;
+    
+    if (g->hold && is_retryable_status(g->resp->http_code)) return len;
+    if (g->held && g->resp->http_code >= 400 && !g->held->failed) {
+        if (g->held->n + len <= HELD_BODY_MAX) {
+            jb_put(g->held, data, len);
+            if (!g->held->failed) return len;
+        }
+        
+        // Too large to hold (or no memory): the reply is final, hand over what was held
+        g->held->failed = 1;
+        if (g->held->n) {
+            g->delivered += g->held->n;
+            if (g->sink(g->held->d, g->held->n, g->ud) != g->held->n) return 0;
+        }
     }
-    fseek(f, 0, SEEK_SET);
-    
-    // Read entire file into buffer
-    char *buf = (char*)malloc((size_t)sz + 1);
-    if (!buf) {
-        fclose(f);
-        return CHATGPT_ERR_OOM;
+    g->delivered += len;
+    return g->sink(data, len, g->ud);
+}
+
+/*
+ * POST a request body to the chat completions endpoint
+ * Feeds the response into 'sink' as it arrives and records the HTTP status
+ * Retries transport failures and 429/5xx replies up to max_retries times, waiting
+ * retry_delay_ms or the server's Retry-After (whichever is longer); a response that
+ * already reached the sink is never retried
+ * held: When not NULL, an error reply (status 400 and up) is not retried and its body
+ *       goes here instead of to the sink, for the caller to try another model first;
+ *       a body over HELD_BODY_MAX goes to the sink after all and held->failed is set
+ * Goes through the active cassette when one is open
+ * Internal function behind http_post_chat and the model cascade
+ * Returns: 0 on success, -1 on transport failure (err is filled in)
+ */
+static int http_post_body(ChatGPTConversation *c, const char *body, size_t body_len, struct jbuf *held,
+                          chatgpt_sink_fn sink, void *ud, char *err, size_t err_len) {
+    ChatGPTTransport *t = c->transport ? c->transport : &g_curl_transport;
+    const char *headers[2];        // HTTP headers
+    char auth[512];                // Authorization header
+    char url[512];                 // Complete API URL
+    ChatGPTRequest req;            // Request handed to the transport
+    ChatGPTResponse resp;          // Response metadata of the current attempt
+    struct retry_gate gate;        // Holds back retryable error bodies
+    int rc;
+    
+    // Set up HTTP headers and URL (prebuilt by the shared config unless overridden)
+    const ChatGPTClientConfig *cfg = c->config;
+    headers[0] = "Content-Type: application/json";
+    if (cfg && c->api_key == cfg->base.api_key) {
+        headers[1] = cfg->auth_header;
+    } else {
+        snprintf(auth, sizeof(auth), "Authorization: Bearer %s", c->api_key);
+        headers[1] = auth;
     }
-    
-    size_t rd = fread(buf, 1, (size_t)sz, f);
-    buf[rd] = '\0';
-    fclose(f);
-    
-    // Parse JSON
-    cJSON *arr = cJSON_Parse(buf);
-    free(buf);
-    if (!arr) return CHATGPT_ERR_JSON_PARSE;
-    
-    // Verify it's an array
-    if (!cJSON_IsArray(arr)) {
-        cJSON_Delete(arr);
-        return CHATGPT_ERR_JSON_PARSE;
+    if (cfg && c->base_url == cfg->base.base_url) {
+        req.url = cfg->chat_url;
+    } else {
+        snprintf(url, sizeof(url), "%s/v1/chat/completions", c->base_url);
+        req.url = url;
     }
-    
-    // Clear existing messages
-    chatgpt_clear_messages(c);
-    
-    // Add each message from JSON
-    cJSON *it = NULL;
-    cJSON_ArrayForEach(it, arr) {
-        cJSON *r = cJSON_GetObjectItem(it, "role");
-        cJSON *t = cJSON_GetObjectItem(it, "content");
+    req.headers = headers;
+    req.header_count = 2;
+    req.body = body;
+    req.body_len = body_len;
+    req.sink = retry_gate_sink;
+    req.sink_data = &gate;
+    req.tenant = c->tenant;
+    
+    gate.sink = sink;
+    gate.ud = ud;
+    gate.resp = &resp;
+    gate.held = held;
+    
+    // The process-wide cassette, else a cassette transport, decides how replay sleeps
+    struct cassette *cas = cassette_acquire();
+    const struct cassette *replay = cas ? cas : t->post == cassette_transport_post ? (struct cassette*)t : NULL;
+    if (replay && replay->mode != CHATGPT_CASSETTE_REPLAY) replay = NULL;
+    
+    uint64_t start = now_us();
+    for (int attempt = 0; ; attempt++) {
+        memset(&resp, 0, sizeof(resp));
+        resp.retry_after_ms = -1;
+        gate.hold = !held && attempt < c->max_retries;
+        gate.delivered = 0;
+        if (held) {
+            held->n = 0;
+            held->failed = 0;
+        }
         
-        if (r && t && cJSON_IsString(r) && cJSON_IsString(t)) {
-            chatgpt_add_message(c, r->valuestring, t->valuestring);
+        // Replay never touches the network
+        rc = cas ? cassette_post(cas, t, &req, &resp) : t->post(t, &req, &resp);
+        c->last_http_code = resp.http_code;
+        
+        int retry = rc != 0 ? gate.delivered == 0
+                            : (gate.hold && is_retryable_status(resp.http_code));
+        if (!retry || attempt >= c->max_retries) break;
+        
+        // Back off before the next attempt
+        long wait_ms = c->retry_delay_ms;
+        if (resp.retry_after_ms > wait_ms) {
+            // Custom transports may report anything, cap it like the built-in ones do
+            wait_ms = resp.retry_after_ms < RETRY_AFTER_MAX_MS ? resp.retry_after_ms : RETRY_AFTER_MAX_MS;
+        }
+        if (g_log) {
+            char note[128];
+            snprintf(note, sizeof(note), "Retrying request (attempt %d, HTTP %ld, waiting %ld ms)",
+                     attempt + 2, resp.http_code, wait_ms);
+            log_line(note);
+        }
+        if (!replay) {
+            sleep_us((uint64_t)wait_ms * 1000);
+        } else if (replay->speed > 0) {
+            sleep_us((uint64_t)(wait_ms * 1000 / replay->speed));
         }
     }
+    cassette_release(cas);
     
-    cJSON_Delete(arr);
-    return CHATGPT_OK;
+    c->last_latency_ms = (double)(now_us() - start) / 1000.0;
+    snprintf(err, err_len, "%s", resp.error);
+    return rc == 0 ? 0 : -1;
 }
 
-/*
+/* 
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
 ┃                                               ┃
-┃             API REQUEST BUILDING              ┃
+┃                 MODEL ROUTING                 ┃
 ┃                                               ┃
 ┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
  */
 
 /*
- * Build the JSON request body for OpenAI API
- * Creates a complete request with model, messages, and parameters
- * Internal function used by chat completion functions
- * Parameters:
- *   - stream: 1 for streaming mode, 0 for regular completion
- * Returns: JSON string or NULL on error (caller must free)
+ * A router picks the model per request from a table of models with their context
+ * windows, prices and latency classes. The request body is serialized once; the
+ * chosen model is spliced into its leading "model" field, and on a context-length or
+ * capacity error the next candidate is spliced in and the same body is sent again
  */
-static char *build_request_body(ChatGPTClient *c, int stream) {
-    if (!c) return NULL;
-    
-    // Create root JSON object
-    cJSON *root = cJSON_CreateObject();
-    if (!root) return NULL;
-    
-    // Add model name
-    cJSON_AddStringToObject(root, "model", c->model ? c->model : "gpt-4o-mini");
-    
-    // Create messages array
-    cJSON *msgs = cJSON_CreateArray();
-    if (!msgs) {
-        cJSON_Delete(root);
-        return NULL;
-    }
-    cJSON_AddItemToObject(root, "messages", msgs);
-    
-    // Add each message to the array
-    for (size_t i = 0; i < c->message_count; i++) {
-        cJSON *m = cJSON_CreateObject();
-        if (!m) {
-            cJSON_Delete(root);
-            return NULL;
-        }
-        
-        // Add role and content to message object
-        cJSON_AddStringToObject(m, "role", c->messages[i].role);
-        cJSON_AddStringToObject(m, "content", c->messages[i].content);
-        cJSON_AddItemToArray(msgs, m);
-    }
-    
-    // Add generation parameters
-    cJSON_AddNumberToObject(root, "temperature", c->temperature);
-    cJSON_AddNumberToObject(root, "top_p", c->top_p);
-    
-    // Add penalty parameters if they are not default (0.0)
-    if (c->presence_penalty != 0.0) {
-        cJSON_AddNumberToObject(root, "presence_penalty", c->presence_penalty);
-    }
-    if (c->frequency_penalty != 0.0) {
-        cJSON_AddNumberToObject(root, "frequency_penalty", c->frequency_penalty);
-    }
+#define ROUTE_COMPLETION_GUESS 256  // Reply tokens assumed when max_tokens is not set
+
+enum { ROUTE_FINAL, ROUTE_CONTEXT, ROUTE_CAPACITY };
+
+struct ChatGPTRouter {
+    size_t count;
+    ChatGPTRouteModel models[];      // Names point into the same allocation
+};
+
+/*
+ * Create a router from a model table (copied; the router is immutable and can be shared)
+ * Usage:
+ *   ChatGPTRouteModel m[] = {
+ *       { "gpt-4o-mini", 128000, 0.15, 0.60, CHATGPT_LATENCY_INTERACTIVE },
+ *       { "gpt-4o",      128000, 2.50, 10.0, CHATGPT_LATENCY_STANDARD },
+ *   };
+ *   ChatGPTRouter *r = chatgpt_router_new(m, 2);
+ * Returns: Router or NULL on error
+ */
+ChatGPTRouter *chatgpt_router_new(const ChatGPTRouteModel *models, size_t count) {
+    if (!models || !count) return NULL;
     
-    // Add max_tokens if specified (0 means don't include it)
-    if (c->max_tokens > 0) {
-        cJSON_AddNumberToObject(root, "max_tokens", c->max_tokens);
+    size_t names = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!models[i].model || models[i].context_window <= 0) return NULL;
+        names += strlen(models[i].model) + 1;
     }
     
-    // Add streaming flag if requested
-    if (stream) {
-        cJSON_AddBoolToObject(root, "stream", 1);
+    ChatGPTRouter *r = (ChatGPTRouter*)malloc(sizeof(*r) + count * sizeof(r->models[0]) + names);
+    if (!r) return NULL;
+    r->count = count;
+    char *p = (char*)&r->models[count];
+    for (size_t i = 0; i < count; i++) {
+        size_t n = strlen(models[i].model) + 1;
+        r->models[i] = models[i];
+        r->models[i].model = memcpy(p, models[i].model, n);
+        p += n;
     }
-    
-    // Convert to string and cleanup
-    char *out = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    return out;
+    return r;
+}
+
+/*
+ * Free a router (no conversation may still be using it)
+ * Usage: chatgpt_router_free(r);
+ */
+void chatgpt_router_free(ChatGPTRouter *r) {
+    free(r);
+}
+
+/*
+ * Route this conversation's requests through a router (NULL goes back to its fixed model)
+ * policy: Latency class, cost ceiling and minimum context window (NULL = no limits)
+ * The router is not owned and must outlive the conversation's use of it
+ * Usage:
+ *   ChatGPTRoutePolicy p = { CHATGPT_LATENCY_INTERACTIVE, 0.01, 0 };
+ *   chatgpt_set_router(conversation, r, &p);
+ * Returns: CHATGPT_OK on success, error code on failure
+ */
+int chatgpt_set_router(ChatGPTConversation *c, const ChatGPTRouter *r, const ChatGPTRoutePolicy *policy) {
+    if (!c || (policy && (policy->max_cost < 0 || policy->min_context < 0))) return CHATGPT_ERR_INVALID_ARG;
+    
+    c->router = r;
+    memset(&c->route_policy, 0, sizeof(c->route_policy));
+    if (policy) c->route_policy = *policy;
+    return CHATGPT_OK;
 }
 
-/* 
-┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
-┃                                               ┃
-┃            HTTP RESPONSE HANDLING             ┃
-┃                                               ┃
-┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+/*
+ * Get the model the last request was answered by (the routed or cascade one when used)
+ * Usage: printf("Answered by %s\n", chatgpt_last_model(conversation));
+ * Returns: Model name, valid until the model or router changes; after a cascade it points
+ *          into the cascade's models array and is valid while those strings are
  */
+const char *chatgpt_last_model(const ChatGPTConversation *c) {
+    if (!c) return NULL;
+    return c->routed_model ? c->routed_model : c->model;
+}
 
 /*
- * Structure for accumulating HTTP response data
- * Used by curl to collect response data in chunks
+ * Copy a request body with another model in its leading "model" field
+ * Returns: New body (caller frees) or NULL if the body does not start with a model
  */
-struct wb {
-    char *d;    // Data buffer
-    size_t n;   // Current size
-};
+static char *route_swap_model(const char *body, size_t len, const char *model, size_t *out_len) {
+    const char lead[] = "{\"model\":\"";
+    const size_t ln = sizeof(lead) - 1;
+    
+    if (len < ln || memcmp(body, lead, ln) != 0) return NULL;
+    size_t end = ln;
+    while (end < len && body[end] != '"') end += body[end] == '\\' ? 2 : 1;
+    if (end >= len) return NULL;
+    
+    size_t mn = strlen(model);
+    size_t q = json_quoted_len(model, mn);
+    size_t rest = len - end - 1;
+    char *out = (char*)malloc(9 + q + rest + 1);
+    if (!out) return NULL;
+    memcpy(out, body, 9);
+    json_quote(out + 9, model, mn);
+    memcpy(out + 9 + q, body + end + 1, rest);
+    out[9 + q + rest] = '\0';
+    *out_len = 9 + q + rest;
+    return out;
+}
 
 /*
- * Curl write callback function
- * Called by curl for each chunk of response data received
- * Accumulates data in a growing buffer
- * Internal function used by HTTP requests
+ * Whether an error reply means another model may succeed
+ * Returns: ROUTE_CONTEXT (prompt too long for the model), ROUTE_CAPACITY (model overloaded
+ *          or rate limited, but not out of quota) or ROUTE_FINAL
  */
-static size_t write_cb(void *ptr, size_t sz, size_t nm, void *ud) {
-    size_t need = sz * nm;  // Calculate total bytes received
-    struct wb *w = (struct wb*)ud;
+static int route_error_kind(long code, struct jbuf *held) {
+    if (held->failed || !held->d) return ROUTE_FINAL;
+    held->d[held->n] = '\0';
     
-    // Reallocate buffer to fit new data
-    char *p = realloc(w->d, w->n + need + 1);
-    if (!p) return 0;  // Signal error to curl
-    
-    // Copy new data and update buffer
-    w->d = p;
-    memcpy(w->d + w->n, ptr, need);
-    w->n += need;
-    w->d[w->n] = '\0';  // Ensure null termination
+    if ((code == 400 || code == 413) &&
+        (strstr(held->d, "context_length_exceeded") || strstr(held->d, "maximum context length"))) {
+        return ROUTE_CONTEXT;
+    }
+    if ((code == 429 && !strstr(held->d, "insufficient_quota")) || code >= 500) return ROUTE_CAPACITY;
+    return ROUTE_FINAL;
+}
+
+/*
+ * Rank the router's models for a request: those that fit the estimated tokens, the
+ * latency class and the cost ceiling, cheapest first (table order among equals)
+ * Returns: Number of candidates written to order
+ */
+static size_t route_rank(const ChatGPTRouter *r, const ChatGPTRoutePolicy *p, long prompt, long completion,
+                         size_t *order, double *cost) {
+    size_t n = 0;
+    long need = prompt + completion;
+    if (need < p->min_context) need = p->min_context;
+    
+    for (size_t i = 0; i < r->count; i++) {
+        const ChatGPTRouteModel *m = &r->models[i];
+        double est = (prompt * m->input_cost_per_1k + completion * m->output_cost_per_1k) / 1000.0;
+        if (m->context_window < need) continue;
+        if (p->latency != CHATGPT_LATENCY_ANY && m->latency > p->latency) continue;
+        if (p->max_cost > 0 && est > p->max_cost) continue;
+        
+        size_t k = n++;
+        while (k > 0 && cost[k - 1] > est) {
+            order[k] = order[k - 1];
+            cost[k] = cost[k - 1];
+            k--;
+        }
+        order[k] = i;
+        cost[k] = est;
+    }
+    return n;
+}
+
+/*
+ * POST a chat request, routed when the conversation has a router
+ * Tries the ranked models in turn while replies are context-length or capacity errors;
+ * the last candidate's reply (or the first other error) reaches the sink as usual.
+ * last_latency_ms covers every candidate tried
+ * Internal function shared by the regular and streaming completion calls
+ * Returns: 0 on success, -1 on transport failure or when no model fits (err is filled in)
+ */
+static int http_post_chat(ChatGPTConversation *c, const char *body, chatgpt_sink_fn sink, void *ud,
+                          char *err, size_t err_len) {
+    size_t len = strlen(body);
+    const ChatGPTRouter *r = c->router;
+    
+    c->routed_model = NULL;
+    if (!r) return http_post_body(c, body, len, NULL, sink, ud, err, err_len);
+    
+    size_t *order = (size_t*)malloc(r->count * (sizeof(size_t) + sizeof(double)));
+    if (!order) {
+        snprintf(err, err_len, "Out of memory");
+        return -1;
+    }
+    double *cost = (double*)(order + r->count);
+    long prompt = (long)(len / 4);
+    long completion = c->max_tokens > 0 ? c->max_tokens : ROUTE_COMPLETION_GUESS;
+    size_t n = route_rank(r, &c->route_policy, prompt, completion, order, cost);
+    if (n == 0) {
+        free(order);
+        long need = prompt + completion > c->route_policy.min_context ? prompt + completion : c->route_policy.min_context;
+        snprintf(err, err_len, "No routed model fits the request (about %ld tokens needed)", need);
+        return -1;
+    }
     
-    return need;  // Return bytes processed
+    struct jbuf held = { NULL, 0, 0, 0 };
+    uint64_t start = now_us();
+    int rc = -1;
+    for (size_t k = 0; k < n; k++) {
+        const ChatGPTRouteModel *m = &r->models[order[k]];
+        size_t blen;
+        char *b = route_swap_model(body, len, m->model, &blen);
+        if (!b) {
+            snprintf(err, err_len, "Request body has no model to route");
+            break;
+        }
+        
+        // While other candidates remain, error replies are held back and inspected
+        int last = k + 1 == n;
+        c->routed_model = m->model;
+        rc = http_post_body(c, b, blen, last ? NULL : &held, sink, ud, err, err_len);
+        free(b);
+        if (last || rc != 0 || c->last_http_code < 400) break;
+        
+        int kind = route_error_kind(c->last_http_code, &held);
+        if (kind == ROUTE_CONTEXT) {
+            // Only a larger window can help
+            size_t j = k + 1;
+            while (j < n && r->models[order[j]].context_window <= m->context_window) j++;
+            if (j == n) kind = ROUTE_FINAL;
+            else k = j - 1;
+        }
+        if (kind == ROUTE_FINAL) {
+            if (held.n && !held.failed) sink(held.d, held.n, ud);
+            break;
+        }
+        if (g_log) {
+            char note[160];
+            snprintf(note, sizeof(note), "Model %s failed with HTTP %ld, falling back", m->model, c->last_http_code);
+            log_line(note);
+        }
+    }
+    c->last_latency_ms = (double)(now_us() - start) / 1000.0;
+    free(held.d);
+    free(order);
+    return rc;
 }
 
 /* 
@@ -1142,23 +8924,14 @@ static size_t write_cb(void *ptr, size_t sz, size_t nm, void *ud) {
  */
 
 /*
- * Send a chat completion request and get the full response
- * This is the main function for getting AI responses
- * Usage: 
- *   chatgpt_add_user(client, "Hello!");
- *   char *response = chatgpt_chat_complete(client);
- *   printf("AI: %s\n", response);
- *   free(response);
- * Returns: Complete AI response as a new string (caller must free), or NULL on error
+ * Turn a completion response body into the reply: checks for API errors, caches the
+ * reply and records usage; takes ownership of w's buffer
+ * mean_logprob: When not NULL, receives the mean token log-probability of the reply
+ *               (NAN if the response has none)
+ * Internal function shared by the plain and cascaded completion calls
+ * Returns: Reply as a new string (caller must free), or NULL on error (error is set)
  */
-char *chatgpt_chat_complete(ChatGPTClient *c) {
-    char *body;                    // Request body JSON
-    struct wb w = {0};             // Response buffer
-    CURL *curl = NULL;             // Curl handle
-    struct curl_slist *hdr = NULL; // HTTP headers
-    CURLcode rc;                   // Curl result code
-    char auth[512];                // Authorization header
-    char url[512];                 // Complete API URL
+static char *completion_reply(ChatGPTClient *c, struct wb *w, double *mean_logprob) {
     cJSON *root;                   // Parsed response JSON
     cJSON *err;                    // Error object from response
     cJSON *choices;                // Choices array from response
@@ -1168,63 +8941,14 @@ char *chatgpt_chat_complete(ChatGPTClient *c) {
     cJSON *usage;                  // Usage statistics
     char *reply;                   // Final response text
     
-    if (!c) return NULL;
-    
-    // Clear any previous error state
-    chatgpt_clear_error(c);
-    
-    // Build request body JSON
-    body = build_request_body(c, 0);  // 0 = non-streaming
-    if (!body) {
-        set_error(c, CHATGPT_ERR_OOM, "Failed to build request body");
-        return NULL;
-    }
-    
-    // Initialize curl
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-    if (!curl) {
-        free(body);
-        set_error(c, CHATGPT_ERR_HTTP, "Failed to initialize curl");
-        return NULL;
-    }
-    
-    // Set up HTTP headers
-    snprintf(auth, sizeof(auth), "Authorization: Bearer %s", c->api_key);
-    hdr = curl_slist_append(hdr, "Content-Type: application/json");
-    hdr = curl_slist_append(hdr, auth);
-    
-    // Build complete API URL
-    snprintf(url, sizeof(url), "%s/v1/chat/completions", c->base_url);
-    
-    // Configure curl options
-    curl_easy_setopt(curl, CURLOPT_URL, url);                    // Set URL
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdr);            // Set headers
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);           // Set POST data
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);    // Response handler
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&w);       // Response buffer
-    
-    // Perform the HTTP request
-    rc = curl_easy_perform(curl);
-    
-    // Cleanup curl resources
-    curl_slist_free_all(hdr);
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
-    free(body);
-    
-    // Check for HTTP errors
-    if (rc != CURLE_OK) {
-        free(w.d);
-        set_error(c, CHATGPT_ERR_HTTP, curl_easy_strerror(rc));
-        return NULL;
-    }
-    
-    // Parse JSON response
-    root = cJSON_Parse(w.d);
+    // Parse JSON response (the error position comes back through the out-param, not shared state)
+    const char *bad = NULL;
+    root = cJSON_ParseWithLengthOpts(w->d, w->n, &bad, 0);
     if (!root) {
-        free(w.d);
-        set_error(c, CHATGPT_ERR_JSON_PARSE, "Failed to parse response JSON");
+        char msg[96];
+        snprintf(msg, sizeof(msg), "Failed to parse response JSON at byte %ld", bad ? (long)(bad - w->d) : 0L);
+        free(w->d);
+        set_error(c, CHATGPT_ERR_JSON_PARSE, msg);
         return NULL;
     }
     
@@ -1235,7 +8959,7 @@ char *chatgpt_chat_complete(ChatGPTClient *c) {
         set_error(c, CHATGPT_ERR_API, 
                  (m && cJSON_IsString(m)) ? m->valuestring : "API returned error");
         cJSON_Delete(root);
-        free(w.d);
+        free(w->d);
         return NULL;
     }
     
@@ -1244,7 +8968,7 @@ char *chatgpt_chat_complete(ChatGPTClient *c) {
     if (!choices || !cJSON_IsArray(choices) || cJSON_GetArraySize(choices) == 0) {
         set_error(c, CHATGPT_ERR_JSON_PARSE, "No choices in response");
         cJSON_Delete(root);
-        free(w.d);
+        free(w->d);
         return NULL;
     }
     
@@ -1256,10 +8980,27 @@ char *chatgpt_chat_complete(ChatGPTClient *c) {
     if (!cont || !cJSON_IsString(cont)) {
         set_error(c, CHATGPT_ERR_JSON_PARSE, "No content in response message");
         cJSON_Delete(root);
-        free(w.d);
+        free(w->d);
         return NULL;
     }
     
+    // Mean log-probability over the reply's tokens, when they were requested
+    if (mean_logprob) {
+        cJSON *lp = cJSON_GetObjectItem(c0, "logprobs");
+        cJSON *toks = lp ? cJSON_GetObjectItem(lp, "content") : NULL;
+        double sum = 0;
+        int n = 0;
+        cJSON *t = NULL;
+        cJSON_ArrayForEach(t, toks) {
+            cJSON *v = cJSON_GetObjectItem(t, "logprob");
+            if (v && cJSON_IsNumber(v)) {
+                sum += v->valuedouble;
+                n++;
+            }
+        }
+        *mean_logprob = n ? sum / n : NAN;
+    }
+    
     // Create response copy for return value
     reply = dup_str(cont->valuestring);
     
@@ -1288,10 +9029,51 @@ char *chatgpt_chat_complete(ChatGPTClient *c) {
     
     // Cleanup and return
     cJSON_Delete(root);
-    free(w.d);
+    free(w->d);
     return reply;
 }
 
+/*
+ * Send a chat completion request and get the full response
+ * This is the main function for getting AI responses
+ * Usage: 
+ *   chatgpt_add_user(client, "Hello!");
+ *   char *response = chatgpt_chat_complete(client);
+ *   printf("AI: %s\n", response);
+ *   free(response);
+ * Returns: Complete AI response as a new string (caller must free), or NULL on error
+ */
+char *chatgpt_chat_complete(ChatGPTClient *c) {
+    char *body;                    // Request body JSON
+    struct wb w = {0};             // Response buffer
+    char errbuf[256];              // Transport error text
+    
+    if (!c) return NULL;
+    
+    // Clear any previous error state
+    chatgpt_clear_error(c);
+    
+    // Build request body JSON
+    body = build_request_body(c, 0);  // 0 = non-streaming
+    if (!body) {
+        set_error(c, CHATGPT_ERR_OOM, "Failed to build request body");
+        return NULL;
+    }
+    
+    // Perform the HTTP request
+    int rc = http_post_chat(c, body, write_cb, &w, errbuf, sizeof(errbuf));
+    free(body);
+    
+    // Check for HTTP errors
+    if (rc != 0) {
+        free(w.d);
+        set_error(c, CHATGPT_ERR_HTTP, errbuf);
+        return NULL;
+    }
+    
+    return completion_reply(c, &w, NULL);
+}
+
 /*
  * Get usage statistics from the last API call
  * Returns token counts for prompt, completion, and total usage
@@ -1310,6 +9092,121 @@ int chatgpt_get_last_usage(ChatGPTClient *c, ChatGPTUsage *u) {
     return CHATGPT_OK;
 }
 
+/* 
+┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
+┃                                               ┃
+┃                 MODEL CASCADE                 ┃
+┃                                               ┃
+┗━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┛
+ */
+
+/*
+ * Whether a cascade level's reply passes every check the cascade enables
+ * A reply without log-probabilities fails a log-probability threshold
+ */
+static int cascade_accepts(const ChatGPTCascade *k, const char *reply, double mean_logprob) {
+    if (k->min_mean_logprob < 0 && !(mean_logprob >= k->min_mean_logprob)) return 0;
+    
+    if (k->require_json) {
+        cJSON *j = cJSON_ParseWithOpts(reply, NULL, 1);
+        int ok = j != NULL;
+        for (const char *const *key = k->required_keys; ok && key && *key; key++) {
+            ok = cJSON_IsObject(j) && cJSON_GetObjectItemCaseSensitive(j, *key) != NULL;
+        }
+        cJSON_Delete(j);
+        if (!ok) return 0;
+    }
+    return !k->accept || k->accept(reply, mean_logprob, k->accept_data);
+}
+
+/*
+ * Complete with a cascade of models: the cheapest first, escalating to the next one
+ * while the reply fails the acceptance checks (or the request fails). The request body
+ * is built once; each level gets a copy with only the model field swapped. The last
+ * level's reply is taken as it is. Usage and last_latency_ms cover all levels tried, and
+ * chatgpt_last_model() tells which level answered: it returns the cascade's own string,
+ * not a copy, until the next request
+ * Usage:
+ *   const char *models[] = { "gpt-4o-mini", "gpt-4o" };
+ *   ChatGPTCascade k = { models, 2, -0.2, 0, NULL, NULL, NULL };
+ *   char *label = chatgpt_chat_complete_cascade(conversation, &k);
+ * Returns: Reply as a new string (caller must free), or NULL on error
+ */
+char *chatgpt_chat_complete_cascade(ChatGPTClient *c, const ChatGPTCascade *k) {
+    if (!c) return NULL;
+    
+    chatgpt_clear_error(c);
+    if (!k || !k->models || !k->count) {
+        set_error(c, CHATGPT_ERR_INVALID_ARG, "Cascade has no models");
+        return NULL;
+    }
+    
+    char *body = build_request_body(c, 0);
+    size_t len = body ? strlen(body) : 0;
+    if (body && k->min_mean_logprob < 0) {
+        // Ask for token log-probabilities: one field spliced in before the closing brace
+        const char lp[] = ",\"logprobs\":true}";
+        char *b = (char*)realloc(body, len + sizeof(lp) - 1);
+        if (!b) {
+            free(body);
+            body = NULL;
+        } else {
+            memcpy(b + len - 1, lp, sizeof(lp));
+            body = b;
+            len += sizeof(lp) - 2;
+        }
+    }
+    if (!body) {
+        set_error(c, CHATGPT_ERR_OOM, "Failed to build request body");
+        return NULL;
+    }
+    
+    ChatGPTUsage total = { 0, 0, 0 };
+    uint64_t start = now_us();
+    char *reply = NULL;
+    for (size_t i = 0; i < k->count; i++) {
+        int last = i + 1 == k->count;
+        struct wb w = {0};
+        char errbuf[256];
+        double mean_logprob = NAN;
+        size_t blen;
+        
+        char *b = route_swap_model(body, len, k->models[i], &blen);
+        if (!b) {
+            set_error(c, CHATGPT_ERR_OOM, "Failed to build request body");
+            break;
+        }
+        chatgpt_clear_error(c);
+        memset(&c->last_usage, 0, sizeof(c->last_usage));
+        c->routed_model = k->models[i];
+        int rc = http_post_body(c, b, blen, NULL, write_cb, &w, errbuf, sizeof(errbuf));
+        free(b);
+        if (rc != 0) {
+            free(w.d);
+            set_error(c, CHATGPT_ERR_HTTP, errbuf);
+        } else {
+            reply = completion_reply(c, &w, &mean_logprob);
+        }
+        total.prompt_tokens += c->last_usage.prompt_tokens;
+        total.completion_tokens += c->last_usage.completion_tokens;
+        total.total_tokens += c->last_usage.total_tokens;
+        
+        if (last || (reply && cascade_accepts(k, reply, mean_logprob))) break;
+        free(reply);
+        reply = NULL;
+        if (g_log) {
+            char note[160];
+            snprintf(note, sizeof(note), "Cascade escalating from %s", k->models[i]);
+            log_line(note);
+        }
+    }
+    
+    c->last_usage = total;
+    c->last_latency_ms = (double)(now_us() - start) / 1000.0;
+    free(body);
+    return reply;
+}
+
 /* 
 ┏━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━━┓
 ┃                                               ┃
@@ -1327,81 +9224,111 @@ struct stream_ctx {
     void *ud;                    // User data for callback
     char *acc;                   // Accumulated full response
     size_t len;                  // Length of accumulated response
+    char *pend;                  // Partial line carried over from the previous chunk
+    size_t pend_len;             // Length of the partial line
+    int done;                    // Set once "[DONE]" was seen
 };
 
 /*
- * Curl write callback for streaming responses
+ * Handle one complete SSE line
+ * Extracts the content delta from "data: {...}" lines and passes it on
+ */
+static void stream_line(struct stream_ctx *ctx, const char *p, size_t L) {
+    
+    // Tolerate CRLF line endings
+    if (L > 0 && p[L - 1] == '\r') L--;
+    
+    // Check if this is a data line (SSE format: "data: ...")
+    if (L <= 5 || strncmp(p, "data:", 5) != 0) return;
+    
+    // Skip "data:" prefix and any spaces
+    size_t k = 5;
+    while (k < L && p[k] == ' ') k++;
+    p += k;
+    L -= k;
+    
+    // Check for end marker
+    if (L == 6 && memcmp(p, "[DONE]", 6) == 0) {
+        ctx->done = 1;
+        return;
+    }
+    
+    // Parse JSON data straight from the receive buffer
+    cJSON *root = cJSON_ParseWithLength(p, L);
+    if (!root) return;
+    
+    // Navigate to content delta
+    cJSON *choices = cJSON_GetObjectItem(root, "choices");
+    if (choices && cJSON_IsArray(choices) && cJSON_GetArraySize(choices) > 0) {
+        cJSON *c0 = cJSON_GetArrayItem(choices, 0);
+        cJSON *delta = cJSON_GetObjectItem(c0, "delta");
+        if (delta) {
+            cJSON *content = cJSON_GetObjectItem(delta, "content");
+            if (content && cJSON_IsString(content)) {
+                // Call user callback with content delta
+                if (ctx->cb) {
+                    ctx->cb(content->valuestring, ctx->ud);
+                }
+                
+                // Accumulate content for full response
+                size_t add = strlen(content->valuestring);
+                char *np = (char*)realloc(ctx->acc, ctx->len + add + 1);
+                if (np) {
+                    ctx->acc = np;
+                    memcpy(ctx->acc + ctx->len, content->valuestring, add + 1);
+                    ctx->len += add;
+                }
+            }
+        }
+    }
+    cJSON_Delete(root);
+}
+
+/*
+ * Append bytes to the carried-over partial line
+ */
+static int stream_pend(struct stream_ctx *ctx, const char *p, size_t n) {
+    char *np = (char*)realloc(ctx->pend, ctx->pend_len + n + 1);
+    if (!np) return -1;
+    memcpy(np + ctx->pend_len, p, n);
+    ctx->pend = np;
+    ctx->pend_len += n;
+    return 0;
+}
+
+/*
+ * Response sink for streaming responses
  * Parses Server-Sent Events (SSE) format and extracts content deltas
+ * Lines split across network chunks are carried over to the next call
  * Calls user callback for each content chunk received
  * Internal function used by streaming completion
  */
-static size_t stream_cb(char *ptr, size_t sz, size_t nm, void *ud) {
-    size_t tot = sz * nm;  // Total bytes received
+static size_t stream_cb(const char *ptr, size_t tot, void *ud) {
     struct stream_ctx *ctx = (struct stream_ctx*)ud;
     
     // Process each line in the received data
-    for (size_t i = 0; i < tot; ) {
+    for (size_t i = 0; i < tot && !ctx->done; ) {
         // Find end of current line
-        size_t j = i;
-        while (j < tot && ptr[j] != '\n') j++;
+        const char *nl = (const char*)memchr(ptr + i, '\n', tot - i);
         
-        size_t L = j - i;  // Line length
+        // No newline: keep the tail for the next chunk
+        if (!nl) {
+            if (stream_pend(ctx, ptr + i, tot - i)) return 0;
+            break;
+        }
         
-        // Check if this is a data line (SSE format: "data: ...")
-        if (L > 5 && strncmp(&ptr[i], "data:", 5) == 0) {
-            // Skip "data:" prefix and any spaces
-            size_t k = i + 5;
-            while (k < j && ptr[k] == ' ') k++;
-            
-            size_t pure = j - k;  // Length of actual data
-            
-            // Extract the data content
-            char *line = (char*)malloc(pure + 1);
-            if (line) {
-                memcpy(line, &ptr[k], pure);
-                line[pure] = '\0';
-                
-                // Check for end marker
-                if (strcmp(line, "[DONE]") == 0) {
-                    free(line);
-                    return tot;  // Signal completion
-                }
-                
-                // Parse JSON data
-                cJSON *root = cJSON_Parse(line);
-                if (root) {
-                    // Navigate to content delta
-                    cJSON *choices = cJSON_GetObjectItem(root, "choices");
-                    if (choices && cJSON_IsArray(choices) && cJSON_GetArraySize(choices) > 0) {
-                        cJSON *c0 = cJSON_GetArrayItem(choices, 0);
-                        cJSON *delta = cJSON_GetObjectItem(c0, "delta");
-                        if (delta) {
-                            cJSON *content = cJSON_GetObjectItem(delta, "content");
-                            if (content && cJSON_IsString(content)) {
-                                // Call user callback with content delta
-                                if (ctx->cb) {
-                                    ctx->cb(content->valuestring, ctx->ud);
-                                }
-                                
-                                // Accumulate content for full response
-                                size_t add = strlen(content->valuestring);
-                                char *np = (char*)realloc(ctx->acc, ctx->len + add + 1);
-                                if (np) {
-                                    ctx->acc = np;
-                                    memcpy(ctx->acc + ctx->len, content->valuestring, add + 1);
-                                    ctx->len += add;
-                                }
-                            }
-                        }
-                    }
-                    cJSON_Delete(root);
-                }
-                free(line);
-            }
+        size_t j = (size_t)(nl - ptr);
+        if (ctx->pend_len) {
+            // Complete the carried-over line first
+            if (stream_pend(ctx, ptr + i, j - i)) return 0;
+            stream_line(ctx, ctx->pend, ctx->pend_len);
+            ctx->pend_len = 0;
+        } else {
+            stream_line(ctx, ptr + i, j - i);
         }
         
         // Move to next line
-        i = (j < tot) ? j + 1 : j;
+        i = j + 1;
     }
     
     return tot;  // Return bytes processed
@@ -1428,12 +9355,9 @@ static size_t stream_cb(char *ptr, size_t sz, size_t nm, void *ud) {
 int chatgpt_chat_complete_stream(ChatGPTClient *c, chatgpt_stream_callback cb, 
                                 void *ud, char **full_out) {
     char *body;                     // Request body JSON
-    CURL *curl = NULL;             // Curl handle
-    struct curl_slist *hdr = NULL; // HTTP headers
-    char auth[512];                // Authorization header
-    char url[512];                 // Complete API URL
+    char errbuf[256];              // Transport error text
     struct stream_ctx ctx;         // Streaming context
-    CURLcode rc;                   // Curl result code
+    int rc;                        // Transport result
     
     if (!c) return CHATGPT_ERR_INVALID_ARG;
     
@@ -1447,49 +9371,24 @@ int chatgpt_chat_complete_stream(ChatGPTClient *c, chatgpt_stream_callback cb,
         return CHATGPT_ERR_OOM;
     }
     
-    // Initialize curl
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
-    if (!curl) {
-        free(body);
-        set_error(c, CHATGPT_ERR_HTTP, "Failed to initialize curl");
-        return CHATGPT_ERR_HTTP;
-    }
-    
-    // Set up HTTP headers
-    snprintf(auth, sizeof(auth), "Authorization: Bearer %s", c->api_key);
-    hdr = curl_slist_append(hdr, "Content-Type: application/json");
-    hdr = curl_slist_append(hdr, auth);
-    
-    // Build complete API URL
-    snprintf(url, sizeof(url), "%s/v1/chat/completions", c->base_url);
-    
     // Initialize streaming context
     ctx.cb = cb;
     ctx.ud = ud;
     ctx.acc = NULL;
     ctx.len = 0;
-    
-    // Configure curl for streaming
-    curl_easy_setopt(curl, CURLOPT_URL, url);
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdr);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, stream_cb);  // Streaming callback
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&ctx);
+    ctx.pend = NULL;
+    ctx.pend_len = 0;
+    ctx.done = 0;
     
     // Perform the streaming request
-    rc = curl_easy_perform(curl);
-    
-    // Cleanup curl resources
-    curl_slist_free_all(hdr);
-    curl_easy_cleanup(curl);
-    curl_global_cleanup();
+    rc = http_post_chat(c, body, stream_cb, &ctx, errbuf, sizeof(errbuf));
     free(body);
+    free(ctx.pend);
     
     // Check for HTTP errors
-    if (rc != CURLE_OK) {
+    if (rc != 0) {
         free(ctx.acc);
-        set_error(c, CHATGPT_ERR_STREAM, curl_easy_strerror(rc));
+        set_error(c, CHATGPT_ERR_STREAM, errbuf);
         return CHATGPT_ERR_STREAM;
     }
     
@@ -1576,7 +9475,12 @@ long chatgpt_last_http_code(const ChatGPTConversation *c) {
 char *chatgpt_get_available_models(const char *api_key) {
     if (!api_key) return NULL;
     
+    // Served from the catalog cached by chatgpt_client_warmup() when there is one
+    char *cached = catalog_get(api_key);
+    if (cached) return cached;
+    
     struct wb w = {0};             // Response buffer
+    struct curl_sink sink = { write_cb, &w }; // Adapter feeding the buffer
     CURL *curl = NULL;             // Curl handle
     struct curl_slist *hdr = NULL; // HTTP headers
     CURLcode rc;                   // Curl result code
@@ -1584,8 +9488,7 @@ char *chatgpt_get_available_models(const char *api_key) {
     char url[512];                 // Complete API URL
     
     // Initialize curl
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
+    curl = curl_handle_new();
     if (!curl) return NULL;
     
     // Set up HTTP headers
@@ -1593,13 +9496,13 @@ char *chatgpt_get_available_models(const char *api_key) {
     hdr = curl_slist_append(hdr, auth);
     
     // Build complete API URL for models endpoint
-    snprintf(url, sizeof(url), "https://api.openai.com/v1/models");
+    snprintf(url, sizeof(url), "%s/v1/models", DEFAULT_BASE_URL);
     
     // Configure curl options
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdr);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&w);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_sink_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&sink);
     
     // Perform the HTTP request
     rc = curl_easy_perform(curl);
@@ -1607,7 +9510,6 @@ char *chatgpt_get_available_models(const char *api_key) {
     // Cleanup curl resources
     curl_slist_free_all(hdr);
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
     
     // Check for HTTP errors
     if (rc != CURLE_OK) {
@@ -1647,6 +9549,7 @@ char *chatgpt_generate_image(const char *api_key, const char *prompt, const char
     if (!api_key || !prompt || !size) return NULL;
     
     struct wb w = {0};             // Response buffer
+    struct curl_sink sink = { write_cb, &w }; // Adapter feeding the buffer
     CURL *curl = NULL;             // Curl handle
     struct curl_slist *hdr = NULL; // HTTP headers
     CURLcode rc;                   // Curl result code
@@ -1664,17 +9567,16 @@ char *chatgpt_generate_image(const char *api_key, const char *prompt, const char
     root = cJSON_CreateObject();
     if (!root) return NULL;
     
-    cJSON_AddStringToObject(root, "prompt", prompt);
+    json_add_ref(root, "prompt", prompt);
     cJSON_AddNumberToObject(root, "n", 1);
-    cJSON_AddStringToObject(root, "size", size);
+    json_add_ref(root, "size", size);
     
     body = cJSON_PrintUnformatted(root);
     cJSON_Delete(root);
     if (!body) return NULL;
     
     // Initialize curl
-    curl_global_init(CURL_GLOBAL_ALL);
-    curl = curl_easy_init();
+    curl = curl_handle_new();
     if (!curl) {
         free(body);
         return NULL;
@@ -1692,8 +9594,8 @@ char *chatgpt_generate_image(const char *api_key, const char *prompt, const char
     curl_easy_setopt(curl, CURLOPT_URL, url);
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, hdr);
     curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&w);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curl_sink_cb);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void*)&sink);
     
     // Perform the HTTP request
     rc = curl_easy_perform(curl);
@@ -1701,7 +9603,6 @@ char *chatgpt_generate_image(const char *api_key, const char *prompt, const char
     // Cleanup curl resources
     curl_slist_free_all(hdr);
     curl_easy_cleanup(curl);
-    curl_global_cleanup();
     free(body);
     
     // Check for HTTP errors
@@ -23,6 +23,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /*
@@ -45,18 +46,33 @@ typedef enum {
     CHATGPT_ERR_JSON_PARSE,   // JSON parsing failed
     CHATGPT_ERR_API,          // API returned an error
     CHATGPT_ERR_STREAM,       // Streaming error
-    CHATGPT_ERR_STATE         // Invalid internal state
+    CHATGPT_ERR_STATE,        // Invalid internal state
+    CHATGPT_ERR_IO            // File could not be read or written, or failed its checksum
 } ChatGPT_ErrorCode;
 
 /* ========== DATA STRUCTURES ========== */
 
+/**
+ * Categories of sensitive data the outbound scrubber can redact
+ * Combine with bitwise OR and pass to chatgpt_set_scrubbing()
+ */
+typedef enum {
+    CHATGPT_SCRUB_NONE     = 0,       // Scrubbing disabled
+    CHATGPT_SCRUB_API_KEYS = 1 << 0,  // Secret keys of the form "sk-..." (prefix is kept)
+    CHATGPT_SCRUB_EMAILS   = 1 << 1,  // E-mail addresses
+    CHATGPT_SCRUB_CARDS    = 1 << 2,  // Luhn-valid card numbers (13-19 digits, spaces/dashes allowed)
+    CHATGPT_SCRUB_ALL      = CHATGPT_SCRUB_API_KEYS | CHATGPT_SCRUB_EMAILS | CHATGPT_SCRUB_CARDS
+} ChatGPT_ScrubFlags;
+
 /**
  * Represents a single message in a conversation
  * Each message has a role (user, assistant, system) and content (the actual text)
  */
 typedef struct {
     char *role;     // Message role: "user", "assistant", or "system"
-    char *content;  // Message content (the actual text)
+    char *content;  // Message content (the actual text, NULL while compressed)
+    char *packed;   // Compressed content (see chatgpt_set_compression), NULL when not compressed
+    void *interned; // Shared entry that owns content (see chatgpt_set_interning), NULL when private
 } ChatGPTMessage;
 
 /**
@@ -69,20 +85,292 @@ typedef struct {
     int total_tokens;       // Total tokens used (prompt + completion)
 } ChatGPTUsage;
 
+/**
+ * Sink receiving response bytes from a transport
+ * Returns the number of bytes consumed, anything less than len aborts the request
+ */
+typedef size_t (*chatgpt_sink_fn)(const char *data, size_t len, void *user_data);
+
+/**
+ * A single HTTP POST handed to a transport
+ */
+typedef struct {
+    const char *url;               // Absolute URL
+    const char *const *headers;    // Header lines ("Name: value")
+    size_t header_count;           // Number of header lines
+    const char *body;              // Request body
+    size_t body_len;               // Request body length in bytes
+    chatgpt_sink_fn sink;          // Receives the response body as it arrives
+    void *sink_data;               // User data for the sink
+    unsigned tenant;               // Tenant of the conversation (see chatgpt_set_tenant)
+} ChatGPTRequest;
+
+/**
+ * Response metadata filled in by a transport
+ * http_code must be set before the first byte is passed to the sink
+ */
+typedef struct {
+    long http_code;                // HTTP status (0 if no response was received)
+    long retry_after_ms;           // Retry-After from the server (-1 if absent)
+    char error[256];               // Error text when the call fails
+} ChatGPTResponse;
+
+/**
+ * Pluggable HTTP transport
+ * post() returns 0 once a response was received (any status) and -1 on transport failure
+ */
+typedef struct ChatGPTTransport {
+    int (*post)(struct ChatGPTTransport *self, const ChatGPTRequest *req, ChatGPTResponse *resp);
+    void (*destroy)(struct ChatGPTTransport *self);  // NULL for transports that are never freed
+    void *impl;                                      // Implementation data
+} ChatGPTTransport;
+
+/**
+ * Fault profile for chatgpt_transport_fault_new()
+ * Zero-initialize and set only what you need; probabilities are per request (0.0 to 1.0)
+ */
+typedef struct {
+    unsigned seed;                 // RNG seed (0 = seed from the clock)
+    int latency_min_ms;            // Added latency, uniform between min and max
+    int latency_max_ms;
+    double latency_tail_prob;      // Chance of an extra slow-request delay
+    int latency_tail_ms;           // Size of that extra delay
+    double reset_prob;             // Connection reset before any response byte
+    double truncate_prob;          // Response cut off mid-stream
+    size_t truncate_max_bytes;     // Cut point is random in [1, this] (default 512)
+    size_t drip_bytes;             // Deliver the response in pieces of this size (0 = off)
+    int drip_delay_ms;             // Pause between dripped pieces
+    double error_prob;             // Chance that an HTTP error burst starts
+    int error_burst;               // Consecutive failing requests per burst (default 1)
+    int error_status;              // Status of injected errors (default 503)
+    int retry_after_ms;            // Retry-After reported with injected errors (-1 = none)
+} ChatGPTFaultConfig;
+
+/**
+ * Counters kept by a fault-injecting transport
+ */
+typedef struct {
+    unsigned long requests;        // Requests seen
+    unsigned long errors;          // Injected HTTP errors
+    unsigned long resets;          // Injected connection resets
+    unsigned long truncations;     // Injected truncated responses
+    unsigned long delayed_ms;      // Total injected delay
+} ChatGPTFaultStats;
+
+/**
+ * Settings for chatgpt_transport_fair_new(); zero-initialize for the defaults
+ */
+typedef struct {
+    int max_in_flight;             // Requests passed to the inner transport at once (0 = unlimited)
+    int quantum;                   // Tokens a weight-1 tenant is credited per round (default 256)
+    int completion_estimate;       // Reply tokens assumed when a request has no max_tokens (default 256)
+} ChatGPTFairConfig;
+
+/**
+ * A tenant's share and limits on a fair-queuing transport (zero = default / unlimited)
+ */
+typedef struct {
+    unsigned weight;               // Share relative to other tenants (default 1)
+    int max_in_flight;             // Requests of this tenant in progress at once (0 = unlimited)
+    double tokens_per_sec;         // Token rate: estimated tokens charged per second (0 = unlimited)
+    double burst_tokens;           // Token bucket size (default tokens_per_sec)
+} ChatGPTTenantLimits;
+
+/**
+ * Counters a fair-queuing transport keeps per tenant
+ */
+typedef struct {
+    unsigned long requests;        // Requests let through
+    unsigned long waited;          // Requests that had to queue
+    double wait_ms;                // Total queueing time
+    unsigned long tokens;          // Tokens charged (estimates, corrected by reported usage)
+    int in_flight;                 // Requests in progress now
+    int queued;                    // Requests waiting now
+} ChatGPTTenantStats;
+
+/**
+ * Options for the built-in HTTP/1.1 transport (chatgpt_transport_http_new)
+ * Zero or negative fields keep their defaults
+ */
+typedef struct {
+    int max_idle;                  // Idle keep-alive connections kept for reuse (default 8)
+    int connect_timeout_ms;        // TCP connect timeout (default 5000)
+    int io_timeout_ms;             // Maximum wait for the next byte (default 300000)
+} ChatGPTHttpOptions;
+
+/**
+ * Immutable, reference-counted settings shared by many conversations (opaque)
+ */
+typedef struct ChatGPTClientConfig ChatGPTClientConfig;
+
+/**
+ * Change feed callback: receives the delta record of one change (see chatgpt_set_change_feed)
+ * record is NULL (len 0) if the record could not be built; replicas then need a fresh snapshot
+ */
+typedef void (*ChatGPTChangeFn)(uint64_t seq, const void *record, size_t len, void *user_data);
+
+/**
+ * Message list with {{placeholders}}, compiled to pre-escaped JSON fragments (opaque, immutable)
+ */
+typedef struct ChatGPTTemplate ChatGPTTemplate;
+
+/**
+ * Conversations keyed by session id that hibernate to disk under a memory budget (opaque)
+ */
+typedef struct ChatGPTSessionStore ChatGPTSessionStore;
+
+/**
+ * Latency classes for model routing, fastest first
+ */
+typedef enum {
+    CHATGPT_LATENCY_ANY = 0,       // No latency requirement (policies only)
+    CHATGPT_LATENCY_INTERACTIVE,   // Fast first token, for chat
+    CHATGPT_LATENCY_STANDARD,      // Seconds are fine
+    CHATGPT_LATENCY_BATCH          // Slow models, offline work
+} ChatGPT_LatencyClass;
+
+/**
+ * One model in a router's table (see chatgpt_router_new)
+ */
+typedef struct {
+    const char *model;             // Model name sent in the request
+    int context_window;            // Prompt plus completion tokens the model accepts
+    double input_cost_per_1k;      // Price per 1000 prompt tokens
+    double output_cost_per_1k;     // Price per 1000 completion tokens
+    ChatGPT_LatencyClass latency;  // Latency class the model belongs to
+} ChatGPTRouteModel;
+
+/**
+ * Per-conversation routing rules (zero = no limit)
+ */
+typedef struct {
+    ChatGPT_LatencyClass latency;  // Slowest acceptable class
+    double max_cost;               // Ceiling on a request's estimated cost
+    int min_context;               // Context window required regardless of the prompt
+} ChatGPTRoutePolicy;
+
+/**
+ * Acceptance check for a cascade level's reply; return nonzero to accept it
+ * mean_logprob is the reply's mean token log-probability (NAN unless the cascade requests them)
+ */
+typedef int (*ChatGPTAcceptFn)(const char *reply, double mean_logprob, void *user_data);
+
+/**
+ * Model cascade for chatgpt_chat_complete_cascade(); all enabled checks must pass
+ */
+typedef struct {
+    const char *const *models;     // Models to try, cheapest first, the last one's reply is final (not copied)
+    size_t count;                  // Number of models
+    double min_mean_logprob;       // Minimum mean token log-probability, e.g. -0.2 (0 = no check)
+    int require_json;              // Reply must be well-formed JSON
+    const char *const *required_keys; // With require_json: keys the JSON object must have (NULL-terminated, or NULL)
+    ChatGPTAcceptFn accept;        // Custom check, run last (NULL = none)
+    void *accept_data;             // User data for accept
+} ChatGPTCascade;
+
+/**
+ * Immutable model table that chooses the model per request (opaque, shareable between threads)
+ */
+typedef struct ChatGPTRouter ChatGPTRouter;
+
+/**
+ * Concurrent in-memory map from session id to conversation, one turn per session at a time (opaque)
+ */
+typedef struct ChatGPTSessionTable ChatGPTSessionTable;
+
+/**
+ * Writer of an Arrow IPC stream of conversations, for columnar analytics (opaque)
+ */
+typedef struct ChatGPTArrowWriter ChatGPTArrowWriter;
+
+/**
+ * Session store counters (see chatgpt_session_store_stats)
+ */
+typedef struct {
+    size_t sessions;             // Sessions in the store
+    size_t resident;             // Sessions in memory
+    size_t hibernated;           // Sessions on disk (or being moved)
+    size_t resident_bytes;       // Estimated heap of resident conversations
+    unsigned long spills;        // Sessions written to disk
+    unsigned long loads;         // Sessions read back
+    unsigned long prefetches;    // Loads done by the prefetch thread
+} ChatGPTSessionStats;
+
+/**
+ * Conversations archived as deduplicated content-defined chunks in a directory (opaque)
+ */
+typedef struct ChatGPTChunkStore ChatGPTChunkStore;
+
+/**
+ * A message inside MessagePack data: pointers into the buffer, not NUL-terminated
+ */
+typedef struct {
+    const char *role;
+    size_t role_len;
+    const char *content;
+    size_t content_len;
+} ChatGPTMessageView;
+
+/**
+ * Zero-copy reader over MessagePack conversation data (see chatgpt_msgpack_open)
+ */
+typedef struct {
+    const void *p;          // Next unread byte
+    const void *end;        // End of the buffer
+    const char *model;      // Model name in the buffer (not NUL-terminated), NULL if none
+    size_t model_len;
+    size_t count;           // Number of messages
+    size_t index;           // Messages read so far
+} ChatGPTMsgpackReader;
+
+/**
+ * Chunk store counters (see chatgpt_chunk_store_stats)
+ */
+typedef struct {
+    unsigned long chunks_written; // New chunks written to disk
+    unsigned long chunks_reused;  // Chunks the store already had
+    size_t bytes_written;         // Bytes in new chunks
+    size_t bytes_reused;          // Bytes not written thanks to deduplication
+} ChatGPTChunkStats;
+
 /**
  * Main conversation structure for managing ChatGPT interactions
  * Contains configuration, conversation history, and state information
+ * Laid out hot to cold: what every request touches comes first, the error text is
+ * allocated only when an error happens
  */
 typedef struct ChatGPTConversation {
-    // Configuration
-    char *api_key;              // OpenAI API key (private copy)
+    // Conversation state
+    ChatGPTMessage *messages;   // Dynamic array of messages
+    size_t message_count;       // Number of messages currently stored
+    size_t message_capacity;    // Allocated capacity for messages array
+    char *template_json;        // Rendered template messages sent first (see chatgpt_set_template), or NULL
+    size_t template_json_len;   // Length of template_json
+
+    // Request routing
     char *model;                // Model name (e.g., "gpt-4", "gpt-3.5-turbo")
+    char *api_key;              // OpenAI API key (private copy or borrowed from config)
+    char *base_url;            // API base URL (for custom endpoints)
+    ChatGPTTransport *transport; // Transport for API requests (NULL = built-in curl, not owned)
+    unsigned tenant;            // Tenant for fair scheduling (see chatgpt_set_tenant, 0 = default)
+    const ChatGPTRouter *router; // Chooses the model per request (NULL = always use model, not owned)
+    ChatGPTRoutePolicy route_policy; // Rules the router applies to this conversation
+    const char *routed_model;   // Model the last routed or cascaded request went to (not owned), or NULL
+    ChatGPTClientConfig *config; // Config the strings above may be borrowed from (NULL = all private)
+
+    // Response tracking
+    ChatGPTUsage last_usage;    // Token usage from last API call
+    char *last_reply;          // Complete response from last API call
+    ChatGPT_ErrorCode last_code;// Last error code
+    long last_http_code;       // Last HTTP response code
+    double last_latency_ms;     // Wall time of the last API call in milliseconds, retries and fallbacks included
+
+    // Sampling configuration
     double temperature;         // Creativity/randomness (0.0 to 2.0)
     double top_p;              // Nucleus sampling parameter (0.0 to 1.0)
-    int max_tokens;            // Maximum tokens for completion (0 = no limit)
     double presence_penalty;    // Penalty for token presence (-2.0 to 2.0)
     double frequency_penalty;   // Penalty for token frequency (-2.0 to 2.0)
-    char *base_url;            // API base URL (for custom endpoints)
+    int max_tokens;            // Maximum tokens for completion (0 = no limit)
     
     // New streaming and context configuration
     int use_streaming;          // 1 = streaming mode (default), 0 = complete response
@@ -92,19 +380,26 @@ typedef struct ChatGPTConversation {
     int max_retries;           // Maximum number of retry attempts (default: 3)
     int retry_delay_ms;        // Delay between retries in milliseconds (default: 1000)
 
-    // Conversation state
-    ChatGPTMessage *messages;   // Dynamic array of messages
-    size_t message_count;       // Number of messages currently stored
-    size_t message_capacity;    // Allocated capacity for messages array
+    // Outbound scrubbing
+    unsigned scrub_flags;       // CHATGPT_SCRUB_* mask applied to every request body (0 = off)
 
-    // Response tracking
-    ChatGPTUsage last_usage;    // Token usage from last API call
-    char *last_reply;          // Complete response from last API call
+    // In-memory compression of older messages
+    size_t compress_min_bytes;  // Compress messages at least this long (0 = off)
+    int compress_keep_recent;   // Most recent messages always kept uncompressed
+
+    // Process-wide sharing of repeated message contents
+    size_t intern_min_bytes;    // Share message contents at least this long (0 = off)
+
+    // Persistence
+    int save_checksum;          // 1 = saved files end with a CRC32C line (see chatgpt_set_save_checksum)
+
+    // Change feed
+    ChatGPTChangeFn change_fn;  // Receives a delta record after each change (NULL = none)
+    void *change_ud;            // User data passed to change_fn
+    uint64_t change_seq;        // Changes so far: the sequence number of the latest record
 
     // Error handling
-    char last_error[512];       // Last error message text
-    ChatGPT_ErrorCode last_code;// Last error code
-    long last_http_code;       // Last HTTP response code
+    char *last_error;           // Last error message text (allocated on first error, NULL = none)
 } ChatGPTConversation;
 
 // Alias for backward compatibility
@@ -152,6 +447,26 @@ void chatgpt_conversation_free(ChatGPTConversation *conversation);
  */
 int chatgpt_conversation_copy_settings(ChatGPTConversation *dest, const ChatGPTConversation *src);
 
+/**
+ * Freeze the settings of a template conversation into a shared, immutable config
+ * Holds the settings, prebuilt request headers and URL, transport and retry limits
+ * Returns a config with one reference, or NULL on error
+ */
+ChatGPTClientConfig *chatgpt_config_new(const ChatGPTConversation *tmpl);
+
+/**
+ * Take or drop a reference on a shared config (thread-safe)
+ * The last release frees it; conversations created from it hold their own reference
+ */
+ChatGPTClientConfig *chatgpt_config_retain(ChatGPTClientConfig *config);
+void chatgpt_config_release(ChatGPTClientConfig *config);
+
+/**
+ * Create a conversation that borrows its settings from a shared config
+ * One allocation, no string copies; setters still work and make private copies as needed
+ */
+ChatGPTConversation *chatgpt_conversation_new_from_config(ChatGPTClientConfig *config);
+
 /**
  * Create a new ChatGPT client instance (legacy compatibility)
  * api_key: OpenAI API key, or NULL to use global key
@@ -263,11 +578,31 @@ int chatgpt_set_context_messages(ChatGPTConversation *conversation, int context_
 
 /**
  * Set retry configuration for failed requests
+ * Transport failures and 429/5xx replies are retried; a longer Retry-After from the server wins
  * max_retries: Maximum number of retry attempts (default: 3)
  * delay_ms: Delay between retries in milliseconds (default: 1000)
  */
 int chatgpt_set_retry_config(ChatGPTConversation *conversation, int max_retries, int delay_ms);
 
+/**
+ * Enable outbound scrubbing of secrets and PII for this conversation
+ * flags: Combination of CHATGPT_SCRUB_* values, CHATGPT_SCRUB_NONE to disable
+ * Matches are masked with '*' in the serialized request body, stored messages are untouched
+ */
+int chatgpt_set_scrubbing(ChatGPTConversation *conversation, unsigned flags);
+
+/**
+ * Set the scrubbing flags inherited by every conversation created afterwards
+ * Useful when policy requires scrubbing on all requests
+ */
+int chatgpt_set_scrubbing_global(unsigned flags);
+
+/**
+ * Set the tenant id passed with this conversation's requests (default 0)
+ * A fair-queuing transport shares capacity between tenants by it
+ */
+int chatgpt_set_tenant(ChatGPTConversation *conversation, unsigned tenant);
+
 /* ========== MESSAGE MANAGEMENT ========== */
 
 /**
@@ -315,6 +650,38 @@ int chatgpt_add_user_with_file(ChatGPTConversation *conversation, const char *co
  */
 int chatgpt_get_message_count(const ChatGPTConversation *conversation);
 
+/**
+ * Get the content of a message by index (0-based), inflating it if it is compressed
+ * Use this instead of messages[i].content when compression is enabled
+ */
+const char *chatgpt_message_content(ChatGPTConversation *conversation, size_t index);
+
+/**
+ * Keep older message contents compressed in memory (off by default)
+ * Messages of at least min_bytes that are older than the keep_recent most recent ones are
+ * compressed as the conversation grows, and inflated on demand for requests and saves
+ * min_bytes = 0 turns the policy off
+ */
+int chatgpt_set_compression(ChatGPTConversation *conversation, size_t min_bytes, int keep_recent);
+
+/**
+ * Compress every sufficiently long message now, regardless of age (e.g. when a session goes idle)
+ * Returns the number of messages compressed, or a negative error code
+ */
+int chatgpt_compact(ChatGPTConversation *conversation);
+
+/**
+ * Store message contents of at least min_bytes once per process (off by default)
+ * Identical contents added to any conversation with interning on share one reference-counted
+ * copy, whose escaped JSON form is cached for request bodies. min_bytes = 0 turns it off
+ */
+int chatgpt_set_interning(ChatGPTConversation *conversation, size_t min_bytes);
+
+/**
+ * Report the number of shared contents and the heap they hold (either pointer may be NULL)
+ */
+int chatgpt_intern_stats(size_t *strings, size_t *bytes);
+
 /**
  * Remove the last message from the conversation
  */
@@ -340,10 +707,33 @@ int chatgpt_append_to_last_assistant(ChatGPTConversation *conversation, const ch
 /**
  * Reset the conversation to a clean state
  * Clears messages, usage statistics, last reply, and errors
- * Keeps configuration settings (model, temperature, etc.)
+ * Keeps configuration settings (model, temperature, etc.) and the message array capacity,
+ * so a reset conversation can be reused without reallocating
  */
 int chatgpt_reset(ChatGPTConversation *conversation);
 
+/* ========== PROMPT TEMPLATES ========== */
+
+/**
+ * Compile messages whose contents contain {{name}} placeholders (roles are taken literally)
+ * The static text is escaped for JSON once, here. A template can be shared between threads
+ */
+ChatGPTTemplate *chatgpt_template_compile(const ChatGPTMessage *messages, size_t count);
+
+/**
+ * Free a compiled template (conversations rendered from it keep their messages)
+ */
+void chatgpt_template_free(ChatGPTTemplate *tmpl);
+
+/**
+ * Render a template with values and use its messages ahead of the conversation's own
+ * vars: NULL-terminated list of name/value pairs; every placeholder needs a value
+ * Template messages are sent with every request but are not counted, saved or cleared by
+ * chatgpt_clear_messages(); chatgpt_reset() or tmpl = NULL removes them
+ */
+int chatgpt_set_template(ChatGPTConversation *conversation, const ChatGPTTemplate *tmpl,
+                         const char *const *vars);
+
 /* ========== API COMMUNICATION ========== */
 
 /**
@@ -402,20 +792,408 @@ char *chatgpt_get_available_models(const char *api_key);
  */
 int chatgpt_is_model_available(const char *api_key, const char *model_name);
 
+/* ========== TRANSPORTS ========== */
+
+/**
+ * Get the built-in libcurl transport (shared, never free it)
+ */
+ChatGPTTransport *chatgpt_transport_curl(void);
+
+/**
+ * Set the transport used by a conversation for chat completion requests
+ * Pass NULL for the built-in curl transport. The conversation does not take ownership.
+ */
+int chatgpt_set_transport(ChatGPTConversation *conversation, ChatGPTTransport *transport);
+
+/**
+ * Create a transport that injects latency, resets, truncation, slow-drip delivery
+ * and 429/5xx bursts in front of another transport (which it does not own)
+ * It may be shared between threads; with a fixed seed only a single caller gets a repeatable run
+ * Returns: New transport or NULL on error
+ */
+ChatGPTTransport *chatgpt_transport_fault_new(ChatGPTTransport *inner, const ChatGPTFaultConfig *config);
+
+/**
+ * Read the injection counters of a fault-injecting transport
+ */
+int chatgpt_transport_fault_stats(const ChatGPTTransport *transport, ChatGPTFaultStats *stats_out);
+
+/**
+ * Create a transport that shares another one fairly between tenants (not available on Windows)
+ * Requests queue per tenant and are let through by deficit round robin weighted by estimated
+ * tokens, within the global and per-tenant concurrency caps and per-tenant token rates.
+ * The inner transport is not owned. Returns NULL on error
+ */
+ChatGPTTransport *chatgpt_transport_fair_new(ChatGPTTransport *inner, const ChatGPTFairConfig *config);
+
+/**
+ * Set a tenant's weight, concurrency cap and token rate on a fair-queuing transport
+ */
+int chatgpt_transport_fair_set_tenant(ChatGPTTransport *transport, unsigned tenant, const ChatGPTTenantLimits *limits);
+
+/**
+ * Read a tenant's counters on a fair-queuing transport
+ * Returns CHATGPT_ERR_INVALID_ARG for a tenant that has neither sent a request nor been configured
+ */
+int chatgpt_transport_fair_tenant_stats(ChatGPTTransport *transport, unsigned tenant, ChatGPTTenantStats *stats_out);
+
+/**
+ * Create the built-in HTTP/1.1 keep-alive transport for plaintext local endpoints
+ * Base URLs: "http://host:port" over TCP or "http+unix://%2Fpath%2Fto.sock" over a Unix socket
+ * opts: NULL for defaults. Returns NULL on error (and on Windows, where it is not available)
+ */
+ChatGPTTransport *chatgpt_transport_http_new(const ChatGPTHttpOptions *opts);
+
+/**
+ * Free a transport created by a chatgpt_transport_*_new() function
+ */
+void chatgpt_transport_free(ChatGPTTransport *transport);
+
+/* ========== RECORD / REPLAY ========== */
+
+/**
+ * Cassette modes for recording and replaying API traffic
+ */
+typedef enum {
+    CHATGPT_CASSETTE_OFF,     // Live network traffic (default)
+    CHATGPT_CASSETTE_RECORD,  // Send live requests and record every exchange
+    CHATGPT_CASSETTE_REPLAY   // Serve recorded exchanges in order, no network
+} ChatGPT_CassetteMode;
+
+/**
+ * Open a cassette file for all chat completion requests in the process
+ * Recording keeps the arrival timing of every response chunk (including SSE streams);
+ * concurrent requests are recorded as whole exchanges in the order they finish
+ * speed: Replay time scale (1.0 = original timing, 2.0 = twice as fast, 0 = no delays)
+ */
+int chatgpt_cassette_open(const char *path, ChatGPT_CassetteMode mode, double speed);
+
+/**
+ * Close the active cassette and return to live network traffic
+ */
+int chatgpt_cassette_close(void);
+
+/**
+ * Create a transport that records another transport's exchanges to a cassette, or replays
+ * them; set it on the conversations to cover instead of opening a process-wide cassette
+ * Returns: New transport (free with chatgpt_transport_free) or NULL on error
+ */
+ChatGPTTransport *chatgpt_transport_cassette_new(ChatGPTTransport *inner, const char *path,
+                                                 ChatGPT_CassetteMode mode, double speed);
+
+/* ========== SHARED CONNECTION STATE ========== */
+
+/**
+ * All libcurl requests share one process-wide DNS cache, TLS session cache and connection cache
+ * Persist TLS sessions in a file so restarted workers resume sessions instead of full handshakes
+ * The file's sessions are imported immediately; pass NULL to stop persisting
+ * Requires libcurl 8.12 or newer at run time (looked up when the build's headers are older;
+ * link with -ldl on glibc before 2.34), otherwise returns CHATGPT_ERR_STATE
+ */
+int chatgpt_set_tls_session_file(const char *path);
+
+/**
+ * Write the cached TLS sessions to the session file now
+ * Replaces it atomically and durably; a new file is created with mode 0600
+ */
+int chatgpt_save_tls_sessions(void);
+
+/**
+ * Open connections ahead of the first request: DNS, TCP, TLS and HTTP/2 setup for each endpoint
+ * endpoints: NULL-terminated list of base URLs, or NULL for the default endpoint
+ * n_connections: Connections per endpoint (0 = 1)
+ * Also caches the model catalog (fetched with the global API key as set at this call) for chatgpt_get_available_models()
+ * A background thread then revisits the endpoints every 45 s so idle connections stay open
+ * (not on Windows). Calling it again replaces the endpoint set; chatgpt_global_cleanup() stops it
+ */
+int chatgpt_client_warmup(const char *const *endpoints, int n_connections);
+
+/**
+ * Release the process-wide curl state: stops warmup keep-alives, drops the model catalog
+ * and saves TLS sessions first when a session file is set
+ * Call once at process exit, after the last request
+ */
+void chatgpt_global_cleanup(void);
+
+/* ========== MODEL ROUTING ========== */
+
+/**
+ * Create a router from a table of models (copied)
+ * Per request it picks the cheapest model whose context window holds the estimated
+ * prompt and reply and that meets the conversation's latency class and cost ceiling
+ */
+ChatGPTRouter *chatgpt_router_new(const ChatGPTRouteModel *models, size_t count);
+
+/**
+ * Free a router (no conversation may still be using it)
+ */
+void chatgpt_router_free(ChatGPTRouter *router);
+
+/**
+ * Route a conversation's requests (router NULL = use its fixed model; policy NULL = no limits)
+ * Context-length and capacity errors fall back to the next candidate with the same request body
+ */
+int chatgpt_set_router(ChatGPTConversation *conversation, const ChatGPTRouter *router, const ChatGPTRoutePolicy *policy);
+
+/**
+ * Get the model the last request was sent to (the routed or cascade one when used)
+ * Not a copy: valid until the model or router changes, or for a cascade while its model strings live
+ */
+const char *chatgpt_last_model(const ChatGPTConversation *conversation);
+
+/**
+ * Complete with a cascade: cheapest model first, escalating while the acceptance checks fail
+ * The request body is serialized once and only its model field changes between levels.
+ * Usage and latency cover the levels tried. Returns the reply (caller frees) or NULL on error
+ */
+char *chatgpt_chat_complete_cascade(ChatGPTConversation *conversation, const ChatGPTCascade *cascade);
+
+/* ========== SESSION STORE ========== */
+
+/**
+ * Create a store that keeps conversations under a memory budget (not available on Windows)
+ * When resident conversations exceed memory_budget (estimated heap bytes), the least
+ * recently used idle ones are written to spill_dir and freed; they are read back on access
+ * Spill files are private (0600, created exclusively); a conversation's own API key is never written
+ */
+ChatGPTSessionStore *chatgpt_session_store_new(const char *spill_dir, size_t memory_budget);
+
+/**
+ * Free the store, its conversations and spill files (no session may be acquired)
+ */
+void chatgpt_session_store_free(ChatGPTSessionStore *store);
+
+/**
+ * Add a conversation under an id; the store takes ownership
+ * Returns CHATGPT_ERR_STATE if the id is already in use
+ */
+int chatgpt_session_put(ChatGPTSessionStore *store, const char *id, ChatGPTConversation *conversation);
+
+/**
+ * Get a session's conversation, loading it from disk if it was hibernated
+ * It stays in memory until chatgpt_session_release(); do not free it or share it across threads
+ */
+ChatGPTConversation *chatgpt_session_acquire(ChatGPTSessionStore *store, const char *id);
+
+/**
+ * Hand a session back after use; it becomes the most recently used
+ */
+int chatgpt_session_release(ChatGPTSessionStore *store, const char *id);
+
+/**
+ * Remove a session and free its conversation (CHATGPT_ERR_STATE while acquired)
+ */
+int chatgpt_session_remove(ChatGPTSessionStore *store, const char *id);
+
+/**
+ * Load a hibernated session on a background thread ahead of chatgpt_session_acquire()
+ */
+int chatgpt_session_prefetch(ChatGPTSessionStore *store, const char *id);
+
+/**
+ * Read the store's counters
+ */
+int chatgpt_session_store_stats(ChatGPTSessionStore *store, ChatGPTSessionStats *stats);
+
+/* ========== SESSION TABLE ========== */
+
+/**
+ * Create a concurrent session table for servers (not available on Windows)
+ * Lookups take no lock and writers lock one of 64 stripes; expected sizes the buckets
+ */
+ChatGPTSessionTable *chatgpt_session_table_new(size_t expected);
+
+/**
+ * Free the table and its conversations (no other thread may be using it)
+ */
+void chatgpt_session_table_free(ChatGPTSessionTable *table);
+
+/**
+ * Add a conversation under an id; the table takes ownership
+ * Returns CHATGPT_ERR_STATE if the id is already in use
+ */
+int chatgpt_session_table_put(ChatGPTSessionTable *table, const char *id, ChatGPTConversation *conversation);
+
+/**
+ * Take a session for one turn; concurrent callers for the same id queue in arrival order
+ * Returns NULL if the id is unknown
+ */
+ChatGPTConversation *chatgpt_session_table_acquire(ChatGPTSessionTable *table, const char *id);
+
+/**
+ * End the current turn on a session and let the next waiter in
+ */
+int chatgpt_session_table_release(ChatGPTSessionTable *table, const char *id);
+
+/**
+ * Remove a session and free its conversation (CHATGPT_ERR_STATE while acquired or waited for)
+ */
+int chatgpt_session_table_remove(ChatGPTSessionTable *table, const char *id);
+
+/**
+ * Number of sessions in the table
+ */
+size_t chatgpt_session_table_size(ChatGPTSessionTable *table);
+
 /* ========== CONVERSATION PERSISTENCE ========== */
 
 /**
  * Save the current conversation to a JSON file
- * Saves only the messages array, not configuration settings
+ * Saves only the messages array, not configuration settings; the file is replaced
+ * atomically (temporary file, fsync, rename) and keeps the permissions of the file it
+ * replaces (new files are created 0600)
+ * With chatgpt_set_save_checksum() enabled a "#crc32c:xxxxxxxx" line follows the JSON
  */
 int chatgpt_save_conversation(ChatGPTConversation *conversation, const char *path);
 
 /**
  * Load a conversation from a JSON file
  * Replaces current messages with those from the file
+ * A trailing checksum line is verified: returns CHATGPT_ERR_IO if it does not match
  */
 int chatgpt_load_conversation(ChatGPTConversation *conversation, const char *path);
 
+/**
+ * Check a saved conversation file's checksum without parsing it
+ * Returns CHATGPT_OK if intact, CHATGPT_ERR_IO if unreadable, corrupt or without a checksum
+ */
+int chatgpt_verify_conversation_file(const char *path);
+
+/**
+ * Choose whether chatgpt_save_conversation() appends a CRC32C checksum line (default off)
+ * Checksummed files detect corruption on load but are no longer plain JSON to other tools
+ */
+int chatgpt_set_save_checksum(ChatGPTConversation *conversation, int enabled);
+
+/* ========== BULK JSONL IMPORT / EXPORT ========== */
+
+/**
+ * Write conversations to a JSONL file, one {"model":...,"messages":[...]} object per line,
+ * in array order. Serialization runs on threads worker threads (0 = one per CPU);
+ * the conversations must not be modified meanwhile
+ */
+int chatgpt_export_jsonl(ChatGPTConversation *const *conversations, size_t count,
+                         const char *path, int threads);
+
+/**
+ * Read a JSONL file written by chatgpt_export_jsonl, parsing slices of it in parallel
+ * New conversations take their settings from config (or chatgpt_conversation_new()
+ * defaults and the global API key when NULL); a line's model overrides the config's.
+ * On success *conversations is a malloc'd array of *count conversations in file order;
+ * the caller frees each one and then the array. On failure nothing is returned
+ */
+int chatgpt_import_jsonl(const char *path, ChatGPTClientConfig *config, int threads,
+                         ChatGPTConversation ***conversations, size_t *count);
+
+/* ========== ARROW IPC EXPORT ========== */
+
+/**
+ * Create an Arrow IPC stream file (readable by pyarrow.ipc.open_stream, DuckDB, Polars)
+ * One row per message: conversation, message, role, content, model, prompt_tokens,
+ * completion_tokens, total_tokens, latency_ms; role and model are dictionary-encoded
+ * Returns the writer or NULL on error
+ */
+ChatGPTArrowWriter *chatgpt_arrow_open(const char *path);
+
+/**
+ * Append conversations as one record batch
+ * Token counts and latency are those of each conversation's last request;
+ * conversations are numbered in the order they are written
+ */
+int chatgpt_arrow_write(ChatGPTArrowWriter *writer, ChatGPTConversation *const *conversations, size_t count);
+
+/**
+ * Write the end-of-stream marker, close the file and free the writer
+ */
+int chatgpt_arrow_close(ChatGPTArrowWriter *writer);
+
+/* ========== DEDUPLICATING CHUNK STORE ========== */
+
+/**
+ * Open (creating if needed) a chunk store directory; a store is used by one thread at a time
+ * Conversations are cut into content-defined chunks (FastCDC) stored once under their
+ * SHA-256, so conversations sharing a prefix share its chunks on disk
+ * Returns the store or NULL on error
+ */
+ChatGPTChunkStore *chatgpt_chunk_store_open(const char *dir);
+
+/**
+ * Close a chunk store handle; the files stay
+ */
+void chatgpt_chunk_store_close(ChatGPTChunkStore *store);
+
+/**
+ * Save a conversation's messages under a name (a plain file name), writing only new chunks
+ * A previous save with the same name is replaced atomically
+ */
+int chatgpt_chunk_store_save(ChatGPTChunkStore *store, ChatGPTConversation *conversation, const char *name);
+
+/**
+ * Load a saved conversation's messages, replacing the current ones
+ * Returns CHATGPT_ERR_IO if the save is missing or any chunk fails its hash check
+ */
+int chatgpt_chunk_store_load(ChatGPTChunkStore *store, ChatGPTConversation *conversation, const char *name);
+
+/**
+ * Get the store's write counters since it was opened
+ */
+int chatgpt_chunk_store_stats(const ChatGPTChunkStore *store, ChatGPTChunkStats *stats);
+
+/* ========== MESSAGEPACK ENCODING ========== */
+
+/**
+ * Encode a conversation's model and messages as MessagePack:
+ * {"model": str|nil, "messages": [[role, content], ...]}
+ * On success *out is a malloc'd buffer of *len bytes
+ */
+int chatgpt_msgpack_encode(const ChatGPTConversation *conversation, char **out, size_t *len);
+
+/**
+ * Start reading MessagePack conversation data in place; fills in model and count
+ * The buffer must outlive the reader and the views it hands out
+ */
+int chatgpt_msgpack_open(ChatGPTMsgpackReader *reader, const void *buf, size_t len);
+
+/**
+ * Read the next message as a view into the buffer
+ * Returns 1 if a message was read, 0 after the last one, negative error code if malformed
+ */
+int chatgpt_msgpack_next(ChatGPTMsgpackReader *reader, ChatGPTMessageView *message);
+
+/**
+ * Replace a conversation's messages (and model, when present) with MessagePack data
+ * Malformed data leaves the conversation untouched
+ */
+int chatgpt_msgpack_load(ChatGPTConversation *conversation, const void *buf, size_t len);
+
+/**
+ * Convert MessagePack conversation data directly to the messages JSON array sent to the API
+ * On success *json is a malloc'd string
+ */
+int chatgpt_msgpack_to_json(const void *buf, size_t len, char **json);
+
+/* ========== CHANGE FEED ========== */
+
+/**
+ * Set the callback that receives a sequence-numbered delta record after every change that
+ * shapes requests: messages (add, remove, clear, replace, append), model, template messages,
+ * sampling parameters, max_tokens and scrubbing flags; NULL removes it
+ */
+int chatgpt_set_change_feed(ChatGPTConversation *conversation, ChatGPTChangeFn fn, void *user_data);
+
+/**
+ * Build a snapshot record of the whole conversation (messages, model, template messages and
+ * request parameters) as of its change_seq, for seeding or
+ * resynchronizing a replica. On success *record is a malloc'd buffer of *len bytes
+ */
+int chatgpt_change_snapshot(const ChatGPTConversation *conversation, void **record, size_t *len);
+
+/**
+ * Apply a delta or snapshot record from another conversation's change feed
+ * Duplicates are ignored; returns CHATGPT_ERR_STATE if records are missing (apply a snapshot)
+ */
+int chatgpt_apply_change(ChatGPTConversation *conversation, const void *record, size_t len);
+
 /* ========== UTILITY FUNCTIONS ========== */
 
 /**
@@ -434,6 +1212,13 @@ char *chatgpt_dump_messages(ChatGPTConversation *conversation);
  */
 void chatgpt_print_messages(ChatGPTConversation *conversation, FILE *out);
 
+/**
+ * Mask secrets and PII in a buffer in place (same length, matches become '*')
+ * Safe to run on serialized JSON: escape sequences are never modified
+ * Returns: Number of spans that were masked
+ */
+size_t chatgpt_scrub_buffer(char *buf, size_t len, unsigned flags);
+
 /**
  * Remove trailing whitespace from a string
  * Modifies the string in-place